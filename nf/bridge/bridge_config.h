@@ -1,4 +1,6 @@
+#ifndef MAC_TABLE_SIZE
 #define MAC_TABLE_SIZE 65536
+#endif
 
 #ifndef EXPIRATION_TIME
 #define EXPIRATION_TIME 1200000 // 1.2 sec
@@ -7,6 +9,19 @@
 #define PERIODIC_HANDLER_PERIOD 10 // 10 usecs
 #define REFRESH_INTERVAL 180000000000LL
 
+// Per-core log of MACs to learn or refresh, merged by the control core
+#define LEARN_LOG_SIZE 4096
+// Per-core cache of recently logged MACs, must be a power of 2
+#define LEARN_CACHE_SIZE 1024
+// Time (in us) before a core logs the same MAC again
+#define LEARN_HOLDOFF 1000
+// Log entries merged per transaction, and per period
+#define LEARN_BATCH 32
+#define LEARN_BUDGET 1024
+// MACs expired per transaction, and per period
+#define AGING_BATCH 32
+#define AGING_BUDGET 1024
+
 #ifndef LCORES
 #define LCORES "8,10,12,14,16"
 #endif
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nf.h"
+#include "nf-log.h"
+#include "bridge_domain.h"
+
+struct bridge_domain bridge_domains[NUM_BRIDGE_DOMAINS];
+
+void bridge_domains_init() {
+  for (int bd = 0; bd < NUM_BRIDGE_DOMAINS; bd++) {
+    bridge_domains[bd].devices = UINT64_MAX;
+    bridge_domains[bd].flood_group = BD_FLOOD_ALL;
+  }
+}
+
+// Parse "dev[,dev...]" into a bitmask of devices, returns 0 if invalid
+static uint64_t parse_devices(char *s) {
+  uint64_t devices = 0;
+  for (char *tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+    char *end;
+    unsigned long dev = strtoul(tok, &end, 10);
+    if (end == tok || *end != '\0' || dev >= 64)
+      return 0;
+    devices |= 1ULL << dev;
+  }
+  return devices;
+}
+
+int bridge_domains_load(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    NF_INFO("Cannot open bridge domains file %s", path);
+    return -1;
+  }
+
+  for (int bd = 0; bd < NUM_BRIDGE_DOMAINS; bd++) {
+    bridge_domains[bd].devices = 0;
+    bridge_domains[bd].flood_group = BD_FLOOD_ALL;
+  }
+
+  char line[256];
+  int lineno = 0;
+  int ret = 0;
+  while (ret >= 0 && fgets(line, sizeof(line), file)) {
+    lineno++;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+
+    unsigned vlan;
+    char devs[200], tail;
+    int n = sscanf(line, " %u %199s %c", &vlan, devs, &tail);
+    if (n <= 0)
+      continue;
+
+    uint64_t devices = n == 2 && vlan < NUM_BRIDGE_DOMAINS ? parse_devices(devs) : 0;
+    int group = devices ? register_multicast_group(devices) : -1;
+    if (!devices) {
+      NF_INFO("Invalid bridge domain at %s:%d", path, lineno);
+      ret = -1;
+    } else if (group < 0) {
+      NF_INFO("Cannot add bridge domain at %s:%d, more than %d flood lists", path, lineno, MAX_MULTICAST_GROUPS);
+      ret = -1;
+    } else {
+      bridge_domains[vlan].devices = devices;
+      bridge_domains[vlan].flood_group = group;
+      ret++;
+    }
+  }
+
+  fclose(file);
+  return ret;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Bridge domains, one per VLAN, untagged packets belong to VLAN 0.
+ *
+ * A domain spans a set of devices, packets received on other devices are
+ * dropped, and unknown destinations are flooded to the devices of the domain
+ * through its multicast group. By default every domain spans all devices.
+ */
+#define NUM_BRIDGE_DOMAINS 4096
+
+// Flood to all devices
+#define BD_FLOOD_ALL -1
+
+struct bridge_domain {
+  // Bitmask of the devices of the domain, 0 if the VLAN is not bridged
+  uint64_t devices;
+  int flood_group;
+};
+
+// Read-only after nf_init()
+extern struct bridge_domain bridge_domains[NUM_BRIDGE_DOMAINS];
+
+// Every VLAN is bridged across all devices
+void bridge_domains_init();
+
+//   Load the bridge domains from a file, one "vlan dev[,dev...]" per line.
+//   VLANs that are not listed are not bridged.
+//   @returns the number of loaded domains, -1 on error.
+int bridge_domains_load(const char *path);
+
+static inline uint16_t bridge_domain_of_tci(uint16_t vlan_tci) {
+  return vlan_tci & (NUM_BRIDGE_DOMAINS - 1);
+}
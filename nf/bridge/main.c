@@ -1,13 +1,19 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <rte_hash_crc.h>
+#include <rte_malloc.h>
+#include <rte_ring.h>
+
 #include "nf.h"
 #include "nf-log.h"
 #include "bridge_config.h"
+#include "bridge_domain.h"
 
+#include "vigor/libvig/verified/double-chain.h"
 #include "vigor/libvig/verified/ether.h"
-#include "double-chain-exp.h"
 #include "map.h"
+#include "timer.h"
 #include "vector.h"
 
 // temp hack for transaction chopping
@@ -36,19 +42,41 @@ typedef struct nf_config {
   // TODO: Add static macs
 } nf_config_t;
 
+// MAC to learn or refresh, logged by data plane cores
+struct learn_entry {
+  uint64_t key;
+  uint16_t dev;
+} __attribute__((aligned(16)));
+
+// Recently logged MAC, see log_learn()
+struct learn_cache_entry {
+  struct learn_entry entry;
+  vigor_time_t time;
+};
+
 struct nf_state {
-  // mac table entry allocator
-  struct NfosDoubleChainExp *dyn_heap;
+  // mac table entry allocator and LRU, only used by the control core
+  struct DoubleChain *dyn_heap;
 
-  // mac to map entry index mapping
+  // (bridge domain, mac) key to map entry index mapping
   struct NfosMap *dyn_map;
 
   // mac table entry to device mapping
   struct NfosVector *dyn_vals;
 
-  // mac table entry to macs mapping
+  // mac table entry to (bridge domain, mac) keys mapping
   struct NfosVector *dyn_macs;
 
+  // Per-core logs of MACs to learn or refresh, single-producer single-consumer
+  struct rte_ring **learn_logs;
+
+  // Per-core caches of recently logged MACs
+  struct learn_cache_entry **learn_caches;
+
+  unsigned num_workers;
+  vigor_time_t learn_holdoff;
+  vigor_time_t expiration_time;
+
   // Configuration
   nf_config_t *cfg;
 };
@@ -67,11 +95,32 @@ void dev_allocate(void* obj) {
   entry->time = INT64_MAX;
 }
 
+// A mac table key packs the bridge domain in the high 16 bits and the MAC in
+// the low 48 bits
+static inline uint64_t mac_key_of(uint16_t bd, const struct rte_ether_addr *mac) {
+  uint64_t key = (uint64_t)bd << 48;
+  for (int i = 0; i < RTE_ETHER_ADDR_LEN; i++)
+    key |= (uint64_t)mac->addr_bytes[i] << (8 * i);
+  return key;
+}
+
+bool mac_key_eq(void* a, void* b) {
+  return *(uint64_t *)a == *(uint64_t *)b;
+}
+
+unsigned mac_key_hash(void* obj) {
+  return rte_hash_crc_8byte(*(uint64_t *)obj, 0);
+}
+
+void mac_key_allocate(void* obj) {
+  *(uint64_t *)obj = 0;
+}
+
 int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
                 uint16_t incoming_dev, pkt_set_state_t *unused_1,
                 pkt_set_id_t *unused_2);
 
-void exp_mac(nf_state_t *non_pkt_set_state);
+void learn_and_age(nf_state_t *non_pkt_set_state);
 
 
 /* Init function */
@@ -97,17 +146,38 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
   ret->cfg = malloc(sizeof(nf_config_t));
   ret->cfg->expiration_time = EXPIRATION_TIME;
   ret->cfg->dyn_capacity = MAC_TABLE_SIZE;
+  ret->expiration_time = nfos_usec_to_tsc_cycles(ret->cfg->expiration_time);
+  ret->learn_holdoff = nfos_usec_to_tsc_cycles(LEARN_HOLDOFF);
 
-  if (!nfos_map_allocate(ether_addr_eq, ether_addr_hash, sizeof(struct rte_ether_addr),
-                         ret->cfg->dyn_capacity, &ret->dyn_map)) ret = NULL;
-  if (!nfos_vector_allocate(sizeof(struct rte_ether_addr), ret->cfg->dyn_capacity,
-                            ether_addr_allocate, &ret->dyn_macs)) ret = NULL;
+  if (!nfos_map_allocate(mac_key_eq, mac_key_hash, sizeof(uint64_t),
+                         ret->cfg->dyn_capacity, &ret->dyn_map)) return NULL;
+  if (!nfos_vector_allocate(sizeof(uint64_t), ret->cfg->dyn_capacity,
+                            mac_key_allocate, &ret->dyn_macs)) return NULL;
   if (!nfos_vector_allocate(sizeof(struct mac_entry), ret->cfg->dyn_capacity,
-                            dev_allocate, &ret->dyn_vals)) ret = NULL;
-  if (!nfos_dchain_exp_allocate(ret->cfg->dyn_capacity,
-    ret->cfg->expiration_time, &ret->dyn_heap)) ret = NULL;
+                            dev_allocate, &ret->dyn_vals)) return NULL;
+  if (!dchain_allocate(ret->cfg->dyn_capacity, &ret->dyn_heap)) return NULL;
+
+  // The last lcore is the control core
+  ret->num_workers = rte_lcore_count() - 1;
+  ret->learn_logs = calloc(ret->num_workers, sizeof(struct rte_ring *));
+  ret->learn_caches = calloc(ret->num_workers, sizeof(struct learn_cache_entry *));
+  if (ret->learn_logs == NULL || ret->learn_caches == NULL) return NULL;
+  for (unsigned worker = 0; worker < ret->num_workers; worker++) {
+    char ring_name[32];
+    sprintf(ring_name, "learn_log_%u", worker);
+    ret->learn_logs[worker] = rte_ring_create_elem(ring_name, sizeof(struct learn_entry), LEARN_LOG_SIZE,
+                                                   SOCKET_ID_ANY, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    ret->learn_caches[worker] = rte_zmalloc(NULL, LEARN_CACHE_SIZE * sizeof(struct learn_cache_entry),
+                                            RTE_CACHE_LINE_SIZE);
+    if (ret->learn_logs[worker] == NULL || ret->learn_caches[worker] == NULL) return NULL;
+  }
 
-  if (!register_periodic_handler(PERIODIC_HANDLER_PERIOD, exp_mac))
+  bridge_domains_init();
+#ifdef BRIDGE_DOMAINS_FILE
+  if (bridge_domains_load(BRIDGE_DOMAINS_FILE) < 0) return NULL;
+#endif
+
+  if (!register_periodic_handler("learn and age", PERIODIC_HANDLER_PERIOD, learn_and_age))
     ret = NULL;
  
   return ret;
@@ -118,6 +188,9 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
 
 bool nf_pkt_parser(uint8_t *buffer, pkt_t *pkt) {
   pkt->ether_header = nf_then_get_ether_header(buffer);
+  pkt->vlan_header = NULL;
+  if (pkt->ether_header->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_VLAN))
+    pkt->vlan_header = (struct rte_vlan_hdr *)nf_borrow_next_chunk(buffer, sizeof(struct rte_vlan_hdr));
   pkt->raw = buffer;
   return true;
 }
@@ -131,6 +204,29 @@ int nf_pkt_dispatcher(const pkt_t *pkt, uint16_t incoming_dev,
   return 0;
 }
 
+// Ask the control core to learn or refresh a MAC. The per-core cache keeps
+// a core from flooding its log with the same MAC until the control core
+// merged it.
+static void log_learn(nf_state_t *non_pkt_set_state, uint64_t key,
+                      uint16_t dev, vigor_time_t now) {
+  unsigned worker = rte_lcore_index(-1);
+  struct learn_cache_entry *cached =
+    &non_pkt_set_state->learn_caches[worker][rte_hash_crc_8byte(key, 0) & (LEARN_CACHE_SIZE - 1)];
+
+  if (cached->entry.key == key && cached->entry.dev == dev &&
+      now < cached->time + non_pkt_set_state->learn_holdoff)
+    return;
+
+  struct learn_entry entry = { .key = key, .dev = dev };
+  // Log full, retry with a later packet
+  if (rte_ring_sp_enqueue_elem(non_pkt_set_state->learn_logs[worker], &entry, sizeof(entry)))
+    return;
+
+  cached->entry = entry;
+  cached->time = now;
+  NF_DEBUG("MAC logged: key %lx dev %d", key, dev);
+}
+
 int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
                 uint16_t incoming_dev, pkt_set_state_t *unused_1,
                 pkt_set_id_t *unused_2) {
@@ -138,68 +234,31 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
   vigor_time_t now = get_curr_time();
   NF_DEBUG("NOW: %ld", now);
 
-  // MAC learning
+  uint16_t bd = pkt->vlan_header ? bridge_domain_of_tci(rte_be_to_cpu_16(pkt->vlan_header->vlan_tci)) : 0;
+  const struct bridge_domain *domain = &bridge_domains[bd];
+  if (incoming_dev >= 64 || !(domain->devices & (1ULL << incoming_dev))) {
+    drop_pkt(pkt);
+    NF_DEBUG("pkt dropped, device %d not in bridge domain %d", incoming_dev, bd);
+    return 0;
+  }
+
+  // MAC learning, the data plane only reads the mac table
   struct rte_ether_addr *src_mac = &ether_header->s_addr;
-  NF_DEBUG("MAC learning: src_mac %2x:%2x:%2x:%2x:%2x:%2x",
+  NF_DEBUG("MAC learning: bd %d src_mac %2x:%2x:%2x:%2x:%2x:%2x", bd,
           src_mac->addr_bytes[0],src_mac->addr_bytes[1],src_mac->addr_bytes[2],
           src_mac->addr_bytes[3],src_mac->addr_bytes[4],src_mac->addr_bytes[5]);
 
+  uint64_t src_key = mac_key_of(bd, src_mac);
   int index;
-  int present = nfos_map_get(non_pkt_set_state->dyn_map, (void *)src_mac, &index);
-  if (present) {
-    struct mac_entry *value;
+  struct mac_entry *value = NULL;
+  if (nfos_map_get(non_pkt_set_state->dyn_map, &src_key, &index))
     nfos_vector_borrow(non_pkt_set_state->dyn_vals, index, (void **)&value);
-    // Optimization: Only refresh if last refreshed more than REFRESH_INTERVAL ago
-    // Th bridge show work as if the expiration time is between (EXPIRATION_TIME
-    // - REFRESH_INTERVAL) and EXPIRATION_TIME
-    // TODO: Add a macro to turn off this opt.
-    if (now > value->time + REFRESH_INTERVAL) {
-      if (nfos_dchain_exp_rejuvenate_index(non_pkt_set_state->dyn_heap, index, now) == ABORT_HANDLER) {
-        return ABORT_HANDLER;
-      }
-      if (nfos_vector_borrow_mut(non_pkt_set_state->dyn_vals, index, (void **)&value) == ABORT_HANDLER) {
-        return ABORT_HANDLER;
-      }
-      value->time = now;
-
-      NF_DEBUG("rejuvenate index %d", index);
-    }
-
-    // TODO: handle mac move
-
-  } else {
-    int allocated =
-      nfos_dchain_exp_allocate_new_index(non_pkt_set_state->dyn_heap, &index, now);
-    if (!allocated) {
-      NF_DEBUG("No more space in the mac table");
-      return 0;
-    } else if (allocated == ABORT_HANDLER) {
-      return ABORT_HANDLER;
-    } else {
-      NF_DEBUG("allocate index %d", index);
-    }
-
-    struct rte_ether_addr *key;
-    struct mac_entry *value;
-    if (nfos_vector_borrow_mut(non_pkt_set_state->dyn_macs, index, (void **)&key) == ABORT_HANDLER) {
-      return ABORT_HANDLER;
-    }
-    if (nfos_vector_borrow_mut(non_pkt_set_state->dyn_vals, index, (void **)&value) == ABORT_HANDLER) {
-      return ABORT_HANDLER;
-    }
-    memcpy(key, src_mac, sizeof(struct rte_ether_addr));
-    value->dev = incoming_dev;
-    value->time = now;
-
-    if (nfos_map_put(non_pkt_set_state->dyn_map, src_mac, index) == ABORT_HANDLER) {
-      return ABORT_HANDLER;
-    }
 
-    NF_DEBUG("MAC learned: [%2x:%2x:%2x:%2x:%2x:%2x, %d]",
-          key->addr_bytes[0],key->addr_bytes[1],key->addr_bytes[2],
-          key->addr_bytes[3],key->addr_bytes[4],key->addr_bytes[5],
-          *value);
-  }
+  // Optimization: Only refresh if last refreshed more than REFRESH_INTERVAL ago
+  // Th bridge show work as if the expiration time is between (EXPIRATION_TIME
+  // - REFRESH_INTERVAL) and EXPIRATION_TIME
+  if (value == NULL || value->dev != incoming_dev || now > value->time + REFRESH_INTERVAL)
+    log_learn(non_pkt_set_state, src_key, incoming_dev, now);
 
   // Pkt forwarding
   struct rte_ether_addr *dst_mac = &ether_header->d_addr;
@@ -207,16 +266,19 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
           dst_mac->addr_bytes[0],dst_mac->addr_bytes[1],dst_mac->addr_bytes[2],
           dst_mac->addr_bytes[3],dst_mac->addr_bytes[4],dst_mac->addr_bytes[5]);
 
+  uint64_t dst_key = mac_key_of(bd, dst_mac);
   int out_index;
-  if (nfos_map_get(non_pkt_set_state->dyn_map, (void *)dst_mac, &out_index)) {
-    // uint16_t *out_device;
+  if (nfos_map_get(non_pkt_set_state->dyn_map, &dst_key, &out_index)) {
     struct mac_entry *value;
     nfos_vector_borrow(non_pkt_set_state->dyn_vals, out_index, (void **)&value);
     send_pkt(pkt, value->dev);
-    NF_DEBUG("pkt sent to port %d", *out_device);
-  } else {
+    NF_DEBUG("pkt sent to port %d", value->dev);
+  } else if (domain->flood_group == BD_FLOOD_ALL) {
     flood_pkt(pkt);
     NF_DEBUG("pkt flooded");
+  } else {
+    multicast_pkt(pkt, domain->flood_group);
+    NF_DEBUG("pkt flooded to bridge domain %d", bd);
   }
 
   return 0;
@@ -225,41 +287,90 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
 
 /* Periodic handlers */
 
-void exp_mac(nf_state_t *non_pkt_set_state) {
-  // temp hack for transaction chopping
-  rlu_thread_data_t *rlu_data = get_rlu_thread_data();
+// Learn or refresh a batch of logged MACs in one transaction
+static void learn_batch(nf_state_t *non_pkt_set_state, rlu_thread_data_t *rlu_data,
+                        struct learn_entry *entries, unsigned num_entries, vigor_time_t now) {
+  // Indexes allocated by the transaction, given back if it aborts
+  int new_indexes[LEARN_BATCH];
+  unsigned num_new;
 
-  int index;
-  vigor_time_t now = get_curr_time();
-  int expiration_done = 0;
+retry_learn:
+  num_new = 0;
+  RLU_READER_LOCK(rlu_data);
+  for (unsigned i = 0; i < num_entries; i++) {
+    uint16_t dev = entries[i].dev;
 
-  NF_DEBUG("NOW: %ld", now);
+    int index;
+    struct mac_entry *value;
+    if (nfos_map_get(non_pkt_set_state->dyn_map, &entries[i].key, &index)) {
+      if (nfos_vector_borrow_mut(non_pkt_set_state->dyn_vals, index, (void **)&value) == ABORT_HANDLER)
+        goto abort_learn;
+      dchain_rejuvenate_index(non_pkt_set_state->dyn_heap, index, now);
+      value->dev = dev;
+      value->time = now;
+
+      NF_DEBUG("rejuvenate index %d", index);
+      continue;
+    }
+
+    if (!dchain_allocate_new_index(non_pkt_set_state->dyn_heap, &index, now)) {
+      NF_DEBUG("No more space in the mac table");
+      continue;
+    }
+    new_indexes[num_new++] = index;
+
+    uint64_t *key;
+    if (nfos_vector_borrow_mut(non_pkt_set_state->dyn_macs, index, (void **)&key) == ABORT_HANDLER)
+      goto abort_learn;
+    if (nfos_vector_borrow_mut(non_pkt_set_state->dyn_vals, index, (void **)&value) == ABORT_HANDLER)
+      goto abort_learn;
+    *key = entries[i].key;
+    value->dev = dev;
+    value->time = now;
+
+    if (nfos_map_put(non_pkt_set_state->dyn_map, key, index) == ABORT_HANDLER)
+      goto abort_learn;
+
+    NF_DEBUG("MAC learned: [%lx, %d]", *key, dev);
+  }
+  if (RLU_READER_UNLOCK(rlu_data))
+    return;
+
+abort_learn:
+  NF_DEBUG("ABORT: learn");
+  nfos_abort_txn(rlu_data);
+  for (unsigned i = 0; i < num_new; i++)
+    dchain_free_index(non_pkt_set_state->dyn_heap, new_indexes[i]);
+  goto retry_learn;
+}
+
+// Expire a batch of MACs in one transaction, returns the number of expired MACs
+static unsigned age_batch(nf_state_t *non_pkt_set_state, rlu_thread_data_t *rlu_data,
+                          vigor_time_t now) {
+  int indexes[AGING_BATCH];
+  unsigned num_expired = 0;
+
+  // The control core is the only user of the allocator, the indexes cannot be
+  // reused before their MACs are erased below
+  while (num_expired < AGING_BATCH &&
+         dchain_expire_one_index(non_pkt_set_state->dyn_heap, &indexes[num_expired],
+                                 now - non_pkt_set_state->expiration_time))
+    num_expired++;
+  if (num_expired == 0)
+    return 0;
 
 retry_exp:
   RLU_READER_LOCK(rlu_data);
-  // Temp hack to reset curr_free_list to 0 in case of aborts
-  nfos_dchain_exp_reset_curr_free_list(non_pkt_set_state->dyn_heap);
-  while (!expiration_done) {
-    int ret = nfos_dchain_exp_expire_one_index(non_pkt_set_state->dyn_heap, &index, &expiration_done, now);
-    if (ret == ABORT_HANDLER) {
-      NF_DEBUG("ABORT: expire index");
+  for (unsigned i = 0; i < num_expired; i++) {
+    uint64_t *key;
+    nfos_vector_borrow(non_pkt_set_state->dyn_macs, indexes[i], (void **)&key);
+    if (nfos_map_erase(non_pkt_set_state->dyn_map, (void *)key) == ABORT_HANDLER) {
+      NF_DEBUG("ABORT: map erase");
       nfos_abort_txn(rlu_data);
       goto retry_exp;
-
-    } else if (ret == 1) {
-      struct rte_ether_addr *key;
-      nfos_vector_borrow(non_pkt_set_state->dyn_macs, index, (void **)&key);   
-      if (nfos_map_erase(non_pkt_set_state->dyn_map, (void *)key) == ABORT_HANDLER) {
-        NF_DEBUG("ABORT: map erase");
-        nfos_abort_txn(rlu_data);
-        goto retry_exp;
-      }
-
-      NF_DEBUG("MAC deleted: mac %2x:%2x:%2x:%2x:%2x:%2x index %d",
-          key->addr_bytes[0],key->addr_bytes[1],key->addr_bytes[2],
-          key->addr_bytes[3],key->addr_bytes[4],key->addr_bytes[5],
-          index);
     }
+
+    NF_DEBUG("MAC deleted: key %lx index %d", *key, indexes[i]);
   }
   if (!RLU_READER_UNLOCK(rlu_data)) {
     nfos_abort_txn(rlu_data);
@@ -267,7 +378,39 @@ retry_exp:
     goto retry_exp;
   }
 
-  NF_DEBUG("EXP DONE");
+  return num_expired;
+}
+
+// Merge the per-core learn logs into the mac table, then expire old MACs.
+// Both are bounded per period so that a burst of new MACs does not stall the
+// control core.
+void learn_and_age(nf_state_t *non_pkt_set_state) {
+  // temp hack for transaction chopping
+  rlu_thread_data_t *rlu_data = get_rlu_thread_data();
+  vigor_time_t now = get_curr_time();
+  unsigned budget = LEARN_BUDGET;
+
+  NF_DEBUG("NOW: %ld", now);
+
+  for (unsigned worker = 0; worker < non_pkt_set_state->num_workers && budget; worker++) {
+    struct rte_ring *log = non_pkt_set_state->learn_logs[worker];
+    struct learn_entry entries[LEARN_BATCH];
+    unsigned num_entries;
+
+    while (budget &&
+           (num_entries = rte_ring_sc_dequeue_burst_elem(log, entries, sizeof(struct learn_entry),
+                                                         RTE_MIN(budget, LEARN_BATCH), NULL))) {
+      learn_batch(non_pkt_set_state, rlu_data, entries, num_entries, now);
+      budget -= num_entries;
+    }
+  }
+
+  budget = AGING_BUDGET;
+  unsigned num_expired;
+  while (budget && (num_expired = age_batch(non_pkt_set_state, rlu_data, now)))
+    budget -= RTE_MIN(budget, num_expired);
+
+  NF_DEBUG("LEARN AND EXP DONE");
 }
 
 
@@ -0,0 +1,116 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include "nf.h"
+#include "fib_table.h"
+#include "ip6_fib.h"
+#include "load-balance.h"
+#include "fib_control.h"
+
+static uint32_t n_control_fibs;
+
+typedef struct{
+  uint32_t fib_index;
+  int is_ip6;
+  uint8_t dst_address[16];
+  uint32_t dst_address_length;
+} fib_control_prefix_t;
+
+/*
+Parse "<fib_index> <prefix>/<len>", returns the number of characters read,
+-1 on error with the reason in reply.
+*/
+static int
+parse_prefix(const char *args, fib_control_prefix_t *p, char *reply, size_t reply_size)
+{
+  char address[64];
+  unsigned fib, len;
+  int n_read = 0;
+  if (sscanf(args, "%u %63[0-9a-fA-F:.]/%u%n", &fib, address, &len, &n_read) != 3) {
+    snprintf(reply, reply_size, "expected <fib_index> <prefix>/<len>");
+    return -1;
+  }
+  if (fib >= n_control_fibs) {
+    snprintf(reply, reply_size, "no FIB %u", fib);
+    return -1;
+  }
+
+  p->fib_index = fib;
+  p->is_ip6 = strchr(address, ':') != NULL;
+  p->dst_address_length = len;
+  if (p->is_ip6 && !ip6_fibs) {
+    snprintf(reply, reply_size, "no IPv6 FIB");
+    return -1;
+  }
+  if (inet_pton(p->is_ip6 ? AF_INET6 : AF_INET, address, p->dst_address) != 1 ||
+      len > (p->is_ip6 ? 128 : 32)) {
+    snprintf(reply, reply_size, "invalid prefix %s/%u", address, len);
+    return -1;
+  }
+  return n_read;
+}
+
+static uint32_t
+ip4_address(const uint8_t *bytes)
+{
+  return ((uint32_t)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+static int
+route_add_command(nf_state_t *global_state, const char *args, char *reply, size_t reply_size)
+{
+  fib_control_prefix_t p;
+  int n_read = parse_prefix(args, &p, reply, reply_size);
+  if (n_read < 0)
+    return 1;
+
+  unsigned adj;
+  char tail;
+  if (sscanf(args + n_read, "%u %c", &adj, &tail) != 1) {
+    snprintf(reply, reply_size, "expected <adj_index>");
+    return 1;
+  }
+  if (adj >= load_balance_pool_index) {
+    snprintf(reply, reply_size, "no load-balance %u", adj);
+    return 1;
+  }
+
+  int ret = p.is_ip6 ?
+    ip6_fib_route_add(p.fib_index, p.dst_address, p.dst_address_length, adj) :
+    ip4_fib_route_add(p.fib_index, ip4_address(p.dst_address), p.dst_address_length, adj);
+  if (ret) {
+    snprintf(reply, reply_size, p.is_ip6 ? "IPv6 FIB full" : "ply pool exhausted");
+    return 1;
+  }
+  return 0;
+}
+
+static int
+route_del_command(nf_state_t *global_state, const char *args, char *reply, size_t reply_size)
+{
+  fib_control_prefix_t p;
+  int n_read = parse_prefix(args, &p, reply, reply_size);
+  if (n_read < 0)
+    return 1;
+
+  char tail;
+  if (sscanf(args + n_read, " %c", &tail) == 1) {
+    snprintf(reply, reply_size, "unexpected arguments after the prefix");
+    return 1;
+  }
+
+  int ret = p.is_ip6 ?
+    ip6_fib_route_del(p.fib_index, p.dst_address, p.dst_address_length) :
+    ip4_fib_route_del(p.fib_index, ip4_address(p.dst_address), p.dst_address_length);
+  if (ret)
+    snprintf(reply, reply_size, "absent");
+  return 0;
+}
+
+bool
+fib_control_register(uint32_t n_fibs)
+{
+  n_control_fibs = n_fibs;
+  return register_control_command("route_add", route_add_command) &&
+         register_control_command("route_del", route_del_command);
+}
@@ -0,0 +1,22 @@
+#pragma once
+#ifndef __FIB_CONTROL_H__
+#define __FIB_CONTROL_H__
+#include <stdbool.h>
+#include <stdint.h>
+/*
+Control channel commands updating the FIB tables (see control.h):
+
+  route_add <fib_index> <a.b.c.d/len | x:x::x/len> <adj_index>
+  route_del <fib_index> <a.b.c.d/len | x:x::x/len>
+
+The formats are those of the routes files. Deleting a missing route succeeds
+with "absent" as reply, so that the command is idempotent.
+*/
+
+/*
+Register the commands in nf_init, for FIB tables 0 to n_fibs - 1 and the
+load-balances created so far.
+Returns true on success, false otherwise.
+*/
+bool fib_control_register(uint32_t n_fibs);
+#endif
@@ -1,3 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vigor/nf-log.h"
 #include "fib_table.h"
+#include "load-balance.h"
 struct NfosVector *ip4_fibs;
 uint32_t fib_table_index = 0;
+
+/*
+Prefixes of a FIB table, open addressing with linear probing.
+Only touched by the control plane.
+*/
+typedef struct{
+  uint32_t dst_address;
+  uint32_t adj_index;
+  uint8_t dst_address_length;
+  uint8_t used;
+} ip4_fib_prefix_t;
+
+typedef struct{
+  ip4_fib_prefix_t *slots;
+  /*Power of two*/
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t n_prefixes_of_length[33];
+} ip4_fib_prefix_table_t;
+
+#define PREFIX_TABLE_MIN_CAPACITY 64
+
+static ip4_fib_prefix_table_t *prefix_tables;
+static uint32_t n_prefix_tables;
+
+static inline uint32_t
+prefix_hash(uint32_t dst_address, uint32_t dst_address_length)
+{
+  uint64_t h = ((uint64_t)dst_address << 6 | dst_address_length) * 0x9E3779B97F4A7C15ULL;
+  return h >> 32;
+}
+
+static ip4_fib_prefix_table_t*
+prefix_table_get(uint32_t fib_index)
+{
+  if (fib_index >= n_prefix_tables) {
+    ip4_fib_prefix_table_t *tables = realloc(prefix_tables, (fib_index + 1) * sizeof(ip4_fib_prefix_table_t));
+    if (!tables)
+      return NULL;
+    memset(tables + n_prefix_tables, 0, (fib_index + 1 - n_prefix_tables) * sizeof(ip4_fib_prefix_table_t));
+    prefix_tables = tables;
+    n_prefix_tables = fib_index + 1;
+  }
+  return &prefix_tables[fib_index];
+}
+
+static ip4_fib_prefix_t*
+prefix_find(ip4_fib_prefix_table_t *t, uint32_t dst_address, uint32_t dst_address_length)
+{
+  if (!t->count)
+    return NULL;
+  uint32_t mask = t->capacity - 1;
+  for (uint32_t i = prefix_hash(dst_address, dst_address_length) & mask; t->slots[i].used; i = (i + 1) & mask) {
+    if (t->slots[i].dst_address == dst_address && t->slots[i].dst_address_length == dst_address_length)
+      return &t->slots[i];
+  }
+  return NULL;
+}
+
+static int
+prefix_table_reserve(ip4_fib_prefix_table_t *t, uint32_t count)
+{
+  /*Keep the load factor under 1/2*/
+  if (2 * count <= t->capacity)
+    return 0;
+
+  uint32_t capacity = t->capacity ? t->capacity : PREFIX_TABLE_MIN_CAPACITY;
+  while (2 * count > capacity)
+    capacity *= 2;
+
+  ip4_fib_prefix_t *slots = calloc(capacity, sizeof(ip4_fib_prefix_t));
+  if (!slots)
+    return -1;
+  for (uint32_t j = 0; j < t->capacity; j++) {
+    if (!t->slots[j].used)
+      continue;
+    uint32_t i = prefix_hash(t->slots[j].dst_address, t->slots[j].dst_address_length) & (capacity - 1);
+    while (slots[i].used)
+      i = (i + 1) & (capacity - 1);
+    slots[i] = t->slots[j];
+  }
+  free(t->slots);
+  t->slots = slots;
+  t->capacity = capacity;
+  return 0;
+}
+
+static int
+prefix_insert(ip4_fib_prefix_table_t *t, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index)
+{
+  if (prefix_table_reserve(t, t->count + 1))
+    return -1;
+
+  uint32_t mask = t->capacity - 1;
+  uint32_t i = prefix_hash(dst_address, dst_address_length) & mask;
+  while (t->slots[i].used)
+    i = (i + 1) & mask;
+  t->slots[i].dst_address = dst_address;
+  t->slots[i].dst_address_length = dst_address_length;
+  t->slots[i].adj_index = adj_index;
+  t->slots[i].used = 1;
+  t->count++;
+  t->n_prefixes_of_length[dst_address_length]++;
+  return 0;
+}
+
+static void
+prefix_remove(ip4_fib_prefix_table_t *t, ip4_fib_prefix_t *p)
+{
+  uint32_t mask = t->capacity - 1;
+  uint32_t hole = p - t->slots;
+
+  t->n_prefixes_of_length[p->dst_address_length]--;
+  t->count--;
+
+  /*Backward shift the following entries of the probe sequence*/
+  for (uint32_t i = (hole + 1) & mask; t->slots[i].used; i = (i + 1) & mask) {
+    uint32_t home = prefix_hash(t->slots[i].dst_address, t->slots[i].dst_address_length) & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      t->slots[hole] = t->slots[i];
+      hole = i;
+    }
+  }
+  t->slots[hole].used = 0;
+}
+
+/*Longest prefix shorter than dst_address_length that contains dst_address*/
+static void
+prefix_find_cover(ip4_fib_prefix_table_t *t, uint32_t dst_address, uint32_t dst_address_length,
+                  uint32_t *cover_address_length, uint32_t *cover_adj_index)
+{
+  for (int32_t len = dst_address_length - 1; len >= 0; len--) {
+    if (!t->n_prefixes_of_length[len])
+      continue;
+    ip4_fib_prefix_t *p = prefix_find(t, dst_address & ip4_fib_mtrie_prefix_mask(len), len);
+    if (p) {
+      *cover_address_length = len;
+      *cover_adj_index = p->adj_index;
+      return;
+    }
+  }
+  /*Same as the leaves of a new mtrie*/
+  *cover_address_length = 0;
+  *cover_adj_index = 0;
+}
+
+int
+ip4_fib_route_add(uint32_t fib_index, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index)
+{
+  ip4_fib_prefix_table_t *t = prefix_table_get(fib_index);
+  if (!t || dst_address_length > 32)
+    return -1;
+
+  dst_address &= ip4_fib_mtrie_prefix_mask(dst_address_length);
+  ip4_fib_prefix_t *p = prefix_find(t, dst_address, dst_address_length);
+  if (p && p->adj_index == adj_index)
+    return 0;
+  if (!p && prefix_table_reserve(t, t->count + 1))
+    return -1;
+
+  if (ip4_fib_mtrie_route_add(&(ip4_fib_get(fib_index)->mtrie), dst_address, dst_address_length, adj_index))
+    return -1;
+
+  if (p)
+    p->adj_index = adj_index;
+  else
+    prefix_insert(t, dst_address, dst_address_length, adj_index);
+  return 0;
+}
+
+int
+ip4_fib_route_del(uint32_t fib_index, uint32_t dst_address, uint32_t dst_address_length)
+{
+  ip4_fib_prefix_table_t *t = prefix_table_get(fib_index);
+  if (!t || dst_address_length > 32)
+    return -1;
+
+  dst_address &= ip4_fib_mtrie_prefix_mask(dst_address_length);
+  ip4_fib_prefix_t *p = prefix_find(t, dst_address, dst_address_length);
+  if (!p)
+    return -1;
+
+  uint32_t cover_address_length, cover_adj_index;
+  prefix_find_cover(t, dst_address, dst_address_length, &cover_address_length, &cover_adj_index);
+  ip4_fib_mtrie_route_del(&(ip4_fib_get(fib_index)->mtrie), dst_address, dst_address_length, p->adj_index,
+                          cover_address_length, cover_adj_index);
+  prefix_remove(t, p);
+  return 0;
+}
+
+typedef struct{
+  uint32_t dst_address;
+  uint32_t dst_address_length;
+  uint32_t adj_index;
+} ip4_fib_route_t;
+
+static int
+route_cmp(const void *a, const void *b)
+{
+  const ip4_fib_route_t *ra = a, *rb = b;
+  if (ra->dst_address_length != rb->dst_address_length)
+    return ra->dst_address_length < rb->dst_address_length ? -1 : 1;
+  if (ra->dst_address != rb->dst_address)
+    return ra->dst_address < rb->dst_address ? -1 : 1;
+  return 0;
+}
+
+int
+ip4_fib_table_load(uint32_t fib_index, const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    NF_INFO("Cannot open FIB routes file %s", path);
+    return -1;
+  }
+
+  uint32_t n_routes = 0, capacity = 1024;
+  ip4_fib_route_t *routes = malloc(capacity * sizeof(ip4_fib_route_t));
+  char line[256];
+  int lineno = 0;
+  int ret = -1;
+
+  while (routes && fgets(line, sizeof(line), file)) {
+    lineno++;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+
+    unsigned a, b, c, d, len, adj;
+    char tail;
+    int n = sscanf(line, " %u.%u.%u.%u/%u %u %c", &a, &b, &c, &d, &len, &adj, &tail);
+    if (n <= 0)
+      continue;
+    if (n != 6 || a > 255 || b > 255 || c > 255 || d > 255 || len > 32) {
+      NF_INFO("Invalid route at %s:%d", path, lineno);
+      goto out;
+    }
+    if (adj >= load_balance_pool_index) {
+      NF_INFO("No load-balance %u at %s:%d", adj, path, lineno);
+      goto out;
+    }
+
+    if (n_routes == capacity) {
+      capacity *= 2;
+      ip4_fib_route_t *grown = realloc(routes, capacity * sizeof(ip4_fib_route_t));
+      if (!grown)
+        goto out;
+      routes = grown;
+    }
+    uint32_t dst_address = (a << 24) | (b << 16) | (c << 8) | d;
+    routes[n_routes].dst_address = dst_address & ip4_fib_mtrie_prefix_mask(len);
+    routes[n_routes].dst_address_length = len;
+    routes[n_routes].adj_index = adj;
+    n_routes++;
+  }
+  if (!routes)
+    goto out;
+
+  qsort(routes, n_routes, sizeof(ip4_fib_route_t), route_cmp);
+
+  ip4_fib_prefix_table_t *t = prefix_table_get(fib_index);
+  if (!t || prefix_table_reserve(t, t->count + n_routes))
+    goto out;
+
+  for (uint32_t i = 0; i < n_routes; i++) {
+    if (ip4_fib_route_add(fib_index, routes[i].dst_address, routes[i].dst_address_length, routes[i].adj_index)) {
+      NF_INFO("FIB %u: ply pool exhausted after %u of %u routes", fib_index, i, n_routes);
+      goto out;
+    }
+  }
+  ret = n_routes;
+
+out:
+  free(routes);
+  fclose(file);
+  return ret;
+}
@@ -2,6 +2,7 @@
 #ifndef __FIB_TABLE_H__
 #define __FIB_TABLE_H__
 #include "mtrie.h"
+#include "load-balance.h"
 #include "vector.h"
 // WARNING: using nfos_vector_borrow_unsafe instead of nfos_vector_borrow
 // since the latter will cause SEG_FAULT if called in the nf_init when the threads
@@ -22,4 +23,51 @@ ip4_fib_get(uint32_t fib_index){
     nfos_vector_borrow_unsafe(ip4_fibs, fib_index, (void **)(&fib_table));
     return fib_table;
 }
+
+/*
+Route a batch of addresses (in host byte order) at once: the mtrie lookups are
+interleaved, then the load-balances of the routes are prefetched.
+lb_indices[i] is set to the load-balance of dst_addresses[i].
+*/
+static inline void
+ip4_fib_lookup_prefetch_xN(uint32_t fib_index, const uint32_t *dst_addresses,
+                           uint32_t *lb_indices, uint16_t n){
+    ip4_fib_mtrie_leaf_t leaves[n];
+    ip4_fib_mtrie_lookup_xN(&(ip4_fib_get(fib_index)->mtrie), dst_addresses, leaves, n);
+
+    for (uint16_t i = 0; i < n; i++) {
+        /*Leaves from full lookups are terminal and hold the load-balance*/
+        lb_indices[i] = leaves[i] >> 1;
+        load_balance_prefetch(lb_indices[i]);
+    }
+    for (uint16_t i = 0; i < n; i++)
+        load_balance_prefetch_buckets(lb_indices[i]);
+}
+
+/*
+Route updates of a FIB table, to be called from nf_init or the control core
+(e.g., the periodic handler), never from data plane cores.
+The FIB keeps the set of its prefixes to find the cover of deleted ones.
+Addresses are in host byte order.
+*/
+
+/*
+Add a route, or change the load-balance of an existing one.
+Returns 0 on success, -1 if the ply pool is exhausted.
+*/
+int ip4_fib_route_add(uint32_t fib_index, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index);
+
+/*
+Delete a route. Returns 0 on success, -1 if the route does not exist.
+*/
+int ip4_fib_route_del(uint32_t fib_index, uint32_t dst_address, uint32_t dst_address_length);
+
+/*
+Bulk-load routes from a text file with one "a.b.c.d/len adj_index" route per
+line ('#' starts a comment), adj_index being an existing load-balance.
+Routes are added one by one from the least to the most specific one, so that
+no route is pushed down into the plies of a more specific one.
+Returns the number of routes loaded, -1 on error.
+*/
+int ip4_fib_table_load(uint32_t fib_index, const char *path);
 #endif
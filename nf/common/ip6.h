@@ -0,0 +1,95 @@
+#pragma once
+#ifndef __IP6_H__
+#define __IP6_H__
+#include <stdint.h>
+#include <string.h>
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include "vigor/nf-util.h"
+#include "nf.h"
+
+/*
+IPv6 counterparts of the nf-util parsing helpers. Extension headers are not
+parsed, a packet whose first next header is not TCP/UDP has no L4 header.
+*/
+
+#define IP6_PROTOCOL_TCP 6
+#define IP6_PROTOCOL_UDP 17
+
+static inline struct rte_ipv6_hdr *
+nf_then_get_ipv6_header(struct rte_ether_hdr *ether_header, void *p)
+{
+  if (ether_header->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6) ||
+      packet_get_unread_length(p) < sizeof(struct rte_ipv6_hdr))
+    return NULL;
+
+  struct rte_ipv6_hdr *hdr =
+      (struct rte_ipv6_hdr *)nf_borrow_next_chunk(p, sizeof(struct rte_ipv6_hdr));
+  if (packet_get_unread_length(p) < rte_be_to_cpu_16(hdr->payload_len))
+    return NULL;
+  return hdr;
+}
+
+static inline struct tcpudp_hdr *
+nf_then_get_ipv6_tcpudp_header(struct rte_ipv6_hdr *ip6_header, void *p)
+{
+  if ((ip6_header->proto != IP6_PROTOCOL_TCP && ip6_header->proto != IP6_PROTOCOL_UDP) ||
+      packet_get_unread_length(p) < sizeof(struct tcpudp_hdr))
+    return NULL;
+  return (struct tcpudp_hdr *)nf_borrow_next_chunk(p, sizeof(struct tcpudp_hdr));
+}
+
+/*L4 protocol of an IPv4 or IPv6 packet*/
+static inline uint8_t
+pkt_l4_proto(const pkt_t *pkt)
+{
+  return pkt->ipv4_header ? pkt->ipv4_header->next_proto_id : pkt->ipv6_header->proto;
+}
+
+/*
+Flow tables hold IPv4 addresses as IPv4-mapped IPv6 ones (::ffff:a.b.c.d), so
+that one table serves both families.
+*/
+static inline void
+ip6_addr_from_ipv4(uint8_t *ip6_addr, rte_be32_t ipv4_addr)
+{
+  memset(ip6_addr, 0, 10);
+  ip6_addr[10] = 0xFF;
+  ip6_addr[11] = 0xFF;
+  memcpy(ip6_addr + 12, &ipv4_addr, sizeof(ipv4_addr));
+}
+
+static inline int
+ip6_addr_is_ipv4_mapped(const uint8_t *ip6_addr)
+{
+  static const uint8_t prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+  return !memcmp(ip6_addr, prefix, sizeof(prefix));
+}
+
+/*
+CRC32 of a key made of size / 8 64-bit words, e.g. a 40-byte IPv6 5-tuple in
+five crc32q instructions.
+*/
+static inline unsigned
+ip6_crc32_words(const void *key, unsigned size)
+{
+  const uint64_t *words = (const uint64_t *)key;
+  uint64_t hash = 0;
+  for (unsigned i = 0; i < size / 8; i++)
+    hash = __builtin_ia32_crc32di(hash, words[i]);
+  return hash;
+}
+
+/*Equality of two keys made of size / 8 64-bit words*/
+static inline int
+ip6_words_eq(const void *a, const void *b, unsigned size)
+{
+  const uint64_t *wa = (const uint64_t *)a;
+  const uint64_t *wb = (const uint64_t *)b;
+  uint64_t diff = 0;
+  for (unsigned i = 0; i < size / 8; i++)
+    diff |= wa[i] ^ wb[i];
+  return diff == 0;
+}
+#endif
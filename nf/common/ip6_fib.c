@@ -0,0 +1,154 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <rte_common.h>
+#include <rte_malloc.h>
+#include "vigor/nf-log.h"
+#include "ip6_fib.h"
+#include "load-balance.h"
+
+ip6_fib_entry_t *ip6_fib_entries;
+ip6_fib_t *ip6_fibs;
+uint32_t ip6_fib_entries_mask;
+static uint32_t n_ip6_fibs;
+/*Used and deleted entries, kept under half of the slots so that probes end*/
+static uint32_t n_occupied_entries;
+
+int
+ip6_fib_init(uint32_t n_fibs, uint32_t max_routes)
+{
+  uint32_t capacity = rte_align32pow2(2 * (max_routes ? max_routes : 1));
+  ip6_fib_entries = rte_zmalloc(NULL, capacity * sizeof(ip6_fib_entry_t), RTE_CACHE_LINE_SIZE);
+  ip6_fibs = rte_zmalloc(NULL, n_fibs * sizeof(ip6_fib_t), RTE_CACHE_LINE_SIZE);
+  if (!ip6_fib_entries || !ip6_fibs)
+    return -1;
+
+  ip6_fib_entries_mask = capacity - 1;
+  n_ip6_fibs = n_fibs;
+  n_occupied_entries = 0;
+  return 0;
+}
+
+static inline void
+prefix_length_set(ip6_fib_t *fib, uint32_t dst_address_length, int present)
+{
+  uint64_t *word = &fib->prefix_lengths[dst_address_length / 64];
+  uint64_t bit = 1ULL << (dst_address_length % 64);
+  __atomic_store_n(word, present ? (*word | bit) : (*word & ~bit), __ATOMIC_RELEASE);
+}
+
+int
+ip6_fib_route_add(uint32_t fib_index, const uint8_t *dst_address, uint32_t dst_address_length, uint32_t adj_index)
+{
+  if (fib_index >= n_ip6_fibs || dst_address_length > 128)
+    return -1;
+
+  uint64_t words[2];
+  ip6_fib_address_words(dst_address, words);
+  ip6_fib_mask_words(words, dst_address_length);
+
+  uint32_t i = ip6_fib_entry_hash(fib_index, words, dst_address_length) & ip6_fib_entries_mask;
+  int64_t reusable = -1;
+  for (; ip6_fib_entries[i].state != IP6_FIB_ENTRY_EMPTY; i = (i + 1) & ip6_fib_entries_mask) {
+    ip6_fib_entry_t *e = &ip6_fib_entries[i];
+    if (e->state == IP6_FIB_ENTRY_DELETED) {
+      if (reusable < 0 && grace_period_done(e->retired))
+        reusable = i;
+      continue;
+    }
+    if (e->dst_address[0] == words[0] && e->dst_address[1] == words[1] &&
+        e->fib_index == fib_index && e->dst_address_length == dst_address_length) {
+      __atomic_store_n(&e->adj_index, adj_index, __ATOMIC_RELAXED);
+      return 0;
+    }
+  }
+
+  if (reusable < 0) {
+    if (2 * (n_occupied_entries + 1) > ip6_fib_entries_mask + 1)
+      return -1;
+    reusable = i;
+    n_occupied_entries++;
+  }
+
+  /*Fill in the entry before publishing it*/
+  ip6_fib_entry_t *e = &ip6_fib_entries[reusable];
+  e->dst_address[0] = words[0];
+  e->dst_address[1] = words[1];
+  e->fib_index = fib_index;
+  e->adj_index = adj_index;
+  e->dst_address_length = dst_address_length;
+  __atomic_store_n(&e->state, IP6_FIB_ENTRY_USED, __ATOMIC_RELEASE);
+
+  ip6_fib_t *fib = &ip6_fibs[fib_index];
+  if (fib->n_prefixes_of_length[dst_address_length]++ == 0)
+    prefix_length_set(fib, dst_address_length, 1);
+  return 0;
+}
+
+int
+ip6_fib_route_del(uint32_t fib_index, const uint8_t *dst_address, uint32_t dst_address_length)
+{
+  if (fib_index >= n_ip6_fibs || dst_address_length > 128)
+    return -1;
+
+  uint64_t words[2];
+  ip6_fib_address_words(dst_address, words);
+  ip6_fib_mask_words(words, dst_address_length);
+  int64_t slot = ip6_fib_entry_find(fib_index, words, dst_address_length);
+  if (slot < 0)
+    return -1;
+
+  ip6_fib_t *fib = &ip6_fibs[fib_index];
+  if (--fib->n_prefixes_of_length[dst_address_length] == 0)
+    prefix_length_set(fib, dst_address_length, 0);
+
+  /*Lookups might still be reading the entry*/
+  ip6_fib_entry_t *e = &ip6_fib_entries[slot];
+  __atomic_store_n(&e->state, IP6_FIB_ENTRY_DELETED, __ATOMIC_RELEASE);
+  e->retired = grace_period_start();
+  return 0;
+}
+
+int
+ip6_fib_table_load(uint32_t fib_index, const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    NF_INFO("Cannot open FIB routes file %s", path);
+    return -1;
+  }
+
+  char line[256];
+  int lineno = 0;
+  int ret = 0;
+  while (ret >= 0 && fgets(line, sizeof(line), file)) {
+    lineno++;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+
+    char address[64], tail;
+    unsigned len, adj;
+    int n = sscanf(line, " %63[0-9a-fA-F:.]/%u %u %c", address, &len, &adj, &tail);
+    if (n <= 0)
+      continue;
+
+    uint8_t dst_address[16];
+    if (n != 3 || len > 128 || inet_pton(AF_INET6, address, dst_address) != 1) {
+      NF_INFO("Invalid route at %s:%d", path, lineno);
+      ret = -1;
+    } else if (adj >= load_balance_pool_index) {
+      NF_INFO("No load-balance %u at %s:%d", adj, path, lineno);
+      ret = -1;
+    } else if (ip6_fib_route_add(fib_index, dst_address, len, adj)) {
+      NF_INFO("FIB %u: IPv6 FIB full at %s:%d", fib_index, path, lineno);
+      ret = -1;
+    } else {
+      ret++;
+    }
+  }
+
+  fclose(file);
+  return ret;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#ifndef __IP6_FIB_H__
+#define __IP6_FIB_H__
+#include <stdint.h>
+#include <rte_byteorder.h>
+#include "grace-period.h"
+
+/*
+IPv6 FIB tables, the IPv6 counterpart of the 16-8-8 mtrie (see fib_table.h).
+
+A 128-bit trie would take up to 16 plies per lookup. Instead, as in VPP's IPv6
+FIB, the routes of all FIB tables live in one hash table keyed by (FIB index,
+prefix length, prefix), and a lookup probes the prefix lengths present in the
+FIB from the longest one, typically a handful of them.
+
+Concurrency: routes are added and deleted by a single writer (nf_init or the
+control core) while data plane cores do lock-free lookups. An entry is filled
+in before its state is published, a deleted entry is only marked as such, and
+its slot is reused after a grace period (see grace-period.h).
+
+Addresses are 16 bytes in network byte order, as in the IPv6 header.
+*/
+
+#define IP6_FIB_ENTRY_EMPTY 0
+#define IP6_FIB_ENTRY_USED 1
+#define IP6_FIB_ENTRY_DELETED 2
+
+typedef struct{
+  /*Masked prefix in host byte order, most significant word first*/
+  uint64_t dst_address[2];
+  uint32_t fib_index;
+  uint32_t adj_index;
+  uint8_t dst_address_length;
+  uint8_t state;
+  /*Grace period after which a deleted entry can be reused*/
+  uint64_t retired;
+} ip6_fib_entry_t;
+
+typedef struct{
+  /*Bit l % 64 of word l / 64 is set if the FIB has prefixes of length l*/
+  uint64_t prefix_lengths[3];
+  /*Only touched by the writer*/
+  uint32_t n_prefixes_of_length[129];
+} ip6_fib_t;
+
+extern ip6_fib_entry_t *ip6_fib_entries;
+extern ip6_fib_t *ip6_fibs;
+extern uint32_t ip6_fib_entries_mask;
+
+/*
+Allocate n_fibs FIB tables sharing room for max_routes routes. NFs set
+max_routes with IP6_FIB_CAPACITY, which must cover the routes of
+FIB6_ROUTES_FILE of all tables if the NF loads one.
+Returns 0 on success, -1 otherwise.
+*/
+int ip6_fib_init(uint32_t n_fibs, uint32_t max_routes);
+
+static inline void
+ip6_fib_address_words(const uint8_t *address, uint64_t *words)
+{
+  words[0] = rte_be_to_cpu_64(*(const unaligned_uint64_t *)address);
+  words[1] = rte_be_to_cpu_64(*(const unaligned_uint64_t *)(address + 8));
+}
+
+static inline void
+ip6_fib_mask_words(uint64_t *words, uint32_t dst_address_length)
+{
+  if (dst_address_length < 64) {
+    words[0] &= dst_address_length ? ~0ULL << (64 - dst_address_length) : 0;
+    words[1] = 0;
+  } else if (dst_address_length < 128) {
+    words[1] &= dst_address_length > 64 ? ~0ULL << (128 - dst_address_length) : 0;
+  }
+}
+
+static inline uint32_t
+ip6_fib_entry_hash(uint32_t fib_index, const uint64_t *words, uint32_t dst_address_length)
+{
+  uint64_t hash = __builtin_ia32_crc32di(0, words[0]);
+  hash = __builtin_ia32_crc32di(hash, words[1]);
+  return __builtin_ia32_crc32di(hash, (uint64_t)fib_index << 8 | dst_address_length);
+}
+
+/*Slot of a route, -1 if there is none*/
+static inline int64_t
+ip6_fib_entry_find(uint32_t fib_index, const uint64_t *words, uint32_t dst_address_length)
+{
+  uint32_t i = ip6_fib_entry_hash(fib_index, words, dst_address_length) & ip6_fib_entries_mask;
+  while (1) {
+    const ip6_fib_entry_t *e = &ip6_fib_entries[i];
+    uint8_t state = __atomic_load_n(&e->state, __ATOMIC_ACQUIRE);
+    if (state == IP6_FIB_ENTRY_EMPTY)
+      return -1;
+    if (state == IP6_FIB_ENTRY_USED && e->dst_address[0] == words[0] && e->dst_address[1] == words[1] &&
+        e->fib_index == fib_index && e->dst_address_length == dst_address_length)
+      return i;
+    i = (i + 1) & ip6_fib_entries_mask;
+  }
+}
+
+/*
+Longest prefix match, returns the adj index of the route, 0 if there is none
+(same as the leaves of a new mtrie).
+*/
+static inline uint32_t
+ip6_fib_lookup(uint32_t fib_index, const uint8_t *dst_address)
+{
+  const ip6_fib_t *fib = &ip6_fibs[fib_index];
+  uint64_t address[2];
+  ip6_fib_address_words(dst_address, address);
+
+  for (int w = 2; w >= 0; w--) {
+    uint64_t lengths = __atomic_load_n(&fib->prefix_lengths[w], __ATOMIC_ACQUIRE);
+    while (lengths) {
+      uint32_t bit = 63 - __builtin_clzll(lengths);
+      lengths &= ~(1ULL << bit);
+      uint32_t len = w * 64 + bit;
+      uint64_t words[2] = {address[0], address[1]};
+      ip6_fib_mask_words(words, len);
+      int64_t slot = ip6_fib_entry_find(fib_index, words, len);
+      if (slot >= 0)
+        return __atomic_load_n(&ip6_fib_entries[slot].adj_index, __ATOMIC_RELAXED);
+    }
+  }
+  return 0;
+}
+
+/*
+Route updates, to be called from nf_init or the control core, never from data
+plane cores.
+*/
+
+/*
+Add a route, or change the load-balance of an existing one.
+Returns 0 on success, -1 if the FIB is full.
+*/
+int ip6_fib_route_add(uint32_t fib_index, const uint8_t *dst_address, uint32_t dst_address_length, uint32_t adj_index);
+
+/*
+Delete a route. Returns 0 on success, -1 if the route does not exist.
+*/
+int ip6_fib_route_del(uint32_t fib_index, const uint8_t *dst_address, uint32_t dst_address_length);
+
+/*
+Bulk-load routes from a text file with one "x:x::x/len adj_index" route per
+line ('#' starts a comment), adj_index being an existing load-balance.
+Returns the number of routes loaded, -1 on error.
+*/
+int ip6_fib_table_load(uint32_t fib_index, const char *path);
+#endif
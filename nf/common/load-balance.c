@@ -1,3 +1,5 @@
+#include <stdlib.h>
+#include <rte_malloc.h>
 #include "load-balance.h"
 struct NfosVector* load_balance_pool;
 uint32_t load_balance_pool_index = 0;
@@ -8,21 +10,96 @@ lb_vector_get(struct NfosVector* vector, load_balance_t **p, uint32_t *index){
   (*index) = load_balance_pool_index;
   load_balance_pool_index ++;
 }
-uint32_t load_balance_create(uint32_t n_dpo, uint16_t *action, uint16_t *send_device, rte_be32_t *dst_ip_address, struct rte_ether_addr * dst_mac_address){
+
+/*
+Share out n_buckets among the paths with the largest remainder method.
+Returns the sum of the differences between the shares and the weights.
+*/
+static double
+lb_normalize_weights(uint32_t n_paths, const uint32_t *weights, uint64_t sum_weights,
+                     uint32_t n_buckets, uint32_t *n_path_buckets)
+{
+  uint32_t n_assigned = 0;
+  for (uint32_t i = 0; i < n_paths; i++) {
+    n_path_buckets[i] = (uint64_t)weights[i] * n_buckets / sum_weights;
+    n_assigned += n_path_buckets[i];
+  }
+  while (n_assigned < n_buckets) {
+    /*Path losing the most from rounding down*/
+    uint32_t best = 0;
+    double best_remainder = -1;
+    for (uint32_t i = 0; i < n_paths; i++) {
+      double remainder = (double)weights[i] * n_buckets / sum_weights - n_path_buckets[i];
+      if (weights[i] && remainder > best_remainder) {
+        best = i;
+        best_remainder = remainder;
+      }
+    }
+    n_path_buckets[best]++;
+    n_assigned++;
+  }
+
+  double error = 0;
+  for (uint32_t i = 0; i < n_paths; i++) {
+    double diff = (double)n_path_buckets[i] / n_buckets - (double)weights[i] / sum_weights;
+    error += diff > 0 ? diff : -diff;
+  }
+  return error;
+}
+
+uint32_t load_balance_create_weighted(uint32_t n_paths, const dpo_t *paths, const uint32_t *weights){
+    uint64_t sum_weights = 0;
+    uint32_t n_used_paths = 0;
+    for (uint32_t i = 0; i < n_paths; i++) {
+        sum_weights += weights[i];
+        n_used_paths += weights[i] != 0;
+    }
+    if (!sum_weights || load_balance_pool_index >= nfos_vector_get_capacity(load_balance_pool))
+        return UINT32_MAX;
+
+    /*Smallest table giving each path a bucket and close enough shares*/
+    uint32_t n_path_buckets[n_paths];
+    uint32_t n_buckets = 1;
+    while (n_buckets < n_used_paths && n_buckets < LB_MAX_BUCKETS)
+        n_buckets *= 2;
+    while (lb_normalize_weights(n_paths, weights, sum_weights, n_buckets, n_path_buckets) > LB_WEIGHT_TOLERANCE &&
+           n_buckets < LB_MAX_BUCKETS)
+        n_buckets *= 2;
+
+    /*Allocated before taking a slot of the pool, which cannot be given back*/
+    dpo_t *buckets = NULL;
+    if (n_buckets > LB_NUM_INLINE_BUCKETS) {
+        buckets = rte_malloc(NULL, n_buckets * sizeof(dpo_t), RTE_CACHE_LINE_SIZE);
+        if (!buckets)
+            return UINT32_MAX;
+    }
+
     load_balance_t *lb;
     uint32_t index;
     lb_vector_get(load_balance_pool, &lb, &index);
-    lb ->n_buckets = n_dpo;
-    lb ->lb_buckets = (dpo_t *)malloc(n_dpo * sizeof(dpo_t));
-    for(uint32_t i =0; i < n_dpo; i++){
-        lb->lb_buckets[i].action = action[i];
+    lb->n_buckets = n_buckets;
+    lb->n_buckets_minus_1 = n_buckets - 1;
+    if (buckets)
+        lb->lb_buckets = buckets;
+    else
+        buckets = lb->lb_buckets_inline;
+    uint32_t bucket = 0;
+    for (uint32_t i = 0; i < n_paths; i++) {
+        for (uint32_t j = 0; j < n_path_buckets[i]; j++)
+            buckets[bucket++] = paths[i];
     }
+    return index;
+}
+
+uint32_t load_balance_create(uint32_t n_dpo, uint16_t *action, uint16_t *send_device, rte_be32_t *dst_ip_address, struct rte_ether_addr * dst_mac_address){
+    dpo_t paths[n_dpo];
+    uint32_t weights[n_dpo];
     for(uint32_t i =0; i < n_dpo; i++){
-        lb->lb_buckets[i].send_device = send_device[i];
+        paths[i].action = action[i];
+        paths[i].send_device = send_device[i];
+        paths[i].dst_ip_address = dst_ip_address[i];
+        paths[i].dst_mac_address = dst_mac_address[i];
+        weights[i] = 1;
     }
-    for(uint32_t i =0; i < n_dpo; i++)
-        lb->lb_buckets[i].dst_ip_address = dst_ip_address[i];
-    for(uint32_t i =0; i < n_dpo; i++)
-        lb->lb_buckets[i].dst_mac_address = dst_mac_address[i];
-    return index;
-}
\ No newline at end of file
+    return load_balance_create_weighted(n_dpo, paths, weights);
+}
@@ -16,19 +16,48 @@ typedef struct dpo_t_{
     uint32_t dst_ip_address;  //The ip address is in little endian
     struct rte_ether_addr dst_mac_address; // The ip address is in big endian
 } dpo_t;
+
+/*Buckets stored in the load-balance itself, next to its header*/
+#define LB_NUM_INLINE_BUCKETS 4
+/*Max size of the bucket table of weighted load-balances*/
+#ifndef LB_MAX_BUCKETS
+#define LB_MAX_BUCKETS 64
+#endif
+/*Max sum of the differences between the path weights and their share of buckets*/
+#define LB_WEIGHT_TOLERANCE 0.1
+
 typedef struct load_balance_t_ {
-    /*Numbers of buckets in the load-balance*/
+    /*Numbers of buckets in the load-balance, power of two*/
     uint16_t n_buckets;
+    uint16_t n_buckets_minus_1;
     uint8_t dscp;
-    dpo_t *lb_buckets;
+    union {
+        /*If n_buckets <= LB_NUM_INLINE_BUCKETS*/
+        dpo_t lb_buckets_inline[LB_NUM_INLINE_BUCKETS];
+        dpo_t *lb_buckets;
+    };
 } load_balance_t;
 extern struct NfosVector* load_balance_pool;
 extern uint32_t load_balance_pool_index;
 
+static inline const dpo_t*
+load_balance_get_buckets(const load_balance_t *lb){
+    return lb->n_buckets <= LB_NUM_INLINE_BUCKETS ? lb->lb_buckets_inline : lb->lb_buckets;
+}
+
 static inline const dpo_t*
 load_balance_get_bucket_i(const load_balance_t *lb, uint16_t bucket){
     assert(bucket < lb->n_buckets);
-    return (&lb->lb_buckets[bucket]);
+    return (&load_balance_get_buckets(lb)[bucket]);
+}
+
+/*
+Pick the bucket of a packet from its flow hash, e.g., the RSS hash in pkt_t.
+The low bits of the RSS hash select the RX queue, use the high ones.
+*/
+static inline const dpo_t*
+load_balance_get_bucket_by_hash(const load_balance_t *lb, uint32_t hash){
+    return (&load_balance_get_buckets(lb)[(hash >> 16) & lb->n_buckets_minus_1]);
 }
 
 static inline load_balance_t*
@@ -37,6 +66,21 @@ load_balance_get (uint32_t lb_index){
     nfos_vector_borrow(load_balance_pool, lb_index, (void **)(&lb));
     return lb;
 }
+// Load-balances are not updated after nf_init, prefetching does not need RLU
+static inline void
+load_balance_prefetch(uint32_t lb_index){
+    load_balance_t *lb;
+    nfos_vector_borrow_unsafe(load_balance_pool, lb_index, (void**)(&lb));
+    __builtin_prefetch(lb);
+}
+// Call some time after load_balance_prefetch() on the same index
+static inline void
+load_balance_prefetch_buckets(uint32_t lb_index){
+    load_balance_t *lb;
+    nfos_vector_borrow_unsafe(load_balance_pool, lb_index, (void**)(&lb));
+    if (lb->n_buckets > LB_NUM_INLINE_BUCKETS)
+        __builtin_prefetch(lb->lb_buckets);
+}
 static inline void
 load_balance_set_dscp(uint32_t lb_index, uint8_t dscp){
     load_balance_t *lb;
@@ -47,5 +91,16 @@ void
 lb_vector_get(struct NfosVector* vector, load_balance_t **p, uint32_t *index);
 
 // Attention here, ip address is in little endian while the dst_mac_address is in little endian.
+// Creates an ECMP load-balance over the n_dpo paths.
 uint32_t load_balance_create(uint32_t n_dpo, uint16_t *action, uint16_t *send_device, rte_be32_t *dst_ip_address, struct rte_ether_addr * dst_mac_address);
-#endif
\ No newline at end of file
+
+/*
+Create a load-balance sharing traffic among n_paths paths in proportion to
+their weights. Paths are expanded into a power-of-two bucket table, of at most
+LB_MAX_BUCKETS buckets, whose shares are within LB_WEIGHT_TOLERANCE of the
+weights. Paths with zero weight are not used.
+Returns the index of the load-balance, UINT32_MAX if all weights are zero,
+the pool is exhausted or the bucket table cannot be allocated.
+*/
+uint32_t load_balance_create_weighted(uint32_t n_paths, const dpo_t *paths, const uint32_t *weights);
+#endif
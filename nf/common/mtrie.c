@@ -1,6 +1,75 @@
 #include "mtrie.h"
+#include "grace-period.h"
 struct NfosVector* ip4_ply_pool;
 uint32_t ip4_ply_pool_index = 0;
+
+/*Plies released by route deletes, reused after their grace period*/
+typedef struct{
+  uint32_t index;
+  /*0 until the ply is unlinked from its parent*/
+  uint64_t grace_period;
+} ip4_ply_retired_t;
+
+static uint32_t *ply_free_list;
+static uint32_t ply_free_count;
+static ip4_ply_retired_t *ply_retired_list;
+static uint32_t ply_retired_count;
+
+static void
+ply_free_lists_init(void)
+{
+  if (ply_free_list)
+    return;
+  uint32_t capacity = nfos_vector_get_capacity(ip4_ply_pool);
+  ply_free_list = malloc(capacity * sizeof(uint32_t));
+  ply_retired_list = malloc(capacity * sizeof(ip4_ply_retired_t));
+  assert(ply_free_list && ply_retired_list);
+}
+
+static void
+ply_retire(uint32_t index)
+{
+  ply_free_lists_init();
+  ply_retired_list[ply_retired_count].index = index;
+  ply_retired_list[ply_retired_count].grace_period = 0;
+  ply_retired_count++;
+}
+
+/*Called once the retired plies are no longer reachable from the root*/
+static void
+ply_retire_commit(void)
+{
+  uint64_t grace_period = 0;
+  for (uint32_t i = ply_retired_count; i > 0 && !ply_retired_list[i - 1].grace_period; i--) {
+    if (!grace_period)
+      grace_period = grace_period_start();
+    ply_retired_list[i - 1].grace_period = grace_period;
+  }
+}
+
+static void
+ply_reclaim(void)
+{
+  /*Grace periods are started in order, stop at the first pending one*/
+  uint32_t n_done = 0;
+  while (n_done < ply_retired_count &&
+         grace_period_done(ply_retired_list[n_done].grace_period))
+    ply_free_list[ply_free_count++] = ply_retired_list[n_done++].index;
+
+  if (n_done) {
+    memmove(ply_retired_list, ply_retired_list + n_done,
+            (ply_retired_count - n_done) * sizeof(ip4_ply_retired_t));
+    ply_retired_count -= n_done;
+  }
+}
+
+uint32_t
+ip4_ply_pool_available(void)
+{
+  if (ply_retired_count)
+    ply_reclaim();
+  return nfos_vector_get_capacity(ip4_ply_pool) - ip4_ply_pool_index + ply_free_count;
+}
 void
 ip4_mtrie_init(ip4_fib_mtrie_t *m)
 {
@@ -15,10 +84,14 @@ PLY_INIT (p, init, prefix_len, ply_base_len);
 }
 void
 mtrie_vector_get(struct NfosVector* vector, ip4_fib_mtrie_8_ply_t **p, uint32_t *index){
-  assert(ip4_ply_pool_index < nfos_vector_get_capacity(vector));
-  nfos_vector_borrow_unsafe(vector, ip4_ply_pool_index, (void**)p);
-  (*index) = ip4_ply_pool_index;
-  ip4_ply_pool_index ++;
+  if (ply_free_count) {
+    (*index) = ply_free_list[--ply_free_count];
+  } else {
+    assert(ip4_ply_pool_index < nfos_vector_get_capacity(vector));
+    (*index) = ip4_ply_pool_index;
+    ip4_ply_pool_index ++;
+  }
+  nfos_vector_borrow_unsafe(vector, *index, (void**)p);
 }
 ip4_fib_mtrie_leaf_t
  ply_create (ip4_fib_mtrie_t * m,
@@ -62,7 +135,8 @@ void
        else if (new_leaf_dst_address_bits >=
                 ply->dst_address_bits_of_leaves[i])
          {
-           ply->leaves[i] = new_leaf;
+           ply->n_non_empty_leafs -= ip4_fib_mtrie_leaf_is_non_empty (ply, i);
+           ip4_fib_mtrie_leaf_store(&ply->leaves[i], new_leaf);
            ply->dst_address_bits_of_leaves[i] = new_leaf_dst_address_bits;
            ply->n_non_empty_leafs += ip4_fib_mtrie_leaf_is_non_empty (ply, i);
          }
@@ -123,7 +197,7 @@ void
  
                    old_ply->dst_address_bits_of_leaves[i] =
                      a->dst_address_length;
-                   old_ply->leaves[i] = new_leaf;
+                   ip4_fib_mtrie_leaf_store(&old_ply->leaves[i], new_leaf);
  
                    old_ply->n_non_empty_leafs +=
                      ip4_fib_mtrie_leaf_is_non_empty (old_ply, i);
@@ -181,7 +255,8 @@ void
            /* Refetch since ply_create may move pool. */
            nfos_vector_borrow_unsafe(ip4_ply_pool,old_ply_index, (void**)(&old_ply));
  
-           old_ply->leaves[dst_byte] = new_leaf;
+           /* The new ply is fully initialized, publish it */
+           ip4_fib_mtrie_leaf_store(&old_ply->leaves[dst_byte], new_leaf);
            old_ply->dst_address_bits_of_leaves[dst_byte] = ply_base_len;
  
            old_ply->n_non_empty_leafs +=
@@ -247,7 +322,7 @@ void
                     * the new one */
                    old_ply->dst_address_bits_of_leaves[slot] =
                      a->dst_address_length;
-                   old_ply->leaves[slot] = new_leaf;
+                   ip4_fib_mtrie_leaf_store(&old_ply->leaves[slot], new_leaf);
                  }
                else
                  {
@@ -294,7 +369,8 @@ void
                          old_ply->dst_address_bits_of_leaves[dst_byte],
                          ply_base_len);
            new_ply = get_next_ply_for_leaf (m, new_leaf, &index);
-           old_ply->leaves[dst_byte] = new_leaf;
+           /* The new ply is fully initialized, publish it */
+           ip4_fib_mtrie_leaf_store(&old_ply->leaves[dst_byte], new_leaf);
            old_ply->dst_address_bits_of_leaves[dst_byte] = ply_base_len;
          }
        else{
@@ -303,11 +379,139 @@ void
        set_leaf (m, a, index, 2);
      }
  }
-void ip4_fib_mtrie_route_add (ip4_fib_mtrie_t *m, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index)
+/*
+Returns 1 if old_ply became empty and was retired, the caller must then replace
+the leaf pointing to it.
+*/
+static uint32_t
+ unset_leaf (ip4_fib_mtrie_t * m,
+             const ip4_fib_mtrie_set_unset_leaf_args_t * a,
+             uint32_t old_ply_index, uint32_t dst_address_byte_index)
+ {
+   ip4_fib_mtrie_leaf_t old_leaf, del_leaf;
+   int32_t n_dst_bits_next_plies;
+   uint32_t i, n_dst_bits_this_ply, old_leaf_is_terminal;
+   uint8_t dst_byte;
+   ip4_fib_mtrie_8_ply_t *old_ply;
+ 
+   nfos_vector_borrow_unsafe(ip4_ply_pool, old_ply_index, (void**)(&old_ply));
+ 
+   assert (a->dst_address_length <= 32);
+   assert (dst_address_byte_index < 32 / 8);
+ 
+   n_dst_bits_next_plies =
+     a->dst_address_length - 8 * (dst_address_byte_index + 1);
+ 
+   dst_byte = (a->dst_address >> (24 - 8 * dst_address_byte_index)) & (0xFF);
+ 
+   n_dst_bits_this_ply =
+     n_dst_bits_next_plies <= 0 ? -n_dst_bits_next_plies : 0;
+   n_dst_bits_this_ply = (8 < n_dst_bits_this_ply) ? 8 : n_dst_bits_this_ply;
+ 
+   del_leaf = ip4_fib_mtrie_leaf_set_adj_index (a->adj_index);
+ 
+   for (i = dst_byte; i < dst_byte + (1 << n_dst_bits_this_ply); i++)
+     {
+       old_leaf = old_ply->leaves[i];
+       old_leaf_is_terminal = ip4_fib_mtrie_leaf_is_terminal (old_leaf);
+ 
+       /* Load-balances are shared between routes, only the slots set by this
+        * route have both its adj and its length */
+       if ((old_leaf == del_leaf &&
+            old_ply->dst_address_bits_of_leaves[i] == a->dst_address_length)
+           || (!old_leaf_is_terminal
+               && unset_leaf (m, a, ip4_fib_mtrie_leaf_get_next_ply_index (old_leaf),
+                              dst_address_byte_index + 1)))
+         {
+           old_ply->n_non_empty_leafs -=
+             ip4_fib_mtrie_leaf_is_non_empty (old_ply, i);
+ 
+           ip4_fib_mtrie_leaf_store(&old_ply->leaves[i],
+             ip4_fib_mtrie_leaf_set_adj_index (a->cover_adj_index));
+           /* Keep the length of the cover so that less specific routes
+            * added later still replace it */
+           old_ply->dst_address_bits_of_leaves[i] = a->cover_address_length;
+ 
+           old_ply->n_non_empty_leafs +=
+             ip4_fib_mtrie_leaf_is_non_empty (old_ply, i);
+ 
+           assert (old_ply->n_non_empty_leafs >= 0);
+           if (old_ply->n_non_empty_leafs == 0)
+             {
+               /* Only holds the cover, the parent takes it over */
+               ply_retire (old_ply_index);
+               return 1;
+             }
+         }
+     }
+ 
+   return 0;
+ }
+void
+ unset_root_leaf (ip4_fib_mtrie_t * m,
+                  const ip4_fib_mtrie_set_unset_leaf_args_t * a)
+ {
+   ip4_fib_mtrie_leaf_t old_leaf, del_leaf;
+   ip4_fib_mtrie_16_ply_t *old_ply;
+   int32_t n_dst_bits_next_plies;
+   uint32_t i, n_dst_bits_this_ply, old_leaf_is_terminal;
+   uint16_t dst_byte;
+ 
+   old_ply = &m->root_ply;
+ 
+   assert (a->dst_address_length <= 32);
+ 
+   n_dst_bits_next_plies = a->dst_address_length - 16;
+ 
+   dst_byte = (a->dst_address >> 16) & (0xFFFF);
+ 
+   n_dst_bits_this_ply = (n_dst_bits_next_plies <= 0 ?
+                          (16 - a->dst_address_length) : 0);
+ 
+   del_leaf = ip4_fib_mtrie_leaf_set_adj_index (a->adj_index);
+ 
+   for (i = 0; i < (1 << n_dst_bits_this_ply); i++)
+     {
+       uint16_t slot;
+ 
+       slot = dst_byte + i;
+ 
+       old_leaf = old_ply->leaves[slot];
+       old_leaf_is_terminal = ip4_fib_mtrie_leaf_is_terminal (old_leaf);
+ 
+       if ((old_leaf == del_leaf &&
+            old_ply->dst_address_bits_of_leaves[slot] == a->dst_address_length)
+           || (!old_leaf_is_terminal
+               && unset_leaf (m, a, ip4_fib_mtrie_leaf_get_next_ply_index (old_leaf), 2)))
+         {
+           ip4_fib_mtrie_leaf_store(&old_ply->leaves[slot],
+             ip4_fib_mtrie_leaf_set_adj_index (a->cover_adj_index));
+           old_ply->dst_address_bits_of_leaves[slot] = a->cover_address_length;
+         }
+     }
+ }
+int ip4_fib_mtrie_route_add (ip4_fib_mtrie_t *m, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index)
 {
   ip4_fib_mtrie_set_unset_leaf_args_t a;
-  a.dst_address = dst_address & ((0xFFFFFFFF) << (32 - dst_address_length));
+  /* Never fail half way */
+  if (dst_address_length > 16 && ip4_ply_pool_available() < MTRIE_MAX_PLIES_PER_ADD)
+    return -1;
+
+  a.dst_address = dst_address & ip4_fib_mtrie_prefix_mask(dst_address_length);
   a.dst_address_length = dst_address_length;
   a.adj_index = adj_index;
   set_root_leaf(m, &a);
-}
\ No newline at end of file
+  return 0;
+}
+void ip4_fib_mtrie_route_del (ip4_fib_mtrie_t *m, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index,
+                              uint32_t cover_address_length, uint32_t cover_adj_index)
+{
+  ip4_fib_mtrie_set_unset_leaf_args_t a;
+  a.dst_address = dst_address & ip4_fib_mtrie_prefix_mask(dst_address_length);
+  a.dst_address_length = dst_address_length;
+  a.adj_index = adj_index;
+  a.cover_address_length = cover_address_length;
+  a.cover_adj_index = cover_adj_index;
+  unset_root_leaf(m, &a);
+  ply_retire_commit();
+}
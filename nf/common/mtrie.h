@@ -38,9 +38,26 @@ typedef struct ip4_fib_mtrie_8_ply_t_
     int32_t dst_address_bits_base;
 
 } ip4_fib_mtrie_8_ply_t;
+/*
+ * 8-bit plies of all FIB tables come from ip4_ply_pool, whose capacity the NF
+ * sets with IP4_PLY_POOL_CAPACITY. Each ply takes ~1.3KB. A route longer than
+ * 16 bits adds up to MTRIE_MAX_PLIES_PER_ADD plies, shorter ones none, so NFs
+ * loading FIB_ROUTES_FILE should size the pool for its routes.
+ */
 extern struct NfosVector* ip4_ply_pool;
 extern uint32_t ip4_ply_pool_index;
 
+/*
+ * Concurrency: routes are added and deleted by a single writer (nf_init or the
+ * control core) while data plane cores do lock-free lookups. Leaves are
+ * updated in place with atomic stores, new plies are initialized before the
+ * leaf pointing to them is published, and plies unlinked by a delete are only
+ * reused after a grace period (see grace-period.h).
+ */
+
+// Max number of plies a route add can allocate (one per 8-bit level)
+#define MTRIE_MAX_PLIES_PER_ADD 2
+
 typedef struct{
     ip4_fib_mtrie_16_ply_t root_ply;
 } ip4_fib_mtrie_t;
@@ -49,8 +66,29 @@ typedef struct{
   uint32_t dst_address;
   uint32_t dst_address_length;
   uint32_t adj_index;
+  /*Longest less specific prefix covering the deleted one (unset only)*/
+  uint32_t cover_address_length;
+  uint32_t cover_adj_index;
 } ip4_fib_mtrie_set_unset_leaf_args_t;
 
+static inline uint32_t
+ip4_fib_mtrie_prefix_mask(uint32_t dst_address_length)
+{
+  return dst_address_length ? (0xFFFFFFFF << (32 - dst_address_length)) : 0;
+}
+
+static inline void
+ip4_fib_mtrie_leaf_store(ip4_fib_mtrie_leaf_t *slot, ip4_fib_mtrie_leaf_t leaf)
+{
+  __atomic_store_n(slot, leaf, __ATOMIC_RELEASE);
+}
+
+static inline ip4_fib_mtrie_leaf_t
+ip4_fib_mtrie_leaf_load(const ip4_fib_mtrie_leaf_t *slot)
+{
+  return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
+
  /**
   * @brief Lookup step number 1.  Processes 2 bytes of 4 byte ip4 address.
   */
@@ -60,7 +98,7 @@ typedef struct{
  {
    ip4_fib_mtrie_leaf_t next_leaf;
 
-   next_leaf = m->root_ply.leaves[(dst_address >> 16) & 0xFFFF];
+   next_leaf = ip4_fib_mtrie_leaf_load(&m->root_ply.leaves[(dst_address >> 16) & 0xFFFF]);
    
    return next_leaf;
  }
@@ -114,13 +152,84 @@ static inline ip4_fib_mtrie_leaf_t
    if (!current_is_terminal)
      {
        nfos_vector_borrow(ip4_ply_pool, (current_leaf >> 1), (void**)(&ply));
-       return (ply->leaves[(dst_address >> (24 - 8 * dst_address_byte_index)) & 0xFF]);
+       return ip4_fib_mtrie_leaf_load(&ply->leaves[(dst_address >> (24 - 8 * dst_address_byte_index)) & 0xFF]);
      }
  
    return current_leaf;
  }
 
 
+/*
+ * Plies are reclaimed after grace periods instead of through RLU, the bulk
+ * lookup reads them without RLU_DEREF and does not need to be in a transaction.
+ */
+static inline void
+ip4_fib_mtrie_prefetch_next_leaf (ip4_fib_mtrie_leaf_t current_leaf,
+                                  const uint32_t dst_address,
+                                  uint32_t dst_address_byte_index)
+{
+  ip4_fib_mtrie_8_ply_t *ply;
+
+  if (!ip4_fib_mtrie_leaf_is_terminal (current_leaf))
+    {
+      nfos_vector_borrow_unsafe(ip4_ply_pool, (current_leaf >> 1), (void**)(&ply));
+      __builtin_prefetch(&ply->leaves[(dst_address >> (24 - 8 * dst_address_byte_index)) & 0xFF]);
+    }
+}
+
+static inline ip4_fib_mtrie_leaf_t
+ip4_fib_mtrie_lookup_step_unsafe (ip4_fib_mtrie_leaf_t current_leaf,
+                                  const uint32_t dst_address,
+                                  uint32_t dst_address_byte_index)
+{
+  ip4_fib_mtrie_8_ply_t *ply;
+
+  if (!ip4_fib_mtrie_leaf_is_terminal (current_leaf))
+    {
+      nfos_vector_borrow_unsafe(ip4_ply_pool, (current_leaf >> 1), (void**)(&ply));
+      return ip4_fib_mtrie_leaf_load(&ply->leaves[(dst_address >> (24 - 8 * dst_address_byte_index)) & 0xFF]);
+    }
+
+  return current_leaf;
+}
+
+/*
+ * @brief Bulk lookup of n addresses. Each step is done for all addresses before
+ * the next one, with prefetches of the leaves needed by the next step in
+ * between, so that the cache misses of different addresses overlap.
+ */
+static inline void
+ip4_fib_mtrie_lookup_xN (const ip4_fib_mtrie_t * m,
+                         const uint32_t *dst_addresses,
+                         ip4_fib_mtrie_leaf_t *leaves, uint16_t n)
+{
+  for (uint16_t i = 0; i < n; i++)
+    __builtin_prefetch(&m->root_ply.leaves[(dst_addresses[i] >> 16) & 0xFFFF]);
+
+  for (uint16_t i = 0; i < n; i++)
+    {
+      leaves[i] = ip4_fib_mtrie_lookup_step_one (m, dst_addresses[i]);
+      ip4_fib_mtrie_prefetch_next_leaf (leaves[i], dst_addresses[i], 2);
+    }
+
+  for (uint16_t i = 0; i < n; i++)
+    {
+      leaves[i] = ip4_fib_mtrie_lookup_step_unsafe (leaves[i], dst_addresses[i], 2);
+      ip4_fib_mtrie_prefetch_next_leaf (leaves[i], dst_addresses[i], 3);
+    }
+
+  for (uint16_t i = 0; i < n; i++)
+    leaves[i] = ip4_fib_mtrie_lookup_step_unsafe (leaves[i], dst_addresses[i], 3);
+}
+
+static inline void
+ip4_fib_mtrie_lookup_x4 (const ip4_fib_mtrie_t * m,
+                         const uint32_t dst_addresses[4],
+                         ip4_fib_mtrie_leaf_t leaves[4])
+{
+  ip4_fib_mtrie_lookup_xN (m, dst_addresses, leaves, 4);
+}
+
 /*
 Init a mtrie;
 */
@@ -164,8 +273,11 @@ ip4_mtrie_init(ip4_fib_mtrie_t *m);
 void
 mtrie_vector_get(struct NfosVector* vector, ip4_fib_mtrie_8_ply_t **p, uint32_t *index);
 
-void
-mtrie_vector_get(struct NfosVector* vector, ip4_fib_mtrie_8_ply_t **p, uint32_t *index);
+/*
+Number of plies that can be allocated right now, reclaims plies whose grace
+period is over.
+*/
+uint32_t ip4_ply_pool_available(void);
 
 ip4_fib_mtrie_leaf_t
  ply_create (ip4_fib_mtrie_t * m,
@@ -205,9 +317,22 @@ void
  set_root_leaf (ip4_fib_mtrie_t * m,
                 const ip4_fib_mtrie_set_unset_leaf_args_t * a);
 
+void
+ unset_root_leaf (ip4_fib_mtrie_t * m,
+                  const ip4_fib_mtrie_set_unset_leaf_args_t * a);
+
 /*
 Add a route to mtrie; Here adj_index is the index in the load-balance pool.
+Returns 0 on success, -1 if the ply pool is exhausted (mtrie left unchanged).
+*/
+int ip4_fib_mtrie_route_add (ip4_fib_mtrie_t *m, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index);
+
+/*
+Delete a route from mtrie; slots of the route fall back to the cover route,
+i.e. the longest less specific route containing it (0/0 -> adj 0 if none).
+Plies left empty are released to the pool after a grace period.
 */
-void ip4_fib_mtrie_route_add (ip4_fib_mtrie_t *m, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index);
+void ip4_fib_mtrie_route_del (ip4_fib_mtrie_t *m, uint32_t dst_address, uint32_t dst_address_length, uint32_t adj_index,
+                              uint32_t cover_address_length, uint32_t cover_adj_index);
 #endif
  
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rlu-wrapper.h"
+#include "port-block.h"
+
+#define PORT_BLOCK_N_WORDS (PORT_BLOCK_SIZE / 64)
+_Static_assert(PORT_BLOCK_SIZE % 64 == 0, "PORT_BLOCK_SIZE must be a multiple of 64");
+
+typedef struct port_block_t_ {
+    /*Number of allocated ports*/
+    uint16_t n_used;
+    uint64_t used[PORT_BLOCK_N_WORDS];
+} port_block_t;
+
+typedef struct port_block_owner_t_ {
+    /*Block ports are allocated from, PORT_BLOCK_NONE if the owner has none*/
+    uint32_t current;
+    uint32_t n_blocks;
+    uint32_t blocks[PORT_BLOCK_MAX_PER_OWNER];
+} port_block_owner_t;
+
+static void
+port_block_null_init(void *obj){
+    memset(obj, 0, sizeof(port_block_t));
+}
+
+static void
+port_block_owner_null_init(void *obj){
+    port_block_owner_t *o = (port_block_owner_t *)obj;
+    o->current = PORT_BLOCK_NONE;
+    o->n_blocks = 0;
+}
+
+// Let the control core check the owner. Only written when not flagged yet,
+// the flags of owners of different cores share cache lines.
+static inline void
+port_block_flag_low(port_block_allocator_t *a, uint16_t owner){
+    if (!__atomic_load_n(&a->owner_low[owner], __ATOMIC_RELAXED))
+        __atomic_store_n(&a->owner_low[owner], 1, __ATOMIC_RELAXED);
+}
+
+port_block_allocator_t *
+port_block_allocator_create(uint32_t first_address, uint32_t n_addresses,
+                            uint16_t port_low, uint16_t port_high, uint16_t n_owners){
+    port_block_allocator_t *a = malloc(sizeof(port_block_allocator_t));
+    if (!a)
+        return NULL;
+    a->first_address = first_address;
+    a->n_addresses = n_addresses;
+    a->port_low = port_low;
+    a->n_blocks_per_address = ((uint32_t)port_high - port_low + 1) / PORT_BLOCK_SIZE;
+    a->n_blocks = n_addresses * a->n_blocks_per_address;
+    a->n_owners = n_owners;
+
+    a->block_owner = malloc(a->n_blocks * sizeof(uint16_t));
+    a->free_blocks = malloc(a->n_blocks * sizeof(uint32_t));
+    a->owner_low = calloc(n_owners, sizeof(uint8_t));
+    a->sweep_next = 0;
+    if (!a->block_owner || !a->free_blocks || !a->owner_low ||
+        !nfos_vector_allocate(sizeof(port_block_t), a->n_blocks, port_block_null_init, &a->blocks) ||
+        !nfos_vector_allocate(sizeof(port_block_owner_t), n_owners, port_block_owner_null_init, &a->owners))
+        return NULL;
+
+    /*Hand out the lowest blocks first*/
+    a->n_free_blocks = a->n_blocks;
+    for (uint32_t i = 0; i < a->n_blocks; i++) {
+        a->block_owner[i] = PORT_BLOCK_FREE;
+        a->free_blocks[i] = a->n_blocks - 1 - i;
+    }
+
+    for (uint16_t owner = 0; owner < n_owners && a->n_free_blocks; owner++) {
+        port_block_owner_t *o;
+        nfos_vector_borrow_unsafe(a->owners, owner, (void **)&o);
+        uint32_t block = a->free_blocks[--a->n_free_blocks];
+        a->block_owner[block] = owner;
+        o->blocks[o->n_blocks++] = block;
+        o->current = block;
+    }
+    return a;
+}
+
+int port_block_alloc(port_block_allocator_t *a, uint16_t owner,
+                     uint32_t *ext_address, uint16_t *ext_port){
+    port_block_owner_t *o;
+    port_block_t *b = NULL;
+    nfos_vector_borrow(a->owners, owner, (void **)&o);
+    uint32_t block = o->current;
+    if (block != PORT_BLOCK_NONE)
+        nfos_vector_borrow(a->blocks, block, (void **)&b);
+
+    if (!b || b->n_used == PORT_BLOCK_SIZE) {
+        /*Move on to another block with free ports*/
+        block = PORT_BLOCK_NONE;
+        for (uint32_t i = 0; i < o->n_blocks; i++) {
+            nfos_vector_borrow(a->blocks, o->blocks[i], (void **)&b);
+            if (b->n_used < PORT_BLOCK_SIZE) {
+                block = o->blocks[i];
+                break;
+            }
+        }
+        if (block == PORT_BLOCK_NONE) {
+            port_block_flag_low(a, owner);
+            return 0;
+        }
+        if (nfos_vector_borrow_mut(a->owners, owner, (void **)&o) == -1)
+            return -1;
+        o->current = block;
+    }
+
+    if (nfos_vector_borrow_mut(a->blocks, block, (void **)&b) == -1)
+        return -1;
+    uint32_t word = 0;
+    while (b->used[word] == UINT64_MAX)
+        word++;
+    uint32_t bit = __builtin_ctzll(~b->used[word]);
+    b->used[word] |= 1ULL << bit;
+    b->n_used++;
+    // The owner has fewer free ports than the block, maybe too few
+    if (PORT_BLOCK_SIZE - b->n_used < PORT_BLOCK_LOW_WATERMARK)
+        port_block_flag_low(a, owner);
+
+    uint32_t port = a->port_low + (block % a->n_blocks_per_address) * PORT_BLOCK_SIZE + word * 64 + bit;
+    *ext_address = rte_cpu_to_be_32(a->first_address + block / a->n_blocks_per_address);
+    *ext_port = rte_cpu_to_be_16(port);
+    return 1;
+}
+
+int port_block_free(port_block_allocator_t *a, uint32_t ext_address, uint16_t ext_port){
+    uint32_t block = port_block_of(a, ext_address, ext_port);
+    if (block == PORT_BLOCK_NONE)
+        return 0;
+    uint32_t offset = (rte_be_to_cpu_16(ext_port) - a->port_low) % PORT_BLOCK_SIZE;
+    uint64_t mask = 1ULL << (offset % 64);
+
+    port_block_t *b;
+    // use borrow first to only write allocated ports
+    nfos_vector_borrow(a->blocks, block, (void **)&b);
+    if (!(b->used[offset / 64] & mask))
+        return 0;
+    if (nfos_vector_borrow_mut(a->blocks, block, (void **)&b) == -1)
+        return -1;
+    b->used[offset / 64] &= ~mask;
+    b->n_used--;
+    return 1;
+}
+
+// Give the owner a block if it runs low, or take an unused one back
+static void
+port_block_control_owner(port_block_allocator_t *a, uint16_t owner){
+    rlu_thread_data_t *rlu_data = get_rlu_thread_data();
+    uint32_t assigned, reclaimed;
+retry:
+    assigned = PORT_BLOCK_NONE;
+    reclaimed = PORT_BLOCK_NONE;
+    RLU_READER_LOCK(rlu_data);
+
+    port_block_owner_t *o;
+    port_block_t *b;
+    nfos_vector_borrow(a->owners, owner, (void **)&o);
+    uint32_t n_free = 0, unused = PORT_BLOCK_NONE;
+    for (uint32_t i = 0; i < o->n_blocks; i++) {
+        nfos_vector_borrow(a->blocks, o->blocks[i], (void **)&b);
+        n_free += PORT_BLOCK_SIZE - b->n_used;
+        if (b->n_used == 0 && o->blocks[i] != o->current)
+            unused = i;
+    }
+
+    if (n_free < PORT_BLOCK_LOW_WATERMARK && o->n_blocks < PORT_BLOCK_MAX_PER_OWNER &&
+        a->n_free_blocks) {
+        assigned = a->free_blocks[a->n_free_blocks - 1];
+        // Owned before the owner can allocate from it
+        __atomic_store_n(&a->block_owner[assigned], owner, __ATOMIC_RELEASE);
+        if (nfos_vector_borrow_mut(a->owners, owner, (void **)&o) == -1)
+            goto abort;
+        o->blocks[o->n_blocks++] = assigned;
+        if (o->current == PORT_BLOCK_NONE)
+            o->current = assigned;
+
+    } else if (n_free > PORT_BLOCK_HIGH_WATERMARK && unused != PORT_BLOCK_NONE) {
+        reclaimed = o->blocks[unused];
+        // Conflicts with allocations from the block
+        if (nfos_vector_borrow_mut(a->blocks, reclaimed, (void **)&b) == -1 ||
+            nfos_vector_borrow_mut(a->owners, owner, (void **)&o) == -1)
+            goto abort;
+        o->blocks[unused] = o->blocks[--o->n_blocks];
+    }
+
+    if (!RLU_READER_UNLOCK(rlu_data))
+        goto abort;
+
+    if (assigned != PORT_BLOCK_NONE)
+        a->n_free_blocks--;
+    if (reclaimed != PORT_BLOCK_NONE) {
+        __atomic_store_n(&a->block_owner[reclaimed], PORT_BLOCK_FREE, __ATOMIC_RELEASE);
+        a->free_blocks[a->n_free_blocks++] = reclaimed;
+    }
+    return;
+
+abort:
+    nfos_abort_txn(rlu_data);
+    if (assigned != PORT_BLOCK_NONE)
+        __atomic_store_n(&a->block_owner[assigned], PORT_BLOCK_FREE, __ATOMIC_RELEASE);
+    goto retry;
+}
+
+void port_block_control(port_block_allocator_t *a){
+    for (uint16_t owner = 0; owner < a->n_owners; owner++) {
+        if (__atomic_load_n(&a->owner_low[owner], __ATOMIC_RELAXED)) {
+            // Cleared first, flags set during the check are seen next time
+            __atomic_store_n(&a->owner_low[owner], 0, __ATOMIC_RELAXED);
+            port_block_control_owner(a, owner);
+        }
+    }
+
+    for (uint16_t i = 0; i < PORT_BLOCK_SWEEP_OWNERS && i < a->n_owners; i++) {
+        port_block_control_owner(a, a->sweep_next);
+        a->sweep_next = (a->sweep_next + 1) % a->n_owners;
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+#ifndef __PORT_BLOCK_H__
+#define __PORT_BLOCK_H__
+#include <stdbool.h>
+#include <stdint.h>
+#include <rte_byteorder.h>
+#include "vector.h"
+/*
+Allocator of external IP:port tuples (e.g. of a NAT) in blocks of
+PORT_BLOCK_SIZE consecutive ports of one address.
+
+Each owner, i.e. packet set partition, allocates ports from its own blocks, so
+data plane cores never write the same allocator state. The control core
+(port_block_control) hands free blocks to owners running low on free ports,
+and takes back unused blocks from owners having too many.
+
+The control core only checks the owners that data plane cores flagged as
+running low, plus PORT_BLOCK_SWEEP_OWNERS others in turn to find unused
+blocks, so that its work does not grow with the number of owners.
+
+The tuple -> block mapping is static, and the owner of each block is kept
+outside of RLU (port_block_get_owner), so that packets to an external tuple
+can be steered to the owning core by RSS or flow rules.
+
+Memory is linear in the number of blocks, not of tuples.
+*/
+#ifndef PORT_BLOCK_SIZE
+#define PORT_BLOCK_SIZE 256
+#endif
+/*Max number of blocks of an owner*/
+#ifndef PORT_BLOCK_MAX_PER_OWNER
+#define PORT_BLOCK_MAX_PER_OWNER 64
+#endif
+/*The control core gives an owner one more block below this many free ports...*/
+#define PORT_BLOCK_LOW_WATERMARK (PORT_BLOCK_SIZE / 2)
+/*...and takes an unused block back above this many*/
+#define PORT_BLOCK_HIGH_WATERMARK (3 * PORT_BLOCK_SIZE)
+/*Owners checked for unused blocks by each port_block_control run*/
+#ifndef PORT_BLOCK_SWEEP_OWNERS
+#define PORT_BLOCK_SWEEP_OWNERS 8
+#endif
+#define PORT_BLOCK_FREE 0xFFFF
+#define PORT_BLOCK_NONE 0xFFFFFFFF
+
+typedef struct port_block_allocator_t_ {
+    /*Host byte order*/
+    uint32_t first_address;
+    uint32_t n_addresses;
+    uint16_t port_low;
+    uint16_t n_blocks_per_address;
+    uint32_t n_blocks;
+    uint16_t n_owners;
+    /*Block -> owner, PORT_BLOCK_FREE if not owned*/
+    uint16_t *block_owner;
+    /*Blocks not owned, only used by the control core*/
+    uint32_t *free_blocks;
+    uint32_t n_free_blocks;
+    /*Owner -> 1 if it may be running low, set by data plane cores outside of RLU*/
+    uint8_t *owner_low;
+    /*Next owner checked for unused blocks*/
+    uint16_t sweep_next;
+    /*port_block_t per block*/
+    struct NfosVector *blocks;
+    /*port_block_owner_t per owner*/
+    struct NfosVector *owners;
+} port_block_allocator_t;
+
+/*
+Create an allocator of ports [port_low, port_high] of n_addresses external
+addresses from first_address (host byte order), for n_owners owners.
+Ports of a partial last block of each address are not used.
+Each owner starts with one block. Call from nf_init.
+Returns NULL on failure.
+*/
+port_block_allocator_t *
+port_block_allocator_create(uint32_t first_address, uint32_t n_addresses,
+                            uint16_t port_low, uint16_t port_high, uint16_t n_owners);
+
+/*
+Allocate a tuple of owner, in a data plane transaction.
+ext_address and ext_port are in network byte order.
+Returns 1 on success, 0 if the owner has no free port, -1 on abort.
+*/
+int port_block_alloc(port_block_allocator_t *a, uint16_t owner,
+                     uint32_t *ext_address, uint16_t *ext_port);
+
+/*
+Free a tuple, in a transaction of the core owning its block.
+Returns 1 on success, 0 if the tuple is not allocated, -1 on abort.
+*/
+int port_block_free(port_block_allocator_t *a, uint32_t ext_address, uint16_t ext_port);
+
+/*
+Rebalance blocks among owners, called periodically on the control core.
+Runs its own transactions, one per owner checked.
+*/
+void port_block_control(port_block_allocator_t *a);
+
+/*Block of a tuple in network byte order, PORT_BLOCK_NONE if out of range*/
+static inline uint32_t
+port_block_of(const port_block_allocator_t *a, uint32_t ext_address, uint16_t ext_port){
+    uint32_t address = rte_be_to_cpu_32(ext_address) - a->first_address;
+    uint32_t block = (uint32_t)(rte_be_to_cpu_16(ext_port) - a->port_low) / PORT_BLOCK_SIZE;
+    if (address >= a->n_addresses || rte_be_to_cpu_16(ext_port) < a->port_low ||
+        block >= a->n_blocks_per_address)
+        return PORT_BLOCK_NONE;
+    return address * a->n_blocks_per_address + block;
+}
+
+/*Owner of the block of a tuple, PORT_BLOCK_FREE if none. Safe outside of transactions*/
+static inline uint16_t
+port_block_get_owner(const port_block_allocator_t *a, uint32_t ext_address, uint16_t ext_port){
+    uint32_t block = port_block_of(a, ext_address, ext_port);
+    if (block == PORT_BLOCK_NONE)
+        return PORT_BLOCK_FREE;
+    return __atomic_load_n(&a->block_owner[block], __ATOMIC_ACQUIRE);
+}
+#endif
@@ -76,6 +76,13 @@ local packetConfigs = {
     end,
     [1] = function(pkt, counter)
       pkt.ip4.dst:set(counter)
+    end,
+    -- Many sessions per user: 256 sessions per user, 2 flows per session
+    [5] = function(pkt, counter)
+      pkt.ip4.src:set(math.floor(counter / 512))
+      pkt.ip4.dst:set(10010012)
+      pkt.udp:setSrcPort(math.floor(counter / 2))
+      pkt.udp:setDstPort(counter % 2)
     end
   },
   -- WAN->LAN flows
@@ -95,6 +102,9 @@ local packetConfigs = {
       pkt.ip4.src:set(counter)
       -- Try to minimize spoofing in NAT
       pkt.udp.dst = counter
+    end,
+    [5] = function(pkt, counter)
+      pkt.ip4.dst:set(counter)
     end
   }
 }
@@ -27,12 +27,15 @@
 #include <assert.h>
 
 #include "nf.h"
+#include "checksum.h"
 #include "nat_config.h"
 #include "static_mapping.h"
 
 #include "load-balance.h"
 #include "fib_table.h"
+#include "fib_control.h"
 #include "mtrie.h"
+#include "port-block.h"
 
 #include "double-chain.h"
 #include "map.h"
@@ -60,8 +63,6 @@ typedef struct nf_config {
 
   uint16_t external_port_low;
   uint16_t external_port_high;
-
-  int num_avail_ext_tuples;
 } nf_config_t;
 
 typedef struct session_t {
@@ -82,6 +83,9 @@ typedef struct session_data {
   vigor_time_t last_used;
   uint32_t int_ip;
   uint16_t int_port;
+  // External tuple, in network byte order
+  uint32_t ext_ip;
+  uint16_t ext_port;
   int user_index;
 } session_data_t;
 
@@ -121,26 +125,64 @@ unsigned int user_hash(void *a){
   return hash;
 }
 
-struct nf_state {
-  // Configuration
-  nf_config_t *cfg;
+/*
+ * Users, sessions and external tuples, either global or sharded by packet set
+ * partition (EI_NAT_SHARDED).
+ *
+ * With EI_NAT_SHARDED, RSS hashes LAN packets on their source IP only (see
+ * pkt-set.sharded.cfg.json), so all the sessions of a user are in the same
+ * partition, and each partition has its own maps and session chains. Cores
+ * then never write the same NAT state, while in the global variant two cores
+ * adding sessions conflict on the index allocator, the maps and the session
+ * chains of users.
+ *
+ * External tuples come from port blocks owned by packet set partitions in
+ * both variants (see port-block.h).
+ *
+ * Note: WAN packets would need to be steered to the partition owning their
+ * external tuple (port_block_get_owner()), not supported yet as the WAN side
+ * is WIP.
+ */
+typedef struct nat_shard {
   struct NfosMap *session_map;
   struct NfosVector *session_data;
-  struct NfosDoubleChain *sess_indexes_tcp;
-  struct NfosDoubleChain *sess_indexes_udp;
+  struct NfosDoubleChain *sess_indexes;
   struct NfosMap *user_map;
   struct NfosVector *user_data;
   struct NfosDoubleChain *user_indexes;
+} nat_shard_t;
+
+struct nf_state {
+  // Configuration
+  nf_config_t *cfg;
+  // One per packet set partition with EI_NAT_SHARDED, a single one otherwise
+  nat_shard_t *shards;
+  uint16_t num_shards;
+  // External tuples of TCP and UDP sessions
+  port_block_allocator_t *ext_ports_tcp;
+  port_block_allocator_t *ext_ports_udp;
 };
 
-int alloc_user (uint32_t *user_key, int *user_index, nf_state_t *non_pkt_set_state) {
+static inline port_block_allocator_t *get_ext_ports(nf_state_t *non_pkt_set_state, uint8_t proto) {
+  return proto == 6 ? non_pkt_set_state->ext_ports_tcp : non_pkt_set_state->ext_ports_udp;
+}
+
+static inline uint16_t get_shard_index() {
+#ifdef EI_NAT_SHARDED
+  return nfos_get_pkt_set_partition();
+#else
+  return 0;
+#endif
+}
+
+int alloc_user (uint32_t *user_key, int *user_index, nat_shard_t *shard) {
   int index;
-  int ret = nfos_dchain_allocate_new_index(non_pkt_set_state->user_indexes, &index);
+  int ret = nfos_dchain_allocate_new_index(shard->user_indexes, &index);
   if (ret == 1) {
     user_data_t *user_data;
-    int ret2 = nfos_vector_borrow_mut(non_pkt_set_state->user_data, index, (void **)&user_data);
+    int ret2 = nfos_vector_borrow_mut(shard->user_data, index, (void **)&user_data);
     if (ret2 == 1){
-      int ret3 = nfos_map_put(non_pkt_set_state->user_map, (void*)user_key, index);
+      int ret3 = nfos_map_put(shard->user_map, (void*)user_key, index);
       if (ret3 == 1){
         user_data->num_sessions = 0;
         user_data->sess_list_head.next = SESS_LIST_HEAD;
@@ -155,7 +197,7 @@ int alloc_user (uint32_t *user_key, int *user_index, nf_state_t *non_pkt_set_sta
         NF_DEBUG("alloc_user: map put fail");
         // nfos_map_put shouldn't fail as long as dchain_allocate succeeds, but
         // still do the dchain_free here for complete implementation
-        int ret4 = nfos_dchain_free_index(non_pkt_set_state->user_indexes, index);
+        int ret4 = nfos_dchain_free_index(shard->user_indexes, index);
         if (ret4 == -1) return -1; else return 0;
       }
     } else {
@@ -170,16 +212,16 @@ int alloc_user (uint32_t *user_key, int *user_index, nf_state_t *non_pkt_set_sta
 
 // For debugging purpose
 #ifdef ENABLE_LOG  
-void log_user_sess_chain (int user_index,  nf_state_t *non_pkt_set_state) {
+void log_user_sess_chain (int user_index,  nat_shard_t *shard) {
   user_data_t *user_data;
-  nfos_vector_borrow(non_pkt_set_state->user_data, user_index, (void **)&user_data);
+  nfos_vector_borrow(shard->user_data, user_index, (void **)&user_data);
   sess_list_node_t *head = &(user_data->sess_list_head);
   NF_DEBUG("User index: %d num_sessions: %d session chain head: [%d %d]",
            user_index, user_data->num_sessions, head->prev, head->next);
   session_data_t *curr_data;
   sess_list_node_t *curr = head;
   while (curr->next != SESS_LIST_HEAD) {
-    nfos_vector_borrow(non_pkt_set_state->session_data, curr->next, (void **)&curr_data);
+    nfos_vector_borrow(shard->session_data, curr->next, (void **)&curr_data);
     curr = &(curr_data->node);
     NF_DEBUG("session last_used: %ld node [%d %d]",
              curr_data->last_used, curr->prev, curr->next);
@@ -188,15 +230,10 @@ void log_user_sess_chain (int user_index,  nf_state_t *non_pkt_set_state) {
 #endif
 
 // Return value: -1 => abort handler, 1 => alloc_ip_port succ, 0 => alloc_ip_port fail
-int alloc_session (int *sess_index, session *sess_key, nf_state_t *non_pkt_set_state, vigor_time_t now){
+int alloc_session (int *sess_index, session *sess_key, nf_state_t *non_pkt_set_state,
+                   nat_shard_t *shard, vigor_time_t now){
   int index;
-  int ret;
-  if (sess_key->proto == 6) {
-    ret = nfos_dchain_allocate_new_index(non_pkt_set_state->sess_indexes_tcp, &index);
-  } else {
-    ret = nfos_dchain_allocate_new_index(non_pkt_set_state->sess_indexes_udp, &index);
-    index += non_pkt_set_state->cfg->num_avail_ext_tuples;
-  }
+  int ret = nfos_dchain_allocate_new_index(shard->sess_indexes, &index);
 
   // Free an expired index and retry index allocation
   if (ret == 0) {
@@ -205,15 +242,30 @@ int alloc_session (int *sess_index, session *sess_key, nf_state_t *non_pkt_set_s
   }
 
   if (ret == 1){
+    // External tuple from the port blocks of the partition of the packet
+    uint32_t ext_ip;
+    uint16_t ext_port;
+    int ret1 = port_block_alloc(get_ext_ports(non_pkt_set_state, sess_key->proto),
+                                nfos_get_pkt_set_partition(), &ext_ip, &ext_port);
+    if (ret1 == -1) {
+      return -1;
+    } else if (ret1 == 0) {
+      NF_DEBUG("alloc: No avail ip/port");
+      // Blocks are added by the control core, drop until then
+      if (nfos_dchain_free_index(shard->sess_indexes, index) == -1) return -1; else return 0;
+    }
+
     session_data_t *sess_data;
-    int ret2 = nfos_vector_borrow_mut(non_pkt_set_state->session_data, index, (void **)&sess_data);
+    int ret2 = nfos_vector_borrow_mut(shard->session_data, index, (void **)&sess_data);
     if (ret2 == 1){
       NF_DEBUG("alloc: session src ip %x src port %x proto %d", sess_key->src_addr, sess_key->src_port, sess_key->proto);
-      int ret3 = nfos_map_put(non_pkt_set_state->session_map, (void*)sess_key, index);
+      int ret3 = nfos_map_put(shard->session_map, (void*)sess_key, index);
       if (ret3 == 1){
         sess_data->last_used = now;
         sess_data->int_ip = sess_key->src_addr;
         sess_data->int_port = sess_key->src_port;
+        sess_data->ext_ip = ext_ip;
+        sess_data->ext_port = ext_port;
         // sess node will be initialized when inserting the session to the list
         *sess_index = index;
         NF_DEBUG("alloc: succ sess_index %d", *sess_index);
@@ -225,73 +277,34 @@ int alloc_session (int *sess_index, session *sess_key, nf_state_t *non_pkt_set_s
     	  NF_DEBUG("alloc: map put fail");
         // nfos_map_put shouldn't fail as long as dchain_allocate succeeds, but
         // still do the dchain_free here for complete implementation
-        int ret4;
-        if (sess_key->proto == 6) {
-          ret4 = nfos_dchain_free_index(non_pkt_set_state->sess_indexes_tcp, index);
-        } else {
-          index -= non_pkt_set_state->cfg->num_avail_ext_tuples;
-          ret4 = nfos_dchain_free_index(non_pkt_set_state->sess_indexes_udp, index);
-        }
+        if (port_block_free(get_ext_ports(non_pkt_set_state, sess_key->proto), ext_ip, ext_port) == -1)
+          return -1;
+        int ret4 = nfos_dchain_free_index(shard->sess_indexes, index);
         if (ret4 == -1) return -1; else return 0;
       }
     } else {
       // no need to free index since the tx gets aborted here.
       return ret2;
     }
-  } else if (ret == 0) {
-    NF_DEBUG("alloc: No avail ip/port");
   }
   return ret;
 }
 
-static inline void sess_id_to_ext_tuple(int sess_id, uint8_t proto,
-                                        nf_state_t *non_pkt_set_state,
-                                        uint32_t *ext_ip, uint16_t *ext_port) {
-  if (proto != 6)
-    sess_id -= non_pkt_set_state->cfg->num_avail_ext_tuples;
-  int port_space_size = non_pkt_set_state->cfg->external_port_high -
-                        non_pkt_set_state->cfg->external_port_low + 1;
-  *ext_port = (sess_id % port_space_size) + non_pkt_set_state->cfg->external_port_low;
-  *ext_ip = (sess_id / port_space_size) + non_pkt_set_state->cfg->external_addr;
-  // Assumption: little-endian machine
-  *ext_port = RTE_STATIC_BSWAP16(*ext_port);
-  *ext_ip = RTE_STATIC_BSWAP32(*ext_ip);
-}
-
-static inline int ext_tuple_to_sess_id(uint32_t ext_ip, uint16_t ext_port,
-                                       uint8_t proto, nf_state_t *non_pkt_set_state) {
-  int sess_id;
-  int port_space_size = non_pkt_set_state->cfg->external_port_high -
-                        non_pkt_set_state->cfg->external_port_low + 1;
-
-  // Assumption: little-endian machine
-  ext_port = RTE_STATIC_BSWAP16(ext_port);
-  ext_ip = RTE_STATIC_BSWAP32(ext_ip);
-
-  sess_id = (ext_port - non_pkt_set_state->cfg->external_port_low)
-          + (port_space_size * (ext_ip - non_pkt_set_state->cfg->external_addr));
-  if (proto != 6)
-    sess_id += non_pkt_set_state->cfg->num_avail_ext_tuples;
-
-  return sess_id;
-}
-
 // Return value: -1 => abort handler, 1 => dealloc_ip_port succ, 0 => dealloc_ip_port fail
-int dealloc_session(session *sess_key, int sess_index, nf_state_t *non_pkt_set_state){
+int dealloc_session(session *sess_key, int sess_index, nf_state_t *non_pkt_set_state,
+                    nat_shard_t *shard){
   session_data_t *sess_data;
   // use borrow first to prevent deadlock situation
-  nfos_vector_borrow(non_pkt_set_state->session_data, sess_index, (void **)&sess_data);
+  nfos_vector_borrow(shard->session_data, sess_index, (void **)&sess_data);
 	NF_DEBUG("dealloc: session src ip %x src port %x proto %d", sess_key->src_addr, sess_key->src_port, sess_key->proto);
 
-  int ret3;
-  if (sess_key->proto == 6) {
-    ret3 = nfos_dchain_free_index(non_pkt_set_state->sess_indexes_tcp, sess_index);
-  } else {
-    sess_index -= non_pkt_set_state->cfg->num_avail_ext_tuples;
-    ret3 = nfos_dchain_free_index(non_pkt_set_state->sess_indexes_udp, sess_index);
-  }
+  if (port_block_free(get_ext_ports(non_pkt_set_state, sess_key->proto),
+                      sess_data->ext_ip, sess_data->ext_port) == -1)
+    return -1;
+
+  int ret3 = nfos_dchain_free_index(shard->sess_indexes, sess_index);
   if (ret3 == 1){
-    int ret2 = nfos_map_erase(non_pkt_set_state->session_map, (void *)sess_key);
+    int ret2 = nfos_map_erase(shard->session_map, (void *)sess_key);
     if (ret2 == -1){
       return -1;
     } else if (ret2 == 0) {
@@ -309,7 +322,6 @@ int dealloc_session(session *sess_key, int sess_index, nf_state_t *non_pkt_set_s
 void lb_null_init(void *obj){
   load_balance_t *lb = (load_balance_t *) obj;
   lb->n_buckets = 0;
-  lb->lb_buckets = NULL;
 }
 void ip4_null_init(void *obj){
   ip4_fib_mtrie_8_ply_t *leaf = (ip4_fib_mtrie_8_ply_t*) obj;
@@ -339,6 +351,12 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
 
 /* Init function */
 
+// Hand port blocks to the partitions running low on free external tuples
+void ext_ports_control(nf_state_t *non_pkt_set_state) {
+  port_block_control(non_pkt_set_state->ext_ports_tcp);
+  port_block_control(non_pkt_set_state->ext_ports_udp);
+}
+
 nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool *has_related_pkt_sets_out,
                     bool *do_expiration_out, bool *has_pkt_sets_out) {
   // Number of cores
@@ -378,25 +396,39 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
     (ret->cfg->endpoint_macs[i]).addr_bytes[0] += i;
   }
 
-  // Set up list of available external tuples
-  int num_avail_ext_tuples = (EXTERNAL_PORT_HIGH - EXTERNAL_PORT_LOW + 1) * NUM_EXTERNAL_ADDRS;
-  int max_num_sessions = MAX_NUM_SESSIONS;
-  ret->cfg->num_avail_ext_tuples = num_avail_ext_tuples;
-  // The majority of sessions will be TCP sessions, thus use max_num_sessions
-  // here instead of (2 * max_avail_ext_tuples) to save map space. 
-  // double the number of entries in map to avoid collision
-  if (!nfos_map_allocate(session_equal, session_hash, sizeof(session), 2 * max_num_sessions, &(ret->session_map))) ret = NULL;
-  // Session index space: 2 * #Public IPs * port range size
-  if (!nfos_vector_allocate(sizeof(session_data_t), 2 * num_avail_ext_tuples,sess_data_null_init, &(ret->session_data))) ret = NULL;
-  if (!nfos_dchain_allocate(num_avail_ext_tuples, &(ret->sess_indexes_tcp))) ret = NULL;
-  if (!nfos_dchain_allocate(num_avail_ext_tuples, &(ret->sess_indexes_udp))) ret = NULL;
-
-  // Set up user table
-  int max_num_users = MAX_NUM_USERS;
-  if (!nfos_map_allocate(user_equal, user_hash, sizeof(session), 2 * max_num_users, &(ret->user_map))) ret = NULL;
-  if (!nfos_vector_allocate(sizeof(user_data_t), max_num_users, user_data_null_init, &(ret->user_data))) ret = NULL;
-  // NOTE: try index alloactor first, if perf sucks, try to update map entries directly and template support in map.
-  if (!nfos_dchain_allocate(max_num_users, &(ret->user_indexes))) ret = NULL;
+#ifdef EI_NAT_SHARDED
+  uint16_t num_shards = nfos_num_pkt_set_partitions();
+#else
+  uint16_t num_shards = 1;
+#endif
+  ret->num_shards = num_shards;
+  ret->shards = malloc(num_shards * sizeof(nat_shard_t));
+  if (!ret->shards) return NULL;
+
+  // Set up the external tuples, port blocks are owned by packet set partitions
+  ret->ext_ports_tcp = port_block_allocator_create(EXTERNAL_ADDR, NUM_EXTERNAL_ADDRS, EXTERNAL_PORT_LOW,
+                                                   EXTERNAL_PORT_HIGH, nfos_num_pkt_set_partitions());
+  ret->ext_ports_udp = port_block_allocator_create(EXTERNAL_ADDR, NUM_EXTERNAL_ADDRS, EXTERNAL_PORT_LOW,
+                                                   EXTERNAL_PORT_HIGH, nfos_num_pkt_set_partitions());
+  if (!ret->ext_ports_tcp || !ret->ext_ports_udp) return NULL;
+  if (!register_periodic_handler("ext ports control", PORT_BLOCK_CONTROL_PERIOD, ext_ports_control)) return NULL;
+
+  int max_num_sessions = MAX_NUM_SESSIONS / num_shards;
+  int max_num_users = MAX_NUM_USERS / num_shards;
+  for (uint16_t i = 0; i < num_shards; i++) {
+    nat_shard_t *shard = &ret->shards[i];
+    // double the number of entries in map to avoid collision
+    if (!nfos_map_allocate(session_equal, session_hash, sizeof(session), 2 * max_num_sessions, &(shard->session_map))) ret = NULL;
+    if (!nfos_vector_allocate(sizeof(session_data_t), max_num_sessions, sess_data_null_init, &(shard->session_data))) ret = NULL;
+    if (!nfos_dchain_allocate(max_num_sessions, &(shard->sess_indexes))) ret = NULL;
+
+    // Set up user table
+    if (!nfos_map_allocate(user_equal, user_hash, sizeof(session), 2 * max_num_users, &(shard->user_map))) ret = NULL;
+    if (!nfos_vector_allocate(sizeof(user_data_t), max_num_users, user_data_null_init, &(shard->user_data))) ret = NULL;
+    // NOTE: try index alloactor first, if perf sucks, try to update map entries directly and template support in map.
+    if (!nfos_dchain_allocate(max_num_users, &(shard->user_indexes))) ret = NULL;
+    if (!ret) return NULL;
+  }
 
   // FIB-related stuff
   ret->cfg->lb_pool_capacity = LB_CAPACITY;
@@ -438,19 +470,31 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
     ret = NULL;
   }
 
-  ip4_fib_t *fib = ip4_fib_get(LAN_DEVICE);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index1);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
+  if (ip4_fib_route_add(LAN_DEVICE, 0, 0, index1)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE, 0, 32, index0)) ret = NULL;
 
-  fib = ip4_fib_get(WAN_DEVICE);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index1);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
+  if (ip4_fib_route_add(WAN_DEVICE, 0, 0, index1)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE, 0, 32, index0)) ret = NULL;
+
+#ifdef FIB_ROUTES_FILE
+  // Extra routes, adj indexes refer to the load-balances created above
+  for (uint32_t i = 0; i < N_FIB_TABLE; i++) {
+    if (ip4_fib_table_load(i, FIB_ROUTES_FILE) < 0) ret = NULL;
+  }
+#endif
+
+  // Route updates through the control channel, see control.h
+  if (!fib_control_register(N_FIB_TABLE)) ret = NULL;
 
   // Initialize static_mappings
   ret->cfg->n_static_mappings = N_STATIC_MAPPINGS;
   if (!nat_static_mapping_init(ret->cfg->n_static_mappings)){
     ret = NULL;
   }
+#ifdef STATIC_MAPPINGS_FILE
+  // LAN endpoints mapped to WAN ones
+  if (nat_static_mapping_load(STATIC_MAPPINGS_FILE, LAN_DEVICE, WAN_DEVICE) < 0) ret = NULL;
+#endif
   return ret;
 }
 
@@ -499,10 +543,9 @@ static inline void nat_pkt_action(nf_state_t *non_pkt_set_state, pkt_t *pkt,
     // Shouldn't be called with our current experiment setup
     assert(false); 
   } else {
-    pkt->tcpudp_header->src_port = port;
-    pkt->ipv4_header->src_addr = ip;
+    nfos_cksum_set_l4_port(pkt, &pkt->tcpudp_header->src_port, port);
+    nfos_cksum_set_ipv4_addr(pkt, &pkt->ipv4_header->src_addr, ip);
   }
-  nf_set_ipv4_udptcp_checksum(pkt->ipv4_header, pkt->tcpudp_header, pkt->raw);
   
   // Send packet
   uint32_t le_dst_addr = RTE_STATIC_BSWAP32(pkt->ipv4_header->dst_addr);
@@ -515,7 +558,7 @@ static inline void nat_pkt_action(nf_state_t *non_pkt_set_state, pkt_t *pkt,
   const load_balance_t *lb0;
   lb0 = load_balance_get(leaf0 >> 1);
   const dpo_t *dpo0;
-  dpo0 = load_balance_get_bucket_i(lb0, 0);
+  dpo0 = load_balance_get_bucket_by_hash(lb0, pkt->hash);
   NF_DEBUG("Action: %u\n",dpo0->action);
   if (dpo0->action == DROP) {
     drop_pkt(pkt);
@@ -542,6 +585,7 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
 
   int sess_index;
   int user_index;
+  nat_shard_t *shard = &non_pkt_set_state->shards[get_shard_index()];
   uint32_t ext_ip;
   uint16_t ext_port;
   vigor_time_t now = get_curr_time();
@@ -560,7 +604,7 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
     };
 
     int index = 0;
-    if (!nfos_map_get(non_pkt_set_state->session_map, (void *)&key, &sess_index)){
+    if (!nfos_map_get(shard->session_map, (void *)&key, &sess_index)){
 
       // Check whether a static mapping exist, if not alloc new session
       uint32_t mapping_fib_entry;
@@ -568,7 +612,7 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
       if (!nat_static_mapping_match(key.src_addr, key.src_port, LAN_DEVICE, key.proto,
                                  &ext_ip, &ext_port, &mapping_fib_entry)) {
 
-        int alloc_session_succ = alloc_session(&sess_index, &key, non_pkt_set_state, now);
+        int alloc_session_succ = alloc_session(&sess_index, &key, non_pkt_set_state, shard, now);
         // TODO: pass ABORT_HANDLER here
         if (alloc_session_succ == -1) {
           return -1;
@@ -579,8 +623,8 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
 
         // Allocate if new user
         uint32_t user_key = pkt->ipv4_header->src_addr;
-        if (!nfos_map_get(non_pkt_set_state->user_map, (void *)&user_key, &user_index)) {
-          int alloc_user_succ = alloc_user(&user_key, &user_index, non_pkt_set_state); 
+        if (!nfos_map_get(shard->user_map, (void *)&user_key, &user_index)) {
+          int alloc_user_succ = alloc_user(&user_key, &user_index, shard); 
           // TODO: pass ABORT_HANDLER here
           if (alloc_user_succ == -1) {
             return -1;
@@ -596,7 +640,7 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
         user_data_t *user_data;
         int head_read_ret, head_next_read_ret, sess_read_ret;
 
-        head_read_ret = nfos_vector_borrow_mut(non_pkt_set_state->user_data, user_index, (void **)&user_data);
+        head_read_ret = nfos_vector_borrow_mut(shard->user_data, user_index, (void **)&user_data);
         if (head_read_ret == -1) {
           return -1;
         } else {
@@ -604,7 +648,7 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
         }
 
         if (head->next != SESS_LIST_HEAD) {
-          head_next_read_ret = nfos_vector_borrow_mut(non_pkt_set_state->session_data, head->next, (void **)&head_next_data);
+          head_next_read_ret = nfos_vector_borrow_mut(shard->session_data, head->next, (void **)&head_next_data);
           if (head_next_read_ret != -1)
             head_next = &(head_next_data->node);
           else
@@ -614,7 +658,7 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
           head_next = head;
         }
 
-        sess_read_ret = nfos_vector_borrow_mut(non_pkt_set_state->session_data, sess_index, (void **)&sess_data);
+        sess_read_ret = nfos_vector_borrow_mut(shard->session_data, sess_index, (void **)&sess_data);
         if (sess_read_ret != -1) {
           sess = &(sess_data->node);
         } else {
@@ -640,17 +684,18 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
       }
 
     }
-    sess_id_to_ext_tuple(sess_index, key.proto, non_pkt_set_state, &ext_ip, &ext_port);
   }
 
 
   // Refresh the session of this pkt set if last refreshed 1 sec ago
   session_data_t *sess_data;
-  nfos_vector_borrow(non_pkt_set_state->session_data, sess_index, (void **)&sess_data);
+  nfos_vector_borrow(shard->session_data, sess_index, (void **)&sess_data);
+  ext_ip = sess_data->ext_ip;
+  ext_port = sess_data->ext_port;
   if (now > sess_data->last_used + EI_NAT_SECOND) {
     user_index = sess_data->user_index;
     // refresh timestamp
-    if (nfos_vector_borrow_mut(non_pkt_set_state->session_data, sess_index, (void **)&sess_data) == -1)
+    if (nfos_vector_borrow_mut(shard->session_data, sess_index, (void **)&sess_data) == -1)
       return -1;
     else
       sess_data->last_used = now;
@@ -666,12 +711,12 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
       session_data_t *sess_prev, *sess_next;
       int sess_prev_ret, sess_next_ret;
 
-      sess_prev_ret = nfos_vector_borrow_mut(non_pkt_set_state->session_data,
+      sess_prev_ret = nfos_vector_borrow_mut(shard->session_data,
                         sess->prev, (void **)&sess_prev);
       if (sess->next == SESS_LIST_HEAD) {
-        sess_next_ret = nfos_vector_borrow_mut(non_pkt_set_state->user_data, user_index, (void **)&user_data);
+        sess_next_ret = nfos_vector_borrow_mut(shard->user_data, user_index, (void **)&user_data);
       } else {
-        sess_next_ret = nfos_vector_borrow_mut(non_pkt_set_state->session_data, sess->next, (void **)&sess_next);
+        sess_next_ret = nfos_vector_borrow_mut(shard->session_data, sess->next, (void **)&sess_next);
       }
       if ( (sess_prev_ret == -1) || (sess_next_ret == -1) )
         return -1;
@@ -690,11 +735,11 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
       session_data_t *head_next_data;
       int head_ret, head_next_ret;
 
-      if (nfos_vector_borrow_mut(non_pkt_set_state->user_data, user_index, (void **)&user_data) != -1)
+      if (nfos_vector_borrow_mut(shard->user_data, user_index, (void **)&user_data) != -1)
         head = &(user_data->sess_list_head);
       else
         return -1;
-      if (nfos_vector_borrow_mut(non_pkt_set_state->session_data, head->next, (void **)&head_next_data) != -1)
+      if (nfos_vector_borrow_mut(shard->session_data, head->next, (void **)&head_next_data) != -1)
         head_next = &(head_next_data->node);
       else
         return -1;
@@ -707,7 +752,7 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
   }
 
 #ifdef ENABLE_LOG
-  log_user_sess_chain(user_index, non_pkt_set_state);
+  log_user_sess_chain(user_index, shard);
 #endif
 
   nat_pkt_action(non_pkt_set_state, pkt, ext_ip, ext_port, incoming_dev);
@@ -1,8 +1,10 @@
 #define LAN_DEVICE 0
 #define WAN_DEVICE 1
 #define EXTERNAL_ADDR 0xdeadbeef
-// Todo: parameterize this
+// External addresses are handed to cores in blocks of PORT_BLOCK_SIZE ports
+#ifndef NUM_EXTERNAL_ADDRS
 #define NUM_EXTERNAL_ADDRS 57 // this is where we cut corners
+#endif
 #define MAX_NUM_SESSIONS 8388608 // can be reduced, but doesn't matter here since it will be round to next pow of two
 #define MAX_NUM_USERS 8388608 // over-provisioned to avoid tx aborts on user id allocation
 #define MAX_NUM_SESSIONS_PER_USER 8388608 // Effectively disable user quota
@@ -19,9 +21,16 @@
 
 #define EXTERNAL_PORT_LOW 1024
 #define EXTERNAL_PORT_HIGH 65535
+#define PORT_BLOCK_CONTROL_PERIOD 100LL // 100 usec
 #define LB_CAPACITY 2
+// See mtrie.h
+#ifndef IP4_PLY_POOL_CAPACITY
 #define IP4_PLY_POOL_CAPACITY 5
+#endif
 #define N_FIB_TABLE 2
+// Capacity of the static mapping index, size it for STATIC_MAPPINGS if any
+#ifndef N_STATIC_MAPPINGS
 #define N_STATIC_MAPPINGS 1
+#endif
 
 #define EI_NAT_SECOND 3000000000LL
@@ -1,44 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <rte_byteorder.h>
+#include <rte_malloc.h>
+#include <rte_vect.h>
 #include "static_mapping.h"
-struct NfosVector *static_mappings;
-struct Map *mapping_hash;
+
+typedef struct nat_static_mapping_bucket_t_{
+  uint64_t keys[STATIC_MAPPING_BUCKET_SIZE];
+} __attribute__((aligned(32))) nat_static_mapping_bucket_t;
+
+static nat_static_mapping_bucket_t *mapping_buckets;
+/*mappings[bucket * STATIC_MAPPING_BUCKET_SIZE + slot] is the mapping of the key in that slot*/
+static nat_static_mapping_t *mappings;
+static uint32_t n_buckets_minus_1;
+static uint32_t n_mappings, max_n_mappings;
+/*Skip the address-only lookup if there is none*/
+static uint32_t n_addr_only_mappings;
+
+static inline uint32_t
+mapping_bucket_of(uint64_t key){
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & n_buckets_minus_1;
+}
+
+/*
+Bit i of *empty is set if slot i of the bucket is empty.
+Returns the mask of the slots holding key.
+*/
+static inline uint32_t
+mapping_bucket_match(const nat_static_mapping_bucket_t *b, uint64_t key, uint32_t *empty){
+#if defined(__AVX2__)
+  __m256i keys = _mm256_load_si256((const __m256i *)b->keys);
+  *empty = _mm256_movemask_pd(_mm256_castsi256_pd(
+    _mm256_cmpeq_epi64(keys, _mm256_setzero_si256())));
+  return _mm256_movemask_pd(_mm256_castsi256_pd(
+    _mm256_cmpeq_epi64(keys, _mm256_set1_epi64x(key))));
+#elif defined(__SSE4_1__)
+  __m128i k = _mm_set1_epi64x(key);
+  __m128i lo = _mm_load_si128((const __m128i *)b->keys);
+  __m128i hi = _mm_load_si128((const __m128i *)(b->keys + 2));
+  *empty = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(lo, _mm_setzero_si128()))) |
+           _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(hi, _mm_setzero_si128()))) << 2;
+  return _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(lo, k))) |
+         _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(hi, k))) << 2;
+#else
+  uint32_t match = 0;
+  *empty = 0;
+  for (int i = 0; i < STATIC_MAPPING_BUCKET_SIZE; i++) {
+    match |= (b->keys[i] == key) << i;
+    *empty |= (b->keys[i] == STATIC_MAPPING_EMPTY_KEY) << i;
+  }
+  return match;
+#endif
+}
+
+/*Returns the slot of key, -1 if absent*/
+static inline int64_t
+mapping_lookup(uint64_t key){
+  /*Would match empty slots, e.g. the address-only key of 0.0.0.0 in FIB 0*/
+  if (key == STATIC_MAPPING_EMPTY_KEY)
+    return -1;
+  uint32_t bucket = mapping_bucket_of(key);
+  /*Probing stops at the first bucket with an empty slot, there is always one*/
+  while (1) {
+    uint32_t empty;
+    uint32_t match = mapping_bucket_match(&mapping_buckets[bucket], key, &empty);
+    if (match)
+      return (int64_t)bucket * STATIC_MAPPING_BUCKET_SIZE + __builtin_ctz(match);
+    if (empty)
+      return -1;
+    bucket = (bucket + 1) & n_buckets_minus_1;
+  }
+}
+
 int nat_static_mapping_match(uint32_t match_addr, uint16_t match_port, uint32_t match_fib_index, uint8_t match_protocol,
 uint32_t *mapping_addr, uint16_t *mapping_port, uint32_t *mapping_fib_index){
-    uint64_t key = init_nat_k(match_addr, match_port, match_fib_index,match_protocol);
-    /*Search in the hash table for index*/
-    int index;
-    if (!map_get(mapping_hash,(void*)(&key), &index)){
+    if (!n_mappings)
       return 0;
-    }
-    nat_static_mapping_t *one_mapping;
-    nfos_vector_borrow(static_mappings, index, (void**)(&one_mapping));
+    int64_t slot = mapping_lookup(init_nat_k(match_addr, match_port, match_fib_index, match_protocol));
+    if (slot < 0 && n_addr_only_mappings)
+      slot = mapping_lookup(init_nat_k(match_addr, 0, match_fib_index, 0));
+    if (slot < 0)
+      return 0;
+
+    const nat_static_mapping_t *one_mapping = &mappings[slot];
     (*mapping_addr) = one_mapping->local_address;
     (*mapping_port) = (one_mapping->is_addr_only_static_mapping)? match_port : one_mapping->local_port;
     (*mapping_fib_index) = one_mapping->fib_index;
-    /*Get the mapping from the pool*/
-    /*Return 0 if not matched 1 if matched*/
     return 1;
 }
 
-void static_mapping_null_init(void *obj){
-  nat_static_mapping_t *m = (nat_static_mapping_t*)obj;
-  memset(m, 0, sizeof(nat_static_mapping_t));
+int nat_static_mapping_init(uint32_t num){
+  /*At most half full, keeps probe sequences short*/
+  uint32_t n_buckets = 1;
+  while (n_buckets * STATIC_MAPPING_BUCKET_SIZE < 2 * num)
+    n_buckets *= 2;
+
+  mapping_buckets = rte_zmalloc(NULL, n_buckets * sizeof(nat_static_mapping_bucket_t), RTE_CACHE_LINE_SIZE);
+  mappings = rte_zmalloc(NULL, n_buckets * STATIC_MAPPING_BUCKET_SIZE * sizeof(nat_static_mapping_t),
+                         RTE_CACHE_LINE_SIZE);
+  if (!mapping_buckets || !mappings)
+    return 0;
+
+  n_buckets_minus_1 = n_buckets - 1;
+  max_n_mappings = num;
+  return 1;
 }
-bool key_equal(void *k1, void *k2){
-  uint64_t *a = (uint64_t *)k1;
-  uint64_t *b = (uint64_t *)k2;
-  return (*a) == (*b); 
+
+int nat_static_mapping_add(uint32_t addr, uint16_t port, uint32_t fib_index, uint8_t proto,
+uint32_t mapping_addr, uint16_t mapping_port, uint32_t mapping_fib_index){
+  bool is_addr_only = port == 0;
+  uint64_t key = is_addr_only ? init_nat_k(addr, 0, fib_index, 0) : init_nat_k(addr, port, fib_index, proto);
+  if (n_mappings >= max_n_mappings || key == STATIC_MAPPING_EMPTY_KEY || mapping_lookup(key) >= 0)
+    return -1;
+
+  uint32_t bucket = mapping_bucket_of(key);
+  while (1) {
+    uint32_t empty;
+    mapping_bucket_match(&mapping_buckets[bucket], key, &empty);
+    if (empty) {
+      uint32_t slot = bucket * STATIC_MAPPING_BUCKET_SIZE + __builtin_ctz(empty);
+      mapping_buckets[bucket].keys[__builtin_ctz(empty)] = key;
+      mappings[slot].local_address = mapping_addr;
+      mappings[slot].local_port = mapping_port;
+      mappings[slot].fib_index = mapping_fib_index;
+      mappings[slot].is_addr_only_static_mapping = is_addr_only;
+      break;
+    }
+    bucket = (bucket + 1) & n_buckets_minus_1;
+  }
+
+  n_mappings++;
+  n_addr_only_mappings += is_addr_only;
+  return 0;
 }
-unsigned key_hash(void *k1){
-  uint64_t a = *((uint64_t *)k1);
-  return (unsigned)(((a>>32) + a) & 0xFFFFFFFF);
+
+/*"a.b.c.d" or "a.b.c.d:port", in network order. 1: with port; 0: without; -1: invalid*/
+static int
+parse_endpoint(const char *s, uint32_t *addr, uint16_t *port){
+  unsigned a, b, c, d, p;
+  char tail;
+  int n = sscanf(s, "%u.%u.%u.%u:%u%c", &a, &b, &c, &d, &p, &tail);
+  if ((n != 4 && n != 5) || a > 255 || b > 255 || c > 255 || d > 255 || (n == 5 && (p == 0 || p > 65535)))
+    return -1;
+  *addr = rte_cpu_to_be_32((a << 24) | (b << 16) | (c << 8) | d);
+  *port = n == 5 ? rte_cpu_to_be_16(p) : 0;
+  return n == 5;
 }
-int nat_static_mapping_init(uint32_t num){
-  if(!nfos_vector_allocate(sizeof(nat_static_mapping_t),num,static_mapping_null_init, &static_mappings )){
-    return 0;
+
+int nat_static_mapping_load(const char *path, uint32_t fib_index, uint32_t mapping_fib_index){
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    NF_INFO("Cannot open static mappings file %s", path);
+    return -1;
   }
-  if(!map_allocate(key_equal,key_hash,num, &mapping_hash)){
-    return 0;
+
+  char line[256];
+  int lineno = 0;
+  int ret = 0;
+  while (ret >= 0 && fgets(line, sizeof(line), file)) {
+    lineno++;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+
+    char local[32], external[32], proto_name[16], tail;
+    int n = sscanf(line, " %31s %31s %15s %c", local, external, proto_name, &tail);
+    if (n <= 0)
+      continue;
+
+    uint32_t addr, mapping_addr;
+    uint16_t port, mapping_port;
+    unsigned proto;
+    int has_port = n == 3 ? parse_endpoint(local, &addr, &port) : -1;
+    int has_mapping_port = n == 3 ? parse_endpoint(external, &mapping_addr, &mapping_port) : -1;
+    if (!strcasecmp(proto_name, "tcp")) {
+      proto = 6;
+    } else if (!strcasecmp(proto_name, "udp")) {
+      proto = 17;
+    } else if (sscanf(proto_name, "%u%c", &proto, &tail) != 1 || proto > 255) {
+      has_port = -1;
+    }
+    if (has_port < 0 || has_port != has_mapping_port) {
+      NF_INFO("Invalid static mapping at %s:%d", path, lineno);
+      ret = -1;
+    } else if (nat_static_mapping_add(addr, port, fib_index, proto, mapping_addr, mapping_port, mapping_fib_index)) {
+      NF_INFO("Cannot add static mapping at %s:%d, duplicate or more than %u mappings", path, lineno, max_n_mappings);
+      ret = -1;
+    } else {
+      ret++;
+    }
   }
 
-  return 1;
-}
\ No newline at end of file
+  fclose(file);
+  return ret;
+}
@@ -2,9 +2,17 @@
 #ifndef __STATIC_MAPPING_H__
 #define __STATIC_MAPPING_H__
 #include "nf.h"
-#include "vector.h"
-#include "deps/vigor/libvig/verified/map.h"
-#define STATIC_MAPPINGS_SIZE 1
+/*
+Static mappings are only added in nf_init and read-only afterwards, the index
+is thus read by data plane cores without RLU.
+
+The index is an open-addressing hash table of 64-bit keys from init_nat_k,
+STATIC_MAPPING_BUCKET_SIZE keys per bucket, probed bucket by bucket with SIMD
+compares. The mappings themselves are in a separate array, only touched on a hit.
+*/
+#define STATIC_MAPPING_BUCKET_SIZE 4
+/*Key of empty slots, init_nat_k() of the unusable 0.0.0.0:0 in FIB 0*/
+#define STATIC_MAPPING_EMPTY_KEY 0
 typedef struct nat_static_mapping_t_{
   uint32_t fib_index;
   uint32_t local_address;
@@ -15,16 +23,30 @@ static inline uint64_t init_nat_k(uint32_t ip4_addr, uint16_t port, uint32_t fib
     return (uint64_t) ip4_addr << 32 | (uint64_t) port << 16 | fib_index << 3 |
      (proto & 0x7);
 }
-extern struct NfosVector *static_mappings;
-extern struct Map *mapping_hash;
 /*For now only search is supported, we don't support read yet since it is not used in our trace now
+* Port mappings are matched first, then address-only ones.
 * 1: matched; 0: not matched.
 */
 int nat_static_mapping_match(uint32_t match_addr, uint16_t match_port, uint32_t match_fib_index, uint8_t match_protocol,
 uint32_t *mapping_addr, uint16_t *mapping_port, uint32_t *mapping_fib_index);
 
-void static_mapping_null_init(void *obj);
-bool key_equal(void *k1, void *k2);
-unsigned key_hash(void *k1);
+/*Allocate the index for up to num mappings. 1: success; 0: failure.*/
 int nat_static_mapping_init(uint32_t num);
-#endif
\ No newline at end of file
+
+/*
+Add a mapping, only during nf_init. Addresses and ports are in network order.
+Address-only mappings (port 0) match any port and protocol of the address.
+Returns 0 on success, -1 if the index is full or the mapping already exists.
+*/
+int nat_static_mapping_add(uint32_t addr, uint16_t port, uint32_t fib_index, uint8_t proto,
+uint32_t mapping_addr, uint16_t mapping_port, uint32_t mapping_fib_index);
+
+/*
+Add the mappings in path, one "a.b.c.d[:port] e.f.g.h[:port] proto" per line,
+matching a.b.c.d:port in fib_index and mapped to e.f.g.h:port in mapping_fib_index.
+proto is tcp, udp or an IP protocol number. Omit both ports for address-only
+mappings. '#' starts a comment.
+Returns the number of mappings added, -1 on error.
+*/
+int nat_static_mapping_load(const char *path, uint32_t fib_index, uint32_t mapping_fib_index);
+#endif
@@ -27,6 +27,7 @@
 #include <assert.h>
 
 #include "nf.h"
+#include "checksum.h"
 #include "nat_config.h"
 
 #include "double-chain.h"
@@ -381,10 +382,9 @@ static inline void nat_pkt_action(nf_state_t *non_pkt_set_state, pkt_t *pkt,
     // Shouldn't be called with our current experiment setup
     assert(false); 
   } else {
-    pkt->tcpudp_header->src_port = port;
-    pkt->ipv4_header->src_addr = ip;
+    nfos_cksum_set_l4_port(pkt, &pkt->tcpudp_header->src_port, port);
+    nfos_cksum_set_ipv4_addr(pkt, &pkt->ipv4_header->src_addr, ip);
   }
-  nf_set_ipv4_udptcp_checksum(pkt->ipv4_header, pkt->tcpudp_header, pkt->raw);
 
   dst_dev = 1 - incoming_dev;
   send_pkt(pkt, dst_dev);
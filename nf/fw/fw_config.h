@@ -7,10 +7,37 @@
 #define EXPIRATION_TIME 1200000 // 1.2 sec
 #endif
 
+// Timeouts of TCP connection states (in us), established connections and
+// non-TCP flows use EXPIRATION_TIME
+#ifndef SYN_SENT_TIMEOUT
+#define SYN_SENT_TIMEOUT 200000 // 200 msec
+#endif
+#ifndef FIN_WAIT_TIMEOUT
+#define FIN_WAIT_TIMEOUT 400000 // 400 msec
+#endif
+#ifndef TIME_WAIT_TIMEOUT
+#define TIME_WAIT_TIMEOUT 100000 // 100 msec
+#endif
+#ifndef CLOSED_TIMEOUT
+#define CLOSED_TIMEOUT 10000 // 10 msec
+#endif
+// Timeout of UDP flows to DNS servers (in us)
+#ifndef DNS_TIMEOUT
+#define DNS_TIMEOUT 50000 // 50 msec
+#endif
+#define DNS_PORT 53
+
 #define ENDPOINT_MAC {0x01, 0x23, 0x45, 0x56, 0x78, 0x9a}
 #define LB_CAPACITY 2
+// See mtrie.h
+#ifndef IP4_PLY_POOL_CAPACITY
 #define IP4_PLY_POOL_CAPACITY 5
+#endif
 #define N_FIB_TABLE 2
+// See ip6_fib_init() in ip6_fib.h
+#ifndef IP6_FIB_CAPACITY
+#define IP6_FIB_CAPACITY 64
+#endif
 #ifndef LCORES
 #define LCORES "8,10,12,14,16"
 #endif
@@ -4,36 +4,52 @@
 #include "load-balance.h"
 #include "fib_table.h"
 #include "mtrie.h"
+#include "ip6.h"
+#include "ip6_fib.h"
+#include "fib_control.h"
 
 /* pkt set auxiliary func */
 
 bool pkt_set_id_eq(void* a, void* b) {
-  pkt_set_id_t *id1 = (pkt_set_id_t *) a;
-  pkt_set_id_t *id2 = (pkt_set_id_t *) b;
-  return (id1->internal_ip == id2->internal_ip)
-     && (id1->external_ip == id2->external_ip)
-     && (id1->internal_port == id2->internal_port)
-     && (id1->external_port == id2->external_port)
-     && (id1->protocol == id2->protocol);
+  return ip6_words_eq(a, b, sizeof(pkt_set_id_t));
 }
 
 unsigned pkt_set_id_hash(void* obj) {
-  pkt_set_id_t *id = (pkt_set_id_t *) obj;
-
-  unsigned hash = 0;
-  hash = __builtin_ia32_crc32si(hash, id->internal_ip);
-  hash = __builtin_ia32_crc32si(hash, id->external_ip);
-  hash = __builtin_ia32_crc32si(hash, id->internal_port);
-  hash = __builtin_ia32_crc32si(hash, id->external_port);
-  hash = __builtin_ia32_crc32si(hash, id->protocol);
-  return hash;
+  return ip6_crc32_words(obj, sizeof(pkt_set_id_t));
 }
 
 void pkt_set_state_allocate(void *obj) {
   pkt_set_state_t *state = (pkt_set_state_t *) obj;
   // random value to make sure the compiler prefaults the state
   state->internal_device = 0;
-  state->tcp_flag.as_u16 = 0;
+  state->ct = CT_NONE;
+}
+
+// Timeout classes of flows
+enum {
+  // Established connections and non-TCP flows
+  TIMEOUT_DEFAULT = 0,
+  TIMEOUT_SYN_SENT,
+  TIMEOUT_FIN_WAIT,
+  TIMEOUT_TIME_WAIT,
+  TIMEOUT_CLOSED,
+  NUM_TIMEOUT_CLASSES
+};
+
+static inline int ct_timeout_class(uint8_t ct) {
+  switch (ct_get_state(ct)) {
+  case CT_SYN_SENT:
+  case CT_SYN_RECV:
+    return TIMEOUT_SYN_SENT;
+  case CT_FIN_WAIT:
+    return TIMEOUT_FIN_WAIT;
+  case CT_TIME_WAIT:
+    return TIMEOUT_TIME_WAIT;
+  case CT_CLOSED:
+    return TIMEOUT_CLOSED;
+  default:
+    return TIMEOUT_DEFAULT;
+  }
 }
 
 
@@ -51,6 +67,7 @@ typedef struct nf_config {
   
   uint32_t lb_pool_capacity;
   uint32_t ip4_ply_pool_capacity;
+  uint32_t ip6_fib_capacity;
   uint32_t n_fib_table;
 } nf_config_t;
 
@@ -63,7 +80,6 @@ struct nf_state {
 void lb_null_init(void *obj){
   load_balance_t *lb = (load_balance_t *) obj;
   lb->n_buckets = 0;
-  lb->lb_buckets = NULL;
 }
 void ip4_null_init(void *obj){
   ip4_fib_mtrie_8_ply_t *leaf = (ip4_fib_mtrie_8_ply_t*) obj;
@@ -79,6 +95,25 @@ void fib_table_null_init(void *obj){
   memset(fib->mtrie.root_ply.dst_address_bits_of_leaves, 0, PLY_16_SIZE *sizeof(uint8_t));
 }
 
+#ifdef PKT_BATCH_PREPARE
+// Route all LAN -> WAN packets of a batch at once
+void nf_pkt_batch_prepare(nf_state_t *non_pkt_set_state, pkt_t *pkts, const bool *valid,
+                          uint16_t batch_size, uint16_t incoming_dev) {
+  if (incoming_dev == non_pkt_set_state->cfg->wan_device)
+    return;
+
+  uint32_t le_dst_addrs[batch_size];
+  uint32_t lb_indices[batch_size];
+  // IPv6 packets are routed in forward_pkt()
+  for (uint16_t i = 0; i < batch_size; i++)
+    le_dst_addrs[i] = valid[i] && pkts[i].ipv4_header ? RTE_STATIC_BSWAP32(pkts[i].ipv4_header->dst_addr) : 0;
+
+  ip4_fib_lookup_prefetch_xN(incoming_dev, le_dst_addrs, lb_indices, batch_size);
+  for (uint16_t i = 0; i < batch_size; i++)
+    pkts[i].batch_meta = lb_indices[i];
+}
+#endif
+
 int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
                 uint16_t incoming_dev, pkt_set_state_t *local_state,
                 pkt_set_id_t *pkt_set_id);
@@ -107,6 +142,11 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
   ret->cfg->max_num_flows = MAX_NUM_FLOWS;
   ret->cfg->expiration_time = EXPIRATION_TIME;
 
+  // Expire flows early depending on their TCP state
+  uint64_t timeouts[NUM_TIMEOUT_CLASSES - 1] = {SYN_SENT_TIMEOUT, FIN_WAIT_TIMEOUT,
+                                                TIME_WAIT_TIMEOUT, CLOSED_TIMEOUT};
+  if (!register_pkt_set_timeout_classes(timeouts, NUM_TIMEOUT_CLASSES - 1)) ret = NULL;
+
   // Fill in the device mac addresses
   int num_devs = rte_eth_dev_count_avail();
   ret->cfg->device_macs = malloc(num_devs * sizeof(struct rte_ether_addr));
@@ -159,13 +199,35 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
     ret = NULL;
   }
 
-  ip4_fib_t *fib = ip4_fib_get(LAN_DEVICE);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index1);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
+  if (ip4_fib_route_add(LAN_DEVICE, 0, 0, index1)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE, 0, 32, index0)) ret = NULL;
+
+  if (ip4_fib_route_add(WAN_DEVICE, 0, 0, index1)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE, 0, 32, index0)) ret = NULL;
+
+  // Same routes for IPv6
+  ret->cfg->ip6_fib_capacity = IP6_FIB_CAPACITY;
+  if (ip6_fib_init(ret->cfg->n_fib_table, ret->cfg->ip6_fib_capacity)) ret = NULL;
+  const uint8_t ip6_any[16] = {0};
+  if (ip6_fib_route_add(LAN_DEVICE, ip6_any, 0, index1)) ret = NULL;
+  if (ip6_fib_route_add(LAN_DEVICE, ip6_any, 128, index0)) ret = NULL;
+  if (ip6_fib_route_add(WAN_DEVICE, ip6_any, 0, index1)) ret = NULL;
+  if (ip6_fib_route_add(WAN_DEVICE, ip6_any, 128, index0)) ret = NULL;
+
+#ifdef FIB_ROUTES_FILE
+  // Extra routes, adj indexes refer to the load-balances created above
+  for (uint32_t i = 0; i < N_FIB_TABLE; i++) {
+    if (ip4_fib_table_load(i, FIB_ROUTES_FILE) < 0) ret = NULL;
+  }
+#endif
+#ifdef FIB6_ROUTES_FILE
+  for (uint32_t i = 0; i < N_FIB_TABLE; i++) {
+    if (ip6_fib_table_load(i, FIB6_ROUTES_FILE) < 0) ret = NULL;
+  }
+#endif
 
-  fib = ip4_fib_get(WAN_DEVICE);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index1);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
+  // Route updates through the control channel, see control.h
+  if (!fib_control_register(N_FIB_TABLE)) ret = NULL;
 
   return ret;
 }
@@ -179,13 +241,19 @@ bool nf_pkt_parser(uint8_t *buffer, pkt_t *pkt) {
   uint8_t *ip_options;
   pkt->ipv4_header =
       nf_then_get_ipv4_header(pkt->ether_header, buffer, &ip_options);
-  if (pkt->ipv4_header == NULL) {
-    NF_DEBUG("Malformed IPv4, dropping");
-    return false;
+  pkt->ipv6_header = NULL;
+  if (pkt->ipv4_header != NULL) {
+    pkt->tcpudp_header =
+        nf_then_get_tcpudp_header(pkt->ipv4_header, buffer);
+  } else {
+    pkt->ipv6_header = nf_then_get_ipv6_header(pkt->ether_header, buffer);
+    if (pkt->ipv6_header == NULL) {
+      NF_DEBUG("Malformed IP, dropping");
+      return false;
+    }
+    pkt->tcpudp_header =
+        nf_then_get_ipv6_tcpudp_header(pkt->ipv6_header, buffer);
   }
-
-  pkt->tcpudp_header =
-      nf_then_get_tcpudp_header(pkt->ipv4_header, buffer);
   if (pkt->tcpudp_header == NULL) {
     NF_DEBUG("Not TCP/UDP, dropping");
     return false;
@@ -212,64 +280,87 @@ int nf_pkt_dispatcher(const pkt_t *pkt, uint16_t incoming_dev,
   
   *has_pkt_set_state = true;
 
-  if (incoming_dev != non_pkt_set_state->cfg->wan_device) {
+  bool is_input = incoming_dev != non_pkt_set_state->cfg->wan_device;
+  uint8_t *internal_ip = is_input ? pkt_set_id->internal_ip : pkt_set_id->external_ip;
+  uint8_t *external_ip = is_input ? pkt_set_id->external_ip : pkt_set_id->internal_ip;
+  if (pkt->ipv4_header) {
+    ip6_addr_from_ipv4(internal_ip, pkt->ipv4_header->src_addr);
+    ip6_addr_from_ipv4(external_ip, pkt->ipv4_header->dst_addr);
+  } else {
+    memcpy(internal_ip, pkt->ipv6_header->src_addr, 16);
+    memcpy(external_ip, pkt->ipv6_header->dst_addr, 16);
+  }
+  if (is_input) {
     pkt_set_id->internal_port = pkt->tcpudp_header->src_port;
     pkt_set_id->external_port = pkt->tcpudp_header->dst_port;
-    pkt_set_id->internal_ip = pkt->ipv4_header->src_addr;
-    pkt_set_id->external_ip = pkt->ipv4_header->dst_addr;
   } else {
     pkt_set_id->internal_port = pkt->tcpudp_header->dst_port;
     pkt_set_id->external_port = pkt->tcpudp_header->src_port;
-    pkt_set_id->internal_ip = pkt->ipv4_header->dst_addr;
-    pkt_set_id->external_ip = pkt->ipv4_header->src_addr;
   }
-  pkt_set_id->protocol = pkt->ipv4_header->next_proto_id;
+  pkt_set_id->protocol = pkt_l4_proto(pkt);
 
-  NF_DEBUG("Pkt set id: port: [%x, %x], ip: [%x %x], proto: %x",
+  NF_DEBUG("Pkt set id: port: [%x, %x], proto: %x",
            pkt_set_id->internal_port, pkt_set_id->external_port,
-           pkt_set_id->internal_ip, pkt_set_id->external_ip,
            pkt_set_id->protocol);
 
   // This NF only has one packet class
   return 0;
 }
 
-int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
-                uint16_t incoming_dev, pkt_set_state_t *local_state,
-                pkt_set_id_t *pkt_set_id) {
+// Track the TCP connection of the flow.
+// Returns the new timeout class of the flow if it changes, -1 otherwise
+static inline int ct_update(nf_state_t *non_pkt_set_state, pkt_t *pkt,
+                            uint16_t incoming_dev, pkt_set_state_t *local_state) {
+  if (pkt_l4_proto(pkt) != PROTOCOL_TCP)
+    return -1;
+
+  // TODO: remove this temporary hack to get FLAGS, SEQ and ACK
+  uint8_t tcp_flags = pkt->payload[13];
+  uint8_t ct = ct_track_tcp(local_state->ct, incoming_dev != non_pkt_set_state->cfg->wan_device,
+                            tcp_flags);
+  int timeout_class = ct_timeout_class(ct);
+  int old_timeout_class = ct_timeout_class(local_state->ct);
+  PKT_SET_STATE_WRITE(local_state, ct);
+  local_state->ct = ct;
+  return timeout_class != old_timeout_class ? timeout_class : -1;
+}
 
-  /*
-   * The Packet set is allocated, meaning the flow is valid in this case.
-   * Thus send the packet.
-   */
+static void forward_pkt(nf_state_t *non_pkt_set_state, pkt_t *pkt,
+                        uint16_t incoming_dev, pkt_set_state_t *local_state) {
   uint16_t dst_dev;
 
-  if (pkt->ipv4_header->time_to_live <= 1){
+  if (pkt->ipv4_header ? pkt->ipv4_header->time_to_live <= 1 : pkt->ipv6_header->hop_limits <= 1){
     NF_DEBUG("ttl <= 1, dropping");
     drop_pkt(pkt);
   } 
-  if (pkt->ipv4_header->next_proto_id == PROTOCOL_TCP){
-    // TODO: remove this temporary hack to get FLAGS, SEQ and ACK
-    uint8_t tcp_flags = pkt->payload[13];
-    track_session((incoming_dev!=non_pkt_set_state->cfg->wan_device),&(local_state->tcp_flag),tcp_flags);
-  }
   if (incoming_dev == non_pkt_set_state->cfg->wan_device) {
     dst_dev = local_state->internal_device;
     pkt->ether_header->s_addr = non_pkt_set_state->cfg->device_macs[dst_dev];
     pkt->ether_header->d_addr = non_pkt_set_state->cfg->endpoint_macs[dst_dev];
     send_pkt(pkt, dst_dev);
   } else {
-    uint32_t le_dst_addr = RTE_STATIC_BSWAP32(pkt->ipv4_header->dst_addr);
-    NF_DEBUG("0x%08x\n", le_dst_addr);
-    ip4_fib_mtrie_t *mtrie = &(ip4_fib_get(incoming_dev)->mtrie);
-    ip4_fib_mtrie_leaf_t leaf0;
-    leaf0 = ip4_fib_mtrie_lookup_step_one(mtrie, le_dst_addr);
-    leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,2);
-    leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,3);
+    uint32_t adj0;
+    if (pkt->ipv6_header) {
+      adj0 = ip6_fib_lookup(incoming_dev, pkt->ipv6_header->dst_addr);
+    } else {
+#ifdef PKT_BATCH_PREPARE
+      // Looked up in nf_pkt_batch_prepare()
+      adj0 = pkt->batch_meta;
+#else
+      uint32_t le_dst_addr = RTE_STATIC_BSWAP32(pkt->ipv4_header->dst_addr);
+      NF_DEBUG("0x%08x\n", le_dst_addr);
+      ip4_fib_mtrie_t *mtrie = &(ip4_fib_get(incoming_dev)->mtrie);
+      ip4_fib_mtrie_leaf_t leaf0;
+      leaf0 = ip4_fib_mtrie_lookup_step_one(mtrie, le_dst_addr);
+      leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,2);
+      leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,3);
+      adj0 = leaf0 >> 1;
+#endif
+    }
     const load_balance_t *lb0;
-    lb0 = load_balance_get(leaf0 >> 1);
+    lb0 = load_balance_get(adj0);
     const dpo_t *dpo0;
-    dpo0 = load_balance_get_bucket_i(lb0, 0);
+    dpo0 = load_balance_get_bucket_by_hash(lb0, pkt->hash);
     NF_DEBUG("Action: %u\n",dpo0->action);
     if (dpo0->action == DROP) drop_pkt(pkt);
     if (dpo0->action == FORWARD){
@@ -281,11 +372,26 @@ int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
   }
 
 
-  NF_DEBUG("Send pkt, port: [%x, %x], ip: [%x %x], proto: %x",
+  NF_DEBUG("Send pkt, port: [%x, %x], proto: %x",
            pkt->tcpudp_header->src_port, pkt->tcpudp_header->dst_port,
-           pkt->ipv4_header->src_addr, pkt->ipv4_header->dst_addr,
-           pkt->ipv4_header->next_proto_id);
+           pkt_l4_proto(pkt));
+}
+
+int pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
+                uint16_t incoming_dev, pkt_set_state_t *local_state,
+                pkt_set_id_t *pkt_set_id) {
+
+  /*
+   * The Packet set is allocated, meaning the flow is valid in this case.
+   * Thus send the packet.
+   */
+  int timeout_class = ct_update(non_pkt_set_state, pkt, incoming_dev, local_state);
+  if (timeout_class >= 0) {
+    set_pkt_set_timeout_class(pkt_set_id, timeout_class);
+    NF_DEBUG("Flow moved to timeout class %d", timeout_class);
+  }
 
+  forward_pkt(non_pkt_set_state, pkt, incoming_dev, local_state);
   return 0;
 }
 
@@ -301,16 +407,24 @@ int nf_unknown_pkt_set_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
     // Allocate and initialize the local state of the packet set
     pkt_set_state_t local_state = {
       .internal_device = incoming_dev,
-      .tcp_flag = 0
+      .ct = CT_NONE
     };
+    // Track the first packet before the local state gets copied
+    int timeout_class = ct_update(non_pkt_set_state, pkt, incoming_dev, &local_state);
     // Try to register the packet set
     if (add_pkt_set(pkt_set_id, &local_state, NULL)) {
+      if (timeout_class >= 0)
+        set_pkt_set_timeout_class(pkt_set_id, timeout_class);
+      // DNS lookups are done after one exchange
+      else if (pkt_set_id->protocol == PROTOCOL_UDP &&
+               pkt_set_id->external_port == rte_cpu_to_be_16(DNS_PORT))
+        set_pkt_set_timeout(pkt_set_id, DNS_TIMEOUT);
       NF_DEBUG("New flow inserted");
     } else {
       NF_DEBUG("Flow insertion fails");
     }
     // Send the packet
-    pkt_handler(non_pkt_set_state, pkt, incoming_dev, &local_state, pkt_set_id);
+    forward_pkt(non_pkt_set_state, pkt, incoming_dev, &local_state);
 
   }
 
@@ -1,3 +1,7 @@
 #pragma once
 
 #define PKT_PROCESS_BATCHING
+// Route the packets of a batch with bulk FIB lookups
+#define PKT_BATCH_PREPARE
+// Roll back the conntrack state of flows on aborts, logging only the writes
+#define PKT_SET_STATE_FIELD_LOG
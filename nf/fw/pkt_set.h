@@ -7,16 +7,16 @@
  * 
  */
 struct pkt_set_id {
+  // IP of the internal host, IPv4 addresses are IPv4-mapped (see ip6.h)
+  uint8_t internal_ip[16];
+  // IP of the external host
+  uint8_t external_ip[16];
   // L4 port of the internal host
   uint16_t internal_port;
   // L4 port of the external host
   uint16_t external_port;
-  // IP of the internal host
-  uint32_t internal_ip;
-  // IP of the external host
-  uint32_t external_ip;
-  // L4 protocol
-  uint8_t protocol;
+  // L4 protocol, 32 bits so that the id is made of five 64-bit words
+  uint32_t protocol;
 };
 
 bool pkt_set_id_eq(void* a, void* b);
@@ -31,5 +31,6 @@ struct pkt_set_state {
    * LAN host. 
    */
   uint16_t internal_device;
-  union tcp_flag_t tcp_flag;
+  // Conntrack entry of TCP flows, see tcp-state.h
+  uint8_t ct;
 };
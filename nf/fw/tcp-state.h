@@ -15,17 +15,74 @@
 #define TCP_FLAGS_RSTFINACKSYN (TCP_FLAG_RST + TCP_FLAG_FIN + TCP_FLAG_SYN + TCP_FLAG_ACK)
 #define TCP_FLAGS_ACKSYN (TCP_FLAG_SYN + TCP_FLAG_ACK)
 #define PROTOCOL_TCP    6
-union tcp_flag_t
-{
-    uint8_t as_u8[2];
-    uint16_t as_u16;
+#define PROTOCOL_UDP    17
+
+/*
+Connection tracking states, a connection is opened by the internal (LAN) host.
+Non-TCP flows stay in CT_NONE.
+*/
+enum ct_state_t {
+    CT_NONE = 0,
+    /*SYN from LAN*/
+    CT_SYN_SENT,
+    /*SYN+ACK from WAN*/
+    CT_SYN_RECV,
+    CT_ESTABLISHED,
+    /*FIN from one side*/
+    CT_FIN_WAIT,
+    /*FIN from both sides*/
+    CT_TIME_WAIT,
+    /*RST from any side*/
+    CT_CLOSED,
 };
 
-/*Simple help function to track tcp flags from 2 sides*/
-static inline void track_session(int is_input, union tcp_flag_t *flag, uint8_t tcp_flag){
-  uint8_t old_flags = (*flag).as_u8[is_input];
-  uint8_t new_flags = old_flags | tcp_flag;
-  (*flag).as_u8[is_input] = (old_flags != new_flags) ? new_flags : old_flags;
+/*
+A conntrack entry fits in one byte: the state in the low bits, and the FINs
+seen in each direction.
+*/
+#define CT_STATE_MASK   0x0F
+#define CT_FIN_LAN      0x10
+#define CT_FIN_WAN      0x20
+
+#define ct_get_state(ct) ((enum ct_state_t)((ct) & CT_STATE_MASK))
+
+/*Update the conntrack entry of a TCP flow with a packet from LAN (is_input) or WAN*/
+static inline uint8_t ct_track_tcp(uint8_t ct, int is_input, uint8_t tcp_flags){
+    enum ct_state_t state = ct_get_state(ct);
+    uint8_t fins = ct & (CT_FIN_LAN | CT_FIN_WAN);
+
+    if (tcp_flags & TCP_FLAG_RST)
+        return CT_CLOSED;
+
+    /*New connection, possibly reusing the tuple of a closed one*/
+    if (is_input && (tcp_flags & TCP_FLAGS_ACKSYN) == TCP_FLAG_SYN) {
+        if (state == CT_NONE || state == CT_SYN_SENT || state >= CT_TIME_WAIT)
+            return CT_SYN_SENT;
+        return ct;
+    }
+
+    switch (state) {
+    case CT_NONE:
+        /*Pick up connections established before the flow got tracked*/
+        return is_input ? CT_ESTABLISHED : ct;
+    case CT_SYN_SENT:
+        if (!is_input && (tcp_flags & TCP_FLAGS_ACKSYN) == TCP_FLAGS_ACKSYN)
+            return CT_SYN_RECV;
+        return ct;
+    case CT_SYN_RECV:
+        if (is_input && (tcp_flags & TCP_FLAGS_ACKSYN) == TCP_FLAG_ACK)
+            return CT_ESTABLISHED;
+        return ct;
+    case CT_ESTABLISHED:
+    case CT_FIN_WAIT:
+        if (tcp_flags & TCP_FLAG_FIN)
+            fins |= is_input ? CT_FIN_LAN : CT_FIN_WAN;
+        if (fins == (CT_FIN_LAN | CT_FIN_WAN))
+            return CT_TIME_WAIT | fins;
+        return fins ? (CT_FIN_WAIT | fins) : ct;
+    default:
+        return ct;
+    }
 }
 
 #endif
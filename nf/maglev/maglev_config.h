@@ -15,8 +15,15 @@
 #define PERIODIC_HANDLER_PERIOD 10LL // 10 usec
 
 #define LB_CAPACITY 7
+// See mtrie.h
+#ifndef IP4_PLY_POOL_CAPACITY
 #define IP4_PLY_POOL_CAPACITY 30
+#endif
 #define N_FIB_TABLE 4
+// See ip6_fib_init() in ip6_fib.h
+#ifndef IP6_FIB_CAPACITY
+#define IP6_FIB_CAPACITY 64
+#endif
 
 #ifndef LCORES
 #define LCORES "8,10,12,14,16"
@@ -3,6 +3,7 @@
  */
 
 #include "nf.h"
+#include "checksum.h"
 #include "nf-log.h"
 #include "maglev_config.h"
 
@@ -18,42 +19,66 @@
 #include "load-balance.h"
 #include "mtrie.h"
 #include "fib_table.h"
+#include "ip6.h"
+#include "ip6_fib.h"
+#include "fib_control.h"
 #include "scalability-profiler.h"
 
 /* pkt set auxiliart func */
 
 bool pkt_set_id_eq(void* a, void* b) {
-  pkt_set_id_t *id1 = (pkt_set_id_t *) a;
-  pkt_set_id_t *id2 = (pkt_set_id_t *) b;
-  return (id1->src_ip == id2->src_ip)
-    && (id1->dst_ip == id2->dst_ip)
-    && (id1->src_port == id2->src_port)
-    && (id1->dst_port == id2->dst_port)
-    && (id1->protocol == id2->protocol);
+  return ip6_words_eq(a, b, sizeof(pkt_set_id_t));
 }
 
 unsigned pkt_set_id_hash(void* obj) {
-  pkt_set_id_t *id = (pkt_set_id_t *) obj;
-
-  unsigned hash = 0;
-  hash = __builtin_ia32_crc32si(hash, id->src_ip);
-  hash = __builtin_ia32_crc32si(hash, id->dst_ip);
-  hash = __builtin_ia32_crc32si(hash, id->src_port);
-  hash = __builtin_ia32_crc32si(hash, id->dst_port);
-  hash = __builtin_ia32_crc32si(hash, id->protocol);
-  return hash;
+  return ip6_crc32_words(obj, sizeof(pkt_set_id_t));
 }
 
 static inline unsigned get_hash_from_pkt(const pkt_t *pkt) {
   unsigned hash = 0;
-  hash = __builtin_ia32_crc32si(hash, pkt->ipv4_header->src_addr);
-  hash = __builtin_ia32_crc32si(hash, pkt->ipv4_header->dst_addr);
+  if (pkt->ipv4_header) {
+    hash = __builtin_ia32_crc32si(hash, pkt->ipv4_header->src_addr);
+    hash = __builtin_ia32_crc32si(hash, pkt->ipv4_header->dst_addr);
+  } else {
+    // Src and dst addresses are contiguous
+    hash = ip6_crc32_words(pkt->ipv6_header->src_addr, 32);
+  }
   hash = __builtin_ia32_crc32si(hash, pkt->tcpudp_header->src_port);
   hash = __builtin_ia32_crc32si(hash, pkt->tcpudp_header->dst_port);
-  hash = __builtin_ia32_crc32si(hash, pkt->ipv4_header->next_proto_id);
+  hash = __builtin_ia32_crc32si(hash, pkt_l4_proto(pkt));
   return hash;
 }
 
+// IPs of IPv4 packets are IPv4-mapped
+static inline void get_src_ip_from_pkt(const pkt_t *pkt, uint8_t *ip) {
+  if (pkt->ipv4_header)
+    ip6_addr_from_ipv4(ip, pkt->ipv4_header->src_addr);
+  else
+    memcpy(ip, pkt->ipv6_header->src_addr, 16);
+}
+
+static inline void get_dst_ip_from_pkt(const pkt_t *pkt, uint8_t *ip) {
+  if (pkt->ipv4_header)
+    ip6_addr_from_ipv4(ip, pkt->ipv4_header->dst_addr);
+  else
+    memcpy(ip, pkt->ipv6_header->dst_addr, 16);
+}
+
+static inline uint8_t get_hop_limit_from_pkt(const pkt_t *pkt) {
+  return pkt->ipv4_header ? pkt->ipv4_header->time_to_live : pkt->ipv6_header->hop_limits;
+}
+
+static inline void set_dscp_of_pkt(pkt_t *pkt, uint8_t dscp) {
+  if (pkt->ipv4_header) {
+    nfos_cksum_set_ipv4_tos(pkt, (dscp & 0x3F) << 2);
+  } else {
+    // Traffic class is bits 20-27 of the first word
+    uint32_t vtc_flow = rte_be_to_cpu_32(pkt->ipv6_header->vtc_flow);
+    vtc_flow = (vtc_flow & ~(0xFFU << 20)) | ((uint32_t)((dscp & 0x3F) << 2) << 20);
+    pkt->ipv6_header->vtc_flow = rte_cpu_to_be_32(vtc_flow);
+  }
+}
+
 void pkt_set_state_allocate(void *obj) {
   return;
 }
@@ -91,6 +116,7 @@ typedef struct nf_config {
   // fib-related stuff 
   uint32_t lb_pool_capacity;
   uint32_t ip4_ply_pool_capacity;
+  uint32_t ip6_fib_capacity;
   uint32_t n_fib_table;
 } nf_config_t;
 
@@ -103,8 +129,8 @@ typedef struct backend_info {
   // The dst MAC of packets which the load balancer sends to the backend 
   struct rte_ether_addr mac;
 
-  // The IP of the backend
-  uint32_t ip;
+  // The IP of the backend, IPv4 addresses are IPv4-mapped
+  uint8_t ip[16];
 } backend_info_t;
 
 // Todo: Auto-gen these callbacks as in vigor
@@ -118,31 +144,27 @@ void backend_info_allocate(void* obj) {
   id->mac.addr_bytes[4] = 0;
   id->mac.addr_bytes[5] = 0;
 
-  id->ip = 0;
+  memset(id->ip, 0, sizeof(id->ip));
 }
 
 
 /* ip_addr and auxiliary callbacks */
 struct ip_addr {
-  uint32_t addr;
+  // IPv4 addresses are IPv4-mapped
+  uint8_t addr[16];
 };
 
 bool ip_addr_eq(void* a, void* b) {
-  struct ip_addr* id1 = (struct ip_addr*) a;
-  struct ip_addr* id2 = (struct ip_addr*) b;
-  return (id1->addr == id2->addr);
+  return ip6_words_eq(a, b, sizeof(struct ip_addr));
 }
 
 unsigned ip_addr_hash(void* obj) {
-  struct ip_addr* id = (struct ip_addr*) obj;
-  unsigned hash = 0;
-  hash = __builtin_ia32_crc32si(hash, id->addr);
-  return hash;
+  return ip6_crc32_words(obj, sizeof(struct ip_addr));
 }
 
 void ip_addr_allocate(void* obj) {
   struct ip_addr* id = (struct ip_addr*) obj;
-  id->addr = 0;
+  memset(id->addr, 0, sizeof(id->addr));
 }
 
 
@@ -156,7 +178,6 @@ static void cht_null_init(void *obj)
 void lb_null_init(void *obj){
   load_balance_t *lb = (load_balance_t *) obj;
   lb->n_buckets = 0;
-  lb->lb_buckets = NULL;
 }
 void ip4_null_init(void *obj){
   ip4_fib_mtrie_8_ply_t *leaf = (ip4_fib_mtrie_8_ply_t*) obj;
@@ -198,13 +219,21 @@ struct nf_state {
 /* Auxiliary functions */
 static inline void send_pkt_to_backend(pkt_t *pkt, backend_info_t *backend,
                                        nf_state_t *non_pkt_set_state) {
+  // Backends only serve clients of their own address family
+  bool is_ipv4_backend = ip6_addr_is_ipv4_mapped(backend->ip);
   if (backend->dev != non_pkt_set_state->cfg->wan_device[0] &&
-      backend->dev != non_pkt_set_state->cfg->wan_device[1]) {
-    pkt->ipv4_header->dst_addr = backend->ip;
+      backend->dev != non_pkt_set_state->cfg->wan_device[1] &&
+      is_ipv4_backend == (pkt->ipv4_header != NULL)) {
     pkt->ether_header->s_addr = non_pkt_set_state->cfg->device_macs[backend->dev];
     pkt->ether_header->d_addr = backend->mac;
-    // Update checksum
-    nf_set_ipv4_udptcp_checksum(pkt->ipv4_header, pkt->tcpudp_header, pkt->raw);
+    // Update checksums incrementally
+    if (is_ipv4_backend) {
+      rte_be32_t backend_ip;
+      memcpy(&backend_ip, backend->ip + 12, 4);
+      nfos_cksum_set_ipv4_addr(pkt, &pkt->ipv4_header->dst_addr, backend_ip);
+    } else {
+      nfos_cksum_set_ipv6_addr(pkt, pkt->ipv6_header->dst_addr, backend->ip);
+    }
     send_pkt(pkt, backend->dev);
   } else {
     drop_pkt(pkt);
@@ -216,6 +245,23 @@ static inline void send_pkt_to_backend(pkt_t *pkt, backend_info_t *backend,
 
 void expire_backend(nf_state_t *non_pkt_set_state);
 
+#ifdef PKT_BATCH_PREPARE
+// Route all packets of a batch at once, heartbeats are routed too but ignore
+// the result
+void nf_pkt_batch_prepare(nf_state_t *non_pkt_set_state, pkt_t *pkts, const bool *valid,
+                          uint16_t batch_size, uint16_t incoming_dev) {
+  uint32_t le_dst_addrs[batch_size];
+  uint32_t lb_indices[batch_size];
+  // IPv6 packets are routed in client_pkt_handler()
+  for (uint16_t i = 0; i < batch_size; i++)
+    le_dst_addrs[i] = valid[i] && pkts[i].ipv4_header ? RTE_STATIC_BSWAP32(pkts[i].ipv4_header->dst_addr) : 0;
+
+  ip4_fib_lookup_prefetch_xN(incoming_dev, le_dst_addrs, lb_indices, batch_size);
+  for (uint16_t i = 0; i < batch_size; i++)
+    pkts[i].batch_meta = lb_indices[i];
+}
+#endif
+
 int client_pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
                         uint16_t incoming_dev, pkt_set_state_t *local_state,
                         pkt_set_id_t *pkt_set_id);
@@ -278,7 +324,7 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
     ret = NULL;
 
   // Register backend expirator
-  if (!register_periodic_handler(PERIODIC_HANDLER_PERIOD, expire_backend))
+  if (!register_periodic_handler("expire backend", PERIODIC_HANDLER_PERIOD, expire_backend))
     ret = NULL;
 
 
@@ -346,37 +392,62 @@ nf_state_t *nf_init(vigor_time_t *validity_duration_out, char **lcores_out, bool
     ret = NULL;
   }
 
-  ip4_fib_t *fib = ip4_fib_get(WAN_DEVICE_ONE);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000001, 32, index1);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000002, 32, index2);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000301, 32, index5);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000401, 32, index6);
-
-  fib = ip4_fib_get(WAN_DEVICE_TWO);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000001, 32, index1);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000002, 32, index2);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000301, 32, index5);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000401, 32, index6);
+  if (ip4_fib_route_add(WAN_DEVICE_ONE, 0, 0, index0)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_ONE, 0, 32, index0)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_ONE, 0x76000001, 32, index1)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_ONE, 0x76000002, 32, index2)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_ONE, 0x0A000301, 32, index5)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_ONE, 0x0A000401, 32, index6)) ret = NULL;
+
+  if (ip4_fib_route_add(WAN_DEVICE_TWO, 0, 0, index0)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_TWO, 0, 32, index0)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_TWO, 0x76000001, 32, index1)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_TWO, 0x76000002, 32, index2)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_TWO, 0x0A000301, 32, index5)) ret = NULL;
+  if (ip4_fib_route_add(WAN_DEVICE_TWO, 0x0A000401, 32, index6)) ret = NULL;
   
-  fib = ip4_fib_get(LAN_DEVICE_ONE);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000001, 32, index3);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000002, 32, index4);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000301, 32, index5);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000401, 32, index6);
+  if (ip4_fib_route_add(LAN_DEVICE_ONE, 0, 0, index0)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_ONE, 0, 32, index0)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_ONE, 0x76000001, 32, index3)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_ONE, 0x76000002, 32, index4)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_ONE, 0x0A000301, 32, index5)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_ONE, 0x0A000401, 32, index6)) ret = NULL;
   
-  fib = ip4_fib_get(LAN_DEVICE_TWO);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 0, index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0, 32,index0);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000001, 32, index3);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x76000002, 32, index4);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000301, 32, index5);
-  ip4_fib_mtrie_route_add(&(fib->mtrie), 0x0A000401, 32, index6);
+  if (ip4_fib_route_add(LAN_DEVICE_TWO, 0, 0, index0)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_TWO, 0, 32, index0)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_TWO, 0x76000001, 32, index3)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_TWO, 0x76000002, 32, index4)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_TWO, 0x0A000301, 32, index5)) ret = NULL;
+  if (ip4_fib_route_add(LAN_DEVICE_TWO, 0x0A000401, 32, index6)) ret = NULL;
+
+  // IPv6 VIPs 2001:db8::1 and 2001:db8::2, other IPv6 packets are dropped
+  ret->cfg->ip6_fib_capacity = IP6_FIB_CAPACITY;
+  if (ip6_fib_init(ret->cfg->n_fib_table, ret->cfg->ip6_fib_capacity)) ret = NULL;
+  uint8_t ip6_any[16] = {0};
+  uint8_t ip6_vip[16] = {0x20, 0x01, 0x0d, 0xb8};
+  for (uint32_t i = 0; i < N_FIB_TABLE; i++) {
+    bool is_wan = i == WAN_DEVICE_ONE || i == WAN_DEVICE_TWO;
+    if (ip6_fib_route_add(i, ip6_any, 0, index0)) ret = NULL;
+    ip6_vip[15] = 1;
+    if (ip6_fib_route_add(i, ip6_vip, 128, is_wan ? index1 : index3)) ret = NULL;
+    ip6_vip[15] = 2;
+    if (ip6_fib_route_add(i, ip6_vip, 128, is_wan ? index2 : index4)) ret = NULL;
+  }
+
+#ifdef FIB_ROUTES_FILE
+  // Extra routes, adj indexes refer to the load-balances created above
+  for (uint32_t i = 0; i < N_FIB_TABLE; i++) {
+    if (ip4_fib_table_load(i, FIB_ROUTES_FILE) < 0) ret = NULL;
+  }
+#endif
+#ifdef FIB6_ROUTES_FILE
+  for (uint32_t i = 0; i < N_FIB_TABLE; i++) {
+    if (ip6_fib_table_load(i, FIB6_ROUTES_FILE) < 0) ret = NULL;
+  }
+#endif
+
+  // Route updates through the control channel, see control.h
+  if (!fib_control_register(N_FIB_TABLE)) ret = NULL;
 
   /* End of initializing fib-related stuff, not core functionality of the NF */
 
@@ -392,13 +463,19 @@ bool nf_pkt_parser(uint8_t *buffer, pkt_t *pkt) {
   uint8_t *ip_options;
   pkt->ipv4_header =
       nf_then_get_ipv4_header(pkt->ether_header, buffer, &ip_options);
-  if (pkt->ipv4_header == NULL) {
-    NF_DEBUG("Malformed IPv4, dropping");
-    return false;
+  pkt->ipv6_header = NULL;
+  if (pkt->ipv4_header != NULL) {
+    pkt->tcpudp_header =
+        nf_then_get_tcpudp_header(pkt->ipv4_header, buffer);
+  } else {
+    pkt->ipv6_header = nf_then_get_ipv6_header(pkt->ether_header, buffer);
+    if (pkt->ipv6_header == NULL) {
+      NF_DEBUG("Malformed IP, dropping");
+      return false;
+    }
+    pkt->tcpudp_header =
+        nf_then_get_ipv6_tcpudp_header(pkt->ipv6_header, buffer);
   }
-
-  pkt->tcpudp_header =
-      nf_then_get_tcpudp_header(pkt->ipv4_header, buffer);
   if (pkt->tcpudp_header == NULL) {
     NF_DEBUG("Not TCP/UDP, dropping");
     return false;
@@ -421,17 +498,16 @@ int nf_pkt_dispatcher(const pkt_t *pkt, uint16_t incoming_dev,
   if (incoming_dev == non_pkt_set_state->cfg->wan_device[0] ||
       incoming_dev == non_pkt_set_state->cfg->wan_device[1]) {
     *has_pkt_set_state = true;
+    get_src_ip_from_pkt(pkt, pkt_set_id->src_ip);
+    get_dst_ip_from_pkt(pkt, pkt_set_id->dst_ip);
     pkt_set_id->src_port = pkt->tcpudp_header->src_port;
     pkt_set_id->dst_port = pkt->tcpudp_header->dst_port;
-    pkt_set_id->src_ip = pkt->ipv4_header->src_addr;
-    pkt_set_id->dst_ip = pkt->ipv4_header->dst_addr;
-    pkt_set_id->protocol = pkt->ipv4_header->next_proto_id;
+    pkt_set_id->protocol = pkt_l4_proto(pkt);
 
     pkt_class = 0;
 
-    NF_DEBUG("Client pkt set id: port: [%x, %x], ip: [%x %x], proto: %x",
+    NF_DEBUG("Client pkt set id: port: [%x, %x], proto: %x",
              pkt_set_id->src_port, pkt_set_id->dst_port,
-             pkt_set_id->src_ip, pkt_set_id->dst_ip,
              pkt_set_id->protocol);
   // Heartbeat
   } else {
@@ -439,8 +515,7 @@ int nf_pkt_dispatcher(const pkt_t *pkt, uint16_t incoming_dev,
     pkt_set_id = NULL;
     pkt_class = 1;
 
-    NF_DEBUG("Heartbeat: ip: [%x %x], eth: [%s, %s]",
-             pkt->ipv4_header->src_addr, pkt->ipv4_header->dst_addr,
+    NF_DEBUG("Heartbeat: eth: [%s, %s]",
              nf_mac_to_str(&(pkt->ether_header->s_addr)), 
              nf_mac_to_str(&(pkt->ether_header->d_addr)) 
              );
@@ -455,20 +530,31 @@ int client_pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
                       
   /* Fib-related stuff, not core functionality of the NF */
 
-  if (pkt->ipv4_header->time_to_live == 1) drop_pkt(pkt);
+  if (get_hop_limit_from_pkt(pkt) == 1) drop_pkt(pkt);
   NF_DEBUG("Existing pkt set, backend id: %d", local_state->backend_id);
-  ip4_fib_mtrie_t *mtrie = &(ip4_fib_get(incoming_dev)->mtrie);
-  ip4_fib_mtrie_leaf_t leaf0;
-  // Remember here the dst_addr is in big endian
-  uint32_t le_dst_addr = RTE_STATIC_BSWAP32(pkt->ipv4_header->dst_addr);
-  NF_DEBUG("0x%08x\n", le_dst_addr);
-  leaf0 = ip4_fib_mtrie_lookup_step_one(mtrie, le_dst_addr);
-  leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,2);
-  leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,3);
+  uint32_t adj0;
+  if (pkt->ipv6_header) {
+    adj0 = ip6_fib_lookup(incoming_dev, pkt->ipv6_header->dst_addr);
+  } else {
+#ifdef PKT_BATCH_PREPARE
+    // Looked up in nf_pkt_batch_prepare()
+    adj0 = pkt->batch_meta;
+#else
+    ip4_fib_mtrie_t *mtrie = &(ip4_fib_get(incoming_dev)->mtrie);
+    ip4_fib_mtrie_leaf_t leaf0;
+    // Remember here the dst_addr is in big endian
+    uint32_t le_dst_addr = RTE_STATIC_BSWAP32(pkt->ipv4_header->dst_addr);
+    NF_DEBUG("0x%08x\n", le_dst_addr);
+    leaf0 = ip4_fib_mtrie_lookup_step_one(mtrie, le_dst_addr);
+    leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,2);
+    leaf0 = ip4_fib_mtrie_lookup_step(mtrie, leaf0, le_dst_addr,3);
+    adj0 = leaf0 >> 1;
+#endif
+  }
   const load_balance_t *lb0;
-  lb0 = load_balance_get(leaf0 >> 1);
+  lb0 = load_balance_get(adj0);
   const dpo_t *dpo0;
-  dpo0 = load_balance_get_bucket_i(lb0, 0);
+  dpo0 = load_balance_get_bucket_by_hash(lb0, pkt->hash);
   NF_DEBUG("Action: %u\n",dpo0->action);
   if (dpo0->action == DROP) {drop_pkt(pkt); return 0;}
   // Allocate another backend if assigned backend is expired
@@ -500,7 +586,7 @@ int client_pkt_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
     // which is skipped here.
 
     nfos_vector_borrow(non_pkt_set_state->backend_info, local_state->backend_id, (void **)&backend);
-    pkt->ipv4_header->type_of_service = (lb0->dscp & 0x3F) << 2;
+    set_dscp_of_pkt(pkt, lb0->dscp);
     send_pkt_to_backend(pkt, backend, non_pkt_set_state);
   }
   return 0;
@@ -513,7 +599,8 @@ int heartbeat_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
   vigor_time_t now = get_curr_time();
 
   // Backend not in the backend table, try to insert it
-  struct ip_addr src_ip = {.addr = pkt->ipv4_header->src_addr};
+  struct ip_addr src_ip;
+  get_src_ip_from_pkt(pkt, src_ip.addr);
   if (!nfos_map_get(non_pkt_set_state->backend_ip_to_backend_id, &src_ip,
                     &backend_id)) {
     int allocated = nfos_dchain_exp_allocate_new_index(non_pkt_set_state->backends, &backend_id, now);
@@ -526,7 +613,7 @@ int heartbeat_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
          == ABORT_HANDLER) {
         return ABORT_HANDLER;
       }
-      new_backend->ip = pkt->ipv4_header->src_addr;
+      memcpy(new_backend->ip, src_ip.addr, sizeof(new_backend->ip));
       new_backend->mac = pkt->ether_header->s_addr;
       new_backend->dev = incoming_dev;
 
@@ -563,7 +650,7 @@ int nf_unknown_pkt_set_handler(nf_state_t *non_pkt_set_state, pkt_t *pkt,
                                uint16_t incoming_dev, pkt_set_id_t *pkt_set_id) {
   // Allocate backend
   int backend_id = 0;
-  if (pkt->ipv4_header->time_to_live == 1) drop_pkt(pkt);
+  if (get_hop_limit_from_pkt(pkt) == 1) drop_pkt(pkt);
   int found = nfos_cht_find_preferred_available_backend(
       (uint64_t)get_hash_from_pkt(pkt), non_pkt_set_state->cht,
       non_pkt_set_state->backends, non_pkt_set_state->cfg->cht_height,
@@ -1,3 +1,5 @@
 #pragma once
 
 #define PKT_PROCESS_BATCHING
+// Route the packets of a batch with bulk FIB lookups
+#define PKT_BATCH_PREPARE
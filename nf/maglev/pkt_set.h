@@ -4,16 +4,16 @@
  * A packet set is only defined for client packets.
  */
 struct pkt_set_id {
+  // Src IP of the packet, IPv4 addresses are IPv4-mapped (see ip6.h)
+  uint8_t src_ip[16];
+  // Dst IP of the packet
+  uint8_t dst_ip[16];
   // Src port of the packet
   uint16_t src_port;
   // Dst port of the packet
   uint16_t dst_port;
-  // Src IP of the packet
-  uint32_t src_ip;
-  // Dst IP of the packet
-  uint32_t dst_ip;
-  // L4 port of the packet
-  uint8_t protocol;
+  // L4 protocol of the packet, 32 bits so that the id is made of five 64-bit words
+  uint32_t protocol;
 };
 
 bool pkt_set_id_eq(void* a, void* b);
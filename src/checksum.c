@@ -0,0 +1,99 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+
+#include "vigor/nf-log.h"
+
+#include "checksum.h"
+
+#define TX_CKSUM_OFFLOADS \
+  (DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM | DEV_TX_OFFLOAD_UDP_CKSUM)
+
+bool nfos_tx_cksum_offload = true;
+
+void cksum_device_conf(struct rte_eth_conf *device_conf, uint16_t device) {
+  struct rte_eth_dev_info dev_info;
+  if (rte_eth_dev_info_get(device, &dev_info) != 0 ||
+      (dev_info.tx_offload_capa & TX_CKSUM_OFFLOADS) != TX_CKSUM_OFFLOADS) {
+    // A packet can be sent to any device, e.g. when flooding
+    if (nfos_tx_cksum_offload) {
+      NF_INFO("Device %d has no TX checksum offload, computing checksums in software", device);
+    }
+    nfos_tx_cksum_offload = false;
+    return;
+  }
+  device_conf->txmode.offloads |= TX_CKSUM_OFFLOADS;
+}
+
+static void cksum_offload(pkt_t *pkt, rte_be16_t *cksum, uint64_t l4_flag) {
+  struct rte_mbuf *mbuf = pkt->mbuf;
+
+  if (pkt->ipv4_header) {
+    mbuf->l2_len = (uint8_t *)pkt->ipv4_header - rte_pktmbuf_mtod(mbuf, uint8_t *);
+    mbuf->l3_len = (pkt->ipv4_header->version_ihl & RTE_IPV4_HDR_IHL_MASK) *
+                  RTE_IPV4_IHL_MULTIPLIER;
+    mbuf->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM | l4_flag;
+    pkt->ipv4_header->hdr_checksum = 0;
+    // The NIC expects the pseudo-header checksum in the L4 header
+    if (cksum)
+      *cksum = rte_ipv4_phdr_cksum(pkt->ipv4_header, mbuf->ol_flags);
+  } else {
+    mbuf->l2_len = (uint8_t *)pkt->ipv6_header - rte_pktmbuf_mtod(mbuf, uint8_t *);
+    mbuf->l3_len = sizeof(struct rte_ipv6_hdr);
+    mbuf->ol_flags |= PKT_TX_IPV6 | l4_flag;
+    if (cksum)
+      *cksum = rte_ipv6_phdr_cksum(pkt->ipv6_header, mbuf->ol_flags);
+  }
+}
+
+// TCP/UDP checksum of a packet spanning several segments, the checksum field
+// must be zero
+static uint16_t l4_cksum_segs(pkt_t *pkt, uint16_t phdr_cksum) {
+  uint8_t *l4_header = (uint8_t *)pkt->tcpudp_header;
+  uint32_t l4_offset = l4_header - rte_pktmbuf_mtod(pkt->mbuf, uint8_t *);
+  uint32_t l4_len = pkt->ipv4_header ?
+    rte_be_to_cpu_16(pkt->ipv4_header->total_length) -
+      (l4_header - (uint8_t *)pkt->ipv4_header) :
+    rte_be_to_cpu_16(pkt->ipv6_header->payload_len);
+
+  uint16_t raw_cksum = 0;
+  rte_raw_cksum_mbuf(pkt->mbuf, l4_offset, l4_len, &raw_cksum);
+  uint32_t sum = (uint32_t)raw_cksum + phdr_cksum;
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  return ~sum;
+}
+
+void nfos_cksum_recompute(pkt_t *pkt) {
+  rte_be16_t *cksum = nfos_cksum_is_fragment(pkt) ? NULL : nfos_cksum_l4_field(pkt);
+  uint8_t proto = pkt->ipv4_header ? pkt->ipv4_header->next_proto_id : pkt->ipv6_header->proto;
+
+  if (nfos_tx_cksum_offload) {
+    uint64_t l4_flag = 0;
+    if (cksum)
+      l4_flag = proto == IPPROTO_TCP ? PKT_TX_TCP_CKSUM : PKT_TX_UDP_CKSUM;
+    cksum_offload(pkt, cksum, l4_flag);
+    return;
+  }
+
+  // Assumed by the checksum computations
+  if (cksum)
+    *cksum = 0;
+  if (pkt->ipv4_header) {
+    pkt->ipv4_header->hdr_checksum = 0;
+    if (cksum) {
+      *cksum = pkt->mbuf->nb_segs > 1 ?
+        l4_cksum_segs(pkt, rte_ipv4_phdr_cksum(pkt->ipv4_header, 0)) :
+        rte_ipv4_udptcp_cksum(pkt->ipv4_header, pkt->tcpudp_header);
+      nfos_cksum_fix_l4(cksum);
+    }
+    pkt->ipv4_header->hdr_checksum = rte_ipv4_cksum(pkt->ipv4_header);
+  } else if (cksum) {
+    *cksum = pkt->mbuf->nb_segs > 1 ?
+      l4_cksum_segs(pkt, rte_ipv6_phdr_cksum(pkt->ipv6_header, 0)) :
+      rte_ipv6_udptcp_cksum(pkt->ipv6_header, pkt->tcpudp_header);
+    nfos_cksum_fix_l4(cksum);
+  }
+}
@@ -9,40 +9,54 @@
 //     INDEX_SHIFT = DCHAIN_RESERVED
 // };
 
+// Free indexes moved to the global list from a per-partition list at once
+#define DCHAIN_STEAL_BATCH 8
+
 static struct mcslock_t *dchain_locks;
 static struct mcslock_t dchain_global_lock;
 static int ALLOC_LIST_HEAD, FREE_LIST_HEAD, GLOBAL_FREE_LIST_HEAD, INDEX_SHIFT, NUM_FREE_LISTS;
 
-void concurrent_dchain_impl_init(struct concurrent_dchain_cell *cells, int size, int num_cores)
+void concurrent_dchain_impl_init(struct concurrent_dchain_cell *cells, int size, int num_partitions)
 {
   ALLOC_LIST_HEAD = 0;
-  FREE_LIST_HEAD = num_cores << LIST_HEAD_PADDING;
-  GLOBAL_FREE_LIST_HEAD = (num_cores * 2) << LIST_HEAD_PADDING;
+  FREE_LIST_HEAD = num_partitions << LIST_HEAD_PADDING;
+  GLOBAL_FREE_LIST_HEAD = (num_partitions * 2) << LIST_HEAD_PADDING;
   INDEX_SHIFT = GLOBAL_FREE_LIST_HEAD + 1;
-  NUM_FREE_LISTS = num_cores;
+  NUM_FREE_LISTS = num_partitions;
 
   mcslock_init(&dchain_global_lock);
-  dchain_locks = calloc(num_cores, sizeof(struct mcslock_t));
-  for (int i = 0; i < num_cores; i++)
+  dchain_locks = calloc(num_partitions, sizeof(struct mcslock_t));
+  for (int i = 0; i < num_partitions; i++)
     mcslock_init(&(dchain_locks[i]));
 
-  // Init per-core lists of allocated index
+  // Init per-partition lists of allocated index, one per timeout class
   struct concurrent_dchain_cell* al_head;
   int i = ALLOC_LIST_HEAD;
-  for (; i < FREE_LIST_HEAD; i += (1 << LIST_HEAD_PADDING))
+  for (; i < FREE_LIST_HEAD; i++)
   {
     al_head = cells + i;
     al_head->prev = i;
     al_head->next = i;
-    al_head->list_ind = i - ALLOC_LIST_HEAD;
+    al_head->list_ind = (i - ALLOC_LIST_HEAD) & ~(NUM_TIMEOUT_CLASSES - 1);
+    al_head->timeout_class = (i - ALLOC_LIST_HEAD) & (NUM_TIMEOUT_CLASSES - 1);
   }
 
-  // Init per-core lists of free index
+  // Partitions get size / num_partitions indexes, the first size % num_partitions
+  // ones get one more
+  int per_partition = size / num_partitions;
+  int remainder = size % num_partitions;
+
+  // Init per-partition lists of free index
   struct concurrent_dchain_cell* fl_head;
   for (i = FREE_LIST_HEAD; i < GLOBAL_FREE_LIST_HEAD; i += (1 << LIST_HEAD_PADDING))
   {
+    int partition = (i - FREE_LIST_HEAD) >> LIST_HEAD_PADDING;
     fl_head = cells + i;
-    fl_head->next = INDEX_SHIFT + ((size / num_cores) * ((i - FREE_LIST_HEAD) >> LIST_HEAD_PADDING));
+    if (per_partition == 0 && partition >= remainder)
+      fl_head->next = i;
+    else
+      fl_head->next = INDEX_SHIFT + per_partition * partition +
+                     (partition < remainder ? partition : remainder);
     fl_head->prev = fl_head->next;
     fl_head->list_ind = i - FREE_LIST_HEAD;
   }
@@ -53,12 +67,13 @@ void concurrent_dchain_impl_init(struct concurrent_dchain_cell *cells, int size,
   glb_fl_head->prev = glb_fl_head->next;
   glb_fl_head->list_ind = -1;
 
-  // Partition indexes among per-core lists of free index
-  int core_id;
-  for (i = INDEX_SHIFT, core_id = 0; i < size + INDEX_SHIFT; i += size / num_cores, core_id++)
+  // Partition indexes among per-partition lists of free index
+  int partition;
+  for (i = INDEX_SHIFT, partition = 0; i < size + INDEX_SHIFT; partition++)
   {
+    int count = per_partition + (partition < remainder);
     int j;
-    for (j = 0; (j < size / num_cores - 1) && (i + j < size + INDEX_SHIFT - 1); j++)
+    for (j = 0; j < count - 1; j++)
     {
         struct concurrent_dchain_cell* current = cells + i + j;
         current->next = i + j + 1;
@@ -72,7 +87,7 @@ void concurrent_dchain_impl_init(struct concurrent_dchain_cell *cells, int size,
         current_related->map_chain_next = -1;
     }
     struct concurrent_dchain_cell* last = cells + i + j;
-    last->next = FREE_LIST_HEAD + (core_id << LIST_HEAD_PADDING);
+    last->next = FREE_LIST_HEAD + (partition << LIST_HEAD_PADDING);
     last->prev = last->next;
     last->time = INT64_MAX;
     last->list_ind = -1;
@@ -81,6 +96,7 @@ void concurrent_dchain_impl_init(struct concurrent_dchain_cell *cells, int size,
     // temp hack to support related packet sets
     struct concurrent_dchain_cell* last_related = last + size;
     last_related->map_chain_next = -1;
+    i += count;
   }
 
 }
@@ -95,12 +111,12 @@ int concurrent_dchain_impl_has_free_indexes(struct concurrent_dchain_cell *cells
 }
 
 int concurrent_dchain_impl_allocate_new_index(struct concurrent_dchain_cell *cells, int *index, int core_id,
-                                              vigor_time_t time) 
+                                              vigor_time_t time, int timeout_class) 
 {
   int al_head_ind = core_id << LIST_HEAD_PADDING;
 
   struct concurrent_dchain_cell* fl_head = cells + FREE_LIST_HEAD + al_head_ind;
-  struct concurrent_dchain_cell* al_head = cells + ALLOC_LIST_HEAD + al_head_ind;
+  struct concurrent_dchain_cell* al_head = cells + ALLOC_LIST_HEAD + al_head_ind + timeout_class;
   struct mcsqnode_t qnode;
   mcslock_lock(&(dchain_locks[core_id]), &qnode);
   int allocated = fl_head->next;
@@ -116,9 +132,10 @@ int concurrent_dchain_impl_allocate_new_index(struct concurrent_dchain_cell *cel
   mcslock_unlock(&(dchain_locks[core_id]), &qnode);
 
   // Add the link to the "new"-end "alloc" chain.
-  allocp->next = ALLOC_LIST_HEAD + al_head_ind;
+  allocp->next = ALLOC_LIST_HEAD + al_head_ind + timeout_class;
   allocp->prev = al_head->prev;
   allocp->list_ind = al_head_ind;
+  allocp->timeout_class = timeout_class;
   allocp->time = time;
   struct concurrent_dchain_cell* alloc_head_prevp = cells + al_head->prev;
   alloc_head_prevp->next = allocated;
@@ -128,7 +145,8 @@ int concurrent_dchain_impl_allocate_new_index(struct concurrent_dchain_cell *cel
   return 1;
 }
 
-// Try to move a free index from a local list to the global list.
+// Try to move a free index from a local list to the global list, the caller
+// holds the lock of the local list.
 // Returns 1 if succeeds
 static inline int concurrent_dchain_impl_fill_global_free_list(struct concurrent_dchain_cell *cells, int core_id) 
 {
@@ -159,12 +177,12 @@ static inline int concurrent_dchain_impl_fill_global_free_list(struct concurrent
 }
 
 int concurrent_dchain_impl_allocate_new_index_global(struct concurrent_dchain_cell *cells, int *index, int core_id,
-                                                     vigor_time_t time) 
+                                                     vigor_time_t time, int timeout_class) 
 {
   int al_head_ind = core_id << LIST_HEAD_PADDING;
 
   struct concurrent_dchain_cell* glb_fl_head = cells + GLOBAL_FREE_LIST_HEAD;
-  struct concurrent_dchain_cell* al_head = cells + ALLOC_LIST_HEAD + al_head_ind;
+  struct concurrent_dchain_cell* al_head = cells + ALLOC_LIST_HEAD + al_head_ind + timeout_class;
   int allocated;
   int ret = 0;
 
@@ -175,22 +193,22 @@ int concurrent_dchain_impl_allocate_new_index_global(struct concurrent_dchain_ce
   // the global free list is empty
   if (allocated == GLOBAL_FREE_LIST_HEAD)
   {
-    // Grab all the per-core locks...
-    struct mcsqnode_t qnodes[NUM_FREE_LISTS];
-    for (int i = 0; i < NUM_FREE_LISTS; i++)
-      mcslock_lock(&(dchain_locks[i]), &(qnodes[i]));
-
-    // Try to take one index from each of the per-core free lists
-    for (int i = 0; i < NUM_FREE_LISTS; i++)
-      concurrent_dchain_impl_fill_global_free_list(cells, i);
+    // Steal a few indexes from the next partition having some, holding one
+    // per-partition lock at a time. The own list of the partition comes last.
+    for (int n = 1; n <= NUM_FREE_LISTS && allocated == GLOBAL_FREE_LIST_HEAD; n++) {
+      int victim = (core_id + n) % NUM_FREE_LISTS;
+      struct mcsqnode_t qnode;
+      mcslock_lock(&(dchain_locks[victim]), &qnode);
+      for (int i = 0; i < DCHAIN_STEAL_BATCH; i++) {
+        if (!concurrent_dchain_impl_fill_global_free_list(cells, victim))
+          break;
+      }
+      mcslock_unlock(&(dchain_locks[victim]), &qnode);
+      allocated = glb_fl_head->next;
+    }
 
-    // retry
-    allocated = glb_fl_head->next;
     if (allocated != GLOBAL_FREE_LIST_HEAD)
       ret = 1;
-
-    for (int i = 0; i < NUM_FREE_LISTS; i++)
-      mcslock_unlock(&(dchain_locks[i]), &(qnodes[i]));
   } else {
     ret = 1;
   }
@@ -207,9 +225,10 @@ int concurrent_dchain_impl_allocate_new_index_global(struct concurrent_dchain_ce
   mcslock_unlock(&dchain_global_lock, &glb_qnode);
 
   // Add the link to the "new"-end "alloc" chain.
-  allocp->next = ALLOC_LIST_HEAD + al_head_ind;
+  allocp->next = ALLOC_LIST_HEAD + al_head_ind + timeout_class;
   allocp->prev = al_head->prev;
   allocp->list_ind = al_head_ind;
+  allocp->timeout_class = timeout_class;
   allocp->time = time;
   struct concurrent_dchain_cell* alloc_head_prevp = cells + al_head->prev;
   alloc_head_prevp->next = allocated;
@@ -232,7 +251,7 @@ int concurrent_dchain_impl_free_index(struct concurrent_dchain_cell *cells, int
   int freed_next = freedp->next;
   // The index is already free.
   if (freed_next == freed_prev) {
-    if (freed_prev != ALLOC_LIST_HEAD + al_head_ind) {
+    if (freed_prev != ALLOC_LIST_HEAD + al_head_ind + freedp->timeout_class) {
       return 0;
     } else {
     }
@@ -262,9 +281,10 @@ int concurrent_dchain_impl_free_index(struct concurrent_dchain_cell *cells, int
   return 1;
 }
 
-int concurrent_dchain_impl_get_oldest_index(struct concurrent_dchain_cell *cells, int *index, int core_id)
+int concurrent_dchain_impl_get_oldest_index(struct concurrent_dchain_cell *cells, int *index, int core_id,
+                                            int timeout_class)
 {
-  int al_head_ind = core_id << LIST_HEAD_PADDING;
+  int al_head_ind = (core_id << LIST_HEAD_PADDING) + timeout_class;
 
   struct concurrent_dchain_cell *al_head = cells + ALLOC_LIST_HEAD + al_head_ind;
   // No allocated indexes.
@@ -278,11 +298,11 @@ int concurrent_dchain_impl_get_oldest_index(struct concurrent_dchain_cell *cells
 }
 
 int concurrent_dchain_impl_rejuvenate_index(struct concurrent_dchain_cell *cells, int index, int core_id,
-                                            vigor_time_t time)
+                                            vigor_time_t time, int timeout_class)
 {
   int al_head_ind = core_id << LIST_HEAD_PADDING;
 
-  struct concurrent_dchain_cell *al_head = cells + ALLOC_LIST_HEAD + al_head_ind;
+  struct concurrent_dchain_cell *al_head = cells + ALLOC_LIST_HEAD + al_head_ind + timeout_class;
   int lifted = index + INDEX_SHIFT;
   struct concurrent_dchain_cell *liftedp = cells + lifted;
   int lifted_next = liftedp->next;
@@ -292,9 +312,11 @@ int concurrent_dchain_impl_rejuvenate_index(struct concurrent_dchain_cell *cells
     return 0;
   // The index is not allocated.
   if (lifted_next == lifted_prev) {
-    if (lifted_next != ALLOC_LIST_HEAD + al_head_ind) {
+    if (lifted_next != ALLOC_LIST_HEAD + al_head_ind + liftedp->timeout_class) {
       return 0;
-    } else {
+    } else if (liftedp->timeout_class == timeout_class) {
+      // Only index of the list
+      liftedp->time = time;
       return 1;
     }
   } else {
@@ -309,8 +331,9 @@ int concurrent_dchain_impl_rejuvenate_index(struct concurrent_dchain_cell *cells
   int al_head_prev = al_head->prev;
 
   // Link it at the very end - right before the special link.
-  liftedp->next = ALLOC_LIST_HEAD + al_head_ind;
+  liftedp->next = ALLOC_LIST_HEAD + al_head_ind + timeout_class;
   liftedp->prev = al_head_prev;
+  liftedp->timeout_class = timeout_class;
   liftedp->time = time;
 
   struct concurrent_dchain_cell *al_head_prevp = cells + al_head_prev;
@@ -333,7 +356,7 @@ int concurrent_dchain_impl_is_index_allocated(struct concurrent_dchain_cell *cel
   }
   int result;
   if (lifted_next == lifted_prev) {
-    if (lifted_next != ALLOC_LIST_HEAD + al_head_ind) {
+    if (lifted_next != ALLOC_LIST_HEAD + al_head_ind + liftedp->timeout_class) {
       return 0;
     } else {
       return 1;
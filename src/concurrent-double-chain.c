@@ -16,11 +16,9 @@ struct ConcurrentDoubleChain {
   struct concurrent_dchain_cell* cells;
 };
 
-int concurrent_dchain_allocate(int index_range, struct ConcurrentDoubleChain** chain_out)
+int concurrent_dchain_allocate(int index_range, int num_partitions,
+                               struct ConcurrentDoubleChain** chain_out)
 {
-  // the last core is not used for data plane
-  int num_cores = rte_lcore_count() - 1;
-
   struct ConcurrentDoubleChain* old_chain_out = *chain_out;
   struct ConcurrentDoubleChain* chain_alloc = (struct ConcurrentDoubleChain*) malloc(sizeof(struct ConcurrentDoubleChain));
   if (chain_alloc == NULL) return 0;
@@ -28,7 +26,7 @@ int concurrent_dchain_allocate(int index_range, struct ConcurrentDoubleChain** c
 
   // temp hack to support related packet sets
   struct concurrent_dchain_cell* cells_alloc =
-    (struct concurrent_dchain_cell*) rte_malloc(NULL, sizeof (struct concurrent_dchain_cell)*(index_range * 2 + (num_cores << LIST_HEAD_PADDING) * 2 + 1), 0);
+    (struct concurrent_dchain_cell*) rte_malloc(NULL, sizeof (struct concurrent_dchain_cell)*(index_range * 2 + (num_partitions << LIST_HEAD_PADDING) * 2 + 1), 0);
   if (cells_alloc == NULL) {
     free(chain_alloc);
     *chain_out = old_chain_out;
@@ -36,7 +34,7 @@ int concurrent_dchain_allocate(int index_range, struct ConcurrentDoubleChain** c
   }
   (*chain_out)->cells = cells_alloc;
 
-  concurrent_dchain_impl_init((*chain_out)->cells, index_range, num_cores);
+  concurrent_dchain_impl_init((*chain_out)->cells, index_range, num_partitions);
   return 1;
 }
 
@@ -48,12 +46,18 @@ int concurrent_dchain_has_free_indexes(struct ConcurrentDoubleChain* chain,
 
 int concurrent_dchain_allocate_new_index(struct ConcurrentDoubleChain* chain,
                                          int *index_out, vigor_time_t time,
-                                         int partition)
+                                         int partition, int timeout_class,
+                                         vigor_time_t timeout)
 {
-  int ret = concurrent_dchain_impl_allocate_new_index(chain->cells, index_out, partition, time);
+  int ret = concurrent_dchain_impl_allocate_new_index(chain->cells, index_out, partition, time,
+                                                      timeout_class);
   // try to get index from the global pool if local pool is empty
   if (!ret) {
-    ret = concurrent_dchain_impl_allocate_new_index_global(chain->cells, index_out, partition, time);
+    ret = concurrent_dchain_impl_allocate_new_index_global(chain->cells, index_out, partition, time,
+                                                           timeout_class);
+  }
+  if (ret) {
+    concurrent_dchain_impl_cell_out(chain->cells, *index_out)->timeout = timeout;
   }
 
   return ret;
@@ -61,20 +65,37 @@ int concurrent_dchain_allocate_new_index(struct ConcurrentDoubleChain* chain,
 
 int concurrent_dchain_rejuvenate_index(struct ConcurrentDoubleChain* chain,
                                        int index, vigor_time_t time,
-                                       int partition)
+                                       int partition, int timeout_class)
+{
+  if (timeout_class < 0)
+    timeout_class = concurrent_dchain_impl_cell_out(chain->cells, index)->timeout_class;
+  int ret = concurrent_dchain_impl_rejuvenate_index(chain->cells, index, partition, time,
+                                                    timeout_class);
+  return ret;
+}
+
+int concurrent_dchain_set_timeout(struct ConcurrentDoubleChain* chain,
+                                  int index, vigor_time_t time,
+                                  int partition, int timeout_class,
+                                  vigor_time_t timeout)
 {
-  int ret = concurrent_dchain_impl_rejuvenate_index(chain->cells, index, partition, time);
+  int ret = concurrent_dchain_impl_rejuvenate_index(chain->cells, index, partition, time,
+                                                    timeout_class);
+  if (ret) {
+    concurrent_dchain_impl_cell_out(chain->cells, index)->timeout = timeout;
+  }
   return ret;
 }
 
 int concurrent_dchain_expire_one_index(struct ConcurrentDoubleChain* chain,
                                        int* index_out, vigor_time_t time,
-                                       int partition)
+                                       int partition, int timeout_class)
 {
-  int has_ind = concurrent_dchain_impl_get_oldest_index(chain->cells, index_out, partition);
+  int has_ind = concurrent_dchain_impl_get_oldest_index(chain->cells, index_out, partition,
+                                                        timeout_class);
   if (has_ind) {
     struct concurrent_dchain_cell *cell = concurrent_dchain_impl_cell_out(chain->cells, *index_out);
-    if (cell->time < time) {
+    if (cell->time + cell->timeout < time) {
       int rez = concurrent_dchain_impl_free_index(chain->cells, *index_out, partition);
       return rez;
     }
@@ -85,12 +106,13 @@ int concurrent_dchain_expire_one_index(struct ConcurrentDoubleChain* chain,
 
 int concurrent_dchain_has_expired_index(struct ConcurrentDoubleChain* chain,
                                        int* index_out, vigor_time_t time,
-                                       int partition)
+                                       int partition, int timeout_class)
 {
-  int has_ind = concurrent_dchain_impl_get_oldest_index(chain->cells, index_out, partition);
+  int has_ind = concurrent_dchain_impl_get_oldest_index(chain->cells, index_out, partition,
+                                                        timeout_class);
   if (has_ind) {
     struct concurrent_dchain_cell *cell = concurrent_dchain_impl_cell_out(chain->cells, *index_out);
-    if (cell->time < time) {
+    if (cell->time + cell->timeout < time) {
       return 1;
     }
   }
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+#include "vigor/nf-log.h"
+
+#include "control.h"
+#include "rlu-wrapper.h"
+#include "timer.h"
+
+// Room for the replies of a batch, "error " and a newline included
+#define CONTROL_BATCH_REPLIES_SIZE (CONTROL_BATCH_SIZE * (CONTROL_REPLY_SIZE + 8))
+
+struct control_command {
+  const char *name;
+  control_cmd_handler_t handler;
+};
+
+struct control_request {
+  control_cmd_handler_t handler;
+  const char *args;
+};
+
+struct control_client {
+  int fd;
+  // The client closed its end, serve its pending requests and close
+  bool eof;
+  char in[CONTROL_BATCH_SIZE * CONTROL_LINE_SIZE];
+  size_t in_len;
+  char out[4 * CONTROL_BATCH_REPLIES_SIZE];
+  size_t out_len;
+};
+
+static struct control_command commands[CONTROL_MAX_COMMANDS];
+static int num_commands;
+static struct control_client *clients[CONTROL_MAX_CLIENTS];
+static int num_clients;
+static int listen_fd = -1;
+
+bool register_control_command(const char *name, control_cmd_handler_t handler) {
+  if (num_commands == CONTROL_MAX_COMMANDS || strlen(name) == 0 || strchr(name, ' '))
+    return false;
+  for (int i = 0; i < num_commands; i++) {
+    if (!strcmp(commands[i].name, name))
+      return false;
+  }
+  commands[num_commands++] = (struct control_command) {name, handler};
+  return true;
+}
+
+static control_cmd_handler_t find_command(const char *name) {
+  for (int i = 0; i < num_commands; i++) {
+    if (!strcmp(commands[i].name, name))
+      return commands[i].handler;
+  }
+  return NULL;
+}
+
+bool control_channel_init(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    NF_INFO("Control socket path %s is too long", path);
+    return false;
+  }
+  strcpy(addr.sun_path, path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0)
+    return false;
+  unlink(path);
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(listen_fd, CONTROL_MAX_CLIENTS)) {
+    NF_INFO("Cannot listen on control socket %s: %s", path, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+
+  NF_INFO("Control channel listening on %s, %d commands", path, num_commands);
+  return true;
+}
+
+static void close_client(int i) {
+  close(clients[i]->fd);
+  free(clients[i]);
+  clients[i] = clients[--num_clients];
+}
+
+static void accept_clients() {
+  while (num_clients < CONTROL_MAX_CLIENTS) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+    struct control_client *client = malloc(sizeof(struct control_client));
+    if (client == NULL) {
+      close(fd);
+      return;
+    }
+    client->fd = fd;
+    client->eof = false;
+    client->in_len = 0;
+    client->out_len = 0;
+    clients[num_clients++] = client;
+  }
+}
+
+//   @returns false if the client is gone.
+static bool flush_client(struct control_client *client) {
+  size_t sent = 0;
+  while (sent < client->out_len) {
+    ssize_t n = send(client->fd, client->out + sent, client->out_len - sent,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return false;
+      break;
+    }
+    sent += n;
+  }
+  memmove(client->out, client->out + sent, client->out_len - sent);
+  client->out_len -= sent;
+  return true;
+}
+
+// Run requests in one RLU write transaction and buffer their replies
+static void run_batch(nf_state_t *non_pkt_set_state, struct control_client *client,
+                      struct control_request *requests, int count) {
+  rlu_thread_data_t *rlu_data = get_rlu_thread_data();
+  char replies[CONTROL_BATCH_SIZE][CONTROL_REPLY_SIZE];
+  int results[CONTROL_BATCH_SIZE];
+
+  nfos_timer_tick();
+
+retry:
+  RLU_READER_LOCK(rlu_data);
+  for (int i = 0; i < count; i++) {
+    replies[i][0] = '\0';
+    if (requests[i].handler == NULL) {
+      snprintf(replies[i], CONTROL_REPLY_SIZE, "unknown command");
+      results[i] = 1;
+      continue;
+    }
+    results[i] = requests[i].handler(non_pkt_set_state, requests[i].args, replies[i],
+                                     CONTROL_REPLY_SIZE);
+    if (results[i] == ABORT_HANDLER) {
+      nfos_abort_txn(rlu_data);
+      goto retry;
+    }
+  }
+  if (!RLU_READER_UNLOCK(rlu_data)) {
+    nfos_abort_txn(rlu_data);
+    goto retry;
+  }
+
+  for (int i = 0; i < count; i++) {
+    replies[i][CONTROL_REPLY_SIZE - 1] = '\0';
+    client->out_len += sprintf(client->out + client->out_len, "%s%s%s\n",
+                               results[i] ? "error" : "ok", replies[i][0] ? " " : "",
+                               replies[i]);
+  }
+}
+
+// Run the complete request lines of a client in batches, while there is room
+// for their replies
+//   @returns false if the client sent a line that is too long.
+static bool serve_requests(nf_state_t *non_pkt_set_state, struct control_client *client) {
+  size_t consumed = 0;
+  bool ok = true;
+
+  while (sizeof(client->out) - client->out_len >= CONTROL_BATCH_REPLIES_SIZE) {
+    struct control_request requests[CONTROL_BATCH_SIZE];
+    int count = 0;
+    size_t end = consumed;
+    while (count < CONTROL_BATCH_SIZE) {
+      char *line = client->in + end;
+      char *newline = memchr(line, '\n', client->in_len - end);
+      if (newline == NULL) {
+        ok = client->in_len - end < CONTROL_LINE_SIZE;
+        break;
+      }
+      end = newline + 1 - client->in;
+      if (newline - line >= CONTROL_LINE_SIZE) {
+        ok = false;
+        break;
+      }
+
+      *newline = '\0';
+      if (newline > line && newline[-1] == '\r')
+        newline[-1] = '\0';
+      char *args = line + strcspn(line, " ");
+      if (*args)
+        *args++ = '\0';
+      // Skip empty lines
+      if (*line)
+        requests[count++] = (struct control_request) {find_command(line), args};
+    }
+    if (count)
+      run_batch(non_pkt_set_state, client, requests, count);
+    consumed = end;
+    if (count < CONTROL_BATCH_SIZE || !ok)
+      break;
+  }
+
+  memmove(client->in, client->in + consumed, client->in_len - consumed);
+  client->in_len -= consumed;
+  return ok;
+}
+
+static bool can_read(struct control_client *client) {
+  return !client->eof && client->in_len < sizeof(client->in) &&
+         sizeof(client->out) - client->out_len >= CONTROL_BATCH_REPLIES_SIZE;
+}
+
+//   @returns false if the client is done or gone.
+static bool serve_client(nf_state_t *non_pkt_set_state, struct control_client *client,
+                         short revents) {
+  if ((revents & POLLOUT) && !flush_client(client))
+    return false;
+
+  if ((revents & (POLLIN | POLLHUP | POLLERR)) && can_read(client)) {
+    ssize_t n = recv(client->fd, client->in + client->in_len,
+                     sizeof(client->in) - client->in_len, MSG_DONTWAIT);
+    if (n > 0)
+      client->in_len += n;
+    else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      client->eof = true;
+  }
+
+  if (!serve_requests(non_pkt_set_state, client)) {
+    NF_INFO("Control channel: request line too long, closing client");
+    return false;
+  }
+  if (!flush_client(client))
+    return false;
+
+  // Requests left wait for room for their replies
+  return !client->eof || client->out_len > 0 || memchr(client->in, '\n', client->in_len);
+}
+
+void control_channel_serve(nf_state_t *non_pkt_set_state, uint64_t timeout_us) {
+  if (listen_fd < 0) {
+    rte_delay_us_sleep(timeout_us);
+    return;
+  }
+
+  uint64_t hz = rte_get_timer_hz();
+  uint64_t deadline = rte_get_timer_cycles() + timeout_us * hz / 1000000;
+  while (1) {
+    uint64_t now = rte_get_timer_cycles();
+    if (now >= deadline)
+      return;
+    uint64_t remaining_us = (deadline - now) * 1000000 / hz;
+    struct timespec timeout = {
+      .tv_sec = remaining_us / 1000000,
+      .tv_nsec = (remaining_us % 1000000) * 1000,
+    };
+
+    struct pollfd fds[1 + CONTROL_MAX_CLIENTS];
+    fds[0] = (struct pollfd) {
+      .fd = listen_fd, .events = num_clients < CONTROL_MAX_CLIENTS ? POLLIN : 0,
+    };
+    for (int i = 0; i < num_clients; i++) {
+      fds[1 + i] = (struct pollfd) {
+        .fd = clients[i]->fd,
+        .events = (can_read(clients[i]) ? POLLIN : 0) | (clients[i]->out_len ? POLLOUT : 0),
+      };
+    }
+
+    int nfds = 1 + num_clients;
+    if (ppoll(fds, nfds, &timeout, NULL) <= 0)
+      continue;
+
+    // Backwards since closing a client moves the last one in its place
+    for (int i = nfds - 2; i >= 0; i--) {
+      if (fds[1 + i].revents && !serve_client(non_pkt_set_state, clients[i], fds[1 + i].revents))
+        close_client(i);
+    }
+    if (fds[0].revents & POLLIN)
+      accept_clients();
+  }
+}
@@ -9,6 +9,8 @@
 #include "nf.h"
 #include "data-plane.h"
 #include "pkt-set-manager.h"
+#include "partition-map.h"
+#include "pkt-set-log.h"
 #include "rlu-wrapper.h"
 
 #include "nf-log.h"
@@ -16,6 +18,9 @@
 RTE_DEFINE_PER_LCORE(uint16_t, dst_device);
 static pkt_handler_t *pkt_handlers;
 
+uint64_t multicast_groups[MAX_MULTICAST_GROUPS];
+static int num_multicast_groups;
+
 bool _register_pkt_handlers(pkt_handler_t *handlers) {
   pkt_handlers = handlers;
   return true;
@@ -24,10 +29,12 @@ bool _register_pkt_handlers(pkt_handler_t *handlers) {
 #define MAX_BATCH 32
 
 /*
- * Utils for rolling back packet set state upon aborts
+ * Utils for rolling back packet set state upon aborts, whole states are
+ * copied unless the writes are logged field by field (see pkt-set-log.h)
  */
 #ifdef MUTABLE_PKT_SET_STATE
 #ifdef PKT_PROCESS_BATCHING
+#ifndef PKT_SET_STATE_FIELD_LOG
 typedef struct {
   uint16_t num_logged;
   pkt_set_state_t states[MAX_BATCH];
@@ -35,22 +42,31 @@ typedef struct {
 } pkt_set_state_log_t;
 
 RTE_DEFINE_PER_LCORE(pkt_set_state_log_t, pkt_set_state_log);
+#endif
 
 static inline void reset_log_pkt_set_state() {
+#ifndef PKT_SET_STATE_FIELD_LOG
   pkt_set_state_log_t *log = &RTE_PER_LCORE(pkt_set_state_log);
   log->num_logged = 0;
+#endif
+  pkt_set_log_reset();
 }
 
 static inline void log_one_pkt_set_state(pkt_set_state_t *state) {
+#ifdef PKT_SET_STATE_FIELD_LOG
+  pkt_set_log_object(state, sizeof(pkt_set_state_t));
+#else
   pkt_set_state_log_t *log = &RTE_PER_LCORE(pkt_set_state_log);
   uint16_t num_logged = log->num_logged;
   log->num_logged++;
   pkt_set_state_t *log_elem = log->states + num_logged;
   log->states_main_copy[num_logged] = state;
   memcpy(log_elem, state, sizeof(pkt_set_state_t));
+#endif
 }
 
 static inline void rollback_pkt_set_states() {
+#ifndef PKT_SET_STATE_FIELD_LOG
   pkt_set_state_log_t *log = &RTE_PER_LCORE(pkt_set_state_log);
   uint16_t num_logged = log->num_logged;
   for (uint16_t i = 0; i < num_logged; i++) {
@@ -58,20 +74,32 @@ static inline void rollback_pkt_set_states() {
     pkt_set_state_t *main_copy = log->states_main_copy[i];
     memcpy(main_copy, logged, sizeof(pkt_set_state_t));
   }
+#endif
+  pkt_set_log_rollback();
 }
 
 #else
 
+#ifndef PKT_SET_STATE_FIELD_LOG
 RTE_DEFINE_PER_LCORE(pkt_set_state_t, pkt_set_state_log);
+#endif
 
 static inline void log_pkt_set_state(pkt_set_state_t *state) {
+  pkt_set_log_reset();
+#ifdef PKT_SET_STATE_FIELD_LOG
+  pkt_set_log_object(state, sizeof(pkt_set_state_t));
+#else
   pkt_set_state_t *log = &RTE_PER_LCORE(pkt_set_state_log);
   memcpy(log, state, sizeof(pkt_set_state_t));
+#endif
 }
 
 static inline void rollback_pkt_set_state(pkt_set_state_t *state) {
+#ifndef PKT_SET_STATE_FIELD_LOG
   pkt_set_state_t *log = &RTE_PER_LCORE(pkt_set_state_log);
   memcpy(state, log, sizeof(pkt_set_state_t));
+#endif
+  pkt_set_log_rollback();
 }
 #endif
 #endif
@@ -80,36 +108,103 @@ static inline void rollback_pkt_set_state(pkt_set_state_t *state) {
 /*
  * Packet processing
  */
-#ifdef PKT_PROCESS_BATCHING
-uint16_t process_pkt(struct rte_mbuf **mbufs, uint16_t *dst_devices, uint16_t batch_size,
-                     vigor_time_t now, uint16_t pkt_set_partition,
-                     nf_state_t *non_pkt_set_state) {
 
-  pkt_t packet[MAX_BATCH]; 
+// Packet parsed and dispatched, ready for the packet handlers
+struct parsed_pkt {
+  pkt_t packet;
+  pkt_set_id_t pkt_set_id;
+  int pkt_class;
+  bool has_pkt_set_state;
+};
+
+// Stateless half of packet processing, false if the packet does not parse
+static inline bool parse_pkt(struct rte_mbuf *mbuf, struct parsed_pkt *parsed,
+                             nf_state_t *non_pkt_set_state) {
+  uint8_t *buffer = rte_pktmbuf_mtod(mbuf, uint8_t*);
+  uint16_t buffer_length = mbuf->data_len;
+  pkt_t *packet = &parsed->packet;
+
+  // temp hack
+  // Headers are parsed in the first segment
+  uint32_t buffer_length_u32 = buffer_length;
+  packet_state_total_length(buffer, &buffer_length_u32);
+  // TODO: pass pkt_len explicitly to nf_pkt_parser
+  packet->len = mbuf->pkt_len;
+  packet->hash = mbuf->hash.rss;
+  packet->mbuf = mbuf;
+  bool parse_res = nf_pkt_parser(buffer, packet);
+  nf_return_all_chunks(buffer);
+  if (!parse_res)
+    return false;
+
+  parsed->pkt_class = nf_pkt_dispatcher(packet, mbuf->port, &parsed->pkt_set_id,
+                                        &parsed->has_pkt_set_state, non_pkt_set_state);
+  return true;
+}
+
+#ifdef PIPELINE
+uint16_t pipeline_pkt_meta_size() {
+  return RTE_ALIGN_CEIL(sizeof(struct parsed_pkt), RTE_MBUF_PRIV_ALIGN);
+}
+#endif
+
+#ifdef PKT_PROCESS_BATCHING
+// Parse results of a batch, all the packets come from the same device
+struct pkt_batch {
+  pkt_t packet[MAX_BATCH];
   pkt_set_id_t pkt_set_id[MAX_BATCH];
+  uint16_t pkt_set_partition[MAX_BATCH];
   bool parse_res[MAX_BATCH];
   bool has_pkt_set_state[MAX_BATCH];
   int pkt_class[MAX_BATCH];
-
-  // All packets in a batch comes from the same device
-  uint16_t device = mbufs[0]->port;
+};
+
+// Stateless half of batch processing
+static inline void parse_pkt_batch(struct rte_mbuf **mbufs, uint16_t batch_size, uint16_t device,
+                                   struct pkt_batch *batch, nf_state_t *non_pkt_set_state) {
+  pkt_t *packet = batch->packet;
+  pkt_set_id_t *pkt_set_id = batch->pkt_set_id;
+  uint16_t *pkt_set_partition = batch->pkt_set_partition;
+  bool *parse_res = batch->parse_res;
+  bool *has_pkt_set_state = batch->has_pkt_set_state;
+  int *pkt_class = batch->pkt_class;
 
   // TODO: Stateless processing, should be able to vectorize it
   for (int i = 0; i < batch_size; i++) {
-    dst_devices[i] = device;
+    pkt_set_partition[i] = pkt_set_partition_of_hash(mbufs[i]->hash.rss);
 
     uint8_t *buffer = rte_pktmbuf_mtod(mbufs[i], uint8_t*);
+    // Headers are parsed in the first segment
     uint32_t pkt_len = (uint32_t)(mbufs[i]->data_len);
     packet_state_total_length(buffer, &pkt_len);
     // TODO: pass pkt_len explicitly to nf_pkt_parser
-    packet[i].len = pkt_len;
+    packet[i].len = mbufs[i]->pkt_len;
+    packet[i].hash = mbufs[i]->hash.rss;
+    packet[i].mbuf = mbufs[i];
     parse_res[i] = nf_pkt_parser(buffer, &packet[i]);
     nf_return_all_chunks(buffer);
     pkt_class[i] = nf_pkt_dispatcher(&packet[i], device, &pkt_set_id[i],
                                    &has_pkt_set_state[i], non_pkt_set_state);
   }
 
-  // Stateful processing
+#ifdef PKT_BATCH_PREPARE
+  nf_pkt_batch_prepare(non_pkt_set_state, packet, parse_res, batch_size, device);
+#endif
+}
+
+// Stateful half of batch processing, runs on the owner of the partitions
+static inline void handle_pkt_batch(struct pkt_batch *batch, uint16_t *dst_devices,
+                                    uint16_t batch_size, uint16_t device, vigor_time_t now,
+                                    nf_state_t *non_pkt_set_state) {
+  pkt_t *packet = batch->packet;
+  pkt_set_id_t *pkt_set_id = batch->pkt_set_id;
+  uint16_t *pkt_set_partition = batch->pkt_set_partition;
+  bool *parse_res = batch->parse_res;
+  bool *has_pkt_set_state = batch->has_pkt_set_state;
+  int *pkt_class = batch->pkt_class;
+
+  for (int i = 0; i < batch_size; i++)
+    dst_devices[i] = device;
 
   // Assumption here is that all packets in a batch either has pkt set state or not
   // Temp hack for Bridge/Maglev to do transaction chopping...
@@ -120,6 +215,7 @@ no_pkt_set_restart:
     for (int i = 0; i < batch_size; i++) {
       if (parse_res[i]) {
         RTE_PER_LCORE(dst_device) = dst_devices[i];
+        RTE_PER_LCORE(pkt_set_partition) = pkt_set_partition[i];
         pkt_handler_t pkt_handler = pkt_handlers[pkt_class[i]];
         int handler_res = pkt_handler(non_pkt_set_state, &packet[i], device, NULL, &pkt_set_id[i]);
         if (handler_res == ABORT_HANDLER) {
@@ -146,7 +242,7 @@ no_pkt_set_restart:
     // get the first packet without parsing error
     while ( (n < batch_size) && (!parse_res[n]) ) { n++; }
     if (n < batch_size) {
-      reg_pkt_set = get_pkt_set_state(&pkt_set_id[n], &pkt_set_state[n], pkt_set_partition, now);
+      reg_pkt_set = get_pkt_set_state(&pkt_set_id[n], &pkt_set_state[n], pkt_set_partition[n], now);
       __builtin_prefetch(pkt_set_state[n]);
     }
 
@@ -157,6 +253,7 @@ no_pkt_set_restart:
       if (!reg_pkt_set) {
         // reset dst_device to drop a pkt by default
         RTE_PER_LCORE(dst_device) = device;
+        RTE_PER_LCORE(pkt_set_partition) = pkt_set_partition[n];
 unknown_restart:
         RLU_READER_LOCK(rlu_data);
 
@@ -172,14 +269,14 @@ unknown_restart:
           NF_DEBUG("ABORT: read validation\n");
           goto unknown_restart;
         }
-        add_pkt_set_commit(&pkt_set_id[n], pkt_set_partition, now);
+        add_pkt_set_commit(&pkt_set_id[n], pkt_set_partition[n], now);
 
         dst_devices[n] = RTE_PER_LCORE(dst_device);
 
         // get the next packet without parsing error
         do { n++; } while ( (n < batch_size) && (!parse_res[n]) );
         if (n < batch_size) {
-          reg_pkt_set = get_pkt_set_state(&pkt_set_id[n], &pkt_set_state[n], pkt_set_partition, now);
+          reg_pkt_set = get_pkt_set_state(&pkt_set_id[n], &pkt_set_state[n], pkt_set_partition[n], now);
           __builtin_prefetch(pkt_set_state[n]);
         }
 
@@ -191,7 +288,7 @@ unknown_restart:
           // get the next packet without parsing error
           do { n++; } while ( (n < batch_size) && (!parse_res[n]) );
           if (n < batch_size) {
-            reg_pkt_set = get_pkt_set_state(&pkt_set_id[n], &pkt_set_state[n], pkt_set_partition, now);
+            reg_pkt_set = get_pkt_set_state(&pkt_set_id[n], &pkt_set_state[n], pkt_set_partition[n], now);
             __builtin_prefetch(pkt_set_state[n]);
           } else {
             reg_pkt_set = false;
@@ -216,6 +313,7 @@ restart:
 #endif
           // reset dst_device to drop a pkt by default
           RTE_PER_LCORE(dst_device) = device;
+          RTE_PER_LCORE(pkt_set_partition) = pkt_set_partition[n];
           pkt_handler_t pkt_handler = pkt_handlers[pkt_class[n]];
           int handler_res = pkt_handler(non_pkt_set_state, &packet[n], device, pkt_set_state[n], &pkt_set_id[n]);
           if (handler_res == ABORT_HANDLER) {
@@ -248,100 +346,176 @@ restart:
 
 }
 
+uint16_t process_pkt(struct rte_mbuf **mbufs, uint16_t *dst_devices, uint16_t batch_size,
+                     vigor_time_t now, nf_state_t *non_pkt_set_state) {
+  struct pkt_batch batch;
+
+  // All packets in a batch comes from the same device
+  uint16_t device = mbufs[0]->port;
+
+  parse_pkt_batch(mbufs, batch_size, device, &batch, non_pkt_set_state);
+  handle_pkt_batch(&batch, dst_devices, batch_size, device, now, non_pkt_set_state);
+}
+
+#ifdef PIPELINE
+uint16_t pipeline_parse_pkts(struct rte_mbuf **mbufs, uint16_t count,
+                             nf_state_t *non_pkt_set_state) {
+  struct pkt_batch batch;
+  uint16_t num_parsed = 0;
+
+  if (count == 0)
+    return 0;
+  parse_pkt_batch(mbufs, count, mbufs[0]->port, &batch, non_pkt_set_state);
+
+  for (uint16_t i = 0; i < count; i++) {
+    struct rte_mbuf *mbuf = mbufs[i];
+    if (!batch.parse_res[i]) {
+      rte_pktmbuf_free(mbuf);
+      continue;
+    }
+    struct parsed_pkt *parsed = rte_mbuf_to_priv(mbuf);
+    parsed->packet = batch.packet[i];
+    parsed->pkt_set_id = batch.pkt_set_id[i];
+    parsed->pkt_class = batch.pkt_class[i];
+    parsed->has_pkt_set_state = batch.has_pkt_set_state[i];
+    mbufs[num_parsed++] = mbuf;
+  }
+  return num_parsed;
+}
+
+void pipeline_process_pkts(struct rte_mbuf **mbufs, uint16_t *dst_devices, uint16_t batch_size,
+                           vigor_time_t now, nf_state_t *non_pkt_set_state) {
+  struct pkt_batch batch;
+
+  // Packets handed over through a ring all come from the same device
+  uint16_t device = mbufs[0]->port;
+
+  for (uint16_t i = 0; i < batch_size; i++) {
+    struct parsed_pkt *parsed = rte_mbuf_to_priv(mbufs[i]);
+    batch.packet[i] = parsed->packet;
+    batch.pkt_set_id[i] = parsed->pkt_set_id;
+    batch.pkt_set_partition[i] = pkt_set_partition_of_hash(mbufs[i]->hash.rss);
+    batch.parse_res[i] = true;
+    batch.has_pkt_set_state[i] = parsed->has_pkt_set_state;
+    batch.pkt_class[i] = parsed->pkt_class;
+  }
+  handle_pkt_batch(&batch, dst_devices, batch_size, device, now, non_pkt_set_state);
+}
+#endif
+
 #else
 
-uint16_t process_pkt(uint16_t device, uint8_t* buffer, uint16_t buffer_length,
-                  vigor_time_t now, uint16_t pkt_set_partition,
-                  nf_state_t *non_pkt_set_state) {
-  
-  RTE_PER_LCORE(dst_device) = device;
-  pkt_t packet;
-  pkt_set_id_t pkt_set_id;
+// Stateful half of packet processing, runs on the owner of the partition
+static inline void handle_pkt(struct parsed_pkt *parsed, uint16_t device, vigor_time_t now,
+                              uint16_t pkt_set_partition, nf_state_t *non_pkt_set_state) {
+  pkt_t *packet = &parsed->packet;
+  pkt_set_id_t *pkt_set_id = &parsed->pkt_set_id;
+  pkt_handler_t pkt_handler = pkt_handlers[parsed->pkt_class];
 
   rlu_thread_data_t *rlu_data = get_rlu_thread_data();
 
-  // temp hack
-  uint32_t buffer_length_u32 = buffer_length;
-  packet_state_total_length(buffer, &buffer_length_u32);
-  // TODO: pass pkt_len explicitly to nf_pkt_parser
-  packet.len = buffer_length;
-  bool parse_res = nf_pkt_parser(buffer, &packet);
-  nf_return_all_chunks(buffer);
+  if (!parsed->has_pkt_set_state) {
+no_pkt_set_restart:
+    RLU_READER_LOCK(rlu_data);
+    if (pkt_handler(non_pkt_set_state, packet, device, NULL, pkt_set_id) == ABORT_HANDLER) {
+      nfos_abort_txn(rlu_data);
+      NF_DEBUG("ABORT: pkt_handler\n");
+      goto no_pkt_set_restart;
+    }
+    if (!RLU_READER_UNLOCK(rlu_data)) {
+      nfos_abort_txn(rlu_data);
+      NF_DEBUG("ABORT: read validation\n");
+      goto no_pkt_set_restart;
+    }
 
-  if (parse_res) {
-    bool has_pkt_set_state;
-    int pkt_class = nf_pkt_dispatcher(&packet, device, &pkt_set_id,
-                                   &has_pkt_set_state, non_pkt_set_state);
-    pkt_handler_t pkt_handler = pkt_handlers[pkt_class];
+  } else {
+    pkt_set_state_t *pkt_set_state;
+    if (get_pkt_set_state(pkt_set_id, &pkt_set_state, pkt_set_partition, now)) {
+      __builtin_prefetch(pkt_set_state);
 
-    if (!has_pkt_set_state) {
-no_pkt_set_restart:
+restart_second:
+#ifdef MUTABLE_PKT_SET_STATE
+      log_pkt_set_state(pkt_set_state);
+#endif
       RLU_READER_LOCK(rlu_data);
-      if (pkt_handler(non_pkt_set_state, &packet, device, NULL, &pkt_set_id) == ABORT_HANDLER) {
+      if (pkt_handler(non_pkt_set_state, packet, device, pkt_set_state, pkt_set_id) == ABORT_HANDLER) {
         nfos_abort_txn(rlu_data);
+#ifdef MUTABLE_PKT_SET_STATE
+        // TODO: merging this into nfos_abort_txn
+        rollback_pkt_set_state(pkt_set_state);
+#endif
         NF_DEBUG("ABORT: pkt_handler\n");
-        goto no_pkt_set_restart;
+        goto restart_second;
       }
       if (!RLU_READER_UNLOCK(rlu_data)) {
         nfos_abort_txn(rlu_data);
+#ifdef MUTABLE_PKT_SET_STATE
+        rollback_pkt_set_state(pkt_set_state);
+#endif
         NF_DEBUG("ABORT: read validation\n");
-        goto no_pkt_set_restart;
+        goto restart_second;
       }
 
     } else {
-      pkt_set_state_t *pkt_set_state;
-      if (get_pkt_set_state(&pkt_set_id, &pkt_set_state, pkt_set_partition, now)) {
-        __builtin_prefetch(pkt_set_state);
-
-restart_second:
-#ifdef MUTABLE_PKT_SET_STATE
-        log_pkt_set_state(pkt_set_state);
-#endif
-	      RLU_READER_LOCK(rlu_data);
-        if (pkt_handler(non_pkt_set_state, &packet, device, pkt_set_state, &pkt_set_id) == ABORT_HANDLER) {
-          nfos_abort_txn(rlu_data);
-#ifdef MUTABLE_PKT_SET_STATE
-          // TODO: merging this into nfos_abort_txn
-          rollback_pkt_set_state(pkt_set_state);
-#endif
-          NF_DEBUG("ABORT: pkt_handler\n");
-          goto restart_second;
-        }
-        if (!RLU_READER_UNLOCK(rlu_data)) {
-          nfos_abort_txn(rlu_data);
-#ifdef MUTABLE_PKT_SET_STATE
-          rollback_pkt_set_state(pkt_set_state);
-#endif
-          NF_DEBUG("ABORT: read validation\n");
-          goto restart_second;
-        }
-
-      } else {
 
 restart_third:
-	      RLU_READER_LOCK(rlu_data);
-
-        add_pkt_set_log_clear();
-        if (nf_unknown_pkt_set_handler(non_pkt_set_state, &packet, device, &pkt_set_id) == ABORT_HANDLER) {
-          nfos_abort_txn(rlu_data);
-          NF_DEBUG("ABORT: nf_unknown_pkt_set_handler\n");
-          goto restart_third;
-        }
-        if (!RLU_READER_UNLOCK(rlu_data)) {
-          nfos_abort_txn(rlu_data);
-          NF_DEBUG("ABORT: read validation\n");
-          goto restart_third;
-        }
-        add_pkt_set_commit(&pkt_set_id, pkt_set_partition, now);
+      RLU_READER_LOCK(rlu_data);
 
+      add_pkt_set_log_clear();
+      if (nf_unknown_pkt_set_handler(non_pkt_set_state, packet, device, pkt_set_id) == ABORT_HANDLER) {
+        nfos_abort_txn(rlu_data);
+        NF_DEBUG("ABORT: nf_unknown_pkt_set_handler\n");
+        goto restart_third;
       }
+      if (!RLU_READER_UNLOCK(rlu_data)) {
+        nfos_abort_txn(rlu_data);
+        NF_DEBUG("ABORT: read validation\n");
+        goto restart_third;
+      }
+      add_pkt_set_commit(pkt_set_id, pkt_set_partition, now);
+
     }
+  }
+}
+
+uint16_t process_pkt(struct rte_mbuf *mbuf, vigor_time_t now, uint16_t pkt_set_partition,
+                  nf_state_t *non_pkt_set_state) {
+  uint16_t device = mbuf->port;
+  struct parsed_pkt parsed;
+
+  RTE_PER_LCORE(dst_device) = device;
+  if (parse_pkt(mbuf, &parsed, non_pkt_set_state))
+    handle_pkt(&parsed, device, now, pkt_set_partition, non_pkt_set_state);
 
+  return RTE_PER_LCORE(dst_device);
+}
+
+#ifdef PIPELINE
+uint16_t pipeline_parse_pkts(struct rte_mbuf **mbufs, uint16_t count,
+                             nf_state_t *non_pkt_set_state) {
+  uint16_t num_parsed = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    struct rte_mbuf *mbuf = mbufs[i];
+    RTE_PER_LCORE(dst_device) = mbuf->port;
+    if (parse_pkt(mbuf, rte_mbuf_to_priv(mbuf), non_pkt_set_state))
+      mbufs[num_parsed++] = mbuf;
+    else
+      rte_pktmbuf_free(mbuf);
   }
+  return num_parsed;
+}
+
+uint16_t pipeline_process_pkt(struct rte_mbuf *mbuf, vigor_time_t now, uint16_t pkt_set_partition,
+                              nf_state_t *non_pkt_set_state) {
+  uint16_t device = mbuf->port;
+
+  RTE_PER_LCORE(dst_device) = device;
+  handle_pkt(rte_mbuf_to_priv(mbuf), device, now, pkt_set_partition, non_pkt_set_state);
 
   return RTE_PER_LCORE(dst_device);
 }
 #endif
+#endif
 
 void send_pkt(pkt_t *pkt, uint16_t dev) {
   RTE_PER_LCORE(dst_device) = dev;
@@ -351,4 +525,26 @@ void flood_pkt(pkt_t *pkt) {
   RTE_PER_LCORE(dst_device) = FLOOD_PORT;
 }
 
+void multicast_pkt(pkt_t *pkt, int group) {
+  RTE_PER_LCORE(dst_device) = MULTICAST_PORT + group;
+}
+
 void drop_pkt(pkt_t *pkt) {}
+
+const void *nfos_pkt_read(const pkt_t *pkt, uint32_t offset, uint32_t len, void *buf) {
+  return rte_pktmbuf_read(pkt->mbuf, offset, len, buf);
+}
+
+int register_multicast_group(uint64_t devices) {
+  for (int group = 0; group < num_multicast_groups; group++) {
+    if (multicast_groups[group] == devices)
+      return group;
+  }
+  // MULTICAST_PORT + group must not collide with FLOOD_PORT
+  if (num_multicast_groups == MAX_MULTICAST_GROUPS ||
+      MULTICAST_PORT + num_multicast_groups >= FLOOD_PORT)
+    return -1;
+
+  multicast_groups[num_multicast_groups] = devices;
+  return num_multicast_groups++;
+}
@@ -0,0 +1,282 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+#include <rte_ring.h>
+
+#include "vigor/nf-log.h"
+
+#include "elastic-scaling.h"
+#include "partition-map.h"
+#include "timer.h"
+#include "tx-buffer.h"
+
+struct elastic_worker {
+  // Written by the control core
+  volatile bool active;
+  // Time after which the core flips the owner of the partitions it is
+  // handing over, 0 if there is none
+  volatile vigor_time_t handoff_deadline;
+
+  // Written by the core itself
+  uint64_t rx_pkts;
+  uint64_t rx_slots;
+  uint64_t handoff_drops;
+
+  // Snapshot of the counters at the last scaling decision
+  uint64_t last_rx_pkts;
+  uint64_t last_rx_slots;
+} __rte_cache_aligned;
+
+static struct elastic_worker *workers;
+// handoff_rings[device * num_data_plane_cores + worker]
+static struct rte_ring **handoff_rings;
+static uint16_t num_data_plane_cores;
+static uint16_t num_active_cores;
+static uint16_t num_devices;
+
+static inline struct rte_ring *get_handoff_ring(uint16_t device, uint16_t worker) {
+  return handoff_rings[device * num_data_plane_cores + worker];
+}
+
+bool elastic_scaling_init(uint16_t num_workers, uint16_t nb_devices) {
+  workers = rte_zmalloc(NULL, sizeof(struct elastic_worker) * num_workers,
+                        RTE_CACHE_LINE_SIZE);
+  handoff_rings = calloc(num_workers * nb_devices, sizeof(struct rte_ring *));
+  if (workers == NULL || handoff_rings == NULL)
+    return false;
+
+  num_data_plane_cores = num_workers;
+  num_devices = nb_devices;
+
+  for (uint16_t device = 0; device < nb_devices; device++) {
+    for (uint16_t worker = 0; worker < num_workers; worker++) {
+      char ring_name[32];
+      sprintf(ring_name, "handoff_%d_%d", device, worker);
+      // Multi-producer, single-consumer
+      handoff_rings[device * num_workers + worker] =
+        rte_ring_create(ring_name, ELASTIC_HANDOFF_RING_SIZE, SOCKET_ID_ANY,
+                        RING_F_SC_DEQ);
+      if (handoff_rings[device * num_workers + worker] == NULL)
+        return false;
+    }
+  }
+
+  // Start with all the cores
+  for (uint16_t worker = 0; worker < num_workers; worker++)
+    workers[worker].active = true;
+  num_active_cores = num_workers;
+
+  return true;
+}
+
+/*
+ * Data plane side
+ */
+
+uint16_t elastic_steer_pkts(uint16_t worker, struct rte_mbuf **mbufs, uint16_t count) {
+  uint16_t num_kept = 0;
+
+  for (uint16_t i = 0; i < count; i++) {
+    struct rte_mbuf *mbuf = mbufs[i];
+    uint16_t owner = partition_map_get_owner(pkt_set_partition_of_hash(mbuf->hash.rss));
+
+    if (likely(owner == worker)) {
+      mbufs[num_kept++] = mbuf;
+    } else if (rte_ring_mp_enqueue(get_handoff_ring(mbuf->port, owner), mbuf)) {
+      // Should not happen, rings only carry packets during hand-overs
+      workers[worker].handoff_drops++;
+      rte_pktmbuf_free(mbuf);
+    }
+  }
+
+  return num_kept;
+}
+
+uint16_t elastic_poll_handoff(uint16_t worker, uint16_t device,
+                              struct rte_mbuf **mbufs, uint16_t max_count) {
+  struct rte_ring *ring = get_handoff_ring(device, worker);
+  if (max_count == 0 || rte_ring_empty(ring))
+    return 0;
+
+  uint16_t count = rte_ring_sc_dequeue_burst(ring, (void **)mbufs, max_count, NULL);
+  // The partitions might have changed owner while the packets were queued
+  return elastic_steer_pkts(worker, mbufs, count);
+}
+
+// Flip the owner of the partitions the core is handing over
+static void finish_handoff(uint16_t worker) {
+  for (uint16_t partition = 0; partition < num_pkt_set_partitions; partition++) {
+    if (partition_map_get_owner(partition) != worker)
+      continue;
+    uint16_t target_owner = partition_map_get_target_owner(partition);
+    if (target_owner != worker)
+      partition_map_set_owner(partition, target_owner);
+  }
+  workers[worker].handoff_deadline = 0;
+}
+
+void elastic_worker_poll_done(uint16_t worker, uint16_t rx_count, uint16_t burst_size) {
+  struct elastic_worker *w = &workers[worker];
+
+  w->rx_pkts += rx_count;
+  w->rx_slots += burst_size;
+
+  vigor_time_t handoff_deadline = w->handoff_deadline;
+  // RX queue is drained, packets steered to the core before the RETA update
+  // have all been received
+  if (unlikely(handoff_deadline != 0) && rx_count < burst_size &&
+      nfos_get_time() >= handoff_deadline) {
+    finish_handoff(worker);
+  }
+}
+
+bool elastic_worker_try_park(uint16_t worker) {
+  struct elastic_worker *w = &workers[worker];
+  if (likely(w->active) || w->handoff_deadline != 0)
+    return false;
+
+  // Keep forwarding stragglers
+  for (uint16_t device = 0; device < num_devices; device++) {
+    if (!rte_ring_empty(get_handoff_ring(device, worker)))
+      return false;
+  }
+
+  tx_flush_all();
+  rte_delay_us_sleep(ELASTIC_PARK_SLEEP);
+  return true;
+}
+
+/*
+ * Control plane side
+ */
+
+static bool handoff_in_progress() {
+  for (uint16_t worker = 0; worker < num_data_plane_cores; worker++) {
+    if (workers[worker].handoff_deadline != 0)
+      return true;
+  }
+  return false;
+}
+
+// Steer the partitions to their target owners and let the old owners drain
+static void start_handoff(bool *old_owners) {
+  for (uint16_t device = 0; device < num_devices; device++) {
+    int ret = partition_map_program_reta(device);
+    if (ret != 0)
+      NF_INFO("Cannot update RETA of device %d, ret=%d", device, ret);
+  }
+
+  vigor_time_t deadline = nfos_get_time() + nfos_usec_to_tsc_cycles(ELASTIC_DRAIN_TIME);
+  for (uint16_t worker = 0; worker < num_data_plane_cores; worker++) {
+    if (old_owners[worker])
+      workers[worker].handoff_deadline = deadline;
+  }
+}
+
+static void activate_worker(uint16_t new_worker) {
+  uint16_t num_owned[num_data_plane_cores];
+  bool old_owners[num_data_plane_cores];
+  for (uint16_t worker = 0; worker < num_data_plane_cores; worker++) {
+    num_owned[worker] = 0;
+    old_owners[worker] = false;
+  }
+  for (uint16_t partition = 0; partition < num_pkt_set_partitions; partition++)
+    num_owned[partition_map_get_owner(partition)]++;
+
+  // Take partitions from cores owning more than their fair share
+  uint16_t fair_share = num_pkt_set_partitions / (num_active_cores + 1);
+  uint16_t num_taken = 0;
+  for (uint16_t partition = 0; partition < num_pkt_set_partitions; partition++) {
+    if (num_taken >= fair_share)
+      break;
+    uint16_t owner = partition_map_get_owner(partition);
+    if (owner != new_worker && num_owned[owner] > fair_share) {
+      partition_map_set_target_owner(partition, new_worker);
+      num_owned[owner]--;
+      old_owners[owner] = true;
+      num_taken++;
+    }
+  }
+
+  workers[new_worker].active = true;
+  num_active_cores++;
+  start_handoff(old_owners);
+
+  NF_INFO("Activated data plane core %d, %d partitions, %d active cores",
+          new_worker, num_taken, num_active_cores);
+}
+
+static void park_worker(uint16_t worker) {
+  bool old_owners[num_data_plane_cores];
+  for (uint16_t i = 0; i < num_data_plane_cores; i++)
+    old_owners[i] = false;
+  old_owners[worker] = true;
+
+  // Spread the partitions of the core over the remaining active ones
+  uint16_t next_owner = 0;
+  for (uint16_t partition = 0; partition < num_pkt_set_partitions; partition++) {
+    if (partition_map_get_owner(partition) != worker)
+      continue;
+    while (next_owner == worker || !workers[next_owner].active)
+      next_owner = (next_owner + 1) % num_data_plane_cores;
+    partition_map_set_target_owner(partition, next_owner);
+    next_owner = (next_owner + 1) % num_data_plane_cores;
+  }
+
+  // Deadline must be visible before the core sees itself parked
+  start_handoff(old_owners);
+  __asm__ __volatile__ ("" : : : "memory");
+  workers[worker].active = false;
+  num_active_cores--;
+
+  NF_INFO("Parked data plane core %d, %d active cores", worker, num_active_cores);
+}
+
+void elastic_scaling_control() {
+  if (handoff_in_progress())
+    return;
+
+  uint64_t total_load = 0;
+  int first_inactive = -1, last_active = -1;
+  for (uint16_t worker = 0; worker < num_data_plane_cores; worker++) {
+    struct elastic_worker *w = &workers[worker];
+    uint64_t rx_pkts = w->rx_pkts;
+    uint64_t rx_slots = w->rx_slots;
+
+    if (w->active) {
+      if (rx_slots > w->last_rx_slots)
+        total_load += (rx_pkts - w->last_rx_pkts) * 100 / (rx_slots - w->last_rx_slots);
+      last_active = worker;
+    } else if (first_inactive == -1) {
+      first_inactive = worker;
+    }
+
+    w->last_rx_pkts = rx_pkts;
+    w->last_rx_slots = rx_slots;
+  }
+
+  if (total_load / num_active_cores > ELASTIC_SCALE_OUT_THRESHOLD) {
+    if (first_inactive != -1)
+      activate_worker(first_inactive);
+  } else if (num_active_cores > ELASTIC_MIN_WORKERS &&
+             total_load / (num_active_cores - 1) < ELASTIC_SCALE_IN_THRESHOLD) {
+    park_worker(last_active);
+  }
+}
+
+void elastic_scaling_stats_show() {
+  for (uint16_t worker = 0; worker < num_data_plane_cores; worker++) {
+    struct elastic_worker *w = &workers[worker];
+    printf("core %d %s: received %" PRIu64 ", RX slots %" PRIu64
+           ", handoff drops %" PRIu64 "\n",
+           worker, w->active ? "active" : "parked", w->rx_pkts, w->rx_slots,
+           w->handoff_drops);
+  }
+  fflush(stdout);
+}
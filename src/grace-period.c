@@ -0,0 +1,34 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_malloc.h>
+
+#include "grace-period.h"
+
+struct grace_period_worker *grace_period_workers;
+volatile uint64_t grace_period_epoch;
+static uint16_t num_data_plane_cores;
+
+bool grace_period_init(uint16_t num_workers) {
+  grace_period_workers = rte_zmalloc(NULL, sizeof(struct grace_period_worker) * num_workers,
+                                     RTE_CACHE_LINE_SIZE);
+  if (grace_period_workers == NULL)
+    return false;
+
+  num_data_plane_cores = num_workers;
+  return true;
+}
+
+uint64_t grace_period_start() {
+  // Orders the unlinking stores before the new epoch
+  return __atomic_add_fetch(&grace_period_epoch, 1, __ATOMIC_SEQ_CST);
+}
+
+bool grace_period_done(uint64_t token) {
+  for (uint16_t worker = 0; worker < num_data_plane_cores; worker++) {
+    if (__atomic_load_n(&grace_period_workers[worker].epoch, __ATOMIC_ACQUIRE) < token)
+      return false;
+  }
+  return true;
+}
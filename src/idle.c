@@ -0,0 +1,155 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_cpuflags.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_interrupts.h>
+#include <rte_lcore.h>
+#include <rte_power_intrinsics.h>
+
+#include "vigor/nf-log.h"
+
+#include "idle.h"
+#include "queue-map.h"
+#include "timer.h"
+#include "tx-buffer.h"
+
+RTE_DEFINE_PER_LCORE(uint32_t, idle_empty_polls);
+
+// Idle mode of the core, downgraded if the hardware lacks support
+static RTE_DEFINE_PER_LCORE(int, idle_mode);
+// RX queues polled by the core, interrupts are only armed on those
+static RTE_DEFINE_PER_LCORE(struct rx_poll_list *, idle_poll_list);
+static RTE_DEFINE_PER_LCORE(bool, idle_has_tpause);
+// Wakes the core up after IDLE_WAKEUP_BUDGET, epoll timeouts are in ms
+static RTE_DEFINE_PER_LCORE(int, idle_timer_fd);
+static RTE_DEFINE_PER_LCORE(struct rte_epoll_event, idle_timer_event);
+
+void idle_device_conf(struct rte_eth_conf *device_conf) {
+#if IDLE_MODE == IDLE_MODE_INTR
+  device_conf->intr_conf.rxq = 1;
+#endif
+}
+
+void idle_device_conf_fallback(struct rte_eth_conf *device_conf) {
+  NF_INFO("Device does not support RX interrupts, cores idle with TPAUSE instead");
+  device_conf->intr_conf.rxq = 0;
+}
+
+static void unregister_rx_intrs(struct rx_poll_list *poll_list, uint16_t num_entries) {
+  for (uint16_t i = 0; i < num_entries; i++) {
+    struct rx_poll_entry *e = &poll_list->entries[i];
+    if (!e->ring)
+      rte_eth_dev_rx_intr_ctl_q(e->device, e->queue, RTE_EPOLL_PER_THREAD,
+                                RTE_INTR_EVENT_DEL, NULL);
+  }
+}
+
+// Add a timer to the epoll instance of the core, so that waits on RX
+// interrupts last at most IDLE_WAKEUP_BUDGET
+static bool register_timer() {
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  struct rte_epoll_event *event = &RTE_PER_LCORE(idle_timer_event);
+  event->epdata.event = EPOLLIN;
+  event->epdata.data = NULL;
+  event->epdata.cb_fun = NULL;
+  event->epdata.cb_arg = NULL;
+  if (rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD, fd, event)) {
+    close(fd);
+    return false;
+  }
+  RTE_PER_LCORE(idle_timer_fd) = fd;
+  return true;
+}
+
+void idle_worker_init(struct rx_poll_list *poll_list) {
+  int mode = IDLE_MODE;
+
+  RTE_PER_LCORE(idle_poll_list) = poll_list;
+  RTE_PER_LCORE(idle_has_tpause) = rte_cpu_get_flag_enabled(RTE_CPUFLAG_WAITPKG) > 0;
+  RTE_PER_LCORE(idle_empty_polls) = 0;
+
+  if (mode == IDLE_MODE_INTR) {
+    // Register the RX queue interrupts to the epoll instance of the core,
+    // hand-over rings have none
+    uint16_t num_rx_queues = 0;
+    for (uint16_t i = 0; i < poll_list->num_entries; i++) {
+      struct rx_poll_entry *e = &poll_list->entries[i];
+      if (e->ring)
+        continue;
+      if (rte_eth_dev_rx_intr_ctl_q(e->device, e->queue, RTE_EPOLL_PER_THREAD,
+                                    RTE_INTR_EVENT_ADD, NULL)) {
+        NF_INFO("No RX interrupt on device %d queue %d, idle with TPAUSE instead",
+                e->device, e->queue);
+        unregister_rx_intrs(poll_list, i);
+        mode = IDLE_MODE_PAUSE;
+        break;
+      }
+      num_rx_queues++;
+    }
+
+    // Nothing would wake up a core only polling hand-over rings
+    if (mode == IDLE_MODE_INTR && num_rx_queues == 0) {
+      mode = IDLE_MODE_PAUSE;
+    } else if (mode == IDLE_MODE_INTR && !register_timer()) {
+      NF_INFO("Cannot create the wake-up timer, idle with TPAUSE instead");
+      unregister_rx_intrs(poll_list, poll_list->num_entries);
+      mode = IDLE_MODE_PAUSE;
+    }
+  }
+
+  RTE_PER_LCORE(idle_mode) = mode;
+}
+
+void idle_wait() {
+  // Do not hold packets while idling
+  tx_flush_all();
+
+  switch (RTE_PER_LCORE(idle_mode)) {
+    case IDLE_MODE_INTR: {
+      struct rx_poll_list *list = RTE_PER_LCORE(idle_poll_list);
+      // RX queues and the timer
+      struct rte_epoll_event events[list->num_entries + 1];
+      int timer_fd = RTE_PER_LCORE(idle_timer_fd);
+      struct itimerspec budget = {
+        .it_value = {
+          .tv_sec = IDLE_WAKEUP_BUDGET / 1000000,
+          .tv_nsec = IDLE_WAKEUP_BUDGET % 1000000 * 1000,
+        },
+      };
+
+      for (uint16_t i = 0; i < list->num_entries; i++) {
+        if (!list->entries[i].ring)
+          rte_eth_dev_rx_intr_enable(list->entries[i].device, list->entries[i].queue);
+      }
+      // Packets that arrived right before enabling the interrupts, or
+      // handed over by other cores, wait for the timer at worst. Arming the
+      // timer also clears an expiration left over from an earlier wait.
+      timerfd_settime(timer_fd, 0, &budget, NULL);
+      rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, list->num_entries + 1, -1);
+      for (uint16_t i = 0; i < list->num_entries; i++) {
+        if (!list->entries[i].ring)
+          rte_eth_dev_rx_intr_disable(list->entries[i].device, list->entries[i].queue);
+      }
+      break;
+    }
+
+    case IDLE_MODE_PAUSE:
+      if (RTE_PER_LCORE(idle_has_tpause))
+        rte_power_pause(rte_get_tsc_cycles() + nfos_usec_to_tsc_cycles(IDLE_WAKEUP_BUDGET));
+      else
+        rte_delay_us_sleep(IDLE_WAKEUP_BUDGET);
+      break;
+
+    default:
+      break;
+  }
+}
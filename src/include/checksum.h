@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include <rte_byteorder.h>
+#include <rte_ethdev.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include "nf.h"
+
+/*
+ * Checksum service for NFs rewriting packet headers.
+ *
+ * nfos_cksum_set_*() rewrite an address or port. If all devices support TX
+ * checksum offload, they leave the checksums to the NIC through the mbuf
+ * offload flags. Otherwise, e.g. on net_pcap or net_null, and for IPv4
+ * fragments, they patch the IPv4 header and TCP/UDP checksums incrementally
+ * (RFC 1624), in O(1) instead of over the whole payload.
+ *
+ * nfos_cksum_recompute() sets all the checksums of a packet from scratch, on
+ * the NIC or in software likewise.
+ */
+
+// Set at device init, true if all devices offload IPv4/TCP/UDP checksums
+extern bool nfos_tx_cksum_offload;
+
+// Enable TX checksum offload in the device config if the device supports it
+void cksum_device_conf(struct rte_eth_conf *device_conf, uint16_t device);
+
+//   Set the IPv4 header and TCP/UDP checksums of the packet from scratch,
+//   either on the NIC or in software. The TCP/UDP checksum of IPv4 fragments
+//   is left as is.
+void nfos_cksum_recompute(pkt_t *pkt);
+
+// Patch a checksum for a 16-bit field changing from old to new, all in network order
+static inline void nfos_cksum_adjust16(rte_be16_t *cksum, uint16_t old, uint16_t new) {
+  // HC' = ~(~HC + ~m + m'), RFC 1624 eqn. 3
+  uint32_t sum = (uint16_t)~*cksum + (uint16_t)~old + new;
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  *cksum = ~sum;
+}
+
+static inline void nfos_cksum_adjust32(rte_be16_t *cksum, uint32_t old, uint32_t new) {
+  uint32_t sum = (uint16_t)~*cksum + (uint16_t)~old + (uint16_t)~(old >> 16) +
+                 (uint16_t)new + (uint16_t)(new >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  *cksum = ~sum;
+}
+
+// TCP/UDP checksum of the packet, NULL if it has none
+static inline rte_be16_t *nfos_cksum_l4_field(pkt_t *pkt) {
+  if (pkt->tcpudp_header == NULL)
+    return NULL;
+
+  uint8_t proto;
+  if (pkt->ipv4_header) {
+    // Non-first fragments have no L4 header
+    if (pkt->ipv4_header->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK))
+      return NULL;
+    proto = pkt->ipv4_header->next_proto_id;
+  } else {
+    proto = pkt->ipv6_header->proto;
+  }
+
+  if (proto == IPPROTO_TCP)
+    return &((struct rte_tcp_hdr *)pkt->tcpudp_header)->cksum;
+  if (proto != IPPROTO_UDP)
+    return NULL;
+  rte_be16_t *cksum = &((struct rte_udp_hdr *)pkt->tcpudp_header)->dgram_cksum;
+  // Zero means no checksum for UDP over IPv4
+  return *cksum || pkt->ipv6_header ? cksum : NULL;
+}
+
+// The TCP/UDP checksum of an IPv4 fragment covers the whole datagram, it can
+// only be patched
+static inline bool nfos_cksum_is_fragment(const pkt_t *pkt) {
+  return pkt->ipv4_header &&
+         (pkt->ipv4_header->fragment_offset &
+          rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK | RTE_IPV4_HDR_MF_FLAG));
+}
+
+static inline bool nfos_cksum_use_offload(const pkt_t *pkt) {
+  return nfos_tx_cksum_offload && !nfos_cksum_is_fragment(pkt);
+}
+
+// A zero TCP/UDP checksum is sent as all ones, zero means no checksum for UDP
+// and both are valid for TCP
+static inline void nfos_cksum_fix_l4(rte_be16_t *cksum) {
+  if (*cksum == 0)
+    *cksum = 0xFFFF;
+}
+
+//   Rewrite an IPv4 address of the packet, e.g., &pkt->ipv4_header->src_addr.
+//   The address is part of the TCP/UDP pseudo-header.
+static inline void nfos_cksum_set_ipv4_addr(pkt_t *pkt, rte_be32_t *addr, rte_be32_t new_addr) {
+  rte_be32_t old_addr = *addr;
+  *addr = new_addr;
+  if (nfos_cksum_use_offload(pkt)) {
+    nfos_cksum_recompute(pkt);
+    return;
+  }
+  nfos_cksum_adjust32(&pkt->ipv4_header->hdr_checksum, old_addr, new_addr);
+  rte_be16_t *cksum = nfos_cksum_l4_field(pkt);
+  if (cksum) {
+    nfos_cksum_adjust32(cksum, old_addr, new_addr);
+    nfos_cksum_fix_l4(cksum);
+  }
+}
+
+//   Rewrite an IPv6 address of the packet, e.g., pkt->ipv6_header->dst_addr.
+static inline void nfos_cksum_set_ipv6_addr(pkt_t *pkt, uint8_t *addr, const uint8_t *new_addr) {
+  if (nfos_cksum_use_offload(pkt)) {
+    memcpy(addr, new_addr, 16);
+    nfos_cksum_recompute(pkt);
+    return;
+  }
+  rte_be16_t *cksum = nfos_cksum_l4_field(pkt);
+  if (cksum) {
+    for (int i = 0; i < 16; i += 4) {
+      uint32_t old_word, new_word;
+      memcpy(&old_word, addr + i, 4);
+      memcpy(&new_word, new_addr + i, 4);
+      nfos_cksum_adjust32(cksum, old_word, new_word);
+    }
+    nfos_cksum_fix_l4(cksum);
+  }
+  memcpy(addr, new_addr, 16);
+}
+
+//   Rewrite a TCP/UDP port of the packet, e.g., &pkt->tcpudp_header->src_port.
+static inline void nfos_cksum_set_l4_port(pkt_t *pkt, rte_be16_t *port, rte_be16_t new_port) {
+  rte_be16_t old_port = *port;
+  *port = new_port;
+  if (nfos_cksum_use_offload(pkt)) {
+    nfos_cksum_recompute(pkt);
+    return;
+  }
+  rte_be16_t *cksum = nfos_cksum_l4_field(pkt);
+  if (cksum) {
+    nfos_cksum_adjust16(cksum, old_port, new_port);
+    nfos_cksum_fix_l4(cksum);
+  }
+}
+
+//   Rewrite the type of service of an IPv4 packet.
+static inline void nfos_cksum_set_ipv4_tos(pkt_t *pkt, uint8_t tos) {
+  struct rte_ipv4_hdr *ip = pkt->ipv4_header;
+  // version_ihl and type_of_service form the first 16-bit word of the header
+  uint16_t old_word = rte_cpu_to_be_16((ip->version_ihl << 8) | ip->type_of_service);
+  uint16_t new_word = rte_cpu_to_be_16((ip->version_ihl << 8) | tos);
+  ip->type_of_service = tos;
+  if (nfos_cksum_use_offload(pkt)) {
+    nfos_cksum_recompute(pkt);
+    return;
+  }
+  nfos_cksum_adjust16(&ip->hdr_checksum, old_word, new_word);
+}
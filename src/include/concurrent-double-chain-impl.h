@@ -7,13 +7,18 @@ struct concurrent_dchain_cell {
     int prev;
     int next;
     int list_ind; // ind of corresponding al_list, -1 means the cell is free
+    int timeout_class; // alloc list of the partition the cell is on
     vigor_time_t time;
+    vigor_time_t timeout; // the cell expires at time + timeout
     pkt_set_id_t id;
     int map_chain_next; // index of next cell in the same map chain, -1 means map chain tail
 };
 
 // Separate free/alloc list head cells with 7 (2^3 - 1) padding cells
 #define LIST_HEAD_PADDING 3
+// Each partition has one alloc list per timeout class, their heads use the
+// padding cells of the partition
+#define NUM_TIMEOUT_CLASSES (1 << LIST_HEAD_PADDING)
 
 // Requires the array dchain_cell, large enough to fit all the range of
 // possible 'index' values + 2 special values.
@@ -55,19 +60,23 @@ struct concurrent_dchain_cell {
 // #define DCHAIN_RESERVED (NUM_AL_LISTS + 1)
 
 
-void concurrent_dchain_impl_init(struct concurrent_dchain_cell *cells, int index_range, int num_cores);
+void concurrent_dchain_impl_init(struct concurrent_dchain_cell *cells, int index_range, int num_partitions);
 
 int concurrent_dchain_impl_has_free_indexes(struct concurrent_dchain_cell *cells, int core_id);
 
-int concurrent_dchain_impl_allocate_new_index(struct concurrent_dchain_cell *cells, int *index, int core_id, vigor_time_t time);
+int concurrent_dchain_impl_allocate_new_index(struct concurrent_dchain_cell *cells, int *index, int core_id, vigor_time_t time,
+                                              int timeout_class);
 
-int concurrent_dchain_impl_allocate_new_index_global(struct concurrent_dchain_cell *cells, int *index, int core_id, vigor_time_t time);
+int concurrent_dchain_impl_allocate_new_index_global(struct concurrent_dchain_cell *cells, int *index, int core_id, vigor_time_t time,
+                                                     int timeout_class);
 
 int concurrent_dchain_impl_free_index(struct concurrent_dchain_cell *cells, int index, int core_id);
 
-int concurrent_dchain_impl_get_oldest_index(struct concurrent_dchain_cell *cells, int *index, int core_id);
+int concurrent_dchain_impl_get_oldest_index(struct concurrent_dchain_cell *cells, int *index, int core_id,
+                                            int timeout_class);
 
-int concurrent_dchain_impl_rejuvenate_index(struct concurrent_dchain_cell *cells, int index, int core_id, vigor_time_t time);
+int concurrent_dchain_impl_rejuvenate_index(struct concurrent_dchain_cell *cells, int index, int core_id, vigor_time_t time,
+                                            int timeout_class);
 
 int concurrent_dchain_impl_is_index_allocated(struct concurrent_dchain_cell *cells, int index, int core_id);
 
@@ -11,10 +11,13 @@ struct ConcurrentDoubleChain;
 //   Allocate memory and initialize a new double chain allocator. The produced
 //   allocator will operate on indexes [0-index).
 //   @param index_range - the limit on the number of allocated indexes.
+//   @param num_partitions - number of packet set partitions, each partition
+//                           has its own alloc/free list.
 //   @param chain_out - an output pointer that will hold the pointer to the newly
 //                      allocated allocator in the case of success.
 //   @returns 0 if the allocation failed, and 1 if the allocation is successful.
-int concurrent_dchain_allocate(int index_range, struct ConcurrentDoubleChain** chain_out);
+int concurrent_dchain_allocate(int index_range, int num_partitions,
+                               struct ConcurrentDoubleChain** chain_out);
 
 int concurrent_dchain_has_free_indexes(struct ConcurrentDoubleChain* chain, int partition);
 
@@ -23,37 +26,52 @@ int concurrent_dchain_has_free_indexes(struct ConcurrentDoubleChain* chain, int
 //   @param chain - pointer to the allocator.
 //   @param index_out - output pointer to the newly allocated index.
 //   @param time - current time. Allocator will note this for the new index.
+//   @param timeout_class - LRU list of the partition to put the index on,
+//                          < NUM_TIMEOUT_CLASSES.
+//   @param timeout - the index expires timeout after its last timestamp.
 //   @returns 0 if there is no space, and 1 if the allocation is successful.
 int concurrent_dchain_allocate_new_index(struct ConcurrentDoubleChain* chain,
                                          int* index_out, vigor_time_t time,
-                                         int partition);
+                                         int partition, int timeout_class,
+                                         vigor_time_t timeout);
 
 
 //   Update the index timestamp. Needed to keep the index from expiration.
 //   @param chain - pointer to the allocator.
 //   @param index - the index to rejuvenate.
 //   @param time - the current time, it will replace the old timestamp.
+//   @param timeout_class - LRU list to move the index to, its current one if
+//                          negative.
 //   @returns 1 if the timestamp was updated, and 0 if the index is not tagged as
 //            allocated.
 int concurrent_dchain_rejuvenate_index(struct ConcurrentDoubleChain* chain,
                                        int index, vigor_time_t time,
-                                       int partition);
+                                       int partition, int timeout_class);
+
+//   Rejuvenate the index and change its timeout.
+//   @returns 1 if the timeout was updated, and 0 if the index is not tagged as
+//            allocated.
+int concurrent_dchain_set_timeout(struct ConcurrentDoubleChain* chain,
+                                  int index, vigor_time_t time,
+                                  int partition, int timeout_class,
+                                  vigor_time_t timeout);
 
 
 //   Make space in the allocator by expiring the least recently used index.
+//   Only the oldest index of the LRU list is checked, an index behind it with
+//   a shorter timeout waits for it.
 //   @param chain - pointer to the allocator.
 //   @param index_out - output pointer to the expired index.
-//   @param time - the time border, separating expired indexes from non-expired
-//                ones.
-//   @returns 1 if the oldest index is older then current time and is expired,
+//   @param time - the current time.
+//   @returns 1 if the oldest index is past its timeout and is expired,
 //   0 otherwise.
 int concurrent_dchain_expire_one_index(struct ConcurrentDoubleChain* chain,
                                        int* index_out, vigor_time_t time,
-                                       int partition);
+                                       int partition, int timeout_class);
 
 int concurrent_dchain_has_expired_index(struct ConcurrentDoubleChain* chain,
                                        int* index_out, vigor_time_t time,
-                                       int partition);
+                                       int partition, int timeout_class);
 
 int concurrent_dchain_is_index_allocated(struct ConcurrentDoubleChain* chain, int index,
                                          int partition);
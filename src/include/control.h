@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nf.h"
+
+/*
+ * Control channel of the control core, enabled with CONTROL_SOCKET.
+ *
+ * Clients connect to the Unix stream socket at CONTROL_SOCKET and send one
+ * "<command> [args]" line per request, e.g., "route_add 0 10.0.0.0/8 1". The
+ * commands are registered by the NF with register_control_command(). Each
+ * request gets one "ok [reply]" or "error [reply]" line back, in order, so a
+ * client can stream many requests before reading the replies.
+ *
+ * The control core runs up to CONTROL_BATCH_SIZE pending requests of a client
+ * in one RLU write transaction, i.e., one RLU epoch, between the runs of the
+ * periodic handler. A batch is run again from its first request if one of
+ * them aborts, so handlers writing state outside of RLU, e.g., FIB tables,
+ * must be idempotent. Data plane cores are never blocked: replies are
+ * buffered, and a client that does not read them is not served until it does.
+ */
+
+#ifndef CONTROL_BATCH_SIZE
+#define CONTROL_BATCH_SIZE 64
+#endif
+
+#ifndef CONTROL_MAX_CLIENTS
+#define CONTROL_MAX_CLIENTS 16
+#endif
+
+#ifndef CONTROL_MAX_COMMANDS
+#define CONTROL_MAX_COMMANDS 32
+#endif
+
+// Max length of a request line, newline included
+#define CONTROL_LINE_SIZE 256
+// Max length of a reply passed to a command handler
+#define CONTROL_REPLY_SIZE 128
+
+//   Listen on the Unix socket at path, replacing any stale socket file.
+//   @returns true on success, false otherwise.
+bool control_channel_init(const char *path);
+
+//   Serve the clients of the control channel for timeout_us microseconds, or
+//   sleep if the channel is disabled.
+void control_channel_serve(nf_state_t *non_pkt_set_state, uint64_t timeout_us);
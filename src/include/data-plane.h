@@ -3,21 +3,44 @@
 #include "vigor/libvig/verified/vigor-time.h"
 
 #include "nf.h"
+#include "pipeline.h"
 
 #define FLOOD_PORT 65535
+// Packets sent to a multicast group, the low bits of dst_device are the group
+#define MULTICAST_PORT 0x8000
+
+// multicast_groups[group] is the bitmask of the devices of the group
+extern uint64_t multicast_groups[MAX_MULTICAST_GROUPS];
 
-#ifdef PKT_PROCESS_BATCHING
 #include <rte_mbuf.h>
-#endif
 
 bool _register_pkt_handlers(pkt_handler_t *handlers);
 
 #ifdef PKT_PROCESS_BATCHING
+// Packet set partition of each packet is derived from its RSS hash
 uint16_t process_pkt(struct rte_mbuf **mbufs, uint16_t *dst_devices, uint16_t batch_size,
-                  vigor_time_t now, uint16_t pkt_set_partition,
-                  nf_state_t *non_pkt_set_state);
+                  vigor_time_t now, nf_state_t *non_pkt_set_state);
 #else
-uint16_t process_pkt(uint16_t device, uint8_t* buffer, uint16_t buffer_length,
-                  vigor_time_t now, uint16_t pkt_set_partition,
+uint16_t process_pkt(struct rte_mbuf *mbuf, vigor_time_t now, uint16_t pkt_set_partition,
                   nf_state_t *non_pkt_set_state);
 #endif
+
+#ifdef PIPELINE
+// Size of the parse results kept in the private area of mbufs
+uint16_t pipeline_pkt_meta_size();
+
+//   RX core side: parse and dispatch packets, dropping the ones that do not
+//   parse, and compact the remaining ones at the beginning of mbufs.
+//   @returns the number of packets left.
+uint16_t pipeline_parse_pkts(struct rte_mbuf **mbufs, uint16_t count,
+                             nf_state_t *non_pkt_set_state);
+
+// Handler core side: run the packet handlers on packets parsed by an RX core
+#ifdef PKT_PROCESS_BATCHING
+void pipeline_process_pkts(struct rte_mbuf **mbufs, uint16_t *dst_devices, uint16_t batch_size,
+                           vigor_time_t now, nf_state_t *non_pkt_set_state);
+#else
+uint16_t pipeline_process_pkt(struct rte_mbuf *mbuf, vigor_time_t now, uint16_t pkt_set_partition,
+                              nf_state_t *non_pkt_set_state);
+#endif
+#endif
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+
+/*
+ * Elastic scaling of data plane cores (enabled with -DELASTIC_SCALING).
+ *
+ * NFOS starts with all the cores in LCORES and the control core parks or
+ * re-activates data plane cores based on their load. A core hands its packet
+ * set partitions over by
+ * (1) the control core setting the target owner of the partitions and
+ *     updating the RETA of all devices,
+ * (2) the old owner processing what is left in its RX queues, then flipping
+ *     the owner of the partitions.
+ * Packets of a partition received by a core that does not own it, e.g. those
+ * received by the new owner before the flip, are forwarded to the owner
+ * through per-core handoff rings instead of being dropped.
+ */
+
+// Min number of active data plane cores
+#ifndef ELASTIC_MIN_WORKERS
+#define ELASTIC_MIN_WORKERS 1
+#endif
+#if ELASTIC_MIN_WORKERS < 1
+#error "ELASTIC_MIN_WORKERS must keep at least one data plane core active"
+#endif
+
+// Load of a core is the average fill level (in %) of its RX bursts.
+// Activate one more core if the average load of active cores exceeds this
+#define ELASTIC_SCALE_OUT_THRESHOLD 70
+// Park one core if the load would stay below this after parking it
+#define ELASTIC_SCALE_IN_THRESHOLD 40
+
+// Period of scaling decisions (in us)
+#define ELASTIC_SCALING_PERIOD 500000
+// Time the old owner keeps a partition after the RETA update (in us)
+#define ELASTIC_DRAIN_TIME 100
+// Parked cores check their handoff rings at this interval (in us)
+#define ELASTIC_PARK_SLEEP 1000
+
+#define ELASTIC_HANDOFF_RING_SIZE 4096
+
+bool elastic_scaling_init(uint16_t num_workers, uint16_t nb_devices);
+
+/* Data plane side */
+
+//   Forward packets not owned by the core to the owners, compacting the
+//   remaining ones at the beginning of mbufs.
+//   @returns the number of packets to be processed locally.
+uint16_t elastic_steer_pkts(uint16_t worker, struct rte_mbuf **mbufs, uint16_t count);
+
+//   Receive packets of a device forwarded to the core by other cores.
+//   @returns the number of packets to be processed locally.
+uint16_t elastic_poll_handoff(uint16_t worker, uint16_t device,
+                              struct rte_mbuf **mbufs, uint16_t max_count);
+
+//   Account the load of a core and finish pending partition hand-overs.
+//   Called once per RX poll.
+//   @param rx_count - number of packets received from the NIC in the poll.
+void elastic_worker_poll_done(uint16_t worker, uint16_t rx_count, uint16_t burst_size);
+
+//   Sleep if the core is parked and has nothing left to forward.
+//   @returns true if the core is parked.
+bool elastic_worker_try_park(uint16_t worker);
+
+/* Control plane side */
+
+// Activate or park one data plane core depending on load, called every
+// ELASTIC_SCALING_PERIOD by the control core (see periodic.h)
+void elastic_scaling_control();
+
+// Print the state and counters of the data plane cores
+void elastic_scaling_stats_show();
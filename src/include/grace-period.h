@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_common.h>
+
+/*
+ * Quiescent-state based grace periods.
+ *
+ * For memory that data plane cores read outside of RLU, e.g. plies of the
+ * FIB mtrie which are updated in place by the control core. A data plane core
+ * is quiescent at the start of each polling loop iteration, where it holds no
+ * reference to such memory. Memory unlinked before grace_period_start() can
+ * be reused once grace_period_done() returns true for the returned token.
+ */
+
+struct grace_period_worker {
+  // Last epoch observed by the core at a quiescent state
+  volatile uint64_t epoch;
+} __rte_cache_aligned;
+
+extern struct grace_period_worker *grace_period_workers;
+extern volatile uint64_t grace_period_epoch;
+
+bool grace_period_init(uint16_t num_workers);
+
+// Report a quiescent state of a data plane core
+static inline void grace_period_quiescent(uint16_t worker) {
+  uint64_t epoch = __atomic_load_n(&grace_period_epoch, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&grace_period_workers[worker].epoch, epoch, __ATOMIC_RELEASE);
+}
+
+//   Start a grace period, called after unlinking memory.
+//   @returns token to pass to grace_period_done().
+uint64_t grace_period_start();
+
+//   @returns true if all data plane cores went through a quiescent state since
+//   the grace period of the token started.
+bool grace_period_done(uint64_t token);
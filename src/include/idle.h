@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+
+/*
+ * Power-aware idle mode of data plane cores.
+ *
+ * IDLE_MODE_POLL: busy polling (default), best latency.
+ * IDLE_MODE_PAUSE: after IDLE_EMPTY_POLL_THRESHOLD empty polls, wait in
+ *   TPAUSE (falls back to sleeping if the CPU does not support WAITPKG).
+ * IDLE_MODE_INTR: after IDLE_EMPTY_POLL_THRESHOLD empty polls, sleep until an
+ *   RX interrupt or a timer (falls back to IDLE_MODE_PAUSE if the device does
+ *   not support RX interrupts, e.g. net_ring, and on cores polling hand-over
+ *   rings only).
+ *
+ * A core never sleeps longer than IDLE_WAKEUP_BUDGET, which bounds both the
+ * extra latency of the first packet after idling and the delay of packet set
+ * expiration.
+ */
+#define IDLE_MODE_POLL 0
+#define IDLE_MODE_PAUSE 1
+#define IDLE_MODE_INTR 2
+
+#ifndef IDLE_MODE
+#define IDLE_MODE IDLE_MODE_POLL
+#endif
+
+// Consecutive empty RX polls before a core goes idle
+#ifndef IDLE_EMPTY_POLL_THRESHOLD
+#define IDLE_EMPTY_POLL_THRESHOLD 512
+#endif
+
+// Max time (in us) a core stays idle
+#ifndef IDLE_WAKEUP_BUDGET
+#define IDLE_WAKEUP_BUDGET 50
+#endif
+
+RTE_DECLARE_PER_LCORE(uint32_t, idle_empty_polls);
+
+// Enable RX interrupts in the device config if needed by the idle mode
+void idle_device_conf(struct rte_eth_conf *device_conf);
+
+// Undo idle_device_conf(), used if the device rejects the config
+void idle_device_conf_fallback(struct rte_eth_conf *device_conf);
+
+struct rx_poll_list;
+
+//   Set up the idle mode on the calling data plane core.
+//   @param poll_list - RX queues and rings polled by the core.
+void idle_worker_init(struct rx_poll_list *poll_list);
+
+// Go idle until a packet arrives or the wake-up budget expires
+void idle_wait();
+
+// Called after each RX poll
+static inline void idle_poll_done(uint16_t rx_count) {
+#if IDLE_MODE != IDLE_MODE_POLL
+  if (rx_count) {
+    RTE_PER_LCORE(idle_empty_polls) = 0;
+  } else if (++RTE_PER_LCORE(idle_empty_polls) >= IDLE_EMPTY_POLL_THRESHOLD) {
+    idle_wait();
+    RTE_PER_LCORE(idle_empty_polls) = 0;
+  }
+#endif
+}
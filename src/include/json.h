@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Minimal JSON reader for the config files of NFOS (e.g. pkt-set.cfg.json).
+// No unicode escapes beyond ASCII, numbers are parsed as doubles.
+
+enum json_type {
+  JSON_NULL,
+  JSON_BOOL,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT,
+};
+
+struct json_value {
+  enum json_type type;
+  union {
+    bool boolean;
+    double number;
+    char *string;
+    // Arrays and objects, keys are NULL for arrays
+    struct {
+      struct json_value *items;
+      char **keys;
+      size_t count;
+    };
+  };
+};
+
+//   Parse a JSON document.
+//   @returns the root value, NULL on syntax error or allocation failure.
+struct json_value *json_parse(const char *text);
+
+//   Read and parse a JSON file.
+//   @returns the root value, NULL if the file cannot be read or parsed.
+struct json_value *json_parse_file(const char *path);
+
+void json_free(struct json_value *value);
+
+//   Look up a member of an object.
+//   @returns the member, NULL if value is not an object or has no such key.
+const struct json_value *json_object_get(const struct json_value *value, const char *key);
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+
+/*
+ * Mbuf pools of data plane cores.
+ *
+ * Topologies:
+ * MEMPOOL_PER_CORE: one pool per data plane core, without cache (default).
+ *   LOAD_BALANCING relies on it to find the core of an mbuf.
+ * MEMPOOL_PER_SOCKET: one pool per NUMA socket shared by the cores of the
+ *   socket, each core keeps up to MEMPOOL_CACHE_SIZE free mbufs in a local
+ *   cache.
+ * MEMPOOL_EXTBUF: MEMPOOL_PER_SOCKET with the packet buffers in one pinned,
+ *   IOVA-contiguous memzone per socket instead of inside the mbufs.
+ *
+ * Sizing:
+ * MEMPOOL_SIZING_FIXED: MEMPOOL_BUFFER_COUNT mbufs per core and RX queue it
+ *   polls, and at least per core and device.
+ * MEMPOOL_SIZING_LLC: just enough mbufs to fill the RX queues the core polls,
+ *   its TX rings, TX buffers and caches, so that recycled mbufs are still in
+ *   the LLC. With DDIO, the
+ *   NIC writes packets to MEMPOOL_DDIO_WAYS ways of the LLC, a pool larger
+ *   than that share has packets evicted before the cores read them.
+ *
+ * With MEMPOOL_STATS, cores track the recycle distance of received mbufs: the
+ * number of mbufs the core received since it last received the same one.
+ * Multiplied by the mbuf size, it tells how much of the LLC mbufs go through
+ * before being reused.
+ */
+#define MEMPOOL_PER_CORE 0
+#define MEMPOOL_PER_SOCKET 1
+#define MEMPOOL_EXTBUF 2
+
+#ifndef MEMPOOL_TOPOLOGY
+#define MEMPOOL_TOPOLOGY MEMPOOL_PER_CORE
+#endif
+
+#define MEMPOOL_SIZING_FIXED 0
+#define MEMPOOL_SIZING_LLC 1
+
+#ifndef MEMPOOL_SIZING
+#define MEMPOOL_SIZING MEMPOOL_SIZING_FIXED
+#endif
+
+#if defined(LOAD_BALANCING) && MEMPOOL_TOPOLOGY != MEMPOOL_PER_CORE
+#error "LOAD_BALANCING needs one mempool per core"
+#endif
+
+// Buffer count per core and RX queue with MEMPOOL_SIZING_FIXED
+#ifndef MEMPOOL_BUFFER_COUNT
+#ifdef LOAD_BALANCING
+// TODO: optimize (reduce) the mempool size if needed,
+// makes sure the pools fits in LLC
+#define MEMPOOL_BUFFER_COUNT 2048
+#else
+#define MEMPOOL_BUFFER_COUNT 1024
+#endif
+#endif
+
+// Free mbufs cached per core in shared pools
+#ifndef MEMPOOL_CACHE_SIZE
+#define MEMPOOL_CACHE_SIZE 256
+#endif
+
+// LLC ways written by the NIC, 2 by default on Intel Xeons
+#ifndef MEMPOOL_DDIO_WAYS
+#define MEMPOOL_DDIO_WAYS 2
+#endif
+
+struct mbuf_pool_conf {
+  uint16_t num_workers;
+  uint16_t nb_devices;
+  // RX queues polled by each data plane core over all devices, see queue-map.h
+  const uint16_t *rx_queues;
+  uint16_t rx_queue_size;
+  uint16_t tx_queue_size;
+  // RX burst size
+  uint16_t burst_size;
+  // Buffer size without headroom
+  uint16_t data_size;
+  // Segments of the largest frame
+  uint16_t segs_per_frame;
+  // Private area of each mbuf, e.g. parse results in pipeline mode
+  uint16_t priv_size;
+};
+
+//   Create the mbuf pools.
+//   @param pools - out, pools[worker] is the pool of the RX queues of data
+//   plane core worker.
+//   @returns true on success, false otherwise.
+bool mbuf_pools_init(const struct mbuf_pool_conf *conf, struct rte_mempool **pools);
+
+#ifdef MEMPOOL_STATS
+// Recycle distances are counted in log2 buckets
+#define MEMPOOL_STATS_BUCKETS 32
+
+struct mbuf_recycle_stats {
+  // Mbufs received by the core
+  uint64_t seq;
+  // Mbufs last received by another core or never received
+  uint64_t remote;
+  uint64_t distances[MEMPOOL_STATS_BUCKETS];
+} __rte_cache_aligned;
+
+extern struct mbuf_recycle_stats *mbuf_recycle_stats;
+// Offset of the dynamic mbuf field holding the core and seq of the last reception
+extern int mbuf_recycle_stamp_offset;
+
+static inline void mbuf_pool_stats_rx(uint16_t worker, struct rte_mbuf **mbufs, uint16_t count) {
+  struct mbuf_recycle_stats *stats = &mbuf_recycle_stats[worker];
+  for (uint16_t i = 0; i < count; i++) {
+    uint64_t *stamp = RTE_MBUF_DYNFIELD(mbufs[i], mbuf_recycle_stamp_offset, uint64_t *);
+    uint64_t seq = ++stats->seq;
+    // Core in the high 16 bits, zero means never received
+    if ((*stamp >> 48) == (uint64_t)worker + 1) {
+      uint64_t distance = seq - (*stamp & ((1ULL << 48) - 1));
+      uint32_t bucket = 63 - __builtin_clzll(distance);
+      stats->distances[RTE_MIN(bucket, MEMPOOL_STATS_BUCKETS - 1)]++;
+    } else {
+      stats->remote++;
+    }
+    *stamp = ((uint64_t)(worker + 1) << 48) | seq;
+  }
+}
+
+// Print recycle distances of all cores
+void mbuf_pool_stats_show();
+#else
+static inline void mbuf_pool_stats_rx(uint16_t worker, struct rte_mbuf **mbufs, uint16_t count) {}
+static inline void mbuf_pool_stats_show() {}
+#endif
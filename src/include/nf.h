@@ -13,6 +13,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -22,13 +23,24 @@
 
 // Type of a packet
 typedef struct pkt {
+  // Length over all segments, the headers are in the first one
   uint16_t len;
   struct rte_ether_hdr *ether_header;
+  // 802.1Q tag, NULL if the packet is untagged
+  struct rte_vlan_hdr *vlan_header;
+  // At most one of ipv4_header and ipv6_header is set
   struct rte_ipv4_hdr *ipv4_header;
+  struct rte_ipv6_hdr *ipv6_header;
   struct tcpudp_hdr *tcpudp_header;
   uint8_t *payload;
   // Ugly. Todo: separate this from the headers
   uint8_t *raw;
+  // Buffer holding the packet, a chain of segments for jumbo frames
+  struct rte_mbuf *mbuf;
+  // RSS hash of the packet, e.g., to pick a load-balance bucket
+  uint32_t hash;
+  // Free for the NF to use, set in nf_pkt_batch_prepare()
+  uint32_t batch_meta;
 } pkt_t;
 
 /*
@@ -65,6 +77,15 @@ typedef struct pkt_set_state pkt_set_state_t;
 
 #include <nf_nfos_config.h>
 
+#ifndef PKT_PROCESS_BATCHING
+#undef PKT_BATCH_PREPARE
+#endif
+
+// Packet set state written by the handlers, rolled back field by field on aborts
+#ifdef PKT_SET_STATE_FIELD_LOG
+#define MUTABLE_PKT_SET_STATE
+#endif
+
 /* 
  * Opaque type for global state, you need to declare the actual type.
  * Note: you should use NFOS state interfaces to access the global state.
@@ -132,6 +153,25 @@ bool nf_pkt_parser(uint8_t *buffer, pkt_t *pkt);
 int nf_pkt_dispatcher(const pkt_t *pkt, uint16_t incoming_dev, pkt_set_id_t *pkt_set_id, bool *has_pkt_set_state, nf_state_t *global_state);
 
 
+#ifdef PKT_BATCH_PREPARE
+/*
+ * Optional, define PKT_BATCH_PREPARE in nf_nfos_config.h to use it (requires
+ * PKT_PROCESS_BATCHING).
+ * 
+ * Called on each batch of received packets after parsing and before any
+ * handler, for stateless work that is faster on the whole batch, e.g., bulk
+ * FIB lookups with prefetching. Results can be stored in pkt->batch_meta.
+ * 
+ * valid[i] is false if pkts[i] failed parsing. All packets of the batch come
+ * from incoming_dev.
+ * 
+ * Note: this runs outside of transactions, only read global state that is not
+ * updated through NFOS data structures, e.g., the FIB.
+ */
+void nf_pkt_batch_prepare(nf_state_t *global_state, pkt_t *pkts, const bool *valid,
+                          uint16_t batch_size, uint16_t incoming_dev);
+#endif
+
 // TODO: make the following two symbols weak symbols and provide default impl in NFOS?
 /*
  * Process a packet of unregistered packet set and possibly register the packet set.
@@ -182,12 +222,32 @@ typedef int (*pkt_handler_t)(nf_state_t *global_state, pkt_t *pkt, uint16_t inco
 // Interface for sending a packet through a single ethernet port.
 void send_pkt(pkt_t *pkt, uint16_t dev);
 
-// Interface for flooding a packet to all ethernet device.
+// Interface for flooding a packet to all ethernet devices except the one it
+// was received from. The packet is not copied, do not modify it afterwards.
 void flood_pkt(pkt_t *pkt);
 
+// Max number of multicast groups, see register_multicast_group()
+#ifndef MAX_MULTICAST_GROUPS
+#define MAX_MULTICAST_GROUPS 4096
+#endif
+
+// Interface for registering a multicast group in nf_init(), e.g., the flood list
+// of a bridge domain. devices is a bitmask of ethernet devices. Groups with the
+// same devices are shared. Returns the group, or -1 if there are too many groups.
+int register_multicast_group(uint64_t devices);
+
+// Interface for sending a packet to the devices of a multicast group except the
+// one it was received from. The packet is not copied, do not modify it afterwards.
+void multicast_pkt(pkt_t *pkt, int group);
+
 // Interface for dropping a packet.
 void drop_pkt(pkt_t *pkt);
 
+// Interface for reading len bytes at offset in a packet, which can span several
+// segments, e.g., the payload of a jumbo frame. Returns a pointer to the bytes,
+// either in the packet or copied to buf, or NULL if the packet is too short.
+const void *nfos_pkt_read(const pkt_t *pkt, uint32_t offset, uint32_t len, void *buf);
+
 // Interface for getting current time (in rdtsc cycles)
 vigor_time_t get_curr_time();
 
@@ -196,12 +256,47 @@ typedef void (*periodic_handler_t)(nf_state_t *global_state);
 /*
  * Interface for registering control plane handlers that
  * need to run periodically, e.g., backend expirator in Maglev.
+ * Several handlers can be registered, with their own periods (see periodic.h).
  * 
+ * name => name of the handler in the periodic task stats, must outlive it.
  * period_len => period in micro-seconds.
  * 
  * Returns true if operation succeeds and false if it fails.
  */
-bool register_periodic_handler(uint64_t period_len, periodic_handler_t handler);
+bool register_periodic_handler(const char *name, uint64_t period_len,
+                               periodic_handler_t handler);
+
+/*
+ * Same as register_periodic_handler(), with a runtime budget in micro-seconds
+ * instead of the period. Runs of the handler over budget are counted.
+ */
+bool register_periodic_handler_with_budget(const char *name, uint64_t period_len,
+                                           uint64_t budget, periodic_handler_t handler);
+
+/*
+ * Handler of a control channel command, see control.h.
+ *
+ * args => rest of the request line after the command name, without the newline.
+ * reply => buffer of reply_size bytes for an optional reply, empty by default.
+ *
+ * The handler runs on the control core inside an RLU write transaction shared
+ * with other commands, and can be run again if the transaction aborts.
+ *
+ * Return -1 on abort, 0 on success, any other value on error, in which case
+ * the handler must not have modified global_state.
+ */
+typedef int (*control_cmd_handler_t)(nf_state_t *global_state, const char *args,
+                                     char *reply, size_t reply_size);
+
+/*
+ * Interface for registering a control channel command in nf_init(), e.g.,
+ * adding a route.
+ *
+ * name => first word of the request lines of the command.
+ *
+ * Returns true if operation succeeds and false if it fails.
+ */
+bool register_control_command(const char *name, control_cmd_handler_t handler);
 
 /*
  * Interface for registering pkt handlers
@@ -221,3 +316,109 @@ bool register_pkt_handlers(pkt_handler_t *handlers);
  */
 bool add_pkt_set(pkt_set_id_t *pkt_set_id, pkt_set_state_t *local_state,
                  pkt_set_id_t *related_pkt_set_id);
+
+// Max number of timeout classes, including class 0
+#define MAX_PKT_SET_TIMEOUT_CLASSES 8
+
+/*
+ * Interface for registering timeout classes of packet sets, e.g., one per
+ * TCP connection state. Call from nf_init().
+ *
+ * timeouts => timeouts[i] is the expiration time of class i + 1 (in
+ * micro-seconds). Class 0 uses validity_duration_out of nf_init(), and new
+ * packet sets start in class 0.
+ *
+ * Each class has its own LRU list per packet set partition, so that packet
+ * sets with a short timeout are expired early without scanning the others.
+ * Without classes from the NF, NFOS splits timeouts into classes each 4x
+ * shorter than the previous one, starting from validity_duration_out.
+ *
+ * Returns true if operation succeeds and false if it fails.
+ */
+bool register_pkt_set_timeout_classes(uint64_t *timeouts, int num_classes);
+
+/*
+ * Moves a packet set of the current packet set partition to a timeout class,
+ * also refreshing it. Packet sets added by the running handler through
+ * add_pkt_set() are added directly to the class.
+ *
+ * Note: not undone if the handler aborts, set the class according to the
+ * packet set state rather than to global state.
+ *
+ * Returns true if operation succeeds and false if it fails, e.g., the packet
+ * set does not exist.
+ */
+bool set_pkt_set_timeout_class(pkt_set_id_t *pkt_set_id, int timeout_class);
+
+/*
+ * Sets the timeout of a packet set of the current packet set partition (in
+ * micro-seconds), e.g., a few milliseconds for a DNS flow, also refreshing
+ * it. Same as set_pkt_set_timeout_class() otherwise.
+ *
+ * The packet set goes to the LRU list of the timeout class with the longest
+ * timeout not above its own. It expires once its own timeout has passed, but
+ * can wait behind older packet sets of the list with longer timeouts, i.e.,
+ * by up to the gap between its timeout and the next class.
+ *
+ * Returns true if operation succeeds and false if it fails.
+ */
+bool set_pkt_set_timeout(pkt_set_id_t *pkt_set_id, uint64_t timeout);
+
+/*
+ * Interface for logging a write to packet set state, call it before writing
+ * the field, e.g., PKT_SET_STATE_WRITE(state, bytes) before state->bytes += len.
+ *
+ * With MUTABLE_PKT_SET_STATE, NFOS copies the whole packet set state before
+ * each handler run to roll it back on aborts. With PKT_SET_STATE_FIELD_LOG
+ * instead, it only saves the fields logged through this interface, once per
+ * transaction, so that handlers writing a few fields of a large state do not
+ * pay for the rest. Writes to cold state (see below) must always be logged.
+ *
+ * No-op without MUTABLE_PKT_SET_STATE.
+ */
+#ifdef MUTABLE_PKT_SET_STATE
+void nfos_pkt_set_state_write(void *field, size_t size);
+#else
+static inline void nfos_pkt_set_state_write(void *field, size_t size) {}
+#endif
+#define PKT_SET_STATE_WRITE(state, field) \
+  nfos_pkt_set_state_write(&(state)->field, sizeof((state)->field))
+
+/*
+ * Optional cold part of packet set state, for large state that only some
+ * packet sets need or that is rarely accessed, e.g., DPI context. Define
+ * PKT_SET_COLD_STATE in nf_nfos_config.h and struct pkt_set_cold_state in
+ * pkt_set.h to use it.
+ *
+ * pkt_set_state_t then holds the hot fields accessed by every packet, which
+ * are copied when adding a packet set and logged by MUTABLE_PKT_SET_STATE.
+ * Cold states come from a pool of MAX_NUM_COLD_PKT_SETS and are only
+ * allocated when first requested. They are freed when the packet set expires,
+ * after nf_expired_pkt_set_handler().
+ */
+typedef struct pkt_set_cold_state pkt_set_cold_state_t;
+
+#ifdef PKT_SET_COLD_STATE
+/*
+ * Returns the cold state of the packet set with state local_state, as passed
+ * to a packet handler or to nf_expired_pkt_set_handler(). If it has none and
+ * create is true, allocates a zeroed one, undone if the handler aborts.
+ *
+ * Returns NULL if the packet set has no cold state, or the pool is exhausted.
+ * Packet sets added by the running handler have none yet.
+ */
+pkt_set_cold_state_t *get_pkt_set_cold_state(pkt_set_state_t *local_state, bool create);
+#endif
+
+/*
+ * Packet set partition of the packet being handled.
+ *
+ * Packets are partitioned by their RSS hash, i.e., by the header fields in
+ * pkt-set.cfg.json, and a partition is processed by one data plane core at a
+ * time. NFs can shard global state by partition, e.g., per-user state when
+ * RSS hashes on the source IP, so that cores do not conflict on it.
+ */
+uint16_t nfos_get_pkt_set_partition();
+
+// Number of packet set partitions, valid from nf_init() on
+uint16_t nfos_num_pkt_set_partitions();
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_lcore.h>
+
+// Max number of packet set partitions.
+// Packet sets are partitioned by the RSS hash of their packets, and each
+// partition is owned by exactly one data plane core at a time. Only the owner
+// touches the per-partition lists of the packet set manager.
+// The actual number of partitions is capped by the RETA size of the devices
+// so that all hash values of a partition land in the same RX queue.
+#ifndef NUM_PKT_SET_PARTITIONS
+#define NUM_PKT_SET_PARTITIONS 512
+#endif
+
+// Partition of the packet being processed on the current core
+RTE_DECLARE_PER_LCORE(uint16_t, pkt_set_partition);
+
+extern uint16_t num_pkt_set_partitions;
+// partition -> index of the data plane core owning it
+extern uint16_t *pkt_set_partition_owner;
+// partition -> index of the data plane core the partition is being handed
+// over to. Equals the owner when no hand-over is in progress.
+extern uint16_t *pkt_set_partition_target_owner;
+
+//   Init the partition map. Must be called after the devices are configured
+//   since the number of partitions depends on their RETA size.
+//   @param num_workers - number of data plane cores.
+//   @param nb_devices - number of ethernet devices.
+//   @returns true on success, false otherwise.
+bool partition_map_init(uint16_t num_workers, uint16_t nb_devices);
+
+// Assume num_pkt_set_partitions is power of two
+static inline uint16_t pkt_set_partition_of_hash(uint32_t hash) {
+  return hash & (num_pkt_set_partitions - 1);
+}
+
+static inline uint16_t partition_map_get_owner(uint16_t partition) {
+  return __atomic_load_n(&pkt_set_partition_owner[partition], __ATOMIC_ACQUIRE);
+}
+
+static inline uint16_t partition_map_get_target_owner(uint16_t partition) {
+  return __atomic_load_n(&pkt_set_partition_target_owner[partition], __ATOMIC_ACQUIRE);
+}
+
+//   Hand a partition over to another data plane core.
+//   Note: the caller must make sure the old owner no longer processes packets
+//   or expires packet sets of the partition.
+void partition_map_set_owner(uint16_t partition, uint16_t worker);
+
+// Mark a partition to be handed over to another data plane core
+void partition_map_set_target_owner(uint16_t partition, uint16_t worker);
+
+//   Program the RETA of a device so that each partition is steered to an RX
+//   queue of its target owner, or of a core handing packets over to it, see
+//   queue-map.h.
+//   @returns 0 on success, DPDK error code otherwise.
+int partition_map_program_reta(uint16_t device);
+
+//   Find the next partition owned by a data plane core, used to expire one
+//   partition per polling loop iteration.
+//   @param worker - index of the data plane core.
+//   @param cursor - in/out, position to resume the search from.
+//   @returns the partition, -1 if the core owns no partition.
+int partition_map_next_owned(uint16_t worker, uint16_t *cursor);
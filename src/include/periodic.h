@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nf.h"
+
+/*
+ * Scheduler of the periodic tasks of the control core, i.e., the periodic
+ * handlers of the NF and NFOS's own tasks such as elastic scaling.
+ *
+ * A task is released at every multiple of its period since the start of the
+ * scheduler, however long it runs, so periods do not drift. Released tasks run
+ * by earliest deadline first, the deadline of a release being the next one.
+ * A task late by more than a period skips the releases it missed.
+ *
+ * In between, the control core serves the control channel (see control.h) or
+ * sleeps, which leaves the CPU to the RLU GP thread when it shares the core
+ * (see RLU_GP_CORE).
+ *
+ * Each task has a runtime budget, its period by default. Runs over budget,
+ * deadline misses and skipped releases are counted and shown on exit.
+ */
+
+#ifndef PERIODIC_MAX_TASKS
+#define PERIODIC_MAX_TASKS 16
+#endif
+
+//   Add a task, before the scheduler starts. period and budget are in us.
+//   @returns true on success, false otherwise.
+bool periodic_task_add(const char *name, uint64_t period, uint64_t budget,
+                       periodic_handler_t handler);
+
+//   Run the tasks forever.
+//   @returns right away if there are neither tasks nor a control channel.
+void periodic_sched_run(nf_state_t *non_pkt_set_state);
+
+void periodic_stats_show();
@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * Pipeline mode, enabled with PIPELINE.
+ *
+ * The first PIPELINE_RX_CORES data plane cores poll the devices, run
+ * nf_pkt_parser() and nf_pkt_dispatcher() on the packets, and hand them over
+ * in bursts to the owners of their packet set partitions. The other cores
+ * own all the partitions and run the packet handlers only, so packet set
+ * state is never written by two cores.
+ *
+ * Packets travel through the hand-over rings of the queue map (see
+ * queue-map.h), with the parse results in the private area of their mbufs.
+ * With PKT_BATCH_PREPARE, nf_pkt_batch_prepare() runs on the RX cores too.
+ *
+ * Worth it when parsing and dispatching are expensive compared to the
+ * handlers, e.g., long header chains, and the handlers contend on
+ * non-packet-set state.
+ */
+
+#ifdef PIPELINE
+
+#ifndef PIPELINE_RX_CORES
+#define PIPELINE_RX_CORES 1
+#endif
+
+#if defined(ELASTIC_SCALING) || defined(LOAD_BALANCING)
+#error "PIPELINE does not support ELASTIC_SCALING and LOAD_BALANCING"
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "nf.h"
+
+/*
+ * Write log of packet set state for MUTABLE_PKT_SET_STATE, see
+ * nfos_pkt_set_state_write() in nf.h.
+ *
+ * A transaction logs the hot and cold states it may write as objects. Before
+ * a field of an object is written, the chunks holding it are saved, unless
+ * their dirty bit says they already were in this transaction. An object has
+ * 64 chunks of at least 8 bytes. On aborts, the saved chunks are restored and
+ * the cold states allocated by the transaction are freed.
+ *
+ * Writes outside of the logged objects are not rolled back, e.g., writes to
+ * the whole-state copies of MUTABLE_PKT_SET_STATE without
+ * PKT_SET_STATE_FIELD_LOG.
+ */
+
+#ifdef MUTABLE_PKT_SET_STATE
+
+// Hot and cold states of a batch of 32 packets
+#define PKT_SET_LOG_MAX_OBJECTS 64
+
+// Start the log of a transaction
+void pkt_set_log_reset();
+
+// Log the writes to an object in the current transaction
+void pkt_set_log_object(void *base, size_t size);
+
+// Free a cold state allocated by the current transaction if it aborts
+void pkt_set_log_cold_alloc(int index);
+
+// Roll back the current transaction, and start a new log
+void pkt_set_log_rollback();
+
+#endif
@@ -13,8 +13,13 @@ typedef struct add_pkt_set_log_entry {
     bool add_pkt_set;
     pkt_set_id_t related_pkt_set_id;
     pkt_set_state_t pkt_set_state;
+    int timeout_class;
+    vigor_time_t timeout;
 } add_pkt_set_log_entry_t;
 
+// Called from nf_init(), before init_pkt_set_manager()
+bool register_timeout_classes(uint64_t *timeouts, int num_classes);
+
 bool init_pkt_set_manager(map_keys_equality *pkt_set_id_eq,
                           map_key_hash *pkt_set_id_hash,
                           vigor_time_t _pkt_set_validity_duration,
@@ -32,5 +37,21 @@ void add_pkt_set_commit(pkt_set_id_t *pkt_set_id,
 bool get_pkt_set_state(pkt_set_id_t *pkt_set_id, pkt_set_state_t **_state,
                        int pkt_set_partition, vigor_time_t time);
 
+bool set_pkt_set_timeout_class_of(pkt_set_id_t *pkt_set_id, int timeout_class,
+                                  int pkt_set_partition, vigor_time_t time);
+
+bool set_pkt_set_timeout_of(pkt_set_id_t *pkt_set_id, vigor_time_t timeout,
+                            int pkt_set_partition, vigor_time_t time);
+
+#ifdef PKT_SET_COLD_STATE
+#ifndef MAX_NUM_COLD_PKT_SETS
+#define MAX_NUM_COLD_PKT_SETS (MAX_NUM_PKT_SETS / 4)
+#endif
+// Cold states cached per core by the pool
+#define PKT_SET_COLD_CACHE_SIZE 256
+
+void free_pkt_set_cold_state(int index);
+#endif
+
 int delete_expired_pkt_sets(vigor_time_t time, int pkt_set_partition,
                             nf_state_t *non_pkt_set_state);
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+
+/*
+ * RSS configuration derived from the packet set config of the NF
+ * (pkt-set.cfg.json, see utils/README.md for the format).
+ *
+ * On NICs receiving packet sets, RSS hashes exactly the header fields that
+ * identify a packet set, so all packets of a packet set get the same hash,
+ * hence the same partition and data plane core. If NIC groups identify packet
+ * sets with swapped fields (e.g. both directions of a flow), a symmetric key
+ * is used. All NICs share the same key so that a packet set received on
+ * several NICs stays in one partition.
+ *
+ * What the NICs report back after start is checked against the config, and
+ * the hashes of the first RSS_VALIDATION_PKTS packets of each data plane core
+ * are recomputed in software.
+ *
+ * Devices without usable RSS (e.g. net_pcap, net_null, some VFs), or all of
+ * them with SOFT_RSS, get a single RX queue. The core polling it computes the
+ * hashes the NIC would have, with the same fields and key, and hands packets
+ * over to the owners of their partitions (see queue-map.h).
+ */
+
+#ifndef RSS_VALIDATION_PKTS
+#define RSS_VALIDATION_PKTS 1024
+#endif
+
+#define RSS_MAX_KEY_LEN 64
+
+RTE_DECLARE_PER_LCORE(uint32_t, rss_pkts_to_validate);
+
+//   Load the RSS config of all devices.
+//   @param cfg_path - path to pkt-set.cfg.json, NULL if the NF has none, in
+//   which case all devices hash on IP addresses and L4 ports.
+//   @param nb_devices - number of ethernet devices.
+//   @returns true on success, false if the config is invalid or cannot be
+//   implemented with RSS.
+bool pkt_set_rss_init(const char *cfg_path, uint16_t nb_devices);
+
+// True if the packets of the device are hashed in software
+bool pkt_set_rss_is_soft(uint16_t device);
+
+//   Fill in the RSS part of the config of a device, before configuring it.
+//   @returns 0 on success, negative error code otherwise.
+int pkt_set_rss_device_conf(struct rte_eth_conf *device_conf, uint16_t device,
+                            uint16_t num_workers);
+
+//   Program RSS on a started device and check the NIC applied it.
+//   @returns 0 on success, negative error code otherwise.
+int pkt_set_rss_check_device(uint16_t device);
+
+void pkt_set_rss_validate_burst(struct rte_mbuf **mbufs, uint16_t count);
+
+// Compare RSS hashes computed by the NIC with the software ones, called after
+// each RX poll
+static inline void pkt_set_rss_validate(struct rte_mbuf **mbufs, uint16_t count) {
+  if (unlikely(RTE_PER_LCORE(rss_pkts_to_validate) != 0))
+    pkt_set_rss_validate_burst(mbufs, count);
+}
+
+// Set the RSS hash of packets received on a device hashed in software
+void pkt_set_rss_soft_hash(struct rte_mbuf **mbufs, uint16_t count);
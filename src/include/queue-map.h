@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+/*
+ * Mapping of RX queues to data plane cores, and polling of the queues.
+ *
+ * By default every data plane core polls one RX queue of every device, core i
+ * polling queue i. QUEUE_MAP overrides the cores polling a device, e.g.
+ * "0:0-3;1:0-3;2:4" has cores 0-3 poll devices 0 and 1, and core 4 poll
+ * device 2 alone. A core listed twice for a device polls two of its queues.
+ * Devices left out are polled by all the cores, or by the RX cores only in
+ * pipeline mode (see pipeline.h). Every core keeps one TX queue per device.
+ *
+ * Packet set partitions stay spread over all the data plane cores. A device
+ * steers a partition to a queue of its owner if the owner polls the device,
+ * and to a queue of another core polling the device otherwise, which hands
+ * the packets over to the owner through a ring.
+ *
+ * A core polls its queues round-robin and skips the quiet ones: a queue with
+ * more than POLL_SKIP_RATIO % of empty polls over POLL_WINDOW polls gets
+ * polled every 2nd, then 4th... loop iteration up to POLL_MAX_INTERVAL, and
+ * every iteration again as soon as it receives packets.
+ */
+
+#ifndef POLL_WINDOW
+#define POLL_WINDOW 64
+#endif
+
+#ifndef POLL_SKIP_RATIO
+#define POLL_SKIP_RATIO 90
+#endif
+
+// 1 disables skipping
+#ifndef POLL_MAX_INTERVAL
+#define POLL_MAX_INTERVAL 16
+#endif
+
+#define QUEUE_MAP_RING_SIZE 1024
+
+#if defined(QUEUE_MAP) && (defined(ELASTIC_SCALING) || defined(LOAD_BALANCING))
+#error "QUEUE_MAP does not support ELASTIC_SCALING and LOAD_BALANCING"
+#endif
+
+struct rx_poll_entry {
+  uint16_t device;
+  // RX queue, unused for rings
+  uint16_t queue;
+  // Packets handed over by other cores polling a device the core does not
+  // poll, NULL for RX queues
+  struct rte_ring *ring;
+  // Hand packets of partitions owned by other cores over to them
+  bool steer;
+  // Compute RSS hashes in software, see pkt-set-rss.h
+  bool soft_rss;
+
+  // Poll scheduling
+  uint16_t interval;
+  uint16_t countdown;
+  uint16_t polls;
+  uint16_t empty_polls;
+};
+
+struct rx_poll_list {
+  uint16_t num_entries;
+  struct rx_poll_entry *entries;
+};
+
+//   Init the queue map from QUEUE_MAP, must be called before the devices
+//   are configured.
+//   @returns true on success, false otherwise.
+bool queue_map_init(uint16_t num_workers, uint16_t nb_devices);
+
+// Number of RX queues of a device
+uint16_t queue_map_num_rx_queues(uint16_t device);
+
+// Data plane core polling an RX queue
+uint16_t queue_map_rx_queue_worker(uint16_t device, uint16_t queue);
+
+// Number of RX queues a data plane core polls over all devices
+uint16_t queue_map_worker_num_rx_queues(uint16_t worker);
+
+// RX queue a device steers a packet set partition owned by a core to
+uint16_t queue_map_partition_queue(uint16_t device, uint16_t partition, uint16_t owner);
+
+// Queues and rings polled by a data plane core
+struct rx_poll_list *queue_map_poll_list(uint16_t worker);
+
+static inline bool rx_poll_due(struct rx_poll_entry *e) {
+  if (e->countdown > 1) {
+    e->countdown--;
+    return false;
+  }
+  e->countdown = e->interval;
+  return true;
+}
+
+static inline uint16_t rx_poll_burst(struct rx_poll_entry *e, struct rte_mbuf **mbufs,
+                                     uint16_t max_count) {
+  if (e->ring)
+    return rte_ring_sc_dequeue_burst(e->ring, (void **)mbufs, max_count, NULL);
+  return rte_eth_rx_burst(e->device, e->queue, mbufs, max_count);
+}
+
+static inline void rx_poll_done(struct rx_poll_entry *e, uint16_t count) {
+  if (count) {
+    e->interval = 1;
+    e->countdown = 1;
+  } else {
+    e->empty_polls++;
+  }
+
+  if (++e->polls == POLL_WINDOW) {
+    if (e->empty_polls * 100 > POLL_SKIP_RATIO * POLL_WINDOW)
+      e->interval = RTE_MIN(e->interval * 2, POLL_MAX_INTERVAL);
+    e->polls = 0;
+    e->empty_polls = 0;
+  }
+}
+
+uint16_t queue_map_steer_burst(uint16_t worker, uint16_t device,
+                               struct rte_mbuf **mbufs, uint16_t count);
+
+//   Hand the packets of partitions owned by cores not polling the device over
+//   to them, compacting the remaining ones at the beginning of mbufs.
+//   @returns the number of packets to be processed locally.
+static inline uint16_t queue_map_steer_pkts(uint16_t worker, struct rx_poll_entry *e,
+                                            struct rte_mbuf **mbufs, uint16_t count) {
+  if (likely(!e->steer) || count == 0)
+    return count;
+  return queue_map_steer_burst(worker, e->device, mbufs, count);
+}
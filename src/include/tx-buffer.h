@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+
+#include "timer.h"
+
+/*
+ * Per-core TX buffering of data plane cores.
+ *
+ * Each core has one rte_eth_dev_tx_buffer per device, packets sent to a device
+ * accumulate across RX bursts and devices and are handed to the NIC once the
+ * buffer is full, or after at most TX_FLUSH_TIMEOUT.
+ */
+
+// Packets per TX buffer, i.e., max size of a TX burst
+#ifndef TX_BUFFER_SIZE
+#define TX_BUFFER_SIZE 32
+#endif
+
+// Max time (in us) a packet stays in a TX buffer
+#ifndef TX_FLUSH_TIMEOUT
+#define TX_FLUSH_TIMEOUT 100
+#endif
+
+struct tx_worker {
+  // buffers[device]
+  struct rte_eth_dev_tx_buffer **buffers;
+  uint16_t queue;
+  uint16_t nb_devices;
+  vigor_time_t next_flush;
+  // Packets dropped because the TX queue is full
+  uint64_t drops;
+};
+
+RTE_DECLARE_PER_LCORE(struct tx_worker, tx_worker);
+
+//   Set up the TX buffers of the calling data plane core.
+//   @param queue - TX queue used by the core on every device.
+//   @param nb_devices - number of ethernet devices.
+//   @returns true on success, false otherwise.
+bool tx_worker_init(uint16_t queue, uint16_t nb_devices);
+
+// Send a packet through one device
+static inline void tx_send(uint16_t device, struct rte_mbuf *mbuf) {
+  struct tx_worker *w = &RTE_PER_LCORE(tx_worker);
+  rte_eth_tx_buffer(device, w->queue, w->buffers[device], mbuf);
+}
+
+//   Send a packet through a set of devices except the one it was received
+//   from. The mbuf is not copied, each device holds one reference to it, so
+//   the packet must not be modified afterwards.
+//   @param devices - bitmask of the devices.
+static inline void tx_multicast(struct rte_mbuf *mbuf, uint64_t devices, uint16_t src_device) {
+  struct tx_worker *w = &RTE_PER_LCORE(tx_worker);
+  if (src_device < 64)
+    devices &= ~(1ULL << src_device);
+  if (w->nb_devices < 64)
+    devices &= (1ULL << w->nb_devices) - 1;
+  if (unlikely(devices == 0)) {
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+
+  rte_pktmbuf_refcnt_update(mbuf, __builtin_popcountll(devices) - 1);
+  while (devices) {
+    uint16_t device = __builtin_ctzll(devices);
+    devices &= devices - 1;
+    rte_eth_tx_buffer(device, w->queue, w->buffers[device], mbuf);
+  }
+}
+
+// Send a packet through all devices except the one it was received from
+static inline void tx_flood(struct rte_mbuf *mbuf, uint16_t src_device) {
+  tx_multicast(mbuf, UINT64_MAX, src_device);
+}
+
+// Hand all buffered packets of the core to the NICs
+void tx_flush_all();
+
+//   Flush the TX buffers if the flush timeout has passed, called once per
+//   polling loop iteration.
+//   @param now - current time in TSC cycles.
+static inline void tx_flush_if_stale(vigor_time_t now) {
+  if (unlikely(now >= RTE_PER_LCORE(tx_worker).next_flush))
+    tx_flush_all();
+}
@@ -0,0 +1,258 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+// Max nesting depth, config files are shallow
+#define JSON_MAX_DEPTH 32
+
+struct json_parser {
+  const char *pos;
+  int depth;
+};
+
+static bool parse_value(struct json_parser *p, struct json_value *out);
+static void free_children(struct json_value *value);
+
+static void skip_ws(struct json_parser *p) {
+  while (isspace((unsigned char)*p->pos))
+    p->pos++;
+}
+
+static bool consume(struct json_parser *p, char c) {
+  skip_ws(p);
+  if (*p->pos != c)
+    return false;
+  p->pos++;
+  return true;
+}
+
+static bool consume_literal(struct json_parser *p, const char *literal) {
+  size_t len = strlen(literal);
+  if (strncmp(p->pos, literal, len))
+    return false;
+  p->pos += len;
+  return true;
+}
+
+static char *parse_string(struct json_parser *p) {
+  if (!consume(p, '"'))
+    return NULL;
+
+  // Unescaped string is never longer than the escaped one
+  const char *end = p->pos;
+  while (*end && *end != '"') {
+    if (*end == '\\' && end[1])
+      end++;
+    end++;
+  }
+  if (*end != '"')
+    return NULL;
+
+  char *str = malloc(end - p->pos + 1);
+  if (str == NULL)
+    return NULL;
+
+  size_t len = 0;
+  while (p->pos < end) {
+    char c = *p->pos++;
+    if (c == '\\') {
+      c = *p->pos++;
+      switch (c) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'u': {
+          // Only ASCII code points are supported
+          unsigned code;
+          if (end - p->pos < 4 || sscanf(p->pos, "%4x", &code) != 1 || code > 0x7f) {
+            free(str);
+            return NULL;
+          }
+          p->pos += 4;
+          c = (char)code;
+          break;
+        }
+        default: break; // '"', '\\', '/'
+      }
+    }
+    str[len++] = c;
+  }
+  str[len] = '\0';
+  p->pos = end + 1;
+  return str;
+}
+
+// Parse the members of an array or object, the opening bracket is consumed
+static bool parse_children(struct json_parser *p, struct json_value *out, bool is_object) {
+  char closing = is_object ? '}' : ']';
+  size_t capacity = 0;
+
+  out->items = NULL;
+  out->keys = NULL;
+  out->count = 0;
+
+  if (consume(p, closing))
+    return true;
+
+  do {
+    if (out->count == capacity) {
+      capacity = capacity ? capacity * 2 : 4;
+      struct json_value *items = realloc(out->items, capacity * sizeof(*items));
+      if (items == NULL)
+        return false;
+      out->items = items;
+      if (is_object) {
+        char **keys = realloc(out->keys, capacity * sizeof(*keys));
+        if (keys == NULL)
+          return false;
+        out->keys = keys;
+      }
+    }
+
+    if (is_object) {
+      out->keys[out->count] = parse_string(p);
+      if (out->keys[out->count] == NULL)
+        return false;
+      if (!consume(p, ':')) {
+        free(out->keys[out->count]);
+        return false;
+      }
+    }
+    if (!parse_value(p, &out->items[out->count])) {
+      if (is_object)
+        free(out->keys[out->count]);
+      return false;
+    }
+    out->count++;
+  } while (consume(p, ','));
+
+  return consume(p, closing);
+}
+
+static bool parse_value(struct json_parser *p, struct json_value *out) {
+  skip_ws(p);
+  out->type = JSON_NULL;
+
+  switch (*p->pos) {
+    case '{':
+    case '[': {
+      bool is_object = *p->pos == '{';
+      if (++p->depth > JSON_MAX_DEPTH)
+        return false;
+      p->pos++;
+      out->type = is_object ? JSON_OBJECT : JSON_ARRAY;
+      bool ok = parse_children(p, out, is_object);
+      p->depth--;
+      if (!ok) {
+        // Members parsed so far are complete, free them
+        free_children(out);
+        out->type = JSON_NULL;
+      }
+      return ok;
+    }
+
+    case '"':
+      out->string = parse_string(p);
+      if (out->string == NULL)
+        return false;
+      out->type = JSON_STRING;
+      return true;
+
+    case 't':
+    case 'f':
+      out->type = JSON_BOOL;
+      out->boolean = *p->pos == 't';
+      return consume_literal(p, out->boolean ? "true" : "false");
+
+    case 'n':
+      return consume_literal(p, "null");
+
+    default: {
+      char *end;
+      out->number = strtod(p->pos, &end);
+      if (end == p->pos)
+        return false;
+      out->type = JSON_NUMBER;
+      p->pos = end;
+      return true;
+    }
+  }
+}
+
+// Free what a value owns, but not the value itself
+static void free_children(struct json_value *value) {
+  if (value->type == JSON_STRING) {
+    free(value->string);
+  } else if (value->type == JSON_ARRAY || value->type == JSON_OBJECT) {
+    for (size_t i = 0; i < value->count; i++) {
+      free_children(&value->items[i]);
+      if (value->keys)
+        free(value->keys[i]);
+    }
+    free(value->items);
+    free(value->keys);
+  }
+}
+
+struct json_value *json_parse(const char *text) {
+  struct json_parser p = { .pos = text, .depth = 0 };
+  struct json_value *root = malloc(sizeof(*root));
+  if (root == NULL)
+    return NULL;
+
+  if (!parse_value(&p, root)) {
+    free(root);
+    return NULL;
+  }
+
+  skip_ws(&p);
+  if (*p.pos != '\0') {
+    json_free(root);
+    return NULL;
+  }
+  return root;
+}
+
+struct json_value *json_parse_file(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return NULL;
+
+  struct json_value *root = NULL;
+  char *text = NULL;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    long size = ftell(f);
+    if (size >= 0 && fseek(f, 0, SEEK_SET) == 0 && (text = malloc(size + 1)) != NULL) {
+      size_t len = fread(text, 1, size, f);
+      text[len] = '\0';
+      root = json_parse(text);
+      free(text);
+    }
+  }
+
+  fclose(f);
+  return root;
+}
+
+void json_free(struct json_value *value) {
+  if (value == NULL)
+    return;
+  free_children(value);
+  free(value);
+}
+
+const struct json_value *json_object_get(const struct json_value *value, const char *key) {
+  if (value == NULL || value->type != JSON_OBJECT)
+    return NULL;
+  for (size_t i = 0; i < value->count; i++) {
+    if (!strcmp(value->keys[i], key))
+      return &value->items[i];
+  }
+  return NULL;
+}
@@ -0,0 +1,175 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <rte_common.h>
+#include <rte_errno.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+#include <rte_memzone.h>
+
+#include "vigor/nf-log.h"
+
+#include "mbuf-pool.h"
+#include "tx-buffer.h"
+
+// Mbufs a data plane core holds when its rings and buffers are full
+static unsigned mbufs_per_worker(const struct mbuf_pool_conf *conf, uint16_t worker) {
+  unsigned rx_queues = conf->rx_queues[worker];
+#if MEMPOOL_SIZING == MEMPOOL_SIZING_LLC
+  // RX descriptors hold one segment each, TX rings and buffers whole frames.
+  // The core polls its RX queues but keeps one TX queue per device.
+  unsigned per_device = (conf->tx_queue_size + TX_BUFFER_SIZE) * conf->segs_per_frame;
+  return rx_queues * conf->rx_queue_size + conf->nb_devices * per_device +
+         conf->burst_size * conf->segs_per_frame;
+#else
+  return MEMPOOL_BUFFER_COUNT * RTE_MAX(rx_queues, (unsigned)conf->nb_devices) *
+         conf->segs_per_frame;
+#endif
+}
+
+// Share of the LLC written by the NIC, 0 if unknown
+static size_t ddio_bytes() {
+  long llc_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  long llc_ways = sysconf(_SC_LEVEL3_CACHE_ASSOC);
+  if (llc_size <= 0 || llc_ways <= 0)
+    return 0;
+  return (size_t)llc_size / llc_ways * MEMPOOL_DDIO_WAYS;
+}
+
+static struct rte_mempool *create_pool(const char *name, unsigned count, unsigned cache_size,
+                                       uint16_t priv_size, uint16_t buf_size, int socket) {
+#if MEMPOOL_TOPOLOGY == MEMPOOL_EXTBUF
+  // Pinned buffers in one IOVA-contiguous zone, the NIC reads them without
+  // any per-mbuf address translation
+  char mz_name[RTE_MEMZONE_NAMESIZE];
+  snprintf(mz_name, sizeof(mz_name), "%s_ext", name);
+  struct rte_pktmbuf_extmem ext_mem = {
+    .elt_size = buf_size,
+    .buf_len = RTE_ALIGN_CEIL((size_t)count * buf_size, RTE_PGSIZE_2M),
+  };
+  const struct rte_memzone *mz = rte_memzone_reserve_aligned(
+    mz_name, ext_mem.buf_len, socket,
+    RTE_MEMZONE_IOVA_CONTIG | RTE_MEMZONE_1GB | RTE_MEMZONE_SIZE_HINT_ONLY,
+    RTE_PGSIZE_2M);
+  if (mz == NULL)
+    return NULL;
+  ext_mem.buf_ptr = mz->addr;
+  ext_mem.buf_iova = mz->iova;
+  return rte_pktmbuf_pool_create_extbuf(name, count, cache_size, priv_size, buf_size, socket,
+                                        &ext_mem, 1);
+#else
+  return rte_pktmbuf_pool_create(name, count, cache_size, priv_size, buf_size, socket);
+#endif
+}
+
+static void log_pool(const char *name, unsigned count, uint16_t buf_size) {
+  size_t pool_bytes = (size_t)count * (buf_size + sizeof(struct rte_mbuf));
+  size_t ddio = ddio_bytes();
+  NF_INFO("Mempool %s: %u mbufs, %zu KB, DDIO share of the LLC %zu KB",
+          name, count, pool_bytes >> 10, ddio >> 10);
+  if (MEMPOOL_SIZING == MEMPOOL_SIZING_LLC && ddio && pool_bytes > ddio) {
+    NF_INFO("Mempool %s exceeds the DDIO share, consider smaller RX/TX rings", name);
+  }
+}
+
+bool mbuf_pools_init(const struct mbuf_pool_conf *conf, struct rte_mempool **pools) {
+  uint16_t buf_size = RTE_PKTMBUF_HEADROOM + conf->data_size;
+
+#ifdef MEMPOOL_STATS
+  // Must be registered before mbufs are created for them to be zeroed
+  static const struct rte_mbuf_dynfield stamp_desc = {
+    .name = "nfos_mbuf_recycle_stamp",
+    .size = sizeof(uint64_t),
+    .align = __alignof__(uint64_t),
+  };
+  mbuf_recycle_stamp_offset = rte_mbuf_dynfield_register(&stamp_desc);
+  mbuf_recycle_stats = rte_zmalloc(NULL, sizeof(struct mbuf_recycle_stats) * conf->num_workers,
+                                   RTE_CACHE_LINE_SIZE);
+  if (mbuf_recycle_stamp_offset < 0 || mbuf_recycle_stats == NULL)
+    return false;
+#endif
+
+  // Data plane cores are the first num_workers lcores
+  unsigned lcore_ids[conf->num_workers];
+  unsigned lcore_id, worker = 0;
+  RTE_LCORE_FOREACH(lcore_id) {
+    if (worker < conf->num_workers)
+      lcore_ids[worker++] = lcore_id;
+  }
+
+#if MEMPOOL_TOPOLOGY == MEMPOOL_PER_CORE
+  for (worker = 0; worker < conf->num_workers; worker++) {
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
+    // dirty hack to get mapping from mempool to lcore
+    // useful for LB
+    sprintf(pool_name, "%c", worker);
+    unsigned count = mbufs_per_worker(conf, worker);
+    pools[worker] = create_pool(pool_name, count, 0, conf->priv_size, buf_size,
+                                rte_lcore_to_socket_id(lcore_ids[worker]));
+    if (pools[worker] == NULL)
+      return false;
+    // Sizes differ with the RX queues of the cores
+    char desc[32];
+    snprintf(desc, sizeof(desc), "of core %u", worker);
+    log_pool(desc, count, buf_size);
+  }
+#else
+  // Cache of each core, plus what DPDK lets it overshoot by
+  unsigned cache_mbufs = MEMPOOL_CACHE_SIZE * 3 / 2;
+  for (unsigned socket_idx = 0; socket_idx < rte_socket_count(); socket_idx++) {
+    int socket = rte_socket_id_by_idx(socket_idx);
+    unsigned num_socket_workers = 0, count = 0;
+    for (worker = 0; worker < conf->num_workers; worker++) {
+      if ((int)rte_lcore_to_socket_id(lcore_ids[worker]) == socket) {
+        num_socket_workers++;
+        count += mbufs_per_worker(conf, worker) + cache_mbufs;
+      }
+    }
+    if (num_socket_workers == 0)
+      continue;
+
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
+    snprintf(pool_name, sizeof(pool_name), "mbufs_s%d", socket);
+    struct rte_mempool *pool = create_pool(pool_name, count, MEMPOOL_CACHE_SIZE,
+                                           conf->priv_size, buf_size, socket);
+    if (pool == NULL)
+      return false;
+    log_pool(pool_name, count, buf_size);
+
+    for (worker = 0; worker < conf->num_workers; worker++) {
+      if ((int)rte_lcore_to_socket_id(lcore_ids[worker]) == socket)
+        pools[worker] = pool;
+    }
+  }
+#endif
+
+  return true;
+}
+
+#ifdef MEMPOOL_STATS
+struct mbuf_recycle_stats *mbuf_recycle_stats;
+int mbuf_recycle_stamp_offset;
+
+void mbuf_pool_stats_show() {
+  unsigned lcore_id, worker = 0;
+  RTE_LCORE_FOREACH(lcore_id) {
+    if (worker == rte_lcore_count() - 1)
+      break;
+    struct mbuf_recycle_stats *stats = &mbuf_recycle_stats[worker];
+    printf("core %u mbuf recycle distances, received %" PRIu64 ", first or remote %" PRIu64 "\n",
+           worker, stats->seq, stats->remote);
+    for (int bucket = 0; bucket < MEMPOOL_STATS_BUCKETS; bucket++) {
+      if (stats->distances[bucket])
+        printf("  [%llu, %llu): %" PRIu64 "\n", 1ULL << bucket, 2ULL << bucket,
+               stats->distances[bucket]);
+    }
+    worker++;
+  }
+  fflush(stdout);
+}
+#endif
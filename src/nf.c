@@ -35,8 +35,18 @@
 
 #include "nf.h"
 #include "pkt-set-manager.h"
+#include "partition-map.h"
+#include "pkt-set-rss.h"
 #include "data-plane.h"
 #include "timer.h"
+#include "idle.h"
+#include "mbuf-pool.h"
+#include "checksum.h"
+#include "queue-map.h"
+#include "tx-buffer.h"
+#include "grace-period.h"
+#include "control.h"
+#include "periodic.h"
 #include "scalability-profiler.h"
 
 #ifdef FLOW_PERF_BENCH
@@ -51,6 +61,10 @@
 
 #include "vigor/nf-lb/rss.h"
 
+#ifdef ELASTIC_SCALING
+#include "elastic-scaling.h"
+#endif
+
 #include "rlu-wrapper.h"
 
 #ifdef ENABLE_STAT
@@ -116,19 +130,22 @@
     }
 #else // KLEE_VERIFICATION
 
+// Iterate over the RX queues and hand-over rings of the core, see queue-map.h
 #ifndef DEBUG_REAL_NOP
 #  define VIGOR_LOOP_BEGIN                                                     \
-    unsigned VIGOR_DEVICES_COUNT = rte_eth_dev_count_avail();                  \
+    struct rx_poll_list *_vigor_poll_list = queue_map_poll_list(lcore);        \
     while (1) {                                                                \
       nfos_timer_tick();                                                       \
-      for (uint16_t VIGOR_DEVICE = 0; VIGOR_DEVICE < VIGOR_DEVICES_COUNT;      \
-           VIGOR_DEVICE++) {
+      for (uint16_t _e = 0; _e < _vigor_poll_list->num_entries; _e++) {        \
+        struct rx_poll_entry *VIGOR_POLL = &_vigor_poll_list->entries[_e];     \
+        uint16_t VIGOR_DEVICE = VIGOR_POLL->device;
 #else
 #  define VIGOR_LOOP_BEGIN                                                     \
-    unsigned VIGOR_DEVICES_COUNT = rte_eth_dev_count_avail();                  \
+    struct rx_poll_list *_vigor_poll_list = queue_map_poll_list(lcore);        \
     while (1) {                                                                \
-      for (uint16_t VIGOR_DEVICE = 0; VIGOR_DEVICE < VIGOR_DEVICES_COUNT;      \
-           VIGOR_DEVICE++) {
+      for (uint16_t _e = 0; _e < _vigor_poll_list->num_entries; _e++) {        \
+        struct rx_poll_entry *VIGOR_POLL = &_vigor_poll_list->entries[_e];     \
+        uint16_t VIGOR_DEVICE = VIGOR_POLL->device;
 #endif
 
 #  define VIGOR_LOOP_END                                                       \
@@ -138,8 +155,6 @@
 
 static nf_state_t *non_pkt_set_state;
 RTE_DEFINE_PER_LCORE(uint16_t, pkt_set_partition);
-periodic_handler_t periodic_handler = NULL;
-uint64_t periodic_handler_period;
 
 // RLU per thread data
 rlu_thread_data_t **rlu_threads_data;
@@ -162,67 +177,109 @@ static void update_dev_stats(struct rte_eth_stats *dev_stats, int nb_devices) {
 static const uint16_t RX_QUEUE_SIZE = 512;
 static const uint16_t TX_QUEUE_SIZE = 512;
 
-void flood(struct rte_mbuf *frame, uint16_t skip_device, uint16_t nb_devices, uint16_t txq) {
-  rte_mbuf_refcnt_set(frame, nb_devices - 1);
-  int total_sent = 0;
-  for (uint16_t device = 0; device < nb_devices; device++) {
-    if (device == skip_device)
-      continue;
-    total_sent += rte_eth_tx_burst(device, txq, &frame, 1);
-  }
-  if (total_sent != nb_devices - 1) {
-    rte_pktmbuf_free(frame);
-  }
-}
+// MTU of all devices, e.g., 9000 for jumbo frames
+#ifndef NF_MTU
+#define NF_MTU 1600
+#endif
 
-// Buffer count for mempools
-#ifdef LOAD_BALANCING
-// TODO: optimize (reduce) the mempool size if needed,
-// makes sure the pools fits in LLC
-// or use shared mempool
-static const unsigned MEMPOOL_BUFFER_COUNT = 2048;
-#else
-static const unsigned MEMPOOL_BUFFER_COUNT = 1024;
+// Max data room of mbufs, larger packets are received in several segments
+#ifndef MBUF_MAX_DATA_SIZE
+#define MBUF_MAX_DATA_SIZE RTE_MBUF_DEFAULT_DATAROOM
 #endif
 
+// Largest frame on the wire, with a VLAN tag
+#define MAX_FRAME_LEN (NF_MTU + RTE_ETHER_HDR_LEN + RTE_VLAN_HLEN + RTE_ETHER_CRC_LEN)
+
+// Data room fitting the largest frame. Rounded up to 1KB since some PMDs
+// (e.g. ixgbe, i40e) size RX buffers in 1KB steps and round other sizes down,
+// and at least the DPDK default.
+#define MBUF_FRAME_DATA_SIZE                                               \
+  (RTE_ALIGN_CEIL(MAX_FRAME_LEN, 1024) > RTE_MBUF_DEFAULT_DATAROOM ?       \
+   RTE_ALIGN_CEIL(MAX_FRAME_LEN, 1024) : RTE_MBUF_DEFAULT_DATAROOM)
+
+// Data room of mbufs, a whole frame if MBUF_MAX_DATA_SIZE allows it
+static const uint16_t MBUF_DATA_SIZE =
+  MBUF_FRAME_DATA_SIZE < MBUF_MAX_DATA_SIZE ? MBUF_FRAME_DATA_SIZE : MBUF_MAX_DATA_SIZE;
+// Segments of the largest frame
+#define MBUF_SEGS_PER_FRAME ((MAX_FRAME_LEN + MBUF_DATA_SIZE - 1) / MBUF_DATA_SIZE)
+
 // --- Initialization ---
-static int nf_init_device(uint16_t device, struct rte_mempool **mbuf_pools, uint16_t num_queues) {
-  // Number of RX/TX queues
-  uint16_t RX_QUEUES_COUNT = num_queues;
-  uint16_t TX_QUEUES_COUNT = num_queues;
+static int nf_init_device(uint16_t device, struct rte_mempool **mbuf_pools, uint16_t num_workers) {
+  // RX queues as mapped to the cores, one TX queue per core
+  uint16_t RX_QUEUES_COUNT = queue_map_num_rx_queues(device);
+  uint16_t TX_QUEUES_COUNT = num_workers;
 
   int retval;
 
+  struct rte_eth_dev_info dev_info;
+  retval = rte_eth_dev_info_get(device, &dev_info);
+  if (retval != 0)
+    return retval;
+
+  // Devices without jumbo frames, e.g. net_tap or net_pcap, keep the standard
+  // MTU
+  uint16_t mtu = NF_MTU;
+  uint32_t max_frame_len = MAX_FRAME_LEN;
+  if (max_frame_len > RTE_ETHER_MAX_LEN &&
+      !(dev_info.rx_offload_capa & DEV_RX_OFFLOAD_JUMBO_FRAME)) {
+    NF_INFO("Device %d has no jumbo frame support, using MTU %d instead of %d",
+            device, RTE_ETHER_MTU, NF_MTU);
+    mtu = RTE_ETHER_MTU;
+    max_frame_len = RTE_ETHER_MAX_LEN;
+  }
+
   // device_conf passed to rte_eth_dev_configure cannot be NULL
   // rx crc strip is enabled by default in DPDK 19.05
   // see https://mails.dpdk.org/archives/dev/2018-September/110744.html
   struct rte_eth_conf device_conf = {
-    .rxmode = { .max_rx_pkt_len = RTE_ETHER_MAX_LEN }
+    .rxmode = { .max_rx_pkt_len = RTE_MAX(max_frame_len, RTE_ETHER_MAX_LEN) }
   };
+  if (max_frame_len > RTE_ETHER_MAX_LEN)
+    device_conf.rxmode.offloads |= DEV_RX_OFFLOAD_JUMBO_FRAME;
+
+  // Frames larger than an mbuf span several segments
+  if (max_frame_len > MBUF_DATA_SIZE) {
+    if (!(dev_info.rx_offload_capa & DEV_RX_OFFLOAD_SCATTER) ||
+        !(dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS)) {
+      NF_INFO("Device %d cannot receive %u-byte frames in %d-byte mbufs, "
+              "raise MBUF_MAX_DATA_SIZE", device, max_frame_len, MBUF_DATA_SIZE);
+      return -ENOTSUP;
+    }
+    device_conf.rxmode.offloads |= DEV_RX_OFFLOAD_SCATTER;
+    device_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+  }
 
-  // Enable RSS, temp hack for NAT
-#ifdef POL_RSS
-  rss_init(&device_conf, device, POL);
-#else
-# ifdef FW_RSS
-  rss_init(&device_conf, device, FW);
-# else
-  rss_init(&device_conf, device, OTHER_NF);
-# endif
-#endif
+  // Hash on the header fields identifying packet sets, even with a single
+  // RX queue the partition of packets derives from the hash
+  retval = pkt_set_rss_device_conf(&device_conf, device, num_workers);
+  if (retval != 0) {
+    return retval;
+  }
+
+  idle_device_conf(&device_conf);
+  cksum_device_conf(&device_conf, device);
 
   // Configure the device
   // ******DPDK changes the reta size to RX_QUEUES_COUNT after this step*****
   retval = rte_eth_dev_configure(device, RX_QUEUES_COUNT, TX_QUEUES_COUNT,
                                  &device_conf);
+#if IDLE_MODE == IDLE_MODE_INTR
+  // Retry without RX interrupts, e.g. for net_ring
+  if (retval != 0) {
+    idle_device_conf_fallback(&device_conf);
+    retval = rte_eth_dev_configure(device, RX_QUEUES_COUNT, TX_QUEUES_COUNT,
+                                   &device_conf);
+  }
+#endif
   if (retval != 0) {
     return retval;
   }
 
-  // Temp: change MTU to 1600 since the caida trace we are using contain
+  // Default MTU of 1600 since the caida trace we are using contain
   // 10% jumbo frames? Weird though
-  retval = rte_eth_dev_set_mtu(device, 1600);
-  if (retval != 0)
+  retval = rte_eth_dev_set_mtu(device, mtu);
+  // Devices that cannot change their MTU are fine with the standard one
+  if (retval != 0 && !(retval == -ENOTSUP && mtu <= RTE_ETHER_MTU))
     return retval;
 
   // Allocate and set up TX queues
@@ -239,7 +296,7 @@ static int nf_init_device(uint16_t device, struct rte_mempool **mbuf_pools, uint
     retval = rte_eth_rx_queue_setup(device, rxq, RX_QUEUE_SIZE,
                                     rte_eth_dev_socket_id(device),
                                     NULL, // default config
-                                    mbuf_pools[rxq]);
+                                    mbuf_pools[queue_map_rx_queue_worker(device, rxq)]);
     if (retval != 0) {
       return retval;
     }
@@ -257,8 +314,13 @@ static int nf_init_device(uint16_t device, struct rte_mempool **mbuf_pools, uint
     return retval;
   }
 
-  // reset rss reta to default
-  set_default_rss_reta(device, num_queues);
+  // Make sure the NIC hashes as configured
+  retval = pkt_set_rss_check_device(device);
+  if (retval != 0) {
+    return retval;
+  }
+
+  // RETA is programmed from the partition map once all devices are up
 
   return 0;
 }
@@ -309,12 +371,35 @@ static int process_main(void* unused) {
 
   NF_INFO("Running with batches, this code is unverified!");
 
+  idle_worker_init(queue_map_poll_list(lcore));
+
+  if (!tx_worker_init(lcore, rte_eth_dev_count_avail())) {
+    NF_INFO("Cannot init TX buffers of core %u", true_lcore);
+    exit(-1);
+  }
+
 #ifdef LOAD_BALANCING
   int partition_to_expire = 0;
+#else
+  uint16_t partition_to_expire = 0;
 #endif
 
   VIGOR_LOOP_BEGIN
 
+    // No reference to memory read outside of RLU is held across iterations
+    grace_period_quiescent(lcore);
+
+#ifndef DEBUG_REAL_NOP
+    tx_flush_if_stale(nfos_get_time());
+#else
+    tx_flush_if_stale(rte_get_tsc_cycles());
+#endif
+
+#ifdef ELASTIC_SCALING
+    if (elastic_worker_try_park(lcore))
+      continue;
+#endif
+
     // Try to expire one partition per vigor loop iteration
 #ifdef LOAD_BALANCING
     // sync all workers to make sure they see the new_reta
@@ -333,18 +418,34 @@ static int process_main(void* unused) {
 #else
 #ifndef DEBUG_REAL_NOP
     if (do_expiration) {
-      delete_expired_pkt_sets(nfos_get_time(), lcore, non_pkt_set_state);
+      int partition = partition_map_next_owned(lcore, &partition_to_expire);
+      if (partition >= 0)
+        delete_expired_pkt_sets(nfos_get_time(), partition, non_pkt_set_state);
     }
 #endif
 #endif
 
     struct rte_mbuf *mbufs[VIGOR_BATCH_SIZE];
-    struct rte_mbuf *mbufs_to_send[VIGOR_DEVICES_COUNT][VIGOR_BATCH_SIZE];
-    int mbuf_send_index[VIGOR_DEVICES_COUNT];
-    for (int i = 0; i < VIGOR_DEVICES_COUNT; i++)
-      mbuf_send_index[i] = 0;
 
-    uint16_t received_count = rte_eth_rx_burst(VIGOR_DEVICE, lcore, mbufs, VIGOR_BATCH_SIZE);
+    uint16_t received_count = 0;
+    if (rx_poll_due(VIGOR_POLL)) {
+      received_count = rx_poll_burst(VIGOR_POLL, mbufs, VIGOR_BATCH_SIZE);
+      rx_poll_done(VIGOR_POLL, received_count);
+      idle_poll_done(received_count);
+      mbuf_pool_stats_rx(lcore, mbufs, received_count);
+      if (VIGOR_POLL->soft_rss)
+        pkt_set_rss_soft_hash(mbufs, received_count);
+      else
+        pkt_set_rss_validate(mbufs, received_count);
+#ifdef PIPELINE
+      // RX cores parse packets before handing them over, see pipeline.h
+      if (!VIGOR_POLL->ring)
+        received_count = pipeline_parse_pkts(mbufs, received_count, non_pkt_set_state);
+#endif
+      // Hand packets over to the owners of their partitions that do not
+      // poll the device
+      received_count = queue_map_steer_pkts(lcore, VIGOR_POLL, mbufs, received_count);
+    }
 
 #ifdef SCALABILITY_PROFILER
     profiler_pkt_cnt_inc(received_count);
@@ -356,15 +457,29 @@ static int process_main(void* unused) {
     pkts_cnt[lcore] += received_count;
 #endif
 
+#ifdef ELASTIC_SCALING
+    // Forward pkts of partitions owned by other cores, and pick up the ones
+    // forwarded to this core
+    elastic_worker_poll_done(lcore, received_count, VIGOR_BATCH_SIZE);
+    received_count = elastic_steer_pkts(lcore, mbufs, received_count);
+    received_count += elastic_poll_handoff(lcore, VIGOR_DEVICE, mbufs + received_count,
+                                           VIGOR_BATCH_SIZE - received_count);
+#endif
+
 #ifdef PKT_PROCESS_BATCHING
     // Pkt processing batching case, does not consider load balancing or nop yet
-    RTE_PER_LCORE(pkt_set_partition) = lcore;
     if (received_count) {
       NF_DEBUG("\n--- [%ld] Receive %d pkts from device %d ---", nfos_get_time(),
                received_count, VIGOR_DEVICE);
       uint16_t dst_devices[VIGOR_BATCH_SIZE];
+#ifdef PIPELINE
+      // Packets are handed over by RX cores, already parsed
+      pipeline_process_pkts(mbufs, dst_devices, received_count,
+                            nfos_get_time(), non_pkt_set_state);
+#else
       process_pkt(mbufs, dst_devices, received_count,
-                  nfos_get_time(), RTE_PER_LCORE(pkt_set_partition), non_pkt_set_state);
+                  nfos_get_time(), non_pkt_set_state);
+#endif
 
       for (int n = 0; n < received_count; n++) {
         uint16_t dst_device = dst_devices[n];
@@ -372,16 +487,14 @@ static int process_main(void* unused) {
         if (dst_device == VIGOR_DEVICE) {
           rte_pktmbuf_free(mbufs[n]);
           NF_DEBUG("--- pkt dropped ---");
+        } else if (dst_device == FLOOD_PORT) {
+          tx_flood(mbufs[n], VIGOR_DEVICE);
+          NF_DEBUG("--- pkt flooded ---");
+        } else if (dst_device >= MULTICAST_PORT) {
+          tx_multicast(mbufs[n], multicast_groups[dst_device - MULTICAST_PORT], VIGOR_DEVICE);
+          NF_DEBUG("--- pkt sent to multicast group %d ---", dst_device - MULTICAST_PORT);
         } else {
-          // includes flood when 2 devices, which is equivalent to just a send
-          if (dst_device == FLOOD_PORT) {
-            // the prototype flooding impl only works if there are only 2 devices
-            assert(VIGOR_DEVICES_COUNT == 2);
-            dst_device = 1 - VIGOR_DEVICE;
-          }
-
-          mbufs_to_send[dst_device][mbuf_send_index[dst_device]] = mbufs[n];
-          mbuf_send_index[dst_device]++;
+          tx_send(dst_device, mbufs[n]);
           NF_DEBUG("--- pkt sent to port %d ---", dst_device);
         }
       }
@@ -427,19 +540,23 @@ static int process_main(void* unused) {
       cores_nf_pkt_cnt[lcore].pkt_cnt[monitoring_epoch][partition]++;
 #else
 #ifndef DEBUG_REAL_NOP
-      RTE_PER_LCORE(pkt_set_partition) = lcore;
+      RTE_PER_LCORE(pkt_set_partition) = pkt_set_partition_of_hash(mbufs[n]->hash.rss);
 #endif
 #endif
 
-      uint8_t* packet = rte_pktmbuf_mtod(mbufs[n], uint8_t*);
-
 #ifndef DEBUG_REAL_NOP
 
       uint16_t dst_device;
-      dst_device = process_pkt(mbufs[n]->port, packet, mbufs[n]->data_len,
-                               nfos_get_time(),
+#ifdef PIPELINE
+      // Packets are handed over by RX cores, already parsed
+      dst_device = pipeline_process_pkt(mbufs[n], nfos_get_time(),
+                                        RTE_PER_LCORE(pkt_set_partition),
+                                        non_pkt_set_state);
+#else
+      dst_device = process_pkt(mbufs[n], nfos_get_time(),
                                RTE_PER_LCORE(pkt_set_partition),
                                non_pkt_set_state);
+#endif
 
 #else
       uint16_t dst_device = 1 - mbufs[n]->port;
@@ -448,30 +565,19 @@ static int process_main(void* unused) {
       if (dst_device == VIGOR_DEVICE) {
         rte_pktmbuf_free(mbufs[n]);
         NF_DEBUG("--- pkt dropped ---");
+      } else if (dst_device == FLOOD_PORT) {
+        tx_flood(mbufs[n], VIGOR_DEVICE);
+        NF_DEBUG("--- pkt flooded ---");
+      } else if (dst_device >= MULTICAST_PORT) {
+        tx_multicast(mbufs[n], multicast_groups[dst_device - MULTICAST_PORT], VIGOR_DEVICE);
+        NF_DEBUG("--- pkt sent to multicast group %d ---", dst_device - MULTICAST_PORT);
       } else {
-        // includes flood when 2 devices, which is equivalent to just a send
-        if (dst_device == FLOOD_PORT) {
-          // the prototype flooding impl only works if there are only 2 devices
-          assert(VIGOR_DEVICES_COUNT == 2);
-          dst_device = 1 - VIGOR_DEVICE;
-        }
-
-        mbufs_to_send[dst_device][mbuf_send_index[dst_device]] = mbufs[n];
-        mbuf_send_index[dst_device]++;
+        tx_send(dst_device, mbufs[n]);
         NF_DEBUG("--- pkt sent to port %d ---", dst_device);
       }
     }
 #endif // PKT_PROCESSING_BATCH
 
-    for (int i = 0; i < VIGOR_DEVICES_COUNT; i++) {
-      if (mbuf_send_index[i] > 0) {
-        uint16_t sent_count = rte_eth_tx_burst(i, lcore, mbufs_to_send[i], mbuf_send_index[i]);
-        for (uint16_t n = sent_count; n < mbuf_send_index[i]; n++) {
-          rte_pktmbuf_free(mbufs_to_send[i][n]); // should not happen, but we're in the unverified case anyway
-        }
-      }
-    }
-
     // End of vigor loop iter in common case
 
 #ifdef LOAD_BALANCING
@@ -545,22 +651,19 @@ static int idle_main(void* unused) {
   return 0;
 }
 
+#ifdef ELASTIC_SCALING
+static void elastic_scaling_task(nf_state_t *unused) {
+  elastic_scaling_control();
+}
+#endif
+
 // For now assume user set up RLU critical section
-// inside the periodic handler
+// inside the periodic handlers
 static int periodic_handler_main(void* unused) {
   // Initial update of stats counter
   update_dev_stats(dev_stats, rte_eth_dev_count_avail());
 
-  if (periodic_handler) {
-    while (1) {
-      rte_delay_us_sleep(periodic_handler_period);
-
-      // Update timer for periodic handler
-      nfos_timer_tick();
-
-      periodic_handler(non_pkt_set_state);
-    }
-  }
+  periodic_sched_run(non_pkt_set_state);
   return 0;
 }
 
@@ -592,6 +695,12 @@ static void signal_handler(int signum) {
     fflush(stdout);
   }
 
+  mbuf_pool_stats_show();
+  periodic_stats_show();
+#ifdef ELASTIC_SCALING
+  elastic_scaling_stats_show();
+#endif
+
 #ifdef ENABLE_STAT
   pkt_stats_log();
 #endif
@@ -612,8 +721,19 @@ static void signal_handler(int signum) {
 // Init DPDK EAL, all args hardcoded except lcores 
 // TODO: make this platform-independent, i.e., auto-detect num of memory channels
 static int init_dpdk_eal(char *lcores) {
-  char *dpdk_argv[] = {"", "--no-shconf", "-l", lcores, "-n", "6"};
-  return rte_eal_init(6, dpdk_argv);
+  char *dpdk_argv[16] = {"", "--no-shconf", "-l", lcores, "-n", "6"};
+  int dpdk_argc = 6;
+#ifdef EAL_VDEVS
+  // Virtual devices for testing without NICs, e.g.,
+  // "net_tap0,iface=tap0;net_tap1,iface=tap1"
+  static char vdevs[] = EAL_VDEVS;
+  for (char *vdev = strtok(vdevs, ";"); vdev != NULL && dpdk_argc < 16;
+       vdev = strtok(NULL, ";")) {
+    dpdk_argv[dpdk_argc++] = "--vdev";
+    dpdk_argv[dpdk_argc++] = vdev;
+  }
+#endif
+  return rte_eal_init(dpdk_argc, dpdk_argv);
 }
 
 // --- Main ---
@@ -641,34 +761,58 @@ int main() {
   RTE_PER_LCORE(_core_ind) = rte_lcore_index(-1);
 #endif
 
-  // Create a memory pool on all lcores
+  // Must be ready before nf_init() which may update FIBs
+  if (!grace_period_init(rte_lcore_count() - 1)) {
+    rte_exit(EXIT_FAILURE, "Cannot init grace periods\n");
+  }
+
   // TODO: make nb_devices configurable by NF dev
   unsigned nb_devices = rte_eth_dev_count_avail();
-  struct rte_mempool** mbuf_pools = calloc(rte_lcore_count(), sizeof(struct rte_mempool*));
+
   unsigned lcore = 0;
   unsigned true_lcore;
   // temp hack to get last core id
   unsigned last_lcore;
   RTE_LCORE_FOREACH(true_lcore) {
-    // temp hack to get last core id
     last_lcore = true_lcore;
-    char pool_name[128];
-    // dirty hack to get mapping from mempool to lcore
-    // useful for LB
-    sprintf(pool_name, "%c", lcore);
-    NF_DEBUG("pool_name: %d", pool_name[0]);
-    mbuf_pools[lcore] = rte_pktmbuf_pool_create(
-      pool_name, 
-      MEMPOOL_BUFFER_COUNT * nb_devices, 
-      0, 
-      0, 
-      RTE_MBUF_DEFAULT_BUF_SIZE, 
-      rte_lcore_to_socket_id(true_lcore) 
-    );
-    if (mbuf_pools[lcore] == NULL) {
-      rte_exit(EXIT_FAILURE, "Cannot create mbuf pool: %s\n", rte_strerror(rte_errno));
-    }
-    lcore++;
+  }
+
+  // RSS config of the devices is derived from the packet set config
+#ifdef PKT_SET_CFG
+  if (!pkt_set_rss_init(PKT_SET_CFG, nb_devices)) {
+#else
+  if (!pkt_set_rss_init(NULL, nb_devices)) {
+#endif
+    rte_exit(EXIT_FAILURE, "Cannot init RSS config\n");
+  }
+
+  // Map RX queues to data plane cores
+  if (!queue_map_init(rte_lcore_count() - 1, nb_devices)) {
+    rte_exit(EXIT_FAILURE, "Cannot init queue map\n");
+  }
+
+  // Create the memory pools of data plane cores, see mbuf-pool.h
+  struct rte_mempool** mbuf_pools = calloc(rte_lcore_count(), sizeof(struct rte_mempool*));
+  // Pools hold the descriptors of the RX queues of their core
+  uint16_t rx_queues[rte_lcore_count() - 1];
+  for (uint16_t worker = 0; worker < rte_lcore_count() - 1; worker++)
+    rx_queues[worker] = queue_map_worker_num_rx_queues(worker);
+  // Buffers are sized after the MTU, packets in flight may hold several
+  struct mbuf_pool_conf mbuf_pool_conf = {
+    .num_workers = rte_lcore_count() - 1,
+    .nb_devices = nb_devices,
+    .rx_queues = rx_queues,
+    .rx_queue_size = RX_QUEUE_SIZE,
+    .tx_queue_size = TX_QUEUE_SIZE,
+    .burst_size = VIGOR_BATCH_SIZE,
+    .data_size = MBUF_DATA_SIZE,
+    .segs_per_frame = MBUF_SEGS_PER_FRAME,
+#ifdef PIPELINE
+    .priv_size = pipeline_pkt_meta_size(),
+#endif
+  };
+  if (!mbuf_pools_init(&mbuf_pool_conf, mbuf_pools)) {
+    rte_exit(EXIT_FAILURE, "Cannot create mbuf pool: %s\n", rte_strerror(rte_errno));
   }
 
   // Initialize all devices
@@ -683,6 +827,28 @@ int main() {
     }
   }
 
+  // Distribute packet set partitions among data plane cores
+  if (!partition_map_init(rte_lcore_count() - 1, nb_devices)) {
+    rte_exit(EXIT_FAILURE, "Cannot init partition map\n");
+  }
+  for (uint16_t device = 0; device < nb_devices; device++) {
+    ret = partition_map_program_reta(device);
+    if (ret != 0) {
+      rte_exit(EXIT_FAILURE, "Cannot set RETA of device %" PRIu16 ", ret=%d",
+               device, ret);
+    }
+  }
+
+#ifdef ELASTIC_SCALING
+  if (!elastic_scaling_init(rte_lcore_count() - 1, nb_devices)) {
+    rte_exit(EXIT_FAILURE, "Cannot init elastic scaling\n");
+  }
+  if (!periodic_task_add("elastic scaling", ELASTIC_SCALING_PERIOD, ELASTIC_SCALING_PERIOD,
+                         elastic_scaling_task)) {
+    rte_exit(EXIT_FAILURE, "Cannot schedule elastic scaling\n");
+  }
+#endif
+
   unsigned num_lcores = rte_lcore_count();
 
   // Run!
@@ -738,9 +904,20 @@ int main() {
   if (has_pkt_sets) {
     // convert to tsc cycles
     validity_duration *= rte_get_tsc_hz() / 1000000;
-    init_pkt_set_manager(pkt_set_id_eq, pkt_set_id_hash, validity_duration,
-                         has_related_pkt_sets);
+    if (!init_pkt_set_manager(pkt_set_id_eq, pkt_set_id_hash, validity_duration,
+                              has_related_pkt_sets)) {
+      fprintf(stderr, "Error with init_pkt_set_manager\n");
+      return 1;
+    }
   }
+
+#ifdef CONTROL_SOCKET
+  // After nf_init, which registers the commands
+  if (!control_channel_init(CONTROL_SOCKET)) {
+    fprintf(stderr, "Error with control_channel_init\n");
+    return 1;
+  }
+#endif
 #endif
 
   // Init dev_stats
@@ -749,12 +926,12 @@ int main() {
 
 #ifndef DEBUG_REAL_NOP
   // Init RLU
-  // Temporarily hacked the mv-rlu lib to put the gp_thread to the last lcore
-  // TODO: control the scheduling of periodic handler and mvrlu-gp thread on the 
-  // last lcore.
-  // Issue: Under high update rate, throughput of NF drops a lot because periodic
-  // handler and gp thread preempt each other...
-#ifdef ENABLE_STAT
+  // Temporarily hacked the mv-rlu lib to put the gp_thread to the last lcore,
+  // where it runs while the control core sleeps in between periodic tasks.
+  // Under high update rate, pin it to a core of its own with RLU_GP_CORE.
+#if defined(RLU_GP_CORE)
+  RLU_INIT(RLU_GP_CORE);
+#elif defined(ENABLE_STAT)
   RLU_INIT(46);
 #else
   RLU_INIT(last_lcore);
@@ -784,10 +961,14 @@ vigor_time_t get_curr_time() {
   return nfos_get_time();
 }
 
-bool register_periodic_handler(uint64_t period_len, periodic_handler_t handler) {
-  periodic_handler_period = period_len;
-  periodic_handler = handler;
-  return true;
+bool register_periodic_handler(const char *name, uint64_t period_len,
+                               periodic_handler_t handler) {
+  return periodic_task_add(name, period_len, period_len, handler);
+}
+
+bool register_periodic_handler_with_budget(const char *name, uint64_t period_len,
+                                           uint64_t budget, periodic_handler_t handler) {
+  return periodic_task_add(name, period_len, budget, handler);
 }
 
 bool add_pkt_set(pkt_set_id_t *pkt_set_id, pkt_set_state_t *pkt_set_state,
@@ -796,6 +977,28 @@ bool add_pkt_set(pkt_set_id_t *pkt_set_id, pkt_set_state_t *pkt_set_state,
                          related_pkt_set_id);
 }
 
+bool register_pkt_set_timeout_classes(uint64_t *timeouts, int num_classes) {
+  return register_timeout_classes(timeouts, num_classes);
+}
+
+bool set_pkt_set_timeout_class(pkt_set_id_t *pkt_set_id, int timeout_class) {
+  return set_pkt_set_timeout_class_of(pkt_set_id, timeout_class,
+                                      RTE_PER_LCORE(pkt_set_partition), nfos_get_time());
+}
+
+bool set_pkt_set_timeout(pkt_set_id_t *pkt_set_id, uint64_t timeout) {
+  return set_pkt_set_timeout_of(pkt_set_id, nfos_usec_to_tsc_cycles(timeout),
+                                RTE_PER_LCORE(pkt_set_partition), nfos_get_time());
+}
+
+uint16_t nfos_get_pkt_set_partition() {
+  return RTE_PER_LCORE(pkt_set_partition);
+}
+
+uint16_t nfos_num_pkt_set_partitions() {
+  return num_pkt_set_partitions;
+}
+
 bool register_pkt_handlers(pkt_handler_t *handlers) {
   return _register_pkt_handlers(handlers);
 }
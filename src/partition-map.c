@@ -0,0 +1,101 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <rte_ethdev.h>
+
+#include "vigor/nf-log.h"
+#include "vigor/nf-lb/rss.h"
+
+#include "partition-map.h"
+#include "pipeline.h"
+#include "pkt-set-rss.h"
+#include "queue-map.h"
+
+uint16_t num_pkt_set_partitions = 1;
+uint16_t *pkt_set_partition_owner;
+uint16_t *pkt_set_partition_target_owner;
+
+static uint16_t num_data_plane_cores;
+
+bool partition_map_init(uint16_t num_workers, uint16_t nb_devices) {
+  uint16_t num_partitions = NUM_PKT_SET_PARTITIONS;
+
+  // RSS is disabled with a single data plane core, the RSS hash in the mbuf
+  // is meaningless then
+  if (num_workers <= 1) {
+    num_partitions = 1;
+  } else {
+    // Every RETA entry must map to a single partition
+    for (uint16_t device = 0; device < nb_devices; device++) {
+      if (pkt_set_rss_is_soft(device))
+        continue;
+      uint16_t reta_size = get_rss_reta_size(device);
+      if (reta_size != 0 && reta_size < num_partitions)
+        num_partitions = reta_size;
+    }
+  }
+
+  // Round down to power of two
+  while (num_partitions & (num_partitions - 1))
+    num_partitions &= num_partitions - 1;
+
+  pkt_set_partition_owner = calloc(num_partitions, sizeof(uint16_t));
+  pkt_set_partition_target_owner = calloc(num_partitions, sizeof(uint16_t));
+  if (pkt_set_partition_owner == NULL || pkt_set_partition_target_owner == NULL)
+    return false;
+
+#ifdef PIPELINE
+  // Partitions are owned by the cores running the packet handlers
+  uint16_t first_owner = PIPELINE_RX_CORES;
+#else
+  uint16_t first_owner = 0;
+#endif
+  uint16_t num_owners = num_workers - first_owner;
+  for (uint16_t i = 0; i < num_partitions; i++) {
+    pkt_set_partition_owner[i] = first_owner + i % num_owners;
+    pkt_set_partition_target_owner[i] = pkt_set_partition_owner[i];
+  }
+
+  num_pkt_set_partitions = num_partitions;
+  num_data_plane_cores = num_workers;
+
+  NF_INFO("%d packet set partitions over %d data plane cores",
+          num_partitions, num_workers);
+  return true;
+}
+
+void partition_map_set_owner(uint16_t partition, uint16_t worker) {
+  __atomic_store_n(&pkt_set_partition_owner[partition], worker, __ATOMIC_RELEASE);
+}
+
+void partition_map_set_target_owner(uint16_t partition, uint16_t worker) {
+  __atomic_store_n(&pkt_set_partition_target_owner[partition], worker, __ATOMIC_RELEASE);
+}
+
+int partition_map_program_reta(uint16_t device) {
+  if (num_data_plane_cores <= 1 || pkt_set_rss_is_soft(device))
+    return 0;
+
+  uint16_t reta_sz = get_rss_reta_size(device);
+  uint16_t reta[reta_sz];
+  for (uint16_t i = 0; i < reta_sz; i++) {
+    uint16_t partition = pkt_set_partition_of_hash(i);
+    reta[i] = queue_map_partition_queue(device, partition,
+                                        partition_map_get_target_owner(partition));
+  }
+
+  return set_rss_reta(device, reta, reta_sz);
+}
+
+int partition_map_next_owned(uint16_t worker, uint16_t *cursor) {
+  uint16_t partition = *cursor;
+  for (uint16_t i = 0; i < num_pkt_set_partitions; i++) {
+    partition = (partition + 1) & (num_pkt_set_partitions - 1);
+    if (partition_map_get_owner(partition) == worker) {
+      *cursor = partition;
+      return partition;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,119 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+
+#include "periodic.h"
+#include "control.h"
+#include "timer.h"
+
+struct periodic_task {
+  const char *name;
+  periodic_handler_t handler;
+  // In TSC cycles
+  uint64_t period;
+  uint64_t budget;
+  uint64_t release;
+
+  // Stats
+  uint64_t runs;
+  uint64_t overruns;
+  uint64_t deadline_misses;
+  uint64_t skipped_releases;
+  uint64_t total_runtime;
+  uint64_t max_runtime;
+};
+
+static struct periodic_task tasks[PERIODIC_MAX_TASKS];
+static int num_tasks;
+
+bool periodic_task_add(const char *name, uint64_t period, uint64_t budget,
+                       periodic_handler_t handler) {
+  if (num_tasks == PERIODIC_MAX_TASKS || period == 0)
+    return false;
+  tasks[num_tasks++] = (struct periodic_task) {
+    .name = name, .handler = handler,
+    .period = nfos_usec_to_tsc_cycles(period), .budget = nfos_usec_to_tsc_cycles(budget),
+  };
+  return true;
+}
+
+// Released task with the earliest deadline, NULL if none
+static struct periodic_task *next_task(uint64_t now, uint64_t *next_release) {
+  struct periodic_task *next = NULL;
+  *next_release = UINT64_MAX;
+  for (int i = 0; i < num_tasks; i++) {
+    struct periodic_task *task = &tasks[i];
+    *next_release = RTE_MIN(*next_release, task->release);
+    if (task->release <= now &&
+        (next == NULL || task->release + task->period < next->release + next->period))
+      next = task;
+  }
+  return next;
+}
+
+static void run_task(nf_state_t *non_pkt_set_state, struct periodic_task *task) {
+  nfos_timer_tick();
+  uint64_t start = nfos_get_time();
+  task->handler(non_pkt_set_state);
+  uint64_t end = rte_get_tsc_cycles();
+
+  uint64_t runtime = end - start;
+  task->runs++;
+  task->total_runtime += runtime;
+  task->max_runtime = RTE_MAX(task->max_runtime, runtime);
+  task->overruns += runtime > task->budget;
+
+  uint64_t deadline = task->release + task->period;
+  task->deadline_misses += end > deadline;
+  task->release = deadline;
+  if (end >= task->release + task->period) {
+    uint64_t missed = (end - task->release) / task->period;
+    task->release += missed * task->period;
+    task->skipped_releases += missed;
+  }
+}
+
+void periodic_sched_run(nf_state_t *non_pkt_set_state) {
+#ifndef CONTROL_SOCKET
+  if (num_tasks == 0)
+    return;
+#endif
+
+  uint64_t start = rte_get_tsc_cycles();
+  for (int i = 0; i < num_tasks; i++)
+    tasks[i].release = start + tasks[i].period;
+
+  uint64_t cycles_per_us = rte_get_tsc_hz() / 1000000;
+  while (1) {
+    uint64_t now = rte_get_tsc_cycles();
+    uint64_t next_release;
+    struct periodic_task *task = next_task(now, &next_release);
+    if (task) {
+      run_task(non_pkt_set_state, task);
+      continue;
+    }
+
+    uint64_t wait = num_tasks ? (next_release - now) / cycles_per_us : 1000000;
+    if (wait)
+      control_channel_serve(non_pkt_set_state, wait);
+  }
+}
+
+void periodic_stats_show() {
+  for (int i = 0; i < num_tasks; i++) {
+    struct periodic_task *task = &tasks[i];
+    uint64_t cycles_per_us = rte_get_tsc_hz() / 1000000;
+    printf("periodic task %d (%s): runs %" PRIu64 ", avg runtime %" PRIu64 " us, "
+           "max runtime %" PRIu64 " us, overruns %" PRIu64 ", deadline misses %" PRIu64
+           ", skipped releases %" PRIu64 "\n",
+           i, task->name, task->runs,
+           task->runs ? task->total_runtime / task->runs / cycles_per_us : 0,
+           task->max_runtime / cycles_per_us, task->overruns, task->deadline_misses,
+           task->skipped_releases);
+  }
+  fflush(stdout);
+}
@@ -0,0 +1,133 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_lcore.h>
+
+#include "pkt-set-log.h"
+#include "pkt-set-manager.h"
+
+#ifdef MUTABLE_PKT_SET_STATE
+
+#ifdef PKT_SET_COLD_STATE
+#define PKT_SET_LOG_MAX_OBJECT_SIZE RTE_MAX(sizeof(pkt_set_state_t), sizeof(pkt_set_cold_state_t))
+#else
+#define PKT_SET_LOG_MAX_OBJECT_SIZE sizeof(pkt_set_state_t)
+#endif
+
+struct pkt_set_log_object {
+  uint8_t *base;
+  uint32_t size;
+  uint32_t chunk_size;
+  uint64_t dirty;
+};
+
+// Followed by the saved bytes, padded to 8 bytes
+struct pkt_set_log_entry {
+  uint8_t *addr;
+  uint64_t len;
+};
+
+// Worst case: all the chunks of all the objects saved one by one, i.e. 64
+// entries per object. Chunks start at multiples of 8, only the last one is
+// padded.
+#define PKT_SET_LOG_SIZE \
+  (PKT_SET_LOG_MAX_OBJECTS * (RTE_ALIGN_CEIL(PKT_SET_LOG_MAX_OBJECT_SIZE, 8) + \
+                              64 * sizeof(struct pkt_set_log_entry)))
+
+typedef struct {
+  uint16_t num_objects;
+  uint16_t num_cold_allocs;
+  uint32_t len;
+  struct pkt_set_log_object objects[PKT_SET_LOG_MAX_OBJECTS];
+  int cold_allocs[PKT_SET_LOG_MAX_OBJECTS];
+  uint64_t entries[PKT_SET_LOG_SIZE / 8];
+} pkt_set_log_t;
+
+static RTE_DEFINE_PER_LCORE(pkt_set_log_t, pkt_set_log);
+
+void pkt_set_log_reset() {
+  pkt_set_log_t *log = &RTE_PER_LCORE(pkt_set_log);
+  log->num_objects = 0;
+  log->num_cold_allocs = 0;
+  log->len = 0;
+}
+
+void pkt_set_log_object(void *base, size_t size) {
+  pkt_set_log_t *log = &RTE_PER_LCORE(pkt_set_log);
+  for (uint16_t i = 0; i < log->num_objects; i++) {
+    if (log->objects[i].base == base)
+      return;
+  }
+
+  assert(log->num_objects < PKT_SET_LOG_MAX_OBJECTS);
+  log->objects[log->num_objects++] = (struct pkt_set_log_object) {
+    .base = base, .size = size,
+    .chunk_size = RTE_MAX(8, RTE_ALIGN_CEIL((size + 63) / 64, 8)),
+  };
+}
+
+void pkt_set_log_cold_alloc(int index) {
+  pkt_set_log_t *log = &RTE_PER_LCORE(pkt_set_log);
+  assert(log->num_cold_allocs < PKT_SET_LOG_MAX_OBJECTS);
+  log->cold_allocs[log->num_cold_allocs++] = index;
+}
+
+static void save(pkt_set_log_t *log, uint8_t *addr, uint32_t len) {
+  struct pkt_set_log_entry *entry = (struct pkt_set_log_entry *)&log->entries[log->len / 8];
+  assert(log->len + sizeof(*entry) + RTE_ALIGN_CEIL(len, 8) <= PKT_SET_LOG_SIZE);
+  entry->addr = addr;
+  entry->len = len;
+  memcpy(entry + 1, addr, len);
+  log->len += sizeof(*entry) + RTE_ALIGN_CEIL(len, 8);
+}
+
+void nfos_pkt_set_state_write(void *field, size_t size) {
+  pkt_set_log_t *log = &RTE_PER_LCORE(pkt_set_log);
+  uint8_t *addr = field;
+  if (size == 0)
+    return;
+
+  // Most likely the state of the packet being handled, logged last
+  for (int i = log->num_objects - 1; i >= 0; i--) {
+    struct pkt_set_log_object *obj = &log->objects[i];
+    if (addr < obj->base || addr + size > obj->base + obj->size)
+      continue;
+
+    uint32_t first = (addr - obj->base) / obj->chunk_size;
+    uint32_t last = (addr + size - 1 - obj->base) / obj->chunk_size;
+    for (uint32_t chunk = first; chunk <= last; chunk++) {
+      if (obj->dirty & (1ULL << chunk))
+        continue;
+      // Save the run of clean chunks at once
+      uint32_t end = chunk;
+      while (end < last && !(obj->dirty & (1ULL << (end + 1))))
+        end++;
+      uint32_t offset = chunk * obj->chunk_size;
+      save(log, obj->base + offset, RTE_MIN((end + 1) * obj->chunk_size, obj->size) - offset);
+      for (uint32_t c = chunk; c <= end; c++)
+        obj->dirty |= 1ULL << c;
+      chunk = end;
+    }
+    return;
+  }
+}
+
+void pkt_set_log_rollback() {
+  pkt_set_log_t *log = &RTE_PER_LCORE(pkt_set_log);
+  for (uint32_t pos = 0; pos < log->len;) {
+    struct pkt_set_log_entry *entry = (struct pkt_set_log_entry *)&log->entries[pos / 8];
+    memcpy(entry->addr, entry + 1, entry->len);
+    pos += sizeof(*entry) + RTE_ALIGN_CEIL(entry->len, 8);
+  }
+
+#ifdef PKT_SET_COLD_STATE
+  for (uint16_t i = 0; i < log->num_cold_allocs; i++)
+    free_pkt_set_cold_state(log->cold_allocs[i]);
+#endif
+
+  pkt_set_log_reset();
+}
+
+#endif
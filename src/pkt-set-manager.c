@@ -1,8 +1,10 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <rte_lcore.h>
+#include <rte_mempool.h>
 
 #include "vigor/libvig/verified/vigor-time.h"
 #include "vigor/libvig/verified/vector.h"
@@ -11,7 +13,10 @@
 #include "concurrent-map.h"
 #include "concurrent-double-chain.h"
 #include "pkt-set-manager.h"
+#include "partition-map.h"
+#include "pkt-set-log.h"
 #include "rlu-wrapper.h"
+#include "timer.h"
 
 // TODO: expose these params to NF dev
 #ifndef MAX_NUM_PKT_SETS
@@ -19,14 +24,27 @@
 #endif
 // #define MAX_NUM_PKT_SETS 155000U // vigpol
 // #define MAX_NUM_PKT_SETS 1376256U // 21 * 65536
-#define NUM_PKT_SET_PARTITIONS 128
 
 static struct ConcurrentMap *pkt_set_id_to_state;
 static struct ConcurrentDoubleChain *pkt_set_chain;
 static struct Vector *pkt_set_state;
-static vigor_time_t pkt_set_validity_duration;
+// Expiration time of each timeout class, class 0 is the validity duration
+static vigor_time_t pkt_set_timeouts[NUM_TIMEOUT_CLASSES];
+static int num_timeout_classes = 1;
+static bool has_timeout_classes = false;
 static bool has_related_pkt_sets;
 
+#ifdef PKT_SET_COLD_STATE
+static struct rte_mempool *pkt_set_cold_pool;
+// Cold state of each packet set index, NULL if none
+static pkt_set_cold_state_t **pkt_set_cold;
+// Packet set states are contiguous in the vector, this is the one of index 0
+static pkt_set_state_t *pkt_set_state_base;
+#endif
+
+_Static_assert(MAX_PKT_SET_TIMEOUT_CLASSES == NUM_TIMEOUT_CLASSES,
+               "Timeout classes must match the LRU lists of the dchain");
+
 // Per-core logs of add_pkt_set() operation. Needed to avoid modification on
 // the packet set map before the corresponding NF handler commits.
 static RTE_DEFINE_PER_LCORE(add_pkt_set_log_entry_t, add_pkt_set_log_entry);
@@ -48,12 +66,24 @@ static inline unsigned int next_pow2(unsigned int v) {
   return v;
 }
 
+bool register_timeout_classes(uint64_t *timeouts, int num_classes) {
+  if (num_classes < 0 || num_classes >= NUM_TIMEOUT_CLASSES)
+    return false;
+
+  for (int i = 0; i < num_classes; i++)
+    pkt_set_timeouts[i + 1] = nfos_usec_to_tsc_cycles(timeouts[i]);
+  num_timeout_classes = num_classes + 1;
+  has_timeout_classes = true;
+  return true;
+}
+
 bool init_pkt_set_manager(map_keys_equality *pkt_set_id_eq,
                           map_key_hash *pkt_set_id_hash,
                           vigor_time_t _pkt_set_validity_duration,
                           bool _has_related_pkt_sets) {
-  // For now set this to be equal to the number of data plane cores
-  int num_pkt_set_partitions = rte_lcore_count() - 1;
+  // Each partition needs at least one index in its free list
+  if (MAX_NUM_PKT_SETS < num_pkt_set_partitions)
+    return false;
 
   has_related_pkt_sets = _has_related_pkt_sets;
 
@@ -67,13 +97,30 @@ bool init_pkt_set_manager(map_keys_equality *pkt_set_id_eq,
 
   int map_size_per_partition = next_pow2(map_size / num_pkt_set_partitions);
 
-  if (!concurrent_dchain_allocate(MAX_NUM_PKT_SETS, &(pkt_set_chain))) return false;
+  if (!concurrent_dchain_allocate(MAX_NUM_PKT_SETS, num_pkt_set_partitions,
+                                  &(pkt_set_chain))) return false;
   if (!concurrent_map_allocate(pkt_set_id_eq, pkt_set_id_hash, num_pkt_set_partitions,
                                map_size_per_partition,
                                pkt_set_chain, &(pkt_set_id_to_state))) return false;
   if (!vector_allocate(sizeof(pkt_set_state_t), MAX_NUM_PKT_SETS,
                        pkt_set_state_allocate, &(pkt_set_state))) return false;
-  pkt_set_validity_duration = _pkt_set_validity_duration;
+#ifdef PKT_SET_COLD_STATE
+  pkt_set_cold_pool = rte_mempool_create("pkt_set_cold", MAX_NUM_COLD_PKT_SETS,
+                                         sizeof(pkt_set_cold_state_t), PKT_SET_COLD_CACHE_SIZE,
+                                         0, NULL, NULL, NULL, NULL, SOCKET_ID_ANY, 0);
+  pkt_set_cold = calloc(MAX_NUM_PKT_SETS, sizeof(pkt_set_cold_state_t *));
+  if (pkt_set_cold_pool == NULL || pkt_set_cold == NULL) return false;
+  vector_borrow(pkt_set_state, 0, (void **)&pkt_set_state_base);
+  vector_return(pkt_set_state, 0, pkt_set_state_base);
+#endif
+  pkt_set_timeouts[0] = _pkt_set_validity_duration;
+  // Without classes from the NF, use the LRU lists as buckets of per packet
+  // set timeouts, each one 4x shorter than the previous one
+  if (!has_timeout_classes) {
+    for (int i = 1; i < NUM_TIMEOUT_CLASSES; i++)
+      pkt_set_timeouts[i] = pkt_set_timeouts[i - 1] / 4;
+    num_timeout_classes = NUM_TIMEOUT_CLASSES;
+  }
 
   return true;
 }
@@ -82,6 +129,8 @@ bool init_pkt_set_manager(map_keys_equality *pkt_set_id_eq,
 // ASSUMPTION: only one call to add_pkt_set_log per NF tx
 void add_pkt_set_log_clear() {
   RTE_PER_LCORE(add_pkt_set_log_entry).add_pkt_set = false;
+  RTE_PER_LCORE(add_pkt_set_log_entry).timeout_class = 0;
+  RTE_PER_LCORE(add_pkt_set_log_entry).timeout = pkt_set_timeouts[0];
 }
 
 bool add_pkt_set_log(pkt_set_state_t *_state, int pkt_set_partition,
@@ -108,7 +157,9 @@ void add_pkt_set_commit(pkt_set_id_t *pkt_set_id,
     int index;
 
     concurrent_dchain_allocate_new_index(pkt_set_chain, &index, time,
-                                         pkt_set_partition);
+                                         pkt_set_partition,
+                                         RTE_PER_LCORE(add_pkt_set_log_entry).timeout_class,
+                                         RTE_PER_LCORE(add_pkt_set_log_entry).timeout);
 
     concurrent_map_put(pkt_set_id_to_state, (void *)pkt_set_id, pkt_set_partition, index);
 
@@ -122,6 +173,8 @@ void add_pkt_set_commit(pkt_set_id_t *pkt_set_id,
     vector_borrow(pkt_set_state, index, (void **)&state_ptr);
     memcpy((void *)state_ptr, (void *)_state, sizeof(pkt_set_state_t));
     vector_return(pkt_set_state, index, state_ptr);
+
+    RTE_PER_LCORE(add_pkt_set_log_entry).add_pkt_set = false;
   }
 }
 
@@ -135,7 +188,7 @@ bool get_pkt_set_state(pkt_set_id_t *pkt_set_id, pkt_set_state_t **_state,
   if (index >= MAX_NUM_PKT_SETS)
     index -= MAX_NUM_PKT_SETS;
 
-  concurrent_dchain_rejuvenate_index(pkt_set_chain, index, time, pkt_set_partition);
+  concurrent_dchain_rejuvenate_index(pkt_set_chain, index, time, pkt_set_partition, -1);
 
   pkt_set_state_t *state_ptr;
   vector_borrow(pkt_set_state, index, (void **)&state_ptr);
@@ -147,59 +200,155 @@ bool get_pkt_set_state(pkt_set_id_t *pkt_set_id, pkt_set_state_t **_state,
   return true;
 }
 
+#ifdef PKT_SET_COLD_STATE
+pkt_set_cold_state_t *get_pkt_set_cold_state(pkt_set_state_t *local_state, bool create) {
+  // States of packet sets being added are not in the vector yet
+  if (local_state < pkt_set_state_base || local_state >= pkt_set_state_base + MAX_NUM_PKT_SETS)
+    return NULL;
+
+  int index = local_state - pkt_set_state_base;
+  pkt_set_cold_state_t *cold = pkt_set_cold[index];
+  if (cold == NULL && create && rte_mempool_get(pkt_set_cold_pool, (void **)&cold) == 0) {
+    memset(cold, 0, sizeof(pkt_set_cold_state_t));
+    pkt_set_cold[index] = cold;
+#ifdef MUTABLE_PKT_SET_STATE
+    pkt_set_log_cold_alloc(index);
+#endif
+  }
+
+#ifdef MUTABLE_PKT_SET_STATE
+  if (cold)
+    pkt_set_log_object(cold, sizeof(pkt_set_cold_state_t));
+#endif
+  return cold;
+}
+
+void free_pkt_set_cold_state(int index) {
+  if (pkt_set_cold[index]) {
+    rte_mempool_put(pkt_set_cold_pool, pkt_set_cold[index]);
+    pkt_set_cold[index] = NULL;
+  }
+}
+#endif
+
+// LRU list of a packet set timeout: the class with the longest timeout not
+// above it, or the shortest class. The packet set is expired late by at most
+// the gap to the next class.
+static int timeout_class_of(vigor_time_t timeout) {
+  int best = -1, shortest = 0;
+  for (int i = 0; i < num_timeout_classes; i++) {
+    if (pkt_set_timeouts[i] <= timeout &&
+        (best == -1 || pkt_set_timeouts[i] > pkt_set_timeouts[best]))
+      best = i;
+    if (pkt_set_timeouts[i] < pkt_set_timeouts[shortest])
+      shortest = i;
+  }
+  return best == -1 ? shortest : best;
+}
+
+static bool set_pkt_set_timeout_(pkt_set_id_t *pkt_set_id, int timeout_class,
+                                 vigor_time_t timeout, int pkt_set_partition,
+                                 vigor_time_t time) {
+  int index;
+  if (!concurrent_map_get(pkt_set_id_to_state, pkt_set_id, pkt_set_partition, &index)) {
+    // Packet set being added by the handler, allocated on commit
+    if (!RTE_PER_LCORE(add_pkt_set_log_entry).add_pkt_set)
+      return false;
+    RTE_PER_LCORE(add_pkt_set_log_entry).timeout_class = timeout_class;
+    RTE_PER_LCORE(add_pkt_set_log_entry).timeout = timeout;
+    return true;
+  }
+
+  // Temp hack to support related pkt sets
+  if (index >= MAX_NUM_PKT_SETS)
+    index -= MAX_NUM_PKT_SETS;
+
+  return concurrent_dchain_set_timeout(pkt_set_chain, index, time, pkt_set_partition,
+                                       timeout_class, timeout);
+}
+
+bool set_pkt_set_timeout_class_of(pkt_set_id_t *pkt_set_id, int timeout_class,
+                                  int pkt_set_partition, vigor_time_t time) {
+  if (timeout_class < 0 || timeout_class >= num_timeout_classes)
+    return false;
+
+  return set_pkt_set_timeout_(pkt_set_id, timeout_class, pkt_set_timeouts[timeout_class],
+                              pkt_set_partition, time);
+}
+
+bool set_pkt_set_timeout_of(pkt_set_id_t *pkt_set_id, vigor_time_t timeout,
+                            int pkt_set_partition, vigor_time_t time) {
+  return set_pkt_set_timeout_(pkt_set_id, timeout_class_of(timeout), timeout,
+                              pkt_set_partition, time);
+}
+
 int delete_expired_pkt_sets(vigor_time_t time, int pkt_set_partition,
                             nf_state_t *non_pkt_set_state) {
   assert(time >= 0); // we don't support the past
   assert(sizeof(vigor_time_t) <= sizeof(uint64_t));
   uint64_t time_u = (uint64_t)time; // OK because of the two asserts
-  vigor_time_t last_time = time_u - pkt_set_validity_duration;
 
   int index, count = 0;
   rlu_thread_data_t *rlu_data = get_rlu_thread_data();
 
-  while (concurrent_dchain_has_expired_index(pkt_set_chain, &index, last_time,
-                                            pkt_set_partition)) {
+  // Each timeout class has its own LRU list
+  for (int timeout_class = 0; timeout_class < num_timeout_classes; timeout_class++) {
+    while (concurrent_dchain_has_expired_index(pkt_set_chain, &index, time_u,
+                                              pkt_set_partition, timeout_class)) {
 
-    pkt_set_state_t *state_ptr;
-    vector_borrow(pkt_set_state, index, (void **)&state_ptr);
+      pkt_set_state_t *state_ptr;
+      vector_borrow(pkt_set_state, index, (void **)&state_ptr);
 
 restart:
-	  RLU_READER_LOCK(rlu_data);
-    if (nf_expired_pkt_set_handler(non_pkt_set_state, state_ptr) == ABORT_HANDLER) {
-      NF_DEBUG("ABORT: nf_expired_pkt_set_handler\n");
-      nfos_abort_txn(rlu_data);
-      goto restart;
-    }
-    if (!RLU_READER_UNLOCK(rlu_data)) {
-      nfos_abort_txn(rlu_data);
-      NF_DEBUG("ABORT: read validation\n");
-      goto restart;
-    }
-
-    vector_return(pkt_set_state, index, state_ptr);
+#ifdef MUTABLE_PKT_SET_STATE
+      pkt_set_log_reset();
+#endif
+      RLU_READER_LOCK(rlu_data);
+      if (nf_expired_pkt_set_handler(non_pkt_set_state, state_ptr) == ABORT_HANDLER) {
+        NF_DEBUG("ABORT: nf_expired_pkt_set_handler\n");
+        nfos_abort_txn(rlu_data);
+#ifdef MUTABLE_PKT_SET_STATE
+        pkt_set_log_rollback();
+#endif
+        goto restart;
+      }
+      if (!RLU_READER_UNLOCK(rlu_data)) {
+        nfos_abort_txn(rlu_data);
+#ifdef MUTABLE_PKT_SET_STATE
+        pkt_set_log_rollback();
+#endif
+        NF_DEBUG("ABORT: read validation\n");
+        goto restart;
+      }
 
-    struct concurrent_dchain_cell *cell = 
-           concurrent_dchain_cell_out(pkt_set_chain, index);
+      vector_return(pkt_set_state, index, state_ptr);
+#ifdef PKT_SET_COLD_STATE
+      free_pkt_set_cold_state(index);
+#endif
 
-    pkt_set_id_t *key;
-    key = &(cell->id);
-    concurrent_map_erase(pkt_set_id_to_state, key, pkt_set_partition, (void **)&key);
+      struct concurrent_dchain_cell *cell = 
+             concurrent_dchain_cell_out(pkt_set_chain, index);
 
-    // FIXME: this does not work if packet set state can be shared by either one or two packet sets.
-    // Temp hack to support related pkt sets
-    if (has_related_pkt_sets) {
-      cell = concurrent_dchain_cell_out(pkt_set_chain, index + MAX_NUM_PKT_SETS);
+      pkt_set_id_t *key;
       key = &(cell->id);
       concurrent_map_erase(pkt_set_id_to_state, key, pkt_set_partition, (void **)&key);
-    }
 
-    // Make sure map/vector entry of the packet set map is invalidated
-    // before returning the index to the free list
-    __asm__ __volatile__ ("" : : : "memory");
+      // FIXME: this does not work if packet set state can be shared by either one or two packet sets.
+      // Temp hack to support related pkt sets
+      if (has_related_pkt_sets) {
+        cell = concurrent_dchain_cell_out(pkt_set_chain, index + MAX_NUM_PKT_SETS);
+        key = &(cell->id);
+        concurrent_map_erase(pkt_set_id_to_state, key, pkt_set_partition, (void **)&key);
+      }
+
+      // Make sure map/vector entry of the packet set map is invalidated
+      // before returning the index to the free list
+      __asm__ __volatile__ ("" : : : "memory");
 
-    concurrent_dchain_free_index(pkt_set_chain, index, pkt_set_partition);
+      concurrent_dchain_free_index(pkt_set_chain, index, pkt_set_partition);
 
-    ++count;
+      ++count;
+    }
   }
   return count;
 }
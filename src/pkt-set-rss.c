@@ -0,0 +1,499 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_lcore.h>
+#include <rte_mbuf.h>
+#include <rte_thash.h>
+
+#include "vigor/nf-log.h"
+
+#include "json.h"
+#include "pkt-set-rss.h"
+
+// Max number of layers in a packet set id
+#define RSS_MAX_LAYERS 4
+#define RSS_DEFAULT_KEY_LEN 40
+
+// Hash types of NICs that do not receive packet sets
+#define RSS_DEFAULT_HF (ETH_RSS_IP | ETH_RSS_TCP | ETH_RSS_UDP)
+#define RSS_SINGLE_FIELD_HF \
+  (ETH_RSS_L3_SRC_ONLY | ETH_RSS_L3_DST_ONLY | ETH_RSS_L4_SRC_ONLY | ETH_RSS_L4_DST_ONLY)
+
+// Toeplitz key of Microsoft's RSS spec
+static const uint8_t default_rss_key[RSS_DEFAULT_KEY_LEN] = {
+  0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+  0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+  0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+  0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+  0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+// Repeated to fill the key. With a 16-bit period, swapping src and dst
+// IP addresses and L4 ports does not change the hash.
+static const uint8_t symmetric_rss_key[2] = { 0x6d, 0x5a };
+
+struct rss_device_cfg {
+  // Requested hash types
+  uint64_t rss_hf;
+  uint8_t key_len;
+  // RSS is used on the device
+  bool enabled;
+  // The device cannot hash packet sets, cores hash its packets in software
+  bool soft;
+};
+
+// Header fields of one layer of a packet set id
+struct layer_cfg {
+  int layer;
+  const char *fields[2];
+  int num_fields;
+};
+
+static struct rss_device_cfg *device_cfgs;
+// Shared by all devices, each uses its first key_len bytes
+static uint8_t rss_key[RSS_MAX_KEY_LEN];
+
+RTE_DEFINE_PER_LCORE(uint32_t, rss_pkts_to_validate) = RSS_VALIDATION_PKTS;
+static RTE_DEFINE_PER_LCORE(uint32_t, rss_mismatches);
+
+/*
+ * Config parsing, mirrors utils/pkt-set-cfg-parser.py
+ */
+
+// Hash types covering one layer of a packet set id, 0 if RSS cannot hash it
+static uint64_t layer_rss_hf(const char *proto, const struct layer_cfg *l) {
+  uint64_t rss_hf = 0;
+
+  switch (l->layer) {
+    case 2:
+      // NICs hash on both MAC addresses or none
+      if (!strcmp(proto, "eth") && l->num_fields == 2)
+        rss_hf = ETH_RSS_ETH;
+      break;
+
+    case 3:
+      if (strcmp(proto, "ipv4") && strcmp(proto, "ipv6"))
+        break;
+      rss_hf = ETH_RSS_IP;
+      if (l->num_fields == 1) {
+        if (!strcmp(l->fields[0], "src_ip"))
+          rss_hf |= ETH_RSS_L3_SRC_ONLY;
+        else if (!strcmp(l->fields[0], "dst_ip"))
+          rss_hf |= ETH_RSS_L3_DST_ONLY;
+        else
+          rss_hf = 0;
+      }
+      break;
+
+    case 4:
+      // e.g. "tcp|udp"
+      if (strstr(proto, "tcp"))
+        rss_hf |= ETH_RSS_TCP;
+      if (strstr(proto, "udp"))
+        rss_hf |= ETH_RSS_UDP;
+      if (rss_hf && l->num_fields == 1) {
+        if (!strcmp(l->fields[0], "src_port"))
+          rss_hf |= ETH_RSS_L4_SRC_ONLY;
+        else if (!strcmp(l->fields[0], "dst_port"))
+          rss_hf |= ETH_RSS_L4_DST_ONLY;
+        else
+          rss_hf = 0;
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return rss_hf;
+}
+
+static bool parse_layer(const struct json_value *value, struct layer_cfg *l, uint64_t *rss_hf) {
+  const struct json_value *layer = json_object_get(value, "layer");
+  const struct json_value *proto = json_object_get(value, "proto");
+  const struct json_value *fields = json_object_get(value, "hdr fields");
+  if (layer == NULL || layer->type != JSON_NUMBER ||
+      proto == NULL || proto->type != JSON_STRING || fields == NULL)
+    return false;
+
+  l->layer = (int)layer->number;
+  // A single field may be given without the enclosing list
+  if (fields->type == JSON_STRING) {
+    l->fields[0] = fields->string;
+    l->num_fields = 1;
+  } else if (fields->type == JSON_ARRAY && fields->count >= 1 && fields->count <= 2) {
+    for (size_t i = 0; i < fields->count; i++) {
+      if (fields->items[i].type != JSON_STRING)
+        return false;
+      l->fields[i] = fields->items[i].string;
+    }
+    l->num_fields = fields->count;
+  } else {
+    return false;
+  }
+
+  *rss_hf = layer_rss_hf(proto->string, l);
+  if (*rss_hf == 0) {
+    NF_INFO("Layer %d: %s cannot be hashed by RSS, ignored", l->layer, proto->string);
+  }
+  return true;
+}
+
+// Same fields in reverse order, e.g. [src_ip, dst_ip] and [dst_ip, src_ip]
+static bool layer_is_swapped(const struct layer_cfg *a, const struct layer_cfg *b) {
+  return a->num_fields == 2 && b->num_fields == 2 &&
+         !strcmp(a->fields[0], b->fields[1]) && !strcmp(a->fields[1], b->fields[0]);
+}
+
+static bool load_cfg(const struct json_value *root, uint16_t nb_devices, bool *symmetric) {
+  const struct json_value *cfg = json_object_get(root, "cfg");
+  if (cfg == NULL)
+    return false;
+
+  // A single NIC group may be given without the enclosing list
+  size_t num_groups = cfg->type == JSON_ARRAY ? cfg->count : 1;
+  const struct json_value *groups = cfg->type == JSON_ARRAY ? cfg->items : cfg;
+  if (num_groups == 0)
+    return false;
+
+  struct layer_cfg layers[num_groups][RSS_MAX_LAYERS];
+  size_t num_layers[num_groups];
+
+  for (size_t g = 0; g < num_groups; g++) {
+    const struct json_value *id = json_object_get(&groups[g], "id");
+    const struct json_value *nic = json_object_get(&groups[g], "nic");
+    if (id == NULL || id->type != JSON_ARRAY || id->count > RSS_MAX_LAYERS || nic == NULL)
+      return false;
+
+    uint64_t rss_hf = 0;
+    for (size_t i = 0; i < id->count; i++) {
+      uint64_t layer_hf;
+      if (!parse_layer(&id->items[i], &layers[g][i], &layer_hf))
+        return false;
+      rss_hf |= layer_hf;
+    }
+    num_layers[g] = id->count;
+
+    if (rss_hf == 0) {
+      NF_INFO("NIC group %zu: packet set id cannot be hashed by RSS", g);
+      return false;
+    }
+
+    size_t num_nics = nic->type == JSON_ARRAY ? nic->count : 1;
+    const struct json_value *nics = nic->type == JSON_ARRAY ? nic->items : nic;
+    for (size_t n = 0; n < num_nics; n++) {
+      if (nics[n].type != JSON_NUMBER || nics[n].number < 0)
+        return false;
+      uint16_t device = (uint16_t)nics[n].number;
+      if (device >= nb_devices) {
+        NF_INFO("NIC %d of the packet set config is not present, ignored", device);
+        continue;
+      }
+      device_cfgs[device].rss_hf = rss_hf;
+    }
+  }
+
+  // Packet sets identified with swapped fields on different NICs need the
+  // same hash for both orders
+  *symmetric = false;
+  for (size_t g = 1; g < num_groups; g++) {
+    for (size_t i = 0; i < num_layers[g] && i < num_layers[0]; i++) {
+      if (layer_is_swapped(&layers[0][i], &layers[g][i]))
+        *symmetric = true;
+    }
+  }
+
+  return true;
+}
+
+bool pkt_set_rss_init(const char *cfg_path, uint16_t nb_devices) {
+  device_cfgs = calloc(nb_devices, sizeof(struct rss_device_cfg));
+  if (device_cfgs == NULL)
+    return false;
+
+  for (uint16_t device = 0; device < nb_devices; device++)
+    device_cfgs[device].rss_hf = RSS_DEFAULT_HF;
+
+  bool symmetric = false;
+  if (cfg_path != NULL) {
+    struct json_value *root = json_parse_file(cfg_path);
+    if (root == NULL) {
+      NF_INFO("Cannot read packet set config %s", cfg_path);
+      return false;
+    }
+    bool valid = load_cfg(root, nb_devices, &symmetric);
+    json_free(root);
+    if (!valid) {
+      NF_INFO("Invalid packet set config %s", cfg_path);
+      return false;
+    }
+  }
+
+  for (int i = 0; i < RSS_MAX_KEY_LEN; i++) {
+    rss_key[i] = symmetric ? symmetric_rss_key[i % sizeof(symmetric_rss_key)]
+                           : default_rss_key[i % RSS_DEFAULT_KEY_LEN];
+  }
+
+  if (symmetric) {
+    uint32_t tuple[3] = { RTE_IPV4(10, 0, 0, 1), RTE_IPV4(192, 168, 0, 1), (1234 << 16) | 80 };
+    uint32_t reverse_tuple[3] = { tuple[1], tuple[0], (80 << 16) | 1234 };
+    if (rte_softrss(tuple, 3, rss_key) != rte_softrss(reverse_tuple, 3, rss_key)) {
+      NF_INFO("RSS key is not symmetric");
+      return false;
+    }
+  }
+
+  NF_INFO("RSS %s key", symmetric ? "with symmetric" : "with default");
+
+  for (uint16_t device = 0; device < nb_devices; device++) {
+    struct rss_device_cfg *cfg = &device_cfgs[device];
+#ifdef SOFT_RSS
+    cfg->soft = true;
+#else
+    // e.g. net_pcap, net_null or VFs without RSS, and NICs unable to hash on
+    // single header fields
+    struct rte_eth_dev_info dev_info;
+    if (rte_eth_dev_info_get(device, &dev_info) != 0)
+      return false;
+    uint64_t supported_hf = cfg->rss_hf & dev_info.flow_type_rss_offloads;
+    cfg->soft = dev_info.max_rx_queues <= 1 || supported_hf == 0 ||
+                (cfg->rss_hf & ~supported_hf & RSS_SINGLE_FIELD_HF);
+#endif
+    if (cfg->soft) {
+      NF_INFO("Device %d: packet set hashes computed in software", device);
+    }
+  }
+
+  return true;
+}
+
+bool pkt_set_rss_is_soft(uint16_t device) {
+  return device_cfgs[device].soft;
+}
+
+/*
+ * Device config
+ */
+
+int pkt_set_rss_device_conf(struct rte_eth_conf *device_conf, uint16_t device,
+                            uint16_t num_workers) {
+  struct rss_device_cfg *cfg = &device_cfgs[device];
+
+  // Nothing to spread with a single data plane core
+  if (num_workers <= 1 || cfg->soft)
+    return 0;
+
+  struct rte_eth_dev_info dev_info;
+  int ret = rte_eth_dev_info_get(device, &dev_info);
+  if (ret != 0)
+    return ret;
+
+  cfg->key_len = dev_info.hash_key_size ? dev_info.hash_key_size : RSS_DEFAULT_KEY_LEN;
+  if (cfg->key_len > RSS_MAX_KEY_LEN)
+    return -ENOTSUP;
+
+  // Hashing on fewer fields than the packet set id still keeps a packet set
+  // on one core, hashing on fields outside of it does not
+  uint64_t unsupported_hf = cfg->rss_hf & ~dev_info.flow_type_rss_offloads;
+  if (unsupported_hf & RSS_SINGLE_FIELD_HF) {
+    NF_INFO("Device %d cannot hash on single header fields (rss_hf 0x%" PRIx64 ")",
+            device, cfg->rss_hf);
+    return -ENOTSUP;
+  }
+  if (unsupported_hf) {
+    NF_INFO("Device %d does not support RSS hash types 0x%" PRIx64 ", ignored",
+            device, unsupported_hf);
+  }
+  cfg->rss_hf &= dev_info.flow_type_rss_offloads;
+  cfg->enabled = true;
+
+  device_conf->rxmode.mq_mode = ETH_MQ_RX_RSS;
+  device_conf->rx_adv_conf.rss_conf.rss_key = rss_key;
+  device_conf->rx_adv_conf.rss_conf.rss_key_len = cfg->key_len;
+  device_conf->rx_adv_conf.rss_conf.rss_hf = cfg->rss_hf;
+  return 0;
+}
+
+int pkt_set_rss_check_device(uint16_t device) {
+  struct rss_device_cfg *cfg = &device_cfgs[device];
+  if (!cfg->enabled)
+    return 0;
+
+  // Some PMDs do not apply the whole RSS config given at configure time
+  struct rte_eth_rss_conf rss_conf = {
+    .rss_key = rss_key,
+    .rss_key_len = cfg->key_len,
+    .rss_hf = cfg->rss_hf,
+  };
+  int ret = rte_eth_dev_rss_hash_update(device, &rss_conf);
+  if (ret != 0 && ret != -ENOTSUP)
+    return ret;
+
+  uint8_t key[RSS_MAX_KEY_LEN];
+  rss_conf.rss_key = key;
+  rss_conf.rss_key_len = cfg->key_len;
+  rss_conf.rss_hf = 0;
+  ret = rte_eth_dev_rss_hash_conf_get(device, &rss_conf);
+  if (ret == -ENOTSUP) {
+    NF_INFO("Cannot read back RSS config of device %d", device);
+    return 0;
+  }
+  if (ret != 0)
+    return ret;
+
+  if (memcmp(key, rss_key, cfg->key_len)) {
+    NF_INFO("Device %d does not use the configured RSS key", device);
+    return -EINVAL;
+  }
+
+  uint64_t extra_hf = rss_conf.rss_hf & ~cfg->rss_hf;
+  uint64_t missing_hf = cfg->rss_hf & ~rss_conf.rss_hf;
+  if (extra_hf || (missing_hf & RSS_SINGLE_FIELD_HF)) {
+    NF_INFO("Device %d hashes on 0x%" PRIx64 " instead of 0x%" PRIx64
+            ", packet sets would be spread over cores", device, rss_conf.rss_hf, cfg->rss_hf);
+    return -EINVAL;
+  }
+  if (missing_hf) {
+    NF_INFO("Device %d ignores RSS hash types 0x%" PRIx64, device, missing_hf);
+  }
+
+  return 0;
+}
+
+/*
+ * Runtime validation
+ */
+
+// Software RSS hash of an IPv4 or IPv6 packet.
+// Returns false if the hash input of the NIC is not known for the packet,
+// unless l3_fallback, in which case TCP/UDP packets are hashed on their
+// addresses if the hash types have no L4 hashing.
+static bool soft_rss_hash(uint64_t rss_hf, struct rte_mbuf *mbuf, uint32_t *hash,
+                          bool l3_fallback) {
+  struct rte_ether_hdr *ether_header = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+  // Addresses in 32-bit words, followed by the L4 header
+  const uint8_t *src_addr, *dst_addr, *l4_header;
+  uint32_t addr_words;
+  uint8_t proto;
+  bool is_fragment;
+  uint64_t l3_hf, tcp_hf, udp_hf;
+
+  if (ether_header->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4)) {
+    struct rte_ipv4_hdr *ipv4_header = (struct rte_ipv4_hdr *)(ether_header + 1);
+    src_addr = (const uint8_t *)&ipv4_header->src_addr;
+    dst_addr = (const uint8_t *)&ipv4_header->dst_addr;
+    addr_words = 1;
+    l4_header = (uint8_t *)ipv4_header +
+                (ipv4_header->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    proto = ipv4_header->next_proto_id;
+    is_fragment = (ipv4_header->fragment_offset &
+                   rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) != 0;
+    l3_hf = ETH_RSS_IPV4 | ETH_RSS_FRAG_IPV4 | ETH_RSS_NONFRAG_IPV4_OTHER;
+    tcp_hf = ETH_RSS_NONFRAG_IPV4_TCP;
+    udp_hf = ETH_RSS_NONFRAG_IPV4_UDP;
+  } else if (ether_header->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6)) {
+    struct rte_ipv6_hdr *ipv6_header = (struct rte_ipv6_hdr *)(ether_header + 1);
+    src_addr = ipv6_header->src_addr;
+    dst_addr = ipv6_header->dst_addr;
+    addr_words = 4;
+    l4_header = (const uint8_t *)(ipv6_header + 1);
+    // Extension headers are not parsed, hash fragments on the addresses only
+    proto = ipv6_header->proto;
+    is_fragment = proto == IPPROTO_FRAGMENT;
+    l3_hf = ETH_RSS_IPV6 | ETH_RSS_FRAG_IPV6 | ETH_RSS_NONFRAG_IPV6_OTHER;
+    tcp_hf = ETH_RSS_NONFRAG_IPV6_TCP;
+    udp_hf = ETH_RSS_NONFRAG_IPV6_UDP;
+  } else {
+    return false;
+  }
+
+  bool is_l4 = !is_fragment && (proto == IPPROTO_TCP || proto == IPPROTO_UDP);
+  uint64_t l4_hf = proto == IPPROTO_TCP ? tcp_hf : udp_hf;
+  // NICs differ on how they hash TCP/UDP packets without L4 hashing
+  if (is_l4 && !(rss_hf & l4_hf)) {
+    if (!l3_fallback)
+      return false;
+    is_l4 = false;
+  }
+  if (!is_l4 && !(rss_hf & l3_hf))
+    return false;
+
+  // Both fields unless one of them is selected
+  uint32_t tuple[9];
+  uint32_t len = 0;
+  if (!(rss_hf & ETH_RSS_L3_DST_ONLY) || (rss_hf & ETH_RSS_L3_SRC_ONLY)) {
+    for (uint32_t i = 0; i < addr_words; i++)
+      tuple[len++] = rte_be_to_cpu_32(((const unaligned_uint32_t *)src_addr)[i]);
+  }
+  if (!(rss_hf & ETH_RSS_L3_SRC_ONLY) || (rss_hf & ETH_RSS_L3_DST_ONLY)) {
+    for (uint32_t i = 0; i < addr_words; i++)
+      tuple[len++] = rte_be_to_cpu_32(((const unaligned_uint32_t *)dst_addr)[i]);
+  }
+
+  if (is_l4) {
+    const uint16_t *ports = (const uint16_t *)l4_header;
+    uint32_t src_port = rte_be_to_cpu_16(ports[0]);
+    uint32_t dst_port = rte_be_to_cpu_16(ports[1]);
+    bool has_src_port = !(rss_hf & ETH_RSS_L4_DST_ONLY) || (rss_hf & ETH_RSS_L4_SRC_ONLY);
+    bool has_dst_port = !(rss_hf & ETH_RSS_L4_SRC_ONLY) || (rss_hf & ETH_RSS_L4_DST_ONLY);
+    // A single port is followed by zero bits, which do not change the hash
+    if (has_src_port && has_dst_port)
+      tuple[len++] = (src_port << 16) | dst_port;
+    else
+      tuple[len++] = (has_src_port ? src_port : dst_port) << 16;
+  }
+
+  *hash = rte_softrss(tuple, len, rss_key);
+  return true;
+}
+
+void pkt_set_rss_validate_burst(struct rte_mbuf **mbufs, uint16_t count) {
+  uint32_t *pkts_to_validate = &RTE_PER_LCORE(rss_pkts_to_validate);
+  uint32_t *mismatches = &RTE_PER_LCORE(rss_mismatches);
+
+  for (uint16_t i = 0; i < count; i++) {
+    struct rte_mbuf *mbuf = mbufs[i];
+    struct rss_device_cfg *cfg = &device_cfgs[mbuf->port];
+    uint32_t hash;
+
+    if (!cfg->enabled || !(mbuf->ol_flags & PKT_RX_RSS_HASH) ||
+        !soft_rss_hash(cfg->rss_hf, mbuf, &hash, false))
+      continue;
+
+    if (hash != mbuf->hash.rss && (*mismatches)++ == 0) {
+      NF_INFO("RSS hash 0x%x of device %d differs from the expected 0x%x",
+              mbuf->hash.rss, mbuf->port, hash);
+    }
+  }
+
+  *pkts_to_validate = count < *pkts_to_validate ? *pkts_to_validate - count : 0;
+  if (*pkts_to_validate == 0 && *mismatches) {
+    NF_INFO("Core %d: %d RSS hashes in the first %d packets differ from the "
+            "packet set config, packet sets might be spread over cores",
+            rte_lcore_id(), *mismatches, RSS_VALIDATION_PKTS);
+  }
+}
+
+/*
+ * Software RSS
+ */
+
+void pkt_set_rss_soft_hash(struct rte_mbuf **mbufs, uint16_t count) {
+  for (uint16_t i = 0; i < count; i++) {
+    struct rte_mbuf *mbuf = mbufs[i];
+    uint32_t hash;
+    // Other packets all land in partition 0, as on NICs
+    if (!soft_rss_hash(device_cfgs[mbuf->port].rss_hf, mbuf, &hash, true))
+      hash = 0;
+    mbuf->hash.rss = hash;
+    mbuf->ol_flags |= PKT_RX_RSS_HASH;
+  }
+}
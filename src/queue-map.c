@@ -0,0 +1,292 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_ethdev.h>
+#include <rte_ring.h>
+
+#include "vigor/nf-log.h"
+
+#include "queue-map.h"
+#include "partition-map.h"
+#include "pipeline.h"
+#include "pkt-set-rss.h"
+
+// rx_queue_workers[device][queue]
+static uint16_t **rx_queue_workers;
+static uint16_t *num_rx_queues;
+// polls_device[device * num_data_plane_cores + worker]
+static bool *polls_device;
+// handoff_rings[device * num_data_plane_cores + worker], NULL if the core
+// polls the device
+static struct rte_ring **handoff_rings;
+static struct rx_poll_list *poll_lists;
+static uint16_t num_data_plane_cores;
+// Cores allowed to poll devices, the first ones
+static uint16_t num_rx_cores;
+static uint16_t num_devices;
+
+#ifdef QUEUE_MAP
+// Parse "a,b-c,..." into the cores polling the successive queues of a device
+static bool parse_workers(char *list, uint16_t *workers, uint16_t *count) {
+  char *save;
+  *count = 0;
+  for (char *item = strtok_r(list, ",", &save); item != NULL;
+       item = strtok_r(NULL, ",", &save)) {
+    char *end;
+    unsigned long first = strtoul(item, &end, 10);
+    unsigned long last = first;
+    if (*end == '-')
+      last = strtoul(end + 1, &end, 10);
+    if (end == item || *end != '\0' || last < first || last >= num_rx_cores) {
+      NF_INFO("Invalid core(s) \"%s\" in QUEUE_MAP, %d RX cores", item, num_rx_cores);
+      return false;
+    }
+    for (unsigned long worker = first; worker <= last; worker++) {
+      if (*count == RTE_MAX_QUEUES_PER_PORT)
+        return false;
+      workers[(*count)++] = worker;
+    }
+  }
+  return *count > 0;
+}
+
+static bool parse_queue_map(const char *map) {
+  char *buf = strdup(map);
+  char *save;
+  bool ok = buf != NULL;
+
+  for (char *entry = ok ? strtok_r(buf, ";", &save) : NULL; ok && entry != NULL;
+       entry = strtok_r(NULL, ";", &save)) {
+    char *end;
+    unsigned long device = strtoul(entry, &end, 10);
+    if (end == entry || *end != ':' || device >= num_devices) {
+      NF_INFO("Invalid entry \"%s\" in QUEUE_MAP, %d devices", entry, num_devices);
+      ok = false;
+      break;
+    }
+
+    uint16_t workers[RTE_MAX_QUEUES_PER_PORT];
+    uint16_t count;
+    ok = parse_workers(end + 1, workers, &count);
+    if (ok) {
+      uint16_t *queues = realloc(rx_queue_workers[device], count * sizeof(uint16_t));
+      ok = queues != NULL;
+      if (ok) {
+        memcpy(queues, workers, count * sizeof(uint16_t));
+        rx_queue_workers[device] = queues;
+        num_rx_queues[device] = count;
+      }
+    }
+  }
+
+  free(buf);
+  return ok;
+}
+#endif
+
+static bool build_poll_list(uint16_t worker) {
+  struct rx_poll_list *list = &poll_lists[worker];
+  // At most all the queues of all devices, or one ring per device
+  uint16_t max_entries = 0;
+  for (uint16_t device = 0; device < num_devices; device++)
+    max_entries += RTE_MAX(num_rx_queues[device], 1);
+
+  list->entries = calloc(max_entries, sizeof(struct rx_poll_entry));
+  if (list->entries == NULL)
+    return false;
+
+  for (uint16_t device = 0; device < num_devices; device++) {
+    // Only devices polled by a subset of the cores hand packets over
+    bool partial = false;
+    for (uint16_t w = 0; w < num_data_plane_cores; w++)
+      partial |= !polls_device[device * num_data_plane_cores + w];
+
+    for (uint16_t queue = 0; queue < num_rx_queues[device]; queue++) {
+      if (rx_queue_workers[device][queue] != worker)
+        continue;
+      list->entries[list->num_entries++] = (struct rx_poll_entry) {
+        .device = device, .queue = queue, .steer = partial,
+        .soft_rss = pkt_set_rss_is_soft(device),
+        .interval = 1, .countdown = 1,
+      };
+    }
+
+    struct rte_ring *ring = handoff_rings[device * num_data_plane_cores + worker];
+    if (ring) {
+      list->entries[list->num_entries++] = (struct rx_poll_entry) {
+        .device = device, .ring = ring, .interval = 1, .countdown = 1,
+      };
+    }
+  }
+
+  return true;
+}
+
+bool queue_map_init(uint16_t num_workers, uint16_t nb_devices) {
+  num_data_plane_cores = num_workers;
+  num_devices = nb_devices;
+
+#ifdef PIPELINE
+  num_rx_cores = PIPELINE_RX_CORES;
+  if (num_rx_cores == 0 || num_rx_cores >= num_workers) {
+    NF_INFO("PIPELINE_RX_CORES must leave some of the %d data plane cores to "
+            "the packet handlers", num_workers);
+    return false;
+  }
+#else
+  num_rx_cores = num_workers;
+#endif
+
+  rx_queue_workers = calloc(nb_devices, sizeof(uint16_t *));
+  num_rx_queues = calloc(nb_devices, sizeof(uint16_t));
+  polls_device = calloc(nb_devices * num_workers, sizeof(bool));
+  handoff_rings = calloc(nb_devices * num_workers, sizeof(struct rte_ring *));
+  poll_lists = calloc(num_workers, sizeof(struct rx_poll_list));
+  if (rx_queue_workers == NULL || num_rx_queues == NULL || polls_device == NULL ||
+      handoff_rings == NULL || poll_lists == NULL)
+    return false;
+
+  // RX core i polls queue i of every device by default
+  for (uint16_t device = 0; device < nb_devices; device++) {
+    rx_queue_workers[device] = calloc(num_rx_cores, sizeof(uint16_t));
+    if (rx_queue_workers[device] == NULL)
+      return false;
+    for (uint16_t worker = 0; worker < num_rx_cores; worker++)
+      rx_queue_workers[device][worker] = worker;
+    num_rx_queues[device] = num_rx_cores;
+
+    // Devices hashed in software are spread over the RX cores
+    if (pkt_set_rss_is_soft(device)) {
+      rx_queue_workers[device][0] = device % num_rx_cores;
+      num_rx_queues[device] = 1;
+    }
+  }
+
+#ifdef QUEUE_MAP
+  if (!parse_queue_map(QUEUE_MAP))
+    return false;
+#endif
+
+  for (uint16_t device = 0; device < nb_devices; device++) {
+    if (!pkt_set_rss_is_soft(device))
+      continue;
+#if defined(ELASTIC_SCALING) || defined(LOAD_BALANCING)
+    NF_INFO("Device %d has no usable RSS, not supported by ELASTIC_SCALING and "
+            "LOAD_BALANCING", device);
+    return false;
+#endif
+    if (num_rx_queues[device] > 1) {
+      NF_INFO("Device %d is hashed in software, it can only have one RX queue", device);
+      return false;
+    }
+  }
+
+  for (uint16_t device = 0; device < nb_devices; device++) {
+    for (uint16_t queue = 0; queue < num_rx_queues[device]; queue++)
+      polls_device[device * num_workers + rx_queue_workers[device][queue]] = true;
+
+    for (uint16_t worker = 0; worker < num_workers; worker++) {
+      if (polls_device[device * num_workers + worker])
+        continue;
+      char ring_name[32];
+      sprintf(ring_name, "queue_map_%d_%d", device, worker);
+      // Multi-producer, single-consumer
+      handoff_rings[device * num_workers + worker] =
+        rte_ring_create(ring_name, QUEUE_MAP_RING_SIZE, SOCKET_ID_ANY, RING_F_SC_DEQ);
+      if (handoff_rings[device * num_workers + worker] == NULL)
+        return false;
+    }
+  }
+
+  for (uint16_t worker = 0; worker < num_workers; worker++) {
+    if (!build_poll_list(worker))
+      return false;
+    NF_INFO("Data plane core %d polls %d RX queues and rings", worker,
+            poll_lists[worker].num_entries);
+  }
+
+  return true;
+}
+
+uint16_t queue_map_num_rx_queues(uint16_t device) {
+  return num_rx_queues[device];
+}
+
+uint16_t queue_map_rx_queue_worker(uint16_t device, uint16_t queue) {
+  return rx_queue_workers[device][queue];
+}
+
+uint16_t queue_map_worker_num_rx_queues(uint16_t worker) {
+  uint16_t count = 0;
+  for (uint16_t device = 0; device < num_devices; device++) {
+    for (uint16_t queue = 0; queue < num_rx_queues[device]; queue++)
+      count += rx_queue_workers[device][queue] == worker;
+  }
+  return count;
+}
+
+uint16_t queue_map_partition_queue(uint16_t device, uint16_t partition, uint16_t owner) {
+  uint16_t n = num_rx_queues[device];
+  if (!polls_device[device * num_data_plane_cores + owner])
+    // Spread over the cores polling the device, which hand the packets over
+    return partition % n;
+
+  // Spread over the queues of the owner on the device
+  uint16_t owner_queues = 0;
+  for (uint16_t queue = 0; queue < n; queue++)
+    owner_queues += rx_queue_workers[device][queue] == owner;
+
+  uint16_t nth = (partition / num_data_plane_cores) % owner_queues;
+  for (uint16_t queue = 0; queue < n; queue++) {
+    if (rx_queue_workers[device][queue] == owner && nth-- == 0)
+      return queue;
+  }
+  return 0;
+}
+
+struct rx_poll_list *queue_map_poll_list(uint16_t worker) {
+  return &poll_lists[worker];
+}
+
+uint16_t queue_map_steer_burst(uint16_t worker, uint16_t device,
+                               struct rte_mbuf **mbufs, uint16_t count) {
+  uint16_t owners[count];
+  for (uint16_t i = 0; i < count; i++)
+    owners[i] = partition_map_get_owner(pkt_set_partition_of_hash(mbufs[i]->hash.rss));
+
+  uint16_t num_kept = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    uint16_t owner = owners[i];
+    if (likely(owner == worker)) {
+      mbufs[num_kept++] = mbufs[i];
+      continue;
+    }
+    // Already handed over with an earlier packet of the same owner
+    if (owner == UINT16_MAX)
+      continue;
+
+    // Hand all the packets of the owner over in one burst, num_kept <= i so
+    // the packets after i are still in place
+    struct rte_mbuf *burst[count];
+    uint16_t burst_size = 0;
+    for (uint16_t j = i; j < count; j++) {
+      if (owners[j] == owner) {
+        burst[burst_size++] = mbufs[j];
+        owners[j] = UINT16_MAX;
+      }
+    }
+
+    // No ring if the owner polls the device, the packets were received
+    // before the RETA was programmed
+    struct rte_ring *ring = handoff_rings[device * num_data_plane_cores + owner];
+    uint16_t sent = ring ? rte_ring_mp_enqueue_burst(ring, (void **)burst, burst_size, NULL) : 0;
+    for (uint16_t j = sent; j < burst_size; j++)
+      rte_pktmbuf_free(burst[j]);
+  }
+
+  return num_kept;
+}
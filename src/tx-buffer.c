@@ -0,0 +1,49 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
+#include "timer.h"
+#include "tx-buffer.h"
+
+RTE_DEFINE_PER_LCORE(struct tx_worker, tx_worker);
+
+bool tx_worker_init(uint16_t queue, uint16_t nb_devices) {
+  struct tx_worker *w = &RTE_PER_LCORE(tx_worker);
+
+  w->queue = queue;
+  w->nb_devices = nb_devices;
+  w->drops = 0;
+  w->buffers = rte_zmalloc_socket(NULL, sizeof(struct rte_eth_dev_tx_buffer *) * nb_devices,
+                                  RTE_CACHE_LINE_SIZE, rte_socket_id());
+  if (w->buffers == NULL)
+    return false;
+
+  for (uint16_t device = 0; device < nb_devices; device++) {
+    w->buffers[device] = rte_zmalloc_socket(NULL, RTE_ETH_TX_BUFFER_SIZE(TX_BUFFER_SIZE),
+                                            RTE_CACHE_LINE_SIZE, rte_socket_id());
+    if (w->buffers[device] == NULL ||
+        rte_eth_tx_buffer_init(w->buffers[device], TX_BUFFER_SIZE))
+      return false;
+    // Free unsent packets and count them
+    if (rte_eth_tx_buffer_set_err_callback(w->buffers[device],
+                                           rte_eth_tx_buffer_count_callback,
+                                           &w->drops))
+      return false;
+  }
+
+  w->next_flush = rte_get_tsc_cycles() + nfos_usec_to_tsc_cycles(TX_FLUSH_TIMEOUT);
+  return true;
+}
+
+void tx_flush_all() {
+  struct tx_worker *w = &RTE_PER_LCORE(tx_worker);
+
+  for (uint16_t device = 0; device < w->nb_devices; device++)
+    rte_eth_tx_buffer_flush(device, w->queue, w->buffers[device]);
+  w->next_flush = rte_get_tsc_cycles() + nfos_usec_to_tsc_cycles(TX_FLUSH_TIMEOUT);
+}
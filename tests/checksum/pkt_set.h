@@ -0,0 +1,11 @@
+#pragma once
+
+// nf.h expects the packet set types of an NF, the test has none
+
+struct pkt_set_id {
+  uint8_t place_holder;
+};
+
+struct pkt_set_state {
+  uint8_t place_holder;
+};
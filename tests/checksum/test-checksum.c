@@ -0,0 +1,227 @@
+#include <inttypes.h>
+// DPDK uses these but doesn't include them. :|
+#include <linux/limits.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include "checksum.h"
+
+#define NUM_ITERS 100000
+#define MAX_PAYLOAD_LEN 1400
+
+static uint8_t buffer[RTE_ETHER_HDR_LEN + sizeof(struct rte_ipv6_hdr) +
+                      sizeof(struct rte_tcp_hdr) + MAX_PAYLOAD_LEN];
+static struct rte_mbuf mbuf;
+static uint64_t num_errors;
+
+static uint32_t rand32() {
+  return (uint32_t)rand() << 16 ^ rand();
+}
+
+// Random TCP or UDP packet with valid checksums, proto 0 for IPv6 over TCP
+static void make_pkt(pkt_t *pkt, uint8_t proto) {
+  memset(pkt, 0, sizeof(*pkt));
+  memset(&mbuf, 0, sizeof(mbuf));
+  mbuf.buf_addr = buffer;
+  mbuf.nb_segs = 1;
+  pkt->mbuf = &mbuf;
+
+  uint32_t payload_len = rand() % MAX_PAYLOAD_LEN;
+  uint32_t l4_len = (proto == IPPROTO_UDP ? sizeof(struct rte_udp_hdr) :
+                                            sizeof(struct rte_tcp_hdr)) + payload_len;
+  for (int i = 0; i < sizeof(buffer); i++)
+    buffer[i] = rand();
+
+  pkt->ether_header = (struct rte_ether_hdr *)buffer;
+  if (proto) {
+    struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(pkt->ether_header + 1);
+    // Version 4, header of 5 words
+    ip->version_ihl = 0x45;
+    ip->total_length = rte_cpu_to_be_16(sizeof(*ip) + l4_len);
+    ip->fragment_offset = 0;
+    ip->next_proto_id = proto;
+    ip->hdr_checksum = 0;
+    pkt->ipv4_header = ip;
+    pkt->tcpudp_header = (struct tcpudp_hdr *)(ip + 1);
+  } else {
+    struct rte_ipv6_hdr *ip = (struct rte_ipv6_hdr *)(pkt->ether_header + 1);
+    ip->vtc_flow = rte_cpu_to_be_32(6 << 28);
+    ip->payload_len = rte_cpu_to_be_16(l4_len);
+    ip->proto = IPPROTO_TCP;
+    pkt->ipv6_header = ip;
+    pkt->tcpudp_header = (struct tcpudp_hdr *)(ip + 1);
+  }
+
+  bool offload = nfos_tx_cksum_offload;
+  nfos_tx_cksum_offload = false;
+  nfos_cksum_recompute(pkt);
+  nfos_tx_cksum_offload = offload;
+}
+
+// Checksums of the packet as recomputed from scratch
+static void expected_cksums(pkt_t *pkt, rte_be16_t *ip_cksum, rte_be16_t *l4_cksum) {
+  static uint8_t copy[sizeof(buffer)];
+  memcpy(copy, buffer, sizeof(buffer));
+
+  bool offload = nfos_tx_cksum_offload;
+  nfos_tx_cksum_offload = false;
+  nfos_cksum_recompute(pkt);
+  nfos_tx_cksum_offload = offload;
+  *ip_cksum = pkt->ipv4_header ? pkt->ipv4_header->hdr_checksum : 0;
+  rte_be16_t *cksum = nfos_cksum_l4_field(pkt);
+  *l4_cksum = cksum ? *cksum : 0;
+
+  memcpy(buffer, copy, sizeof(buffer));
+}
+
+static void check(pkt_t *pkt, const char *what) {
+  rte_be16_t ip_cksum = pkt->ipv4_header ? pkt->ipv4_header->hdr_checksum : 0;
+  rte_be16_t *cksum = nfos_cksum_l4_field(pkt);
+  rte_be16_t l4_cksum = cksum ? *cksum : 0;
+
+  rte_be16_t expected_ip_cksum, expected_l4_cksum;
+  expected_cksums(pkt, &expected_ip_cksum, &expected_l4_cksum);
+  if (ip_cksum != expected_ip_cksum || l4_cksum != expected_l4_cksum) {
+    if (num_errors++ < 10)
+      printf("%s: checksums %04x %04x, expected %04x %04x\n", what, ip_cksum, l4_cksum,
+             expected_ip_cksum, expected_l4_cksum);
+  }
+}
+
+// Incremental updates give the same checksums as a full recompute
+static void incremental_test() {
+  pkt_t pkt;
+  nfos_tx_cksum_offload = false;
+
+  for (int iter = 0; iter < NUM_ITERS; iter++) {
+    uint8_t proto = (uint8_t[]) {IPPROTO_TCP, IPPROTO_UDP, 0}[iter % 3];
+    make_pkt(&pkt, proto);
+
+    if (pkt.ipv4_header) {
+      // Also rewrite fields to the same value, and to the values summing to
+      // zero and all ones
+      uint32_t addr = (uint32_t[]) {rand32(), pkt.ipv4_header->src_addr, 0, UINT32_MAX}[rand() % 4];
+      nfos_cksum_set_ipv4_addr(&pkt, &pkt.ipv4_header->src_addr, addr);
+      check(&pkt, "IPv4 source");
+      nfos_cksum_set_ipv4_addr(&pkt, &pkt.ipv4_header->dst_addr, rand32());
+      check(&pkt, "IPv4 destination");
+      nfos_cksum_set_ipv4_tos(&pkt, rand());
+      check(&pkt, "IPv4 TOS");
+    } else {
+      uint8_t addr[16];
+      for (int i = 0; i < 16; i++)
+        addr[i] = rand();
+      nfos_cksum_set_ipv6_addr(&pkt, pkt.ipv6_header->dst_addr, addr);
+      check(&pkt, "IPv6 destination");
+    }
+
+    rte_be16_t port = (rte_be16_t[]) {rand(), 0, UINT16_MAX}[rand() % 3];
+    nfos_cksum_set_l4_port(&pkt, &pkt.tcpudp_header->src_port, port);
+    check(&pkt, "source port");
+    nfos_cksum_set_l4_port(&pkt, &pkt.tcpudp_header->dst_port, rand());
+    check(&pkt, "destination port");
+  }
+}
+
+// Rewrites keep special TCP/UDP checksums valid
+static void special_cksum_test() {
+  pkt_t pkt;
+  nfos_tx_cksum_offload = false;
+
+  // Zero means no checksum for UDP over IPv4, it stays so
+  make_pkt(&pkt, IPPROTO_UDP);
+  struct rte_udp_hdr *udp = (struct rte_udp_hdr *)pkt.tcpudp_header;
+  udp->dgram_cksum = 0;
+  nfos_cksum_set_ipv4_addr(&pkt, &pkt.ipv4_header->src_addr, rand32());
+  nfos_cksum_set_l4_port(&pkt, &udp->src_port, rand());
+  if (udp->dgram_cksum != 0) {
+    printf("UDP checksum 0 became %04x\n", udp->dgram_cksum);
+    num_errors++;
+  }
+
+  // Non-first fragments have no L4 header, only the IPv4 checksum changes
+  make_pkt(&pkt, IPPROTO_TCP);
+  struct rte_tcp_hdr *tcp = (struct rte_tcp_hdr *)pkt.tcpudp_header;
+  pkt.ipv4_header->fragment_offset = rte_cpu_to_be_16(100);
+  pkt.ipv4_header->hdr_checksum = 0;
+  pkt.ipv4_header->hdr_checksum = rte_ipv4_cksum(pkt.ipv4_header);
+  rte_be16_t l4_cksum = tcp->cksum;
+  nfos_cksum_set_ipv4_addr(&pkt, &pkt.ipv4_header->dst_addr, rand32());
+  rte_be16_t ip_cksum = pkt.ipv4_header->hdr_checksum;
+  pkt.ipv4_header->hdr_checksum = 0;
+  if (tcp->cksum != l4_cksum || ip_cksum != rte_ipv4_cksum(pkt.ipv4_header)) {
+    printf("Fragment checksums are wrong\n");
+    num_errors++;
+  }
+}
+
+// With TX checksum offload, rewrites leave the checksums to the NIC
+static void offload_test() {
+  pkt_t pkt;
+  nfos_tx_cksum_offload = true;
+
+  make_pkt(&pkt, IPPROTO_TCP);
+  struct rte_tcp_hdr *tcp = (struct rte_tcp_hdr *)pkt.tcpudp_header;
+  nfos_cksum_set_ipv4_addr(&pkt, &pkt.ipv4_header->src_addr, rand32());
+  nfos_cksum_set_l4_port(&pkt, &tcp->src_port, rand());
+  uint64_t flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM;
+  if ((mbuf.ol_flags & flags) != flags || mbuf.l2_len != RTE_ETHER_HDR_LEN ||
+      mbuf.l3_len != sizeof(struct rte_ipv4_hdr) || pkt.ipv4_header->hdr_checksum != 0 ||
+      tcp->cksum != rte_ipv4_phdr_cksum(pkt.ipv4_header, mbuf.ol_flags)) {
+    printf("IPv4 TCP packet not set up for checksum offload\n");
+    num_errors++;
+  }
+
+  make_pkt(&pkt, 0);
+  uint8_t addr[16] = {0};
+  nfos_cksum_set_ipv6_addr(&pkt, pkt.ipv6_header->src_addr, addr);
+  tcp = (struct rte_tcp_hdr *)pkt.tcpudp_header;
+  flags = PKT_TX_IPV6 | PKT_TX_TCP_CKSUM;
+  if ((mbuf.ol_flags & flags) != flags || mbuf.l3_len != sizeof(struct rte_ipv6_hdr) ||
+      tcp->cksum != rte_ipv6_phdr_cksum(pkt.ipv6_header, mbuf.ol_flags)) {
+    printf("IPv6 TCP packet not set up for checksum offload\n");
+    num_errors++;
+  }
+
+  // First fragments are patched, the NIC would only checksum the fragment
+  make_pkt(&pkt, IPPROTO_UDP);
+  pkt.ipv4_header->fragment_offset = rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG);
+  pkt.ipv4_header->hdr_checksum = 0;
+  pkt.ipv4_header->hdr_checksum = rte_ipv4_cksum(pkt.ipv4_header);
+  nfos_cksum_set_ipv4_addr(&pkt, &pkt.ipv4_header->dst_addr, rand32());
+  if (mbuf.ol_flags) {
+    printf("IPv4 fragment set up for checksum offload\n");
+    num_errors++;
+  }
+  // The packet holds the whole datagram, check it as such
+  rte_be16_t l4_cksum = ((struct rte_udp_hdr *)pkt.tcpudp_header)->dgram_cksum;
+  rte_be16_t ip_cksum, expected_l4_cksum;
+  pkt.ipv4_header->fragment_offset = 0;
+  expected_cksums(&pkt, &ip_cksum, &expected_l4_cksum);
+  if (l4_cksum != expected_l4_cksum) {
+    printf("IPv4 fragment: UDP checksum %04x, expected %04x\n", l4_cksum, expected_l4_cksum);
+    num_errors++;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  srand(1);
+
+  incremental_test();
+  special_cksum_test();
+  offload_test();
+
+  printf("Checksum errors: %" PRIu64 "\n", num_errors);
+  return num_errors ? 1 : 0;
+}
@@ -0,0 +1,321 @@
+#include <inttypes.h>
+// DPDK uses these but doesn't include them. :|
+#include <linux/limits.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+
+#include "vector.h"
+#include "rlu-wrapper.h"
+#include "grace-period.h"
+#include "mtrie.h"
+#include "fib_table.h"
+#include "load-balance.h"
+
+// Routes added and deleted by the control core, all inside CHURN_PREFIX
+#define NUM_CHURN_ROUTES 512
+#define NUM_ITERS 1000000
+#define PLY_POOL_CAPACITY 4096
+
+// 10.0.0.0/8 -> STABLE_ADJ, more specific routes -> CHURN_ADJ + i % NUM_CHURN_ADJS
+#define CHURN_PREFIX 0x0A000000
+#define STABLE_ADJ 1
+#define CHURN_ADJ 4
+#define NUM_CHURN_ADJS 4
+// 11.0.0.0/8 -> OTHER_ADJ, never updated
+#define OTHER_PREFIX 0x0B000000
+#define OTHER_ADJ 2
+
+// Routes bulk-loaded in FIB 1, all inside LOAD_PREFIX
+#define LOAD_FIB 1
+#define NUM_LOAD_ROUTES 256
+#define LOAD_PREFIX 0x0C000000
+#define NUM_LOAD_CHECKS 100000
+// Adj of the leaves of an empty mtrie
+#define EMPTY_ADJ 0
+
+static volatile bool done;
+static uint64_t num_errors;
+
+// TODO: Ugly to define those here, should have a rlu_wrapper.c
+// RLU per thread data
+rlu_thread_data_t **rlu_threads_data;
+RTE_DEFINE_PER_LCORE(int, rlu_thread_id);
+
+// entry function to various NF threads, a bit ugly...
+static int lcore_entry(void* arg) {
+  int lcore_ind = rte_lcore_index(-1);
+
+  // Used for threads to locate the local rlu data
+  RTE_PER_LCORE(rlu_thread_id) = lcore_ind;
+
+  int (** lcore_funcs)(void*) = (int (**)(void*))arg;
+  int (* lcore_func)(void*) = lcore_funcs[lcore_ind];
+  lcore_func(NULL);
+}
+
+static void ply_null_init(void *obj) {
+  memset(obj, 0, sizeof(ip4_fib_mtrie_8_ply_t));
+}
+
+static void fib_null_init(void *obj) {
+  memset(obj, 0, sizeof(ip4_fib_t));
+}
+
+static uint32_t lookup(const ip4_fib_mtrie_t *mtrie, uint32_t addr) {
+  ip4_fib_mtrie_leaf_t leaf = ip4_fib_mtrie_lookup_step_one(mtrie, addr);
+  leaf = ip4_fib_mtrie_lookup_step(mtrie, leaf, addr, 2);
+  leaf = ip4_fib_mtrie_lookup_step(mtrie, leaf, addr, 3);
+  if (!ip4_fib_mtrie_leaf_is_terminal(leaf))
+    return UINT32_MAX;
+  return leaf >> 1;
+}
+
+// Longest prefix match among routes, default_adj if none covers addr
+static uint32_t expected_adj(const uint32_t *dst, const uint32_t *len, const uint32_t *adj,
+                             const bool *live, int num_routes, uint32_t addr,
+                             uint32_t default_adj) {
+  int best = -1;
+  for (int i = 0; i < num_routes; i++) {
+    if (live[i] && (addr & ip4_fib_mtrie_prefix_mask(len[i])) == dst[i] &&
+        (best < 0 || len[i] > len[best]))
+      best = i;
+  }
+  return best < 0 ? default_adj : adj[best];
+}
+
+static bool is_churn_adj(uint32_t adj) {
+  return adj >= CHURN_ADJ && adj < CHURN_ADJ + NUM_CHURN_ADJS;
+}
+
+// Bulk-loads random routes in LOAD_FIB, checks lookups against them, then
+// deletes them in random order and checks that lookups fall back to covers
+static void load_test() {
+  uint32_t dst[NUM_LOAD_ROUTES], len[NUM_LOAD_ROUTES], adj[NUM_LOAD_ROUTES];
+  bool live[NUM_LOAD_ROUTES];
+  ip4_fib_mtrie_t *mtrie = &(ip4_fib_get(LOAD_FIB)->mtrie);
+
+  char path[] = "/tmp/test-mtrie-routesXXXXXX";
+  int fd = mkstemp(path);
+  FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+  if (!file) {
+    printf("Cannot create routes file\n");
+    num_errors++;
+    return;
+  }
+  fprintf(file, "# Random routes\n");
+  for (int i = 0; i < NUM_LOAD_ROUTES; i++) {
+    len[i] = 8 + rand() % 25;
+    dst[i] = (LOAD_PREFIX | (rand() & 3) << 16 | (rand() & 0xFFFF)) &
+             ip4_fib_mtrie_prefix_mask(len[i]);
+    adj[i] = CHURN_ADJ + rand() % NUM_CHURN_ADJS;
+    // Duplicates are overwritten by the last one in the file
+    live[i] = true;
+    for (int j = 0; j < i; j++) {
+      if (live[j] && dst[j] == dst[i] && len[j] == len[i])
+        live[j] = false;
+    }
+    fprintf(file, "%u.%u.%u.%u/%u %u\n", dst[i] >> 24, (dst[i] >> 16) & 0xFF,
+            (dst[i] >> 8) & 0xFF, dst[i] & 0xFF, len[i], adj[i]);
+  }
+  fclose(file);
+
+  int num_live = 0;
+  for (int i = 0; i < NUM_LOAD_ROUTES; i++)
+    num_live += live[i];
+  int ret = ip4_fib_table_load(LOAD_FIB, path);
+  // The file may hold duplicates, counted as routes
+  if (ret != NUM_LOAD_ROUTES) {
+    printf("Bulk load returned %d for %d routes\n", ret, NUM_LOAD_ROUTES);
+    num_errors++;
+  }
+
+  uint32_t num_load_errors = 0;
+  for (int iter = 0; iter <= NUM_LOAD_ROUTES + NUM_LOAD_CHECKS; iter++) {
+    // Once the routes are checked, delete one at each round
+    if (iter > NUM_LOAD_CHECKS) {
+      int i = rand() % NUM_LOAD_ROUTES;
+      while (!live[i] && num_live)
+        i = (i + 1) % NUM_LOAD_ROUTES;
+      if (num_live) {
+        if (ip4_fib_route_del(LOAD_FIB, dst[i], len[i]))
+          num_load_errors++;
+        live[i] = false;
+        num_live--;
+        // The deleted route itself now resolves to its cover
+        if (lookup(mtrie, dst[i]) != expected_adj(dst, len, adj, live, NUM_LOAD_ROUTES,
+                                                  dst[i], EMPTY_ADJ))
+          num_load_errors++;
+      }
+    }
+    uint32_t addr = LOAD_PREFIX | (rand() & 3) << 16 | (rand() & 0xFFFF);
+    if (lookup(mtrie, addr) != expected_adj(dst, len, adj, live, NUM_LOAD_ROUTES, addr, EMPTY_ADJ))
+      num_load_errors++;
+  }
+
+  // A route to an unknown load-balance fails the whole file
+  file = fopen(path, "w");
+  fprintf(file, "12.0.0.0/8 %u\n", CHURN_ADJ + NUM_CHURN_ADJS);
+  fclose(file);
+  if (ip4_fib_table_load(LOAD_FIB, path) != -1)
+    num_load_errors++;
+  unlink(path);
+
+  printf("Bulk load errors: %u\n", num_load_errors);
+  num_errors += num_load_errors;
+}
+
+// Data plane cores look up while routes churn
+static int lookup_test(void* unused) {
+  rlu_thread_data_t *rlu_data = get_rlu_thread_data();
+  int worker = rte_lcore_index(-1);
+  ip4_fib_mtrie_t *mtrie = &(ip4_fib_get(0)->mtrie);
+  uint32_t seed = worker + 1;
+
+  while (!done) {
+    grace_period_quiescent(worker);
+
+    RLU_READER_LOCK(rlu_data);
+    for (int i = 0; i < 64; i++) {
+      seed = seed * 1103515245 + 12345;
+      uint32_t addr = CHURN_PREFIX | (seed & 0x0003FFFF);
+      uint32_t adj = lookup(mtrie, addr);
+      if (adj != STABLE_ADJ && !is_churn_adj(adj))
+        __atomic_add_fetch(&num_errors, 1, __ATOMIC_RELAXED);
+      if (lookup(mtrie, OTHER_PREFIX | (seed & 0x00FFFFFF)) != OTHER_ADJ)
+        __atomic_add_fetch(&num_errors, 1, __ATOMIC_RELAXED);
+    }
+    RLU_READER_UNLOCK(rlu_data);
+  }
+
+  return 0;
+}
+
+// Control core adds and deletes random routes, and checks that plies get
+// recycled
+static int churn_test(void* unused) {
+  uint32_t dst[NUM_CHURN_ROUTES], len[NUM_CHURN_ROUTES], adj[NUM_CHURN_ROUTES];
+  bool live[NUM_CHURN_ROUTES] = {false};
+  ip4_fib_mtrie_t *mtrie = &(ip4_fib_get(0)->mtrie);
+  uint32_t num_failures = 0;
+  uint32_t num_cover_errors = 0;
+
+  for (int i = 0; i < NUM_CHURN_ROUTES; i++) {
+    adj[i] = CHURN_ADJ + i % NUM_CHURN_ADJS;
+    len[i] = 17 + rand() % 16;
+    // Ensure routes are unique
+    dst[i] = (CHURN_PREFIX | ((i & 3) << 16) | (rand() & 0xFFFF)) & ip4_fib_mtrie_prefix_mask(len[i]);
+    for (int j = 0; j < i; j++) {
+      if (dst[j] == dst[i] && len[j] == len[i]) {
+        len[i] = 0;
+        break;
+      }
+    }
+  }
+
+  for (int iter = 0; iter < NUM_ITERS; iter++) {
+    int i = rand() % NUM_CHURN_ROUTES;
+    if (!len[i])
+      continue;
+    if (live[i]) {
+      if (ip4_fib_route_del(0, dst[i], len[i]))
+        num_failures++;
+      live[i] = false;
+      // Falls back to the longest remaining route covering it
+      if (lookup(mtrie, dst[i]) != expected_adj(dst, len, adj, live, NUM_CHURN_ROUTES, dst[i],
+                                                STABLE_ADJ))
+        num_cover_errors++;
+    } else if (ip4_fib_route_add(0, dst[i], len[i], adj[i]) == 0) {
+      live[i] = true;
+      if (lookup(mtrie, dst[i]) != adj[i])
+        num_cover_errors++;
+    } else {
+      num_failures++;
+    }
+  }
+
+  for (int i = 0; i < NUM_CHURN_ROUTES; i++) {
+    if (live[i] && ip4_fib_route_del(0, dst[i], len[i]))
+      num_failures++;
+    live[i] = false;
+  }
+  for (int i = 0; i < NUM_CHURN_ROUTES; i++) {
+    if (len[i] && lookup(mtrie, dst[i]) != STABLE_ADJ)
+      num_cover_errors++;
+  }
+
+  // Plies are recycled once all data plane cores went through a quiescent state
+  for (int i = 0; i < 100 && ip4_ply_pool_available() != PLY_POOL_CAPACITY; i++)
+    rte_delay_ms(1);
+  uint32_t num_leaked_plies = PLY_POOL_CAPACITY - ip4_ply_pool_available();
+  printf("Route update failures: %u, cover errors: %u, leaked plies: %u/%u\n", num_failures,
+         num_cover_errors, num_leaked_plies, PLY_POOL_CAPACITY);
+  __atomic_add_fetch(&num_errors, num_failures + num_cover_errors + num_leaked_plies,
+                     __ATOMIC_RELAXED);
+
+  done = true;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  // Initialize the Environment Abstraction Layer (EAL)
+  int ret = rte_eal_init(argc, argv);
+  if (ret < 0) {
+    rte_exit(EXIT_FAILURE, "Error with EAL initialization, ret=%d\n", ret);
+  }
+
+  unsigned num_lcores = rte_lcore_count();
+  int (** lcore_funcs)(void*) = calloc(num_lcores, sizeof(int (*)(void*)) );
+
+  // Init DS
+  grace_period_init(num_lcores - 1);
+  nfos_vector_allocate(sizeof(ip4_fib_t), 2, fib_null_init, &ip4_fibs);
+  nfos_vector_allocate(sizeof(ip4_fib_mtrie_8_ply_t), PLY_POOL_CAPACITY, ply_null_init, &ip4_ply_pool);
+  ip4_mtrie_init(&(ip4_fib_get(0)->mtrie));
+  ip4_mtrie_init(&(ip4_fib_get(LOAD_FIB)->mtrie));
+  // Routes only need their load-balances to exist, they are never read
+  load_balance_pool_index = CHURN_ADJ + NUM_CHURN_ADJS;
+  ip4_fib_route_add(0, CHURN_PREFIX, 8, STABLE_ADJ);
+  ip4_fib_route_add(0, OTHER_PREFIX, 8, OTHER_ADJ);
+  load_test();
+
+  // Init RLU
+  // Hacked the mv-rlu lib to put the gp_thread to the last isolated core: 46 on icdslab[5-8].epfl.ch
+  RLU_INIT(46);
+  // Init (mv-)RLU per-thread data
+  rlu_threads_data = malloc(num_lcores * sizeof(rlu_thread_data_t *));
+  for (int i = 0; i < num_lcores; i++) {
+    rlu_threads_data[i] = RLU_THREAD_ALLOC();
+	  RLU_THREAD_INIT(rlu_threads_data[i]);
+  }
+
+  // Test
+  // The last core updates routes as the control core of NFOS does
+  int lcore;
+  for (lcore = 0; lcore < num_lcores - 1; lcore++) {
+    lcore_funcs[lcore] = lookup_test;
+  }
+  lcore_funcs[lcore] = churn_test;
+
+  printf("Threads started\n");
+  rte_eal_mp_remote_launch(lcore_entry, (void*)lcore_funcs, CALL_MASTER);
+  rte_eal_mp_wait_lcore();
+
+  // Check results
+  printf("Threads finished, lookup errors: %" PRIu64 "\n", num_errors);
+
+  // FINI RLU
+  for (int i = 0; i < num_lcores; i++) {
+    RLU_THREAD_FINISH(rlu_threads_data[i]);
+  }
+  RLU_FINISH();
+
+  return num_errors ? 1 : 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+#define PKT_SET_STATE_FIELD_LOG
+#define PKT_SET_COLD_STATE
@@ -0,0 +1,17 @@
+#pragma once
+
+// Packet set states of the test. The hot one is the largest object of the
+// log, with 8-byte chunks, the cold one has a last chunk to pad.
+
+struct pkt_set_id {
+  uint8_t place_holder;
+};
+
+struct pkt_set_state {
+  uint64_t counters[64];
+};
+
+struct pkt_set_cold_state {
+  uint8_t buf[200];
+  uint32_t len;
+};
@@ -0,0 +1,160 @@
+#include <inttypes.h>
+// DPDK uses these but doesn't include them. :|
+#include <linux/limits.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_common.h>
+
+#include "nf.h"
+#include "pkt-set-log.h"
+
+#define NUM_ITERS 10000
+
+static pkt_set_state_t states[PKT_SET_LOG_MAX_OBJECTS];
+static pkt_set_cold_state_t cold_states[PKT_SET_LOG_MAX_OBJECTS];
+static uint64_t num_errors;
+
+// Cold states freed by rollbacks, normally by the packet set manager
+static bool cold_freed[PKT_SET_LOG_MAX_OBJECTS];
+
+void free_pkt_set_cold_state(int index) {
+  cold_freed[index] = true;
+}
+
+static void expect(bool cond, const char *what) {
+  if (!cond && num_errors++ < 10)
+    printf("Failed: %s\n", what);
+}
+
+static void fill(void *obj, size_t size) {
+  uint8_t *bytes = obj;
+  for (size_t i = 0; i < size; i++)
+    bytes[i] = rand();
+}
+
+// Random writes to random hot and cold states are rolled back, whatever their
+// size and alignment
+static void rollback_test() {
+  static pkt_set_state_t saved_states[PKT_SET_LOG_MAX_OBJECTS / 2];
+  static pkt_set_cold_state_t saved_cold_states[PKT_SET_LOG_MAX_OBJECTS / 2];
+
+  for (int iter = 0; iter < NUM_ITERS; iter++) {
+    int num_objects = 1 + rand() % (PKT_SET_LOG_MAX_OBJECTS / 2);
+    fill(states, num_objects * sizeof(pkt_set_state_t));
+    fill(cold_states, num_objects * sizeof(pkt_set_cold_state_t));
+    memcpy(saved_states, states, sizeof(saved_states));
+    memcpy(saved_cold_states, cold_states, sizeof(saved_cold_states));
+
+    pkt_set_log_reset();
+    for (int i = 0; i < num_objects; i++) {
+      pkt_set_log_object(&states[i], sizeof(pkt_set_state_t));
+      pkt_set_log_object(&cold_states[i], sizeof(pkt_set_cold_state_t));
+    }
+    // Logged twice, still once in the log
+    pkt_set_log_object(&states[0], sizeof(pkt_set_state_t));
+
+    for (int write = rand() % 32; write > 0; write--) {
+      int i = rand() % num_objects;
+      if (rand() % 2) {
+        int counter = rand() % 64;
+        PKT_SET_STATE_WRITE(&states[i], counters[counter]);
+        states[i].counters[counter]++;
+      } else {
+        size_t offset = rand() % sizeof(cold_states[i].buf);
+        size_t len = 1 + rand() % (sizeof(cold_states[i].buf) - offset);
+        nfos_pkt_set_state_write(&cold_states[i].buf[offset], len);
+        fill(&cold_states[i].buf[offset], len);
+        PKT_SET_STATE_WRITE(&cold_states[i], len);
+        cold_states[i].len = len;
+      }
+    }
+
+    pkt_set_log_rollback();
+    expect(!memcmp(states, saved_states, sizeof(saved_states)), "hot states rolled back");
+    expect(!memcmp(cold_states, saved_cold_states, sizeof(saved_cold_states)),
+           "cold states rolled back");
+  }
+}
+
+// Each chunk of each object saved on its own, the most the log has to hold
+static void worst_case_test() {
+  static pkt_set_state_t saved_states[PKT_SET_LOG_MAX_OBJECTS];
+
+  fill(states, sizeof(states));
+  memcpy(saved_states, states, sizeof(states));
+
+  pkt_set_log_reset();
+  for (int i = 0; i < PKT_SET_LOG_MAX_OBJECTS; i++)
+    pkt_set_log_object(&states[i], sizeof(pkt_set_state_t));
+  // Even then odd counters, so that no two saved chunks are adjacent
+  for (int i = 0; i < PKT_SET_LOG_MAX_OBJECTS; i++) {
+    for (int counter = 0; counter < 128; counter += 2) {
+      PKT_SET_STATE_WRITE(&states[i], counters[counter % 64 + counter / 64]);
+      states[i].counters[counter % 64 + counter / 64] = 0;
+    }
+  }
+
+  pkt_set_log_rollback();
+  expect(!memcmp(states, saved_states, sizeof(states)), "worst case rolled back");
+}
+
+// Writes are only saved once per transaction, and only rolled back in the
+// transaction doing them
+static void transaction_test() {
+  pkt_set_state_t *state = &states[0];
+  fill(state, sizeof(*state));
+
+  pkt_set_log_reset();
+  pkt_set_log_object(state, sizeof(*state));
+  PKT_SET_STATE_WRITE(state, counters[0]);
+  state->counters[0] = 1;
+  PKT_SET_STATE_WRITE(state, counters[0]);
+  state->counters[0] = 2;
+  // Committed
+  pkt_set_log_reset();
+  pkt_set_state_t committed = *state;
+
+  pkt_set_log_object(state, sizeof(*state));
+  PKT_SET_STATE_WRITE(state, counters[0]);
+  state->counters[0] = 3;
+  // Not logged, not rolled back
+  uint64_t unlogged = 0;
+  nfos_pkt_set_state_write(&unlogged, sizeof(unlogged));
+  unlogged = 1;
+  pkt_set_log_rollback();
+  expect(!memcmp(state, &committed, sizeof(*state)), "only the aborted transaction rolled back");
+  expect(unlogged == 1, "writes outside of the objects ignored");
+}
+
+// Cold states allocated by a transaction are freed if it aborts
+static void cold_alloc_test() {
+  memset(cold_freed, 0, sizeof(cold_freed));
+  pkt_set_log_reset();
+  pkt_set_log_cold_alloc(1);
+  pkt_set_log_cold_alloc(5);
+  pkt_set_log_rollback();
+  expect(cold_freed[1] && cold_freed[5], "cold states freed on abort");
+
+  memset(cold_freed, 0, sizeof(cold_freed));
+  pkt_set_log_cold_alloc(2);
+  pkt_set_log_reset();
+  pkt_set_log_rollback();
+  expect(!cold_freed[2], "cold states kept on commit");
+}
+
+int main(int argc, char *argv[]) {
+  srand(1);
+
+  rollback_test();
+  worst_case_test();
+  transaction_test();
+  cold_alloc_test();
+
+  printf("Packet set log errors: %" PRIu64 "\n", num_errors);
+  return num_errors ? 1 : 0;
+}